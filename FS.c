@@ -1,51 +1,551 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE //O_DIRECT
+#endif
 #include "./FS.h"
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include "./bitmap.h"
+#include "./bcache.h"
+#include "./dcache.h"
+#include "./journal.h"
+#include "./crc32c.h"
 
 // Function prototypes
 void printBitmap(struct filesystem *fs);
 void printInodeTable(struct filesystem *fs);
 
+static inline ui64 bitmap_word(const ui8 *bitmap, ui32 w){
+    //carichiamo 64 bit alla volta (il blocco i è il bit i%64, little endian); la bitmap in memoria è allineata
+    //a 64 bit e in modalità thread-safe la parola può cambiare sotto di noi: lettura atomica, senza barriere
+    return __atomic_load_n((const ui64 *)bitmap + w, __ATOMIC_RELAXED);
+}
+
+static void bitmap_set_range(ui8 *bitmap, ui32 start, ui32 count, bool used){
+    //imposta (used) o azzera i bit [start, start+count): bit singoli ai bordi, memset sui byte interi
+    ui32 end = start + count;
+    while(start < end && (start % 8) != 0){
+        if(used) bitmap[start/8] |= (ui8)(1 << (start%8));
+        else bitmap[start/8] &= (ui8)~(1 << (start%8));
+        start++;
+    }
+    ui32 fullBytes = (end - start) / 8;
+    memset(bitmap + start/8, used ? 0xFF : 0x00, fullBytes);
+    start += fullBytes * 8;
+    while(start < end){
+        if(used) bitmap[start/8] |= (ui8)(1 << (start%8));
+        else bitmap[start/8] &= (ui8)~(1 << (start%8));
+        start++;
+    }
+}
+
+static void summary_refresh(struct filesystem *fs, ui32 w){
+    //summary_update in modalità thread-safe: il contatore si sostituisce con uno scambio atomico e il totale
+    //riceve la differenza, così resta la somma dei contatori; se la parola cambia nel frattempo si ripete,
+    //e l'ultimo thread che l'ha modificata lascia contatore e bit coerenti con il suo valore finale
+    ui64 *word = (ui64 *)fs->blockBitmap + w;
+    ui64 seen = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+    for(;;){
+        ui8 freeInWord = (ui8)(64 - __builtin_popcountll(seen));
+        ui8 old = __atomic_exchange_n(&fs->wordFree[w], freeInWord, __ATOMIC_ACQ_REL);
+        __atomic_add_fetch(&fs->freeBlocks, (ui32)freeInWord - (ui32)old, __ATOMIC_RELAXED);
+        if(freeInWord){
+            __atomic_or_fetch(&fs->freeSummary[w/64], 1ULL << (w%64), __ATOMIC_RELEASE);
+        } else {
+            __atomic_and_fetch(&fs->freeSummary[w/64], ~(1ULL << (w%64)), __ATOMIC_RELEASE);
+        }
+        ui64 now = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+        if(now == seen) break;
+        seen = now;
+    }
+}
+
+static void summary_update(struct filesystem *fs, ui32 w){
+    //ricalcola il contatore della parola w e il relativo bit nel livello superiore del riepilogo
+    if(fs->threadSafe){
+        summary_refresh(fs, w);
+        return;
+    }
+    ui8 freeInWord = (ui8)(64 - __builtin_popcountll(bitmap_word(fs->blockBitmap, w)));
+    fs->freeBlocks = fs->freeBlocks - fs->wordFree[w] + freeInWord; //aggiornamento incrementale del totale
+    fs->wordFree[w] = freeInWord;
+    if(freeInWord){
+        fs->freeSummary[w/64] |= 1ULL << (w%64); //la parola ha almeno un blocco libero
+    } else {
+        fs->freeSummary[w/64] &= ~(1ULL << (w%64)); //parola piena: l'allocatore la salterà
+    }
+}
+
+static void summary_update_range(struct filesystem *fs, ui32 start, ui32 count){
+    for(ui32 w = start / 64; w <= (start + count - 1) / 64; w++){
+        summary_update(fs, w);
+    }
+}
+
+static void summary_build(struct filesystem *fs){
+    ui32 words = (fs->sb.total_blocks + 63) / 64;
+    fs->wordFree = calloc(words, sizeof(ui8)); //un contatore (0..64) per ogni parola della bitmap
+    fs->freeSummary = calloc((words + 63) / 64, sizeof(ui64)); //un bit per ogni parola della bitmap
+    fs->freeBlocks = 0;
+    for(ui32 w = 0; w < words; w++){
+        summary_update(fs, w);
+    }
+}
+
+static block_t summary_find_free(struct filesystem *fs, ui32 from, ui32 to){
+    //primo blocco libero in [from, to): salta le parole piene guardando solo il livello superiore
+    if(from >= to) return (block_t)-1;
+    ui32 w = from / 64;
+    ui32 lastWord = (to - 1) / 64;
+    if(__atomic_load_n(&fs->wordFree[w], __ATOMIC_RELAXED)){
+        ui64 word = bitmap_word(fs->blockBitmap, w) | ((1ULL << (from % 64)) - 1);
+        if(~word != 0){
+            block_t b = w * 64 + (ui32)__builtin_ctzll(~word);
+            return b < to ? b : (block_t)-1;
+        }
+    }
+    for(ui32 next = w + 1; next <= lastWord; ){
+        ui64 sword = __atomic_load_n(&fs->freeSummary[next/64], __ATOMIC_RELAXED) & ~((1ULL << (next % 64)) - 1); //parole con spazio a partire da next
+        if(sword == 0){
+            next = (next/64 + 1) * 64; //64 parole (4096 blocchi) piene saltate con un solo confronto
+            continue;
+        }
+        ui32 nw = (next/64) * 64 + (ui32)__builtin_ctzll(sword);
+        if(nw > lastWord) break;
+        ui64 word = bitmap_word(fs->blockBitmap, nw);
+        if(~word == 0){ //riempita da un altro thread dopo la lettura del riepilogo
+            next = nw + 1;
+            continue;
+        }
+        block_t b = nw * 64 + (ui32)__builtin_ctzll(~word);
+        return b < to ? b : (block_t)-1;
+    }
+    return (block_t)-1;
+}
+
+static inline ui64 range_mask(ui32 w, ui32 start, ui32 end){
+    //bit della parola w che cadono in [start, end)
+    ui32 lo = start > w * 64 ? start - w * 64 : 0;
+    ui32 hi = end < (w + 1) * 64 ? end - w * 64 : 64;
+    ui64 mask = hi == 64 ? ~0ULL : (1ULL << hi) - 1;
+    return mask & ~((1ULL << lo) - 1);
+}
+
+static bool bitmap_claim(ui8 *bitmap, ui32 start, ui32 count){
+    //occupa [start, start + count) con un compare-and-swap per parola; se un bit è già occupato
+    //(preso da un altro thread dopo la ricerca) rilascia le parole già prese e ritorna false
+    ui64 *words = (ui64 *)bitmap;
+    ui32 end = start + count;
+    for(ui32 w = start / 64; w <= (end - 1) / 64; w++){
+        ui64 mask = range_mask(w, start, end);
+        ui64 old = __atomic_load_n(&words[w], __ATOMIC_RELAXED);
+        do {
+            if(old & mask){
+                for(ui32 u = start / 64; u < w; u++){
+                    __atomic_and_fetch(&words[u], ~range_mask(u, start, end), __ATOMIC_RELEASE);
+                }
+                return false;
+            }
+        } while(!__atomic_compare_exchange_n(&words[w], &old, old | mask, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    }
+    return true;
+}
+
+static bool bitmap_release(ui8 *bitmap, ui32 start, ui32 count){
+    //libera [start, start + count); false se qualche bit era già libero (doppia liberazione)
+    ui64 *words = (ui64 *)bitmap;
+    ui32 end = start + count;
+    bool ok = true;
+    for(ui32 w = start / 64; w <= (end - 1) / 64; w++){
+        ui64 mask = range_mask(w, start, end);
+        if((__atomic_fetch_and(&words[w], ~mask, __ATOMIC_ACQ_REL) & mask) != mask) ok = false;
+    }
+    return ok;
+}
+
+static inline block_t meta_end(const struct filesystem *fs){
+    if(fs->sb.csum_blocks) return fs->sb.csum_start + fs->sb.csum_blocks; //la tabella dei checksum segue quella degli inode
+    return fs->sb.inode_table_start + fs->sb.inode_table_blocks; //bitmap e tabella degli inode stanno prima di questo blocco
+}
+
+static inline block_t csum_block(const struct filesystem *fs, block_t block_num){
+    return fs->sb.csum_start + block_num / FS_CSUM_PER_BLOCK; //blocco della tabella con il checksum di block_num
+}
+
+ui32 fs_block_csum(const void *data){
+    ui32 c = crc32c(0, data, BLOCK_SIZE);
+    return c ? c : 1; //0 nella tabella vuol dire "nessun checksum"
+}
+
+static ui32 sb_checksum(const struct superblock *sb){
+    struct superblock copy = *sb;
+    copy.checksum = 0;
+    return crc32c(0, &copy, sizeof(copy));
+}
+
+static bool csum_matches(struct filesystem *fs, block_t block_num, const void *data){
+    //blocco appena letto dal disco confrontato con la tabella dei checksum
+    if(!fs->csum || block_num >= fs->sb.total_blocks) return true;
+    ui32 expected = __atomic_load_n(&fs->csum[block_num], __ATOMIC_RELAXED);
+    return expected == 0 || expected == fs_block_csum(data);
+}
+
+int fs_verify_block(struct filesystem *fs, block_t block_num, const void *data){
+    if(csum_matches(fs, block_num, data)) return 0;
+    printf("Errore: checksum del blocco %u non valido.\n", block_num);
+    return -1;
+}
+
+static void meta_dirty(struct filesystem *fs, block_t block_num){
+    //blocco di bitmap o tabella degli inode modificato in memoria: con il journal entra nella transazione in corso,
+    //altrimenti viene segnato e scritto per intero dal prossimo fs_flush
+    if(fs->csumStale && !fs->journal && block_num != 0 && block_num < fs->sb.csum_start && !fs->csumStale[block_num] &&
+       __atomic_exchange_n(&fs->csumStale[block_num], 1, __ATOMIC_ACQ_REL) == 0){
+        meta_dirty(fs, csum_block(fs, block_num)); //il checksum si ricalcola quando si fotografa il blocco della tabella
+    }
+    if(fs->journal){
+        journal_dirty_mem(fs->journal, block_num);
+    } else if(fs->metaDirty && !fs->metaDirty[block_num]){
+        if(__atomic_exchange_n(&fs->metaDirty[block_num], 1, __ATOMIC_ACQ_REL) == 0){ //un solo thread lo conta
+            __atomic_add_fetch(&fs->metaDirtyCount, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void meta_dirty_bitmap(struct filesystem *fs, block_t start, ui32 count){
+    //i blocchi della bitmap che coprono [start, start + count)
+    if(count == 0) return;
+    block_t first = fs->sb.free_block_bitmap_start + start / 8 / BLOCK_SIZE;
+    block_t last = fs->sb.free_block_bitmap_start + (start + count - 1) / 8 / BLOCK_SIZE;
+    for(block_t b = first; b <= last; b++){
+        meta_dirty(fs, b);
+    }
+}
+
+static inline size_t inode_disk_size(const struct filesystem *fs){
+    //dimensione di un record della tabella degli inode sul disco
+    return fs->legacyInodes ? sizeof(struct inode_v0) : sizeof(struct inode);
+}
+
+static void meta_dirty_inode(struct filesystem *fs, inode_t inodeNum){
+    size_t off = (size_t)inodeNum * inode_disk_size(fs);
+    meta_dirty(fs, fs->sb.inode_table_start + (block_t)(off / BLOCK_SIZE));
+    if((off + inode_disk_size(fs) - 1) / BLOCK_SIZE != off / BLOCK_SIZE){
+        meta_dirty(fs, fs->sb.inode_table_start + (block_t)(off / BLOCK_SIZE) + 1); //record del formato originale a cavallo di due blocchi
+    }
+}
+
+static void inode_from_v0(struct inode *out, const struct inode_v0 *in){
+    memset(out, 0, sizeof(struct inode));
+    out->size = in->size;
+    memcpy(out->directBlocks, in->directBlocks, INODE_V0_PTR_BYTES);
+    out->isUsed = in->isUsed & ((1u << INODE_V0_FLAGS_SHIFT) - 1);
+    out->flags = in->isUsed >> INODE_V0_FLAGS_SHIFT;
+    out->created_at = in->created_at;
+    out->modified_at = in->modified_at;
+}
+
+static void inode_to_v0(struct inode_v0 *out, const struct inode *in){
+    out->size = in->size;
+    memcpy(out->directBlocks, in->directBlocks, INODE_V0_PTR_BYTES);
+    out->isUsed = in->isUsed | (in->flags << INODE_V0_FLAGS_SHIFT);
+    out->created_at = in->created_at;
+    out->modified_at = in->modified_at;
+}
+
+static void inode_table_snapshot_v0(struct filesystem *fs, size_t off, ui8 *out){
+    //i record da 68 byte che cadono nel blocco che inizia a off, anche solo in parte
+    const size_t rec = sizeof(struct inode_v0);
+    size_t end = (size_t)fs->sb.inode_count * rec;
+    if(end > off + BLOCK_SIZE) end = off + BLOCK_SIZE;
+    for(size_t i = off / rec; i * rec < end; i++){
+        struct inode_v0 v;
+        inode_to_v0(&v, &fs->inodeTable[i]);
+        size_t lo = i * rec > off ? i * rec : off;
+        size_t hi = (i + 1) * rec < end ? (i + 1) * rec : end;
+        memcpy(out + (lo - off), (const ui8 *)&v + (lo - i * rec), hi - lo);
+    }
+}
+
+static void meta_dirty_inode_bit(struct filesystem *fs, inode_t inodeNum){
+    //il blocco della bitmap degli inode che contiene inodeNum; le immagini senza bitmap la ricostruiscono a ogni montaggio
+    if(fs->sb.inode_bitmap_start == 0) return;
+    meta_dirty(fs, fs->sb.inode_bitmap_start + inodeNum / 8 / BLOCK_SIZE);
+}
+
+static void csum_refresh(struct filesystem *fs, block_t from, block_t to);
+
+void fs_meta_snapshot(struct filesystem *fs, block_t block_num, void *out){
+    //il blocco block_num di superblocco, bitmap, tabella degli inode o dei checksum così come va scritto sul disco,
+    //preso dalla copia in memoria
+    const struct superblock *sb = &fs->sb;
+    const ui8 *src = NULL;
+    size_t off = 0, total = 0;
+    block_t bitmapEnd = sb->inode_bitmap_start ? sb->inode_bitmap_start : sb->inode_table_start;
+    memset(out, 0, BLOCK_SIZE);
+    if(block_num == 0){
+        src = (const ui8 *)sb;
+        total = sizeof(struct superblock);
+    } else if(fs->legacyInodes && block_num >= sb->inode_table_start && block_num < sb->inode_table_start + sb->inode_table_blocks){
+        inode_table_snapshot_v0(fs, (size_t)(block_num - sb->inode_table_start) * BLOCK_SIZE, out);
+    } else if(block_num >= sb->inode_table_start && block_num < sb->inode_table_start + sb->inode_table_blocks){
+        src = (const ui8 *)fs->inodeTable;
+        off = (size_t)(block_num - sb->inode_table_start) * BLOCK_SIZE;
+        total = (size_t)sb->inode_count * sizeof(struct inode);
+    } else if(block_num >= sb->free_block_bitmap_start && block_num < bitmapEnd){
+        src = fs->blockBitmap;
+        off = (size_t)(block_num - sb->free_block_bitmap_start) * BLOCK_SIZE;
+        total = (sb->total_blocks + 7) / 8;
+    } else if(sb->inode_bitmap_start && block_num >= sb->inode_bitmap_start && block_num < sb->inode_table_start){
+        src = fs->inodeBitmap;
+        off = (size_t)(block_num - sb->inode_bitmap_start) * BLOCK_SIZE;
+        total = (sb->inode_count + 7) / 8;
+    } else if(fs->csum && block_num >= sb->csum_start && block_num < sb->csum_start + sb->csum_blocks){
+        off = (size_t)(block_num - sb->csum_start) * BLOCK_SIZE;
+        csum_refresh(fs, (block_t)(off / sizeof(ui32)), (block_t)((off + BLOCK_SIZE) / sizeof(ui32)));
+        src = (const ui8 *)fs->csum;
+        total = (size_t)sb->csum_blocks * BLOCK_SIZE;
+    }
+    if(src && off < total){
+        memcpy(out, src + off, total - off < BLOCK_SIZE ? total - off : BLOCK_SIZE);
+    }
+    if(block_num == 0){
+        ((struct superblock *)out)->checksum = sb_checksum(sb);
+    }
+}
+
+static void csum_refresh(struct filesystem *fs, block_t from, block_t to){
+    //ricalcola i checksum dei blocchi di bitmap e tabella degli inode in [from, to) modificati dall'ultima volta
+    _Alignas(8) ui8 buffer[BLOCK_SIZE];
+    if(to > fs->sb.csum_start) to = fs->sb.csum_start;
+    for(block_t b = from; b < to; b++){
+        if(!fs->csumStale[b] || __atomic_exchange_n(&fs->csumStale[b], 0, __ATOMIC_ACQ_REL) == 0) continue;
+        const void *p = fs_block_ptr(fs, b); //in modalità mmap il blocco sul disco è quello nella mappatura
+        if(!p){
+            fs_meta_snapshot(fs, b, buffer);
+            p = buffer;
+        }
+        __atomic_store_n(&fs->csum[b], fs_block_csum(p), __ATOMIC_RELAXED);
+    }
+}
+
+static void inode_table_release(struct filesystem *fs, const block_t *blocks, ui32 n);
+
+static int meta_writeback(struct filesystem *fs){
+    //scrive i blocchi di metadati segnati, in ordine di blocco: i tratti contigui diventano una sola pwritev
+    ui32 n = fs->metaDirty ? __atomic_load_n(&fs->metaDirtyCount, __ATOMIC_ACQUIRE) : 0;
+    if(n == 0) return 0;
+    block_t *blocks = malloc(n * sizeof(block_t));
+    void **bufs = malloc(n * sizeof(void *));
+    ui8 *pool = aligned_alloc(BLOCK_SIZE, (size_t)n * BLOCK_SIZE);
+    int result = -1;
+    if(blocks && bufs && pool){
+        ui32 k = 0;
+        for(block_t b = 0; b < meta_end(fs) && k < n; b++){
+            if(!fs->metaDirty[b] || __atomic_exchange_n(&fs->metaDirty[b], 0, __ATOMIC_ACQ_REL) == 0) continue;
+            blocks[k] = b; //il flag si azzera prima della copia: una modifica successiva lo rimette
+            bufs[k] = pool + (size_t)k * BLOCK_SIZE;
+            fs_meta_snapshot(fs, b, bufs[k]);
+            k++;
+        }
+        __atomic_sub_fetch(&fs->metaDirtyCount, k, __ATOMIC_RELAXED);
+        result = bdev_writev(&fs->dev, blocks, bufs, k);
+        for(ui32 i = 0; result != 0 && i < k; i++){
+            meta_dirty(fs, blocks[i]); //non scritti: restano da scrivere
+        }
+        if(result == 0){
+            inode_table_release(fs, blocks, k);
+        }
+    }
+    free(blocks);
+    free(bufs);
+    free(pool);
+    return result;
+}
+
+static void meta_forget(struct filesystem *fs, block_t start, ui32 count){
+    //blocchi liberati: le versioni registrate nel journal non devono più finire sul disco e il checksum non vale
+    //più (il prossimo proprietario può usarli per dati); con il journal il revoke lo azzera anche sul disco
+    for(ui32 i = 0; (fs->journal || fs->csum) && i < count; i++){
+        if(fs->journal) journal_forget(fs->journal, start + i);
+        if(fs->csum && __atomic_load_n(&fs->csum[start + i], __ATOMIC_RELAXED) != 0){
+            __atomic_store_n(&fs->csum[start + i], 0, __ATOMIC_RELAXED);
+            if(!fs->journal) meta_dirty(fs, csum_block(fs, start + i));
+        }
+    }
+}
+
+static int fs_write_meta(struct filesystem *fs, block_t block_num, void *buffer){
+    //blocco di metadati (directory, blocco indiretto, foglia di extent): con il journal passa da una transazione
+    //e il checksum lo calcola il checkpoint, altrimenti va scritto subito insieme al suo checksum
+    if(fs->csum && !fs->journal){
+        __atomic_store_n(&fs->csum[block_num], fs_block_csum(buffer), __ATOMIC_RELAXED);
+        meta_dirty(fs, csum_block(fs, block_num));
+    }
+    if(fs->journal){
+        return journal_log(fs->journal, block_num, buffer);
+    }
+    return fs_write_block(fs, block_num, buffer);
+}
+
+static _Thread_local ui32 txThreadDepth; //modalità thread-safe: operazioni annidate nel thread corrente
+
+static inline ui32 tx_limit(struct filesystem *fs){
+    //blocchi oltre i quali la transazione si chiude appena possibile: lascia margine alle operazioni in corso,
+    //perché journal_end_tx non divide una transazione che non sta in un descrittore o nel log
+    ui32 limit = fs->sb.journal_blocks / 4;
+    return limit < JOURNAL_MAX_TAGS / 4 ? limit : JOURNAL_MAX_TAGS / 4;
+}
+
+static void tx_begin(struct filesystem *fs){
+    if(!fs->threadSafe){
+        fs->txDepth++; //le operazioni chiamate da un'altra operazione fanno parte della stessa transazione
+        return;
+    }
+    if(txThreadDepth++ > 0) return; //il thread ha già un handle
+    pthread_mutex_lock(&fs->txLock);
+    while(fs->txClosing){
+        pthread_cond_wait(&fs->txCond, &fs->txLock); //la transazione sta per chiudersi: si entra nella prossima
+    }
+    fs->txDepth++;
+    pthread_mutex_unlock(&fs->txLock);
+}
+
+static void tx_end(struct filesystem *fs){
+    if(!fs->threadSafe){
+        if(--fs->txDepth == 0 && fs->journal){
+            journal_end_tx(fs->journal); //accodata al group commit: nessuna attesa qui
+        }
+        return;
+    }
+    if(--txThreadDepth > 0) return;
+    pthread_mutex_lock(&fs->txLock);
+    fs->txDepth--;
+    if(fs->journal && journal_tx_size(fs->journal) >= tx_limit(fs)){
+        fs->txClosing = true; //transazione grande: niente nuovi handle finché quelli aperti non finiscono
+    }
+    if(fs->txDepth == 0){ //nessuna operazione a metà: la transazione è coerente e si può chiudere
+        if(fs->journal) journal_end_tx(fs->journal);
+        fs->txClosing = false;
+        pthread_cond_broadcast(&fs->txCond);
+    }
+    pthread_mutex_unlock(&fs->txLock);
+}
+
+static void inode_lock(struct filesystem *fs, inode_t ino, bool write){
+    if(!fs->inodeLocks || ino >= fs->sb.inode_count) return; //modalità normale, o una copia dell'inode (DCACHE_ANY)
+    if(write) pthread_rwlock_wrlock(&fs->inodeLocks[ino]);
+    else pthread_rwlock_rdlock(&fs->inodeLocks[ino]);
+}
+
+static void inode_unlock(struct filesystem *fs, inode_t ino){
+    if(!fs->inodeLocks || ino >= fs->sb.inode_count) return;
+    pthread_rwlock_unlock(&fs->inodeLocks[ino]);
+}
+
+static void tx_restart(struct filesystem *fs, inode_t ino){
+    //punto coerente di un'operazione lunga sull'inode ino: se la transazione ha raggiunto tx_limit la si lascia
+    //chiudere come a fine operazione, senza tenere il lock dell'inode mentre si aspetta di entrare nella prossima
+    if(!fs->journal || journal_tx_size(fs->journal) < tx_limit(fs)) return;
+    inode_unlock(fs, ino);
+    tx_end(fs);
+    tx_begin(fs);
+    inode_lock(fs, ino, true);
+}
+
+struct fs_wbuf {
+    block_t block[FS_WBUF_SLOTS]; //blocco fisico raccolto in ogni slot, 0 se lo slot è libero
+    ui32 hand;                    //prossimo slot da svuotare quando sono tutti occupati
+    ui8 *data;                    //FS_WBUF_SLOTS * BLOCK_SIZE byte allineati
+};
+
+static void wbuf_drop(struct filesystem *fs, block_t start, ui32 count);
+static int truncate_steps(struct filesystem *fs, inode_t ino, ui32 size);
+static int extent_free_all(struct filesystem *fs, struct inode *in);
+static void bmap_forget(struct filesystem *fs, inode_t ino);
+static int bmap_truncate(struct filesystem *fs, inode_t ino, ui32 keep);
+static void inode_bitmap_load(struct filesystem *fs);
+static void inode_table_load(struct filesystem *fs);
+static void inode_table_map(struct filesystem *fs);
+static int csum_table_load(struct filesystem *fs);
+static int inode_table_verify(struct filesystem *fs);
+static void meta_release(struct filesystem *fs);
+
 int init_fs(const char *img, ui32 totalBlocks){
-    FILE* F=fopen(img,"wb");
-    if (F==NULL){
-        printf("Errore nella creazione dell'immagine del file system.\n");
-        return -1; //errore nell'apertura del file
+    return init_fs_opts(img, totalBlocks, NULL); //geometria di default
+}
+
+int init_fs_opts(const char *img, ui32 totalBlocks, const struct mkfs_options *opts){
+    struct mkfs_options defaults = { 0 };
+    if(opts == NULL){
+        opts = &defaults;
     }
     //inizializzazione superblocco
-    struct superblock *sb = malloc(sizeof(struct superblock));
+    struct superblock *sb = calloc(1, sizeof(struct superblock));
     sb->magic = FS_MAGIC;
+    sb->version = FS_VERSION;
     sb->block_size = BLOCK_SIZE;
     sb->total_blocks = totalBlocks;
-    sb->inode_table_blocks = (MAX_INODES * sizeof(struct inode) + BLOCK_SIZE -1) / BLOCK_SIZE;
+    sb->inode_count = opts->inode_count ? opts->inode_count : MAX_INODES; //massimo numero di inode
+    sb->group_blocks = opts->group_blocks ? opts->group_blocks : FS_GROUP_BLOCKS;
+    sb->group_inodes = opts->group_inodes ? opts->group_inodes : FS_GROUP_INODES;
+    sb->inode_table_blocks = (ui32)(((ui64)sb->inode_count * sizeof(struct inode) + BLOCK_SIZE -1) / BLOCK_SIZE);
     /*calcolo del numero di blocchi da cui è composta la tabela degli inodes
     (numero di nodi * dimensione di un inode + blocco separatore -1)/dimensione dei blocchi */
-    sb->inode_count = MAX_INODES; //massimo numero di inode
     sb->free_block_bitmap_start = 1; //superblocco occupa il blocco 0
-    sb->inode_table_start = sb->free_block_bitmap_start + (totalBlocks + 7) / 8 / BLOCK_SIZE + 1;
+    sb->inode_bitmap_start = sb->free_block_bitmap_start + (totalBlocks + 7) / 8 / BLOCK_SIZE + 1;
+    //la bitmap degli inode segue quella dei blocchi: un bit per inode
+    sb->inode_table_start = sb->inode_bitmap_start + (sb->inode_count + BLOCK_SIZE * 8 - 1) / (BLOCK_SIZE * 8);
     /*calcolo del blocco di inizio della tabella degli inode*/
-    sb->data_start = sb->inode_table_start + sb->inode_table_blocks;
-    //trova il primo blocco dedicato ai dati dopo la tabella degli inode
-    //scrittura del superblocco
+    sb->journal_start = sb->inode_table_start + sb->inode_table_blocks; //il journal segue la tabella degli inode
+    if(!opts->no_checksums){ //o la tabella dei checksum, un ui32 per blocco dell'immagine
+        sb->csum_start = sb->journal_start;
+        sb->csum_blocks = (ui32)(((ui64)totalBlocks + FS_CSUM_PER_BLOCK - 1) / FS_CSUM_PER_BLOCK);
+        sb->journal_start += sb->csum_blocks;
+    }
+    sb->journal_blocks = totalBlocks / 16; //circa il 6% dell'immagine, entro [FS_JOURNAL_MIN, FS_JOURNAL_MAX]
+    if(sb->journal_blocks < FS_JOURNAL_MIN) sb->journal_blocks = FS_JOURNAL_MIN;
+    if(sb->journal_blocks > FS_JOURNAL_MAX) sb->journal_blocks = FS_JOURNAL_MAX;
+    sb->data_start = sb->journal_start + sb->journal_blocks;
+    //trova il primo blocco dedicato ai dati dopo il journal
+    if(sb->data_start >= totalBlocks || sb->inode_table_blocks > totalBlocks){
+        printf("Errore: %u blocchi non bastano per i metadati di %u inode.\n", totalBlocks, sb->inode_count);
+        free(sb);
+        return -1;
+    }
+    FILE* F=fopen(img,"wb");
+    if (F==NULL){
+        printf("Errore nella creazione dell'immagine del file system.\n");
+        free(sb);
+        return -1; //errore nell'apertura del file
+    }
+    sb->free_blocks_count = totalBlocks - sb->data_start; //tutta l'area dati è libera
+    sb->free_inodes_count = sb->inode_count;
+    //l'immagine nasce sparsa con la sua dimensione finale: tutto ciò che non viene scritto qui si legge come zeri
+    //(bitmap degli inode vuota, tabella degli inode con tutti gli inode liberi, area dati) senza occupare disco
+    if(ftruncate(fileno(F), (off_t)totalBlocks * BLOCK_SIZE) != 0){
+        printf("Errore nel dimensionamento dell'immagine del file system.\n");
+        free(sb);
+        fclose(F);
+        return -1;
+    }
+    //scrittura del superblocco; la tabella dei checksum nasce vuota: i blocchi non ne hanno finché il file system non li scrive
+    sb->checksum = sb_checksum(sb);
     fwrite(sb, sizeof(struct superblock), 1, F);
 
-    //inizializziamo la bitmap dei blocchi liberi
-    ui32 bitmapSize = (totalBlocks + 7) / 8;
-     /*dimensione della bitmap data dal numero totale di blocchi arrotondato al blocco superiore,
-     diviso per il numero di bit nel byte */
-    ui8 *blockBitmap = malloc(bitmapSize); //la dimensione della bitmap in byte
+    //della bitmap dei blocchi liberi si scrivono solo i byte dei blocchi di metadati, segnati come occupati
+    ui32 metaBytes = (sb->data_start + 7) / 8;
+    ui8 *blockBitmap = calloc(metaBytes, 1);
+    bitmap_set_range(blockBitmap, 0, sb->data_start, true);
     fseek(F, BLOCK_SIZE * sb->free_block_bitmap_start, SEEK_SET); //spostiamo il puntatore di scrittura all'inizio della bitmap
-    memset(blockBitmap, 0, bitmapSize);
-    //memset inizializza la bitmap a 0 (tutti i blocchi liberi)
-    fwrite(blockBitmap, bitmapSize, 1, F);
-    //scrive la bitmap dei blocchi liberi nel file
+    fwrite(blockBitmap, metaBytes, 1, F);
     free(blockBitmap); //libera lo spazio della bitmap in RAM
 
-    //inizializziamo la tabella degli inode
-    struct inode *inodeTable = malloc(sb->inode_count * sizeof(struct inode));
-    //allochiamo lo spazio per inode_count inode nella tabella
-    memset(inodeTable, 0, sb->inode_count * sizeof(struct inode)); //inizializziamo tutti gli inode a zero
-    fseek(F, BLOCK_SIZE * sb->inode_table_start, SEEK_SET); //spostiamo il puntatore di scrittura all'inizio della tabella degli inode
-    fwrite(inodeTable, sb->inode_count * sizeof(struct inode), 1, F); //scriviamo la tabella degli inode inizializzata nel file
-    free(inodeTable); //liberiamo lo spazio della tabella degli inode in RAM
+    //header del journal: log vuoto, la prima transazione avrà sequenza 1
+    struct journal_header jh = { .magic = JOURNAL_MAGIC, .blocks = sb->journal_blocks, .seq = 1 };
+    fseek(F, (long)BLOCK_SIZE * sb->journal_start, SEEK_SET);
+    fwrite(&jh, sizeof(jh), 1, F);
 
     free(sb); //scriviamo il superblocco nel file e liberiamo la memoria
 
@@ -53,49 +553,281 @@ int init_fs(const char *img, ui32 totalBlocks){
     return 0; //il valore di ritorno 0 indica che il processo è andato a buon fine
 }
 
+static int cache_dev_read(void *ctx, block_t block_num, void *buffer){
+    struct filesystem *fs = ctx;
+    if(bdev_read(&fs->dev, block_num, buffer) != 0) return -1;
+    return fs_verify_block(fs, block_num, buffer); //solo alla lettura dal disco: gli hit del cache sono già verificati
+}
+
+static int cache_dev_write(void *ctx, block_t block_num, void *buffer){
+    return bdev_write(&((struct filesystem *)ctx)->dev, block_num, buffer);
+}
+
+static void inode_table_load_v0(struct filesystem *fs){
+    //tabella del formato originale: letta per intero e convertita
+    size_t bytes = (size_t)fs->sb.inode_count * sizeof(struct inode_v0);
+    struct inode_v0 *disk = malloc(bytes);
+    fs->inodeTable = calloc(fs->sb.inode_count, sizeof(struct inode));
+    if(disk && fs->inodeTable && bdev_pread_bytes(&fs->dev, disk, bytes, (off_t)BLOCK_SIZE * fs->sb.inode_table_start) == 0){
+        for(ui32 i = 0; i < fs->sb.inode_count; i++){
+            inode_from_v0(&fs->inodeTable[i], &disk[i]);
+        }
+    }
+    free(disk);
+}
+
+static void legacy_mark(struct filesystem *fs, block_t start, ui32 len){
+    if(start < fs->sb.data_start || start >= fs->sb.total_blocks || len > fs->sb.total_blocks - start) return; //puntatore non valido
+    bitmap_set_range(fs->blockBitmap, start, len, true);
+}
+
+static void legacy_bitmap_rebuild(struct filesystem *fs){
+    //il formato originale non scriveva mai la bitmap dei blocchi: quella sul disco è tutta a zero e va
+    //ricostruita dai blocchi diretti e indiretti degli inode in uso, altrimenti i loro dati verrebbero riallocati
+    //(extent e foglie per i file creati da questa build)
+    memset(fs->blockBitmap, 0, (fs->sb.total_blocks + 7) / 8);
+    ui32 ptrs[BLOCK_SIZE / sizeof(ui32)];
+    for(inode_t n = 0; n < fs->sb.inode_count; n++){
+        const struct inode *in = &fs->inodeTable[n];
+        if(!in->isUsed) continue;
+        if(in->flags & INODE_F_EXTENTS){
+            for(ui32 i = 0; i < in->extents.count && i < EXTENT_INLINE; i++){
+                const struct extent *e = &in->extents.e[i];
+                if(in->extents.depth == 0){
+                    legacy_mark(fs, e->pstart, e->len);
+                    continue;
+                }
+                const struct extentLeaf *leaf = (const struct extentLeaf *)ptrs;
+                legacy_mark(fs, e->pstart, 1);
+                if(e->pstart >= fs->sb.total_blocks || bdev_pread_bytes(&fs->dev, ptrs, BLOCK_SIZE, (off_t)BLOCK_SIZE * e->pstart) != 0 ||
+                   leaf->magic != EXTENT_LEAF_MAGIC) continue;
+                for(ui32 j = 0; j < leaf->count && j < EXTENT_PER_LEAF; j++) legacy_mark(fs, leaf->e[j].pstart, leaf->e[j].len);
+            }
+            continue;
+        }
+        for(ui32 j = 0; j < INODE_DIRECT; j++){
+            if(in->directBlocks[j] != 0) legacy_mark(fs, in->directBlocks[j], 1);
+        }
+        if(in->indirectBlock == 0) continue;
+        legacy_mark(fs, in->indirectBlock, 1);
+        if(in->indirectBlock < fs->sb.data_start || in->indirectBlock >= fs->sb.total_blocks ||
+           bdev_pread_bytes(&fs->dev, ptrs, BLOCK_SIZE, (off_t)BLOCK_SIZE * in->indirectBlock) != 0) continue;
+        for(ui32 j = 0; j < BLOCK_SIZE / sizeof(ui32); j++){
+            if(ptrs[j] != 0) legacy_mark(fs, ptrs[j], 1);
+        }
+    }
+}
+
 struct filesystem *open_fs(const char *img, bool printBlocks, bool printInodes){
-    FILE* F=fopen(img, "r+b");
-    if (F==NULL){
+    struct filesystem *fs = open_fs_opts(img, NULL); //opzioni di default
+    if(fs == NULL){
+        return NULL;
+    }
+    if(printBlocks==true){
+        printBitmap(fs);
+    }
+    if(printInodes==true){
+        printInodeTable(fs);
+    }
+    return fs;
+}
+
+struct filesystem *open_fs_opts(const char *img, const struct fs_options *opts){
+    struct fs_options defaults = { .cache_blocks = FS_DEFAULT_CACHE_BLOCKS, .dentry_cache = FS_DEFAULT_DENTRY_CACHE, .journal = true };
+    if(opts == NULL){
+        opts = &defaults;
+    }
+    struct blockdev dev;
+    if(bdev_open(&dev, img, opts->direct_io) != 0){
         printf("Errore nell'apertura dell'immagine del file system.\n");
         return NULL; //errore nell'apertura del file
     }
     struct filesystem *fs = malloc(sizeof(struct filesystem));
-    fread(&(fs->sb), sizeof(struct superblock),1,F); //leggiamo e inseriamo il superblock nel buffer sb
-    if (fs->sb.magic!=FS_MAGIC){
+    fs->dev = dev;
+    if(bdev_pread_bytes(&fs->dev, &fs->sb, sizeof(struct superblock), 0) != 0 || fs->sb.magic!=FS_MAGIC){ //leggiamo il superblocco
         printf("Errore: immagine del file system non valida.\n");
-        fclose(F);
+        close(dev.fd);
         free(fs);
         return NULL; //errore: immagine del file system non valida
     }
+    //formato originale: record da 68 byte, nessun journal e nessuna bitmap degli inode
+    fs->legacyInodes = fs->sb.version == 0 && fs->sb.journal_blocks == 0 && fs->sb.inode_bitmap_start == 0 &&
+                       fs->sb.inode_table_blocks == (ui32)(((ui64)fs->sb.inode_count * sizeof(struct inode_v0) + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    //altrimenti la tabella è di struct inode: dalla versione 2, o senza versione se l'immagine è stata creata prima che
+    //la versione esistesse (journal, bitmap degli inode e geometria dei gruppi sono facoltativi); la versione 1 non esiste
+    bool layoutOk = fs->legacyInodes || ((fs->sb.version == 0 || fs->sb.version >= 2) &&
+                    fs->sb.inode_table_blocks == (ui32)(((ui64)fs->sb.inode_count * sizeof(struct inode) + BLOCK_SIZE - 1) / BLOCK_SIZE));
+    if(fs->sb.block_size != BLOCK_SIZE || fs->sb.version > FS_VERSION || fs->sb.inode_count == 0 || !layoutOk ||
+       (fs->sb.version >= 3 && fs->sb.checksum != sb_checksum(&fs->sb))){
+        if(fs->sb.block_size != BLOCK_SIZE) printf("Errore: blocchi da %u byte, questa build usa blocchi da %u.\n", fs->sb.block_size, BLOCK_SIZE);
+        else if(fs->sb.version > FS_VERSION || fs->sb.inode_count == 0) printf("Errore: versione del formato %u non supportata.\n", fs->sb.version);
+        else if(!layoutOk) printf("Errore: formato dell'immagine (versione %u) non più supportato, ricreare l'immagine.\n", fs->sb.version);
+        else printf("Errore: checksum del superblocco non valido.\n");
+        close(dev.fd);
+        free(fs);
+        return NULL;
+    }
+    if(fs->legacyInodes && opts->use_mmap){
+        printf("Errore: le immagini del formato originale non si possono mappare in memoria.\n");
+        close(dev.fd);
+        free(fs);
+        return NULL;
+    }
+    if(fs->sb.group_blocks == 0) fs->sb.group_blocks = FS_GROUP_BLOCKS; //immagini senza versione
+    if(fs->sb.group_inodes == 0) fs->sb.group_inodes = FS_GROUP_INODES;
+    if(journal_replay(&fs->dev, &fs->sb) < 0 || csum_table_load(fs) != 0){ //transazioni confermate ma non ancora riportate:
+        close(dev.fd);                                                     //prima di leggere checksum, bitmap e inode
+        free(fs);
+        return NULL;
+    }
     ui32 bitmapSize = (fs->sb.total_blocks + 7) / 8;
-    fs->blockBitmap = malloc(bitmapSize);
-    fseek(F, BLOCK_SIZE * fs->sb.free_block_bitmap_start, SEEK_SET); //spostiamo la testina per leggere all'inizio della bitmap
-    fread(fs->blockBitmap, bitmapSize, 1, F); //leggiamo la bitmap dei blocchi liberi nel buffer blockBitmap
-
+    ui32 bitmapWords = (fs->sb.total_blocks + 63) / 64; //la bitmap in RAM è arrotondata a parole da 64 bit
+    fs->inodeTableMap = 0;
+    if(opts->use_mmap){
+        if(bdev_map(&fs->dev, (size_t)fs->sb.total_blocks * BLOCK_SIZE) != 0){
+            printf("Errore nella mappatura in memoria dell'immagine.\n");
+            free(fs->csum);
+            free(fs->csumStale);
+            close(dev.fd);
+            free(fs);
+            return NULL;
+        }
+        //bitmap e tabella degli inode puntano direttamente nella mappatura: nessuna copia al montaggio
+        //(la regione della bitmap occupa blocchi interi, quindi c'è spazio per il padding a 64 bit)
+        fs->blockBitmap = fs->dev.map + (size_t)BLOCK_SIZE * fs->sb.free_block_bitmap_start;
+        fs->inodeTable = (struct inode *)(fs->dev.map + (size_t)BLOCK_SIZE * fs->sb.inode_table_start);
+        if(fs->sb.inode_bitmap_start){
+            fs->inodeBitmap = fs->dev.map + (size_t)BLOCK_SIZE * fs->sb.inode_bitmap_start;
+        }
+        if(fs->csum){ //anche la tabella dei checksum: msync la rende persistente con il resto
+            free(fs->csum);
+            fs->csum = (ui32 *)(fs->dev.map + (size_t)BLOCK_SIZE * fs->sb.csum_start);
+        }
+    } else {
+        fs->blockBitmap = malloc(bitmapWords * sizeof(ui64));
+        memset(fs->blockBitmap, 0, bitmapWords * sizeof(ui64)); //i byte di padding oltre la fine restano a 0
+        bdev_pread_bytes(&fs->dev, fs->blockBitmap, bitmapSize, (off_t)BLOCK_SIZE * fs->sb.free_block_bitmap_start); //leggiamo la bitmap dei blocchi liberi
 
-    fs->inodeTable = malloc(fs->sb.inode_count * sizeof(struct inode));
-    fseek(F, BLOCK_SIZE * fs->sb.inode_table_start, SEEK_SET); //spostiamo la testina per leggere all'inizio della tabella degli inode
-    fread(fs->inodeTable, fs->sb.inode_count * sizeof(struct inode), 1, F); //leggiamo la tabella degli inode nel buffer inodeTable
+        if(fs->legacyInodes){
+            inode_table_load_v0(fs); //la tabella va convertita: niente mappatura
+            legacy_bitmap_rebuild(fs);
+        } else {
+            inode_table_map(fs);
+        }
+        if(!fs->legacyInodes && !fs->inodeTableMap){
+            fs->inodeTable = calloc(fs->sb.inode_count, sizeof(struct inode));
+            if(fs->sb.inode_bitmap_start == 0){ //senza bitmap degli inode serve tutta la tabella per ricostruirla
+                bdev_pread_bytes(&fs->dev, fs->inodeTable, fs->sb.inode_count * sizeof(struct inode), (off_t)BLOCK_SIZE * fs->sb.inode_table_start);
+            }
+        }
+    }
+    inode_bitmap_load(fs);
+    if(!fs->dev.map && !fs->inodeTableMap && fs->sb.inode_bitmap_start){
+        inode_table_load(fs); //solo le parti della tabella con inode in uso
+    }
+    if(fs->csum && inode_table_verify(fs) != 0){
+        meta_release(fs);
+        close(dev.fd);
+        free(fs);
+        return NULL;
+    }
 
-    fs->img = F; //assign the file pointer
+    fs->img = fdopen(fs->dev.fd, "r+b"); //FILE* sullo stesso descrittore per i chiamanti che usano read_block/write_block
+    if(fs->img){
+        setvbuf(fs->img, NULL, _IONBF, 0); //nessun buffer stdio: non può mai contenere dati vecchi rispetto a pread/pwrite
+    }
+    fs->nextFree = fs->sb.data_start; //la prima ricerca parte dall'inizio dell'area dati
+    bitmap_set_range(fs->blockBitmap, 0, fs->sb.data_start, true); //superblocco, bitmap e tabella degli inode non sono allocabili
+    bitmap_set_range(fs->blockBitmap, fs->sb.total_blocks, bitmapWords * 64 - fs->sb.total_blocks, true); //bit di padding oltre l'ultimo blocco
+    for(block_t b = fs->sb.free_block_bitmap_start; fs->dev.map && fs->csum && b < fs->sb.inode_table_start; b++){
+        fs->csumStale[b] = 1; //bit impostati dentro la mappatura: i checksum delle bitmap si ricalcolano al prossimo flush
+    }
+    fs->threadSafe = false; //il riepilogo si costruisce con un solo thread
+    summary_build(fs); //riepilogo a due livelli dello spazio libero
+    fs->groupCount = (fs->sb.total_blocks - fs->sb.data_start + fs->sb.group_blocks - 1) / fs->sb.group_blocks;
+    if(fs->groupCount == 0) fs->groupCount = 1;
+    fs->inodeGroups = (fs->sb.inode_count + fs->sb.group_inodes - 1) / fs->sb.group_inodes;
+    fs->groupNext = malloc(fs->groupCount * sizeof(block_t));
+    fs->groupFreeInodes = calloc(fs->inodeGroups, sizeof(ui32));
+    fs->threadGroups = 0;
+    fs->freeInodes = 0;
+    for(ui32 g = 0; g < fs->groupCount; g++){
+        fs->groupNext[g] = fs->sb.data_start + g * fs->sb.group_blocks; //ogni gruppo parte dal suo primo blocco
+    }
+    for(ui32 g = 0; g < fs->inodeGroups; g++){ //conteggio sulla bitmap, 64 inode per parola
+        ui32 end = (g + 1) * fs->sb.group_inodes < fs->sb.inode_count ? (g + 1) * fs->sb.group_inodes : fs->sb.inode_count;
+        fs->groupFreeInodes[g] = bm_count_zeros(fs->inodeBitmap, g * fs->sb.group_inodes, end);
+        fs->freeInodes += fs->groupFreeInodes[g];
+    }
+    fs->threadSafe = opts->thread_safe;
+    fs->inodeLocks = NULL;
+    if(fs->threadSafe){
+        fs->inodeLocks = malloc(fs->sb.inode_count * sizeof(pthread_rwlock_t));
+        for(ui32 i = 0; fs->inodeLocks && i < fs->sb.inode_count; i++){
+            pthread_rwlock_init(&fs->inodeLocks[i], NULL);
+        }
+        if(!fs->inodeLocks){
+            printf("Errore nell'allocazione dei lock degli inode.\n");
+            fs->threadSafe = false;
+        }
+    }
+    pthread_mutex_init(&fs->txLock, NULL);
+    pthread_cond_init(&fs->txCond, NULL);
+    fs->txClosing = false;
 
-    if(printBlocks==true){
-        printBitmap(fs);
+    fs->cache = NULL;
+    if(opts->cache_blocks > 0 && !opts->use_mmap){ //sopra una mappatura il buffer cache non serve
+        fs->cache = bcache_create(opts->cache_blocks, cache_dev_read, cache_dev_write, fs);
+        if(fs->cache == NULL){
+            printf("Errore nella creazione del buffer cache.\n");
+        }
     }
-    if(printInodes==true){
-        printInodeTable(fs);
+    memset(fs->readahead, 0xFF, sizeof(fs->readahead)); //nessun file seguito
+    fs->bmap = fs->threadSafe ? NULL : malloc(FS_BMAP_SLOTS * sizeof(struct fs_bmap_cache)); //slot condivisi: solo con un thread
+    for(ui32 i = 0; fs->bmap && i < FS_BMAP_SLOTS; i++){
+        fs->bmap[i].ino = (inode_t)-1;
+    }
+    fs->wbuf = fs->threadSafe ? NULL : calloc(1, sizeof(struct fs_wbuf)); //area di raccolta condivisa: solo con un thread
+    if(fs->wbuf){
+        fs->wbuf->data = aligned_alloc(BLOCK_SIZE, (size_t)FS_WBUF_SLOTS * BLOCK_SIZE);
+        if(!fs->wbuf->data){
+            free(fs->wbuf);
+            fs->wbuf = NULL; //senza area di raccolta le scritture parziali fanno read-modify-write subito
+        }
+    }
+    fs->dcache = NULL;
+    if(opts->dentry_cache > 0){
+        fs->dcache = dcache_create(opts->dentry_cache);
+        if(fs->dcache == NULL){
+            printf("Errore nella creazione del cache dei nomi.\n");
+        }
+    }
+    fs->txDepth = 0;
+    fs->journal = NULL;
+    if(opts->journal){
+        fs->journal = journal_open(fs); //NULL in modalità mmap o su immagini senza area del journal
+    }
+    fs->metaDirty = NULL;
+    fs->metaDirtyCount = 0;
+    if(!fs->journal && !opts->use_mmap){ //con il journal i blocchi sporchi li segue la transazione
+        fs->metaDirty = calloc(meta_end(fs), sizeof(ui8)); //un flag per blocco di superblocco, bitmap e tabella degli inode
     }
     return fs;
 }
 
 void printBitmap(struct filesystem *fs){
     printf("bitmap dei blocchi liberi:\n");
-    for(ui32 i=0; i<fs->sb.total_blocks; i++){ //per ogni blocco (4 kb)
-        ui8 byte = fs->blockBitmap[i/8]; //prendiamo il byte corrispondente
-        ui8 bit = (byte >> (i%8))&1; //prendiamo il bit corrispondente
-        // shiftiamo il byte di i%8 posizioni a destra e facciamo l'AND con 1 per ottenere il bit
-        printf("Blocco %u: %s\n", i, bit ? "Occupato" : "Libero");  //1 - bloccato, 0 - libero
-        //stampa lo stato del blocco
+    ui32 i = 0;
+    while(i < fs->sb.total_blocks){ //stampiamo un tratto omogeneo di blocchi per riga invece di un blocco per riga
+        bool used = (fs->blockBitmap[i/8] >> (i%8)) & 1; //1 - bloccato, 0 - libero
+        ui32 end = used ? bm_find_first_zero(fs->blockBitmap, i, fs->sb.total_blocks)
+                        : bm_find_first_one(fs->blockBitmap, i, fs->sb.total_blocks);
+        if(end - i == 1){
+            printf("Blocco %u: %s\n", i, used ? "Occupato" : "Libero");
+        } else {
+            printf("Blocchi %u-%u: %s\n", i, end - 1, used ? "Occupato" : "Libero");
+        }
+        i = end;
     }
 }
 
@@ -106,15 +838,28 @@ void printInodeTable(struct filesystem *fs){
         if(currentInode.isUsed){ //se il nodo è in uso
             printf("Inode %u:\n", i); //stampa il numero di inode
             printf("    Dimensione del file: %u byte\n", currentInode.size); //stampa la dimensione del file
-            printf("    Blocchi diretti: "); //stampa i blocchi diretti con il ciclo che segue
-            for(ui32 j=0; j<INODE_DIRECT; j++){
-                if(currentInode.directBlocks[j] != 0){ //se il blocco diretto non è 0 allora stampo il contenuto
-                    printf("%u ", currentInode.directBlocks[j]);
+            if(currentInode.flags & INODE_F_INLINE){
+                printf("    Dati inline: %u byte\n", currentInode.size);
+            } else if(currentInode.flags & INODE_F_EXTENTS){ //extent al posto dei puntatori
+                printf("    Extent (profondità %u): ", currentInode.extents.depth);
+                for(ui32 j=0; j<currentInode.extents.count && j<EXTENT_INLINE; j++){
+                    printf("[%u -> %u, %u] ", currentInode.extents.e[j].lstart, currentInode.extents.e[j].pstart, currentInode.extents.e[j].len);
+                }
+                printf("\n");
+            } else {
+                printf("    Blocchi diretti: "); //stampa i blocchi diretti con il ciclo che segue
+                for(ui32 j=0; j<INODE_DIRECT; j++){
+                    if(currentInode.directBlocks[j] != 0){ //se il blocco diretto non è 0 allora stampo il contenuto
+                        printf("%u ", currentInode.directBlocks[j]);
+                    }
+                }
+                printf("\n");
+                if(currentInode.indirectBlock != 0){
+                    printf("  Blocco indiretto: %u\n", currentInode.indirectBlock); //stampo il blocco indiretto se non è 0
+                }
+                if(currentInode.doubleIndirect != 0 || currentInode.tripleIndirect != 0){
+                    printf("  Blocchi doppio e triplo indiretto: %u %u\n", currentInode.doubleIndirect, currentInode.tripleIndirect);
                 }
-            }
-            printf("\n");
-            if(currentInode.indirectBlock != 0){
-                printf("  Blocco indiretto: %u\n", currentInode.indirectBlock); //stampo il blocco indiretto se non è 0
             }
             printf("  Creato il: %u\n", currentInode.created_at); //stampo il timestamp di creazione
             printf("  Ultima modifica: %u\n", currentInode.modified_at); //stampo il timestamp dell'ultima modifica
@@ -122,27 +867,92 @@ void printInodeTable(struct filesystem *fs){
     }
 }
 
-block_t block_alloc(struct filesystem *fs){
-    for(ui32 i=fs->sb.data_start; i<fs->sb.total_blocks; i++){
-        ui8 byte = fs->blockBitmap[i/8];
-        ui8 bit = (byte >> (i%8)) & 1;
-        if(bit==0){
-            fs->blockBitmap[i/8] = byte | (1 << (i%8)); //setto il bit a 1 per indicare che il blocco è occupato
-            /*
-            i è l'indice del blocco corrente, byte è il byte corrente della bitmap (ottenuto con i/8),
-            l'operazione (1<<(i%8)) sposta il bit 1 a sinistra di (i%8) posizioni per creare una maschera, 
-            l'operazioone OR (|) tra byte e la maschera imposta il bit corrispondente a 1, indicando che il blocco è ora allocato. 
-            */
-            return i; //ritorno il blocco allocato
+static inline ui32 block_group(const struct filesystem *fs, block_t b){
+    return (b - fs->sb.data_start) / fs->sb.group_blocks;
+}
+
+static _Thread_local ui32 threadGroup; //modalità thread-safe: gruppo del thread corrente + 1, 0 se non ancora assegnato
+
+static ui32 thread_group(struct filesystem *fs){
+    if(threadGroup == 0){
+        threadGroup = __atomic_fetch_add(&fs->threadGroups, 1, __ATOMIC_RELAXED) + 1; //a rotazione, al primo uso
+    }
+    return threadGroup - 1;
+}
+
+static ui32 alloc_cursor(struct filesystem *fs, inode_t ino){
+    //da dove cercare un blocco per ino: il cursore del gruppo associato al suo gruppo di inode;
+    //senza inode il cursore del thread (modalità thread-safe) o quello globale
+    //(i cursori sono solo suggerimenti: letture concorrenti innocue)
+    if(ino < fs->sb.inode_count){
+        ui32 g = (ui32)((ui64)(ino / fs->sb.group_inodes) * fs->groupCount / fs->inodeGroups);
+        return __atomic_load_n(&fs->groupNext[g], __ATOMIC_RELAXED);
+    }
+    if(fs->threadSafe){
+        return __atomic_load_n(&fs->groupNext[thread_group(fs) % fs->groupCount], __ATOMIC_RELAXED);
+    }
+    return __atomic_load_n(&fs->nextFree, __ATOMIC_RELAXED);
+}
+
+static void alloc_advance(struct filesystem *fs, block_t last){
+    //allocato fino a last: la prossima ricerca nel suo gruppo riparte dal blocco successivo
+    if(!fs->threadSafe) fs->nextFree = last + 1; //con più thread il cursore globale non si usa: nessuna linea condivisa
+    __atomic_store_n(&fs->groupNext[block_group(fs, last)], last + 1, __ATOMIC_RELAXED);
+}
+
+static void alloc_rewind(struct filesystem *fs, block_t b){
+    //b è tornato libero: i cursori che lo hanno superato tornano indietro
+    if(b < __atomic_load_n(&fs->nextFree, __ATOMIC_RELAXED)){
+        __atomic_store_n(&fs->nextFree, b, __ATOMIC_RELAXED);
+    }
+    ui32 g = block_group(fs, b);
+    if(b < __atomic_load_n(&fs->groupNext[g], __ATOMIC_RELAXED)){
+        __atomic_store_n(&fs->groupNext[g], b, __ATOMIC_RELAXED);
+    }
+}
+
+static block_t block_alloc_from(struct filesystem *fs, ui32 start){
+    if(start < fs->sb.data_start || start >= fs->sb.total_blocks) start = fs->sb.data_start;
+    block_t b;
+    for(;;){
+        b = summary_find_free(fs, start, fs->sb.total_blocks); //dal cursore alla fine
+        if(b == (block_t)-1){
+            b = summary_find_free(fs, fs->sb.data_start, start); //ricominciamo dall'inizio dell'area dati
+        }
+        if(b == (block_t)-1){
+            return (block_t)-1; // no free block found
         }
+        if(!fs->threadSafe){
+            fs->blockBitmap[b/8] |= (ui8)(1 << (b%8)); //setto il bit a 1 per indicare che il blocco è occupato
+            break;
+        }
+        if(bitmap_claim(fs->blockBitmap, b, 1)) break; //compare-and-swap sulla parola da 64 bit
+        start = b + 1 < fs->sb.total_blocks ? b + 1 : fs->sb.data_start; //preso da un altro thread: si cerca oltre
     }
-    return (block_t)-1; // no free block found
+    summary_update(fs, b / 64);
+    meta_dirty_bitmap(fs, b, 1);
+    alloc_advance(fs, b); //la prossima ricerca riparte dal blocco successivo
+    return b; //ritorno il blocco allocato
+}
+
+block_t block_alloc(struct filesystem *fs){
+    return block_alloc_from(fs, alloc_cursor(fs, (inode_t)-1));
+}
+
+static block_t block_alloc_near(struct filesystem *fs, inode_t ino){
+    return block_alloc_from(fs, alloc_cursor(fs, ino)); //nel gruppo dell'inode che userà il blocco
 }
 
 int free_block(struct filesystem *fs, block_t blockNum){
-    ui8 byte = fs->blockBitmap[blockNum/8];
-    ui8 bit = (byte >> (blockNum%8)) & 1; //ottengo il bit corrispondente al blocco
-    if(bit==1){
+    if(blockNum < fs->sb.data_start || blockNum >= fs->sb.total_blocks) return -1; //blocco fuori dall'area dati
+    ui8 byte = 0, bit;
+    if(fs->threadSafe){
+        bit = bitmap_release(fs->blockBitmap, blockNum, 1) ? 1 : 0; //controllo e azzeramento in un'unica operazione atomica
+    } else {
+        byte = fs->blockBitmap[blockNum/8];
+        bit = (byte >> (blockNum%8)) & 1; //ottengo il bit corrispondente al blocco
+    }
+    if(!fs->threadSafe && bit==1){
         fs->blockBitmap[blockNum/8] = byte & ~(1 << (blockNum%8)); 
         /*
         l'operazione (1 << (blockNum%8)) crea una maschera con il bit corrispondente al blocco impostato a 1,
@@ -150,58 +960,750 @@ int free_block(struct filesystem *fs, block_t blockNum){
         l'operazione AND (&) tra byte e la maschera aggiornata imposta il bit corrispondente al blocco a 0, 
         indicando che il blocco è ora libero.
         */
+    }
+    if(bit==1){
+        alloc_rewind(fs, blockNum); //riportiamo indietro il cursore sul blocco appena liberato
+        summary_update(fs, blockNum / 64);
+        meta_dirty_bitmap(fs, blockNum, 1);
+        meta_forget(fs, blockNum, 1);
+        wbuf_drop(fs, blockNum, 1); //una scrittura parziale in sospeso non deve finire sul prossimo proprietario
         return 0; //ritorno 0 per indicare che il blocco è stato liberato con successo
     } else {
         return -1; //ritorno -1 per indicare che il blocco era già libero
     }
 }
 
-int read_block(FILE *F, block_t block_num, void *buffer){
-    fseek(F, block_num * BLOCK_SIZE, SEEK_SET); //spostiamo la testina di lettura al blocco desiderato
-    size_t result = fread(buffer, BLOCK_SIZE, 1, F); //inseriamo in result il numero di blocchi che abbiamo letto
-    //abbiamo inoltre inserito nel buffer che abbiamo passato il contenuto del blocco letto con fread
-    if (result != 1) {
-        return -1; //errore nella lettura del blocco
+static ui32 longest_run(const ui8 *bitmap, ui32 from, ui32 to, ui32 min, ui32 *bestStart, ui32 *bestLen){
+    //aggiorna in bestStart/bestLen il tratto libero più lungo (>= min) in [from, to)
+    ui32 pos = from;
+    while(pos < to){
+        ui32 runStart = bm_find_first_zero(bitmap, pos, to);
+        if(runStart >= to) break;
+        ui32 runEnd = bm_find_first_one(bitmap, runStart, to);
+        ui32 len = runEnd - runStart;
+        if(len >= min && len > *bestLen){
+            *bestStart = runStart;
+            *bestLen = len;
+        }
+        pos = runEnd;
+    }
+    return *bestLen;
+}
+
+static int block_alloc_range_from(struct filesystem *fs, ui32 from, ui32 want, ui32 min, block_t *start, ui32 *count){
+    if(want == 0 || min == 0 || min > want || !start || !count) return -1; //parametri non validi
+    if(from < fs->sb.data_start || from >= fs->sb.total_blocks) from = fs->sb.data_start;
+    //in modalità thread-safe la ricerca legge la bitmap senza sincronizzazione: è bitmap_claim a confermare il tratto
+retry:;
+    ui32 bestStart = 0, bestLen = 0;
+    //next-fit: primo tratto di want blocchi dal cursore alla fine, poi dall'inizio dell'area dati
+    ui32 run = bm_find_zero_run(fs->blockBitmap, from, fs->sb.total_blocks, want);
+    if(run >= fs->sb.total_blocks){
+        run = bm_find_zero_run(fs->blockBitmap, fs->sb.data_start, from + want - 1 < fs->sb.total_blocks ? from + want - 1 : fs->sb.total_blocks, want);
+        if(run >= from) run = fs->sb.total_blocks;
+    }
+    if(run < fs->sb.total_blocks){
+        bestStart = run;
+        bestLen = want;
+    } else if(min < want){
+        longest_run(fs->blockBitmap, fs->sb.data_start, fs->sb.total_blocks, min, &bestStart, &bestLen); //ripiego: il tratto più lungo
+    }
+    if(bestLen == 0){
+        return -1; //nessun tratto contiguo di almeno min blocchi
+    }
+    if(!fs->threadSafe){
+        bitmap_set_range(fs->blockBitmap, bestStart, bestLen, true); //occupiamo l'intero tratto in un solo passaggio
+    } else if(!bitmap_claim(fs->blockBitmap, bestStart, bestLen)){
+        from = bestStart + bestLen < fs->sb.total_blocks ? bestStart + bestLen : fs->sb.data_start;
+        goto retry; //un altro thread ha preso parte del tratto: nuova ricerca
     }
+    summary_update_range(fs, bestStart, bestLen);
+    meta_dirty_bitmap(fs, bestStart, bestLen);
+    alloc_advance(fs, bestStart + bestLen - 1);
+    *start = bestStart;
+    *count = bestLen;
     return 0;
 }
 
+int block_alloc_range(struct filesystem *fs, ui32 want, ui32 min, block_t *start, ui32 *count){
+    return block_alloc_range_from(fs, alloc_cursor(fs, (inode_t)-1), want, min, start, count);
+}
+
+int free_block_range(struct filesystem *fs, block_t start, ui32 count){
+    if(count == 0 || start < fs->sb.data_start || start >= fs->sb.total_blocks || count > fs->sb.total_blocks - start){
+        return -1; //tratto fuori dall'area dati
+    }
+    if(fs->threadSafe){
+        for(ui32 w = start / 64; w <= (start + count - 1) / 64; w++){ //controllo parola per parola con letture atomiche
+            ui64 mask = range_mask(w, start, start + count);
+            if((bitmap_word(fs->blockBitmap, w) & mask) != mask) return -1; //almeno un blocco del tratto era già libero
+        }
+    } else if(bm_find_first_zero(fs->blockBitmap, start, start + count) < start + count){
+        return -1; //almeno un blocco del tratto era già libero
+    }
+    if(fs->threadSafe){
+        bitmap_release(fs->blockBitmap, start, count);
+    } else {
+        bitmap_set_range(fs->blockBitmap, start, count, false);
+    }
+    summary_update_range(fs, start, count);
+    meta_dirty_bitmap(fs, start, count);
+    meta_forget(fs, start, count);
+    wbuf_drop(fs, start, count);
+    alloc_rewind(fs, start); //riportiamo indietro il cursore
+    return 0;
+}
+
+int bdev_open(struct blockdev *dev, const char *path, bool direct){
+    int flags = O_RDWR;
+#ifdef O_DIRECT
+    if(direct) flags |= O_DIRECT; //le letture e scritture evitano la page cache
+#else
+    if(direct) return -1; //O_DIRECT non disponibile su questa piattaforma
+#endif
+    dev->fd = open(path, flags);
+    dev->direct = direct;
+    dev->map = NULL;
+    dev->mapSize = 0;
+    return dev->fd < 0 ? -1 : 0;
+}
+
+int bdev_map(struct blockdev *dev, size_t size){
+    struct stat st;
+    if(dev->direct || fstat(dev->fd, &st) != 0) return -1; //mmap e O_DIRECT non si combinano
+    if((size_t)st.st_size < size && ftruncate(dev->fd, (off_t)size) != 0){
+        return -1; //l'immagine va estesa (in modo sparso) fino all'ultimo blocco, altrimenti l'accesso darebbe SIGBUS
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd, 0);
+    if(map == MAP_FAILED) return -1;
+    dev->map = map;
+    dev->mapSize = size;
+    return 0;
+}
+
+static int full_pread(int fd, void *buffer, size_t len, off_t offset){
+    ui8 *p = buffer;
+    while(len > 0){
+        ssize_t n = pread(fd, p, len, offset); //lettura posizionale: nessuna posizione condivisa tra i thread
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0) return -1; //errore di lettura
+        if(n == 0){
+            memset(p, 0, len); //oltre la fine dell'immagine: blocchi mai scritti, si leggono come zeri
+            return 0;
+        }
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int full_pwrite(int fd, const void *buffer, size_t len, off_t offset){
+    const ui8 *p = buffer;
+    while(len > 0){
+        ssize_t n = pwrite(fd, p, len, offset);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+static inline bool is_aligned(const void *p){
+    return ((uintptr_t)p % BLOCK_SIZE) == 0;
+}
+
+int bdev_read(struct blockdev *dev, block_t block_num, void *buffer){
+    if(dev->map){
+        if((size_t)(block_num + 1) * BLOCK_SIZE > dev->mapSize) return -1; //blocco oltre la fine dell'immagine
+        memcpy(buffer, dev->map + (size_t)block_num * BLOCK_SIZE, BLOCK_SIZE); //nessuna system call
+        return 0;
+    }
+    if(dev->direct && !is_aligned(buffer)){
+        _Alignas(BLOCK_SIZE) ui8 bounce[BLOCK_SIZE]; //O_DIRECT richiede un buffer allineato
+        if(full_pread(dev->fd, bounce, BLOCK_SIZE, (off_t)block_num * BLOCK_SIZE) != 0) return -1;
+        memcpy(buffer, bounce, BLOCK_SIZE);
+        return 0;
+    }
+    return full_pread(dev->fd, buffer, BLOCK_SIZE, (off_t)block_num * BLOCK_SIZE);
+}
+
+int bdev_write(struct blockdev *dev, block_t block_num, const void *buffer){
+    if(dev->map){
+        if((size_t)(block_num + 1) * BLOCK_SIZE > dev->mapSize) return -1;
+        memcpy(dev->map + (size_t)block_num * BLOCK_SIZE, buffer, BLOCK_SIZE); //persistito da msync al flush
+        return 0;
+    }
+    if(dev->direct && !is_aligned(buffer)){
+        _Alignas(BLOCK_SIZE) ui8 bounce[BLOCK_SIZE];
+        memcpy(bounce, buffer, BLOCK_SIZE);
+        return full_pwrite(dev->fd, bounce, BLOCK_SIZE, (off_t)block_num * BLOCK_SIZE);
+    }
+    return full_pwrite(dev->fd, buffer, BLOCK_SIZE, (off_t)block_num * BLOCK_SIZE);
+}
+
+int bdev_pread_bytes(struct blockdev *dev, void *buffer, size_t len, off_t offset){
+    //lettura di un intervallo di byte qualsiasi (superblocco, bitmap, tabella degli inode)
+    if(dev->map){
+        if((size_t)offset + len > dev->mapSize) return -1;
+        memcpy(buffer, dev->map + offset, len);
+        return 0;
+    }
+    if(!dev->direct){
+        return full_pread(dev->fd, buffer, len, offset);
+    }
+    off_t first = offset / BLOCK_SIZE;
+    off_t last = (offset + (off_t)len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t span = (size_t)(last - first) * BLOCK_SIZE;
+    ui8 *bounce = aligned_alloc(BLOCK_SIZE, span); //con O_DIRECT si leggono sempre blocchi interi allineati
+    if(!bounce) return -1;
+    int result = full_pread(dev->fd, bounce, span, first * BLOCK_SIZE);
+    if(result == 0) memcpy(buffer, bounce + (offset - first * BLOCK_SIZE), len);
+    free(bounce);
+    return result;
+}
+
+int bdev_pwrite_bytes(struct blockdev *dev, const void *buffer, size_t len, off_t offset){
+    if(dev->map){
+        if((size_t)offset + len > dev->mapSize) return -1;
+        memmove(dev->map + offset, buffer, len); //buffer può già puntare dentro la mappatura
+        return 0;
+    }
+    if(!dev->direct){
+        return full_pwrite(dev->fd, buffer, len, offset);
+    }
+    off_t first = offset / BLOCK_SIZE;
+    off_t last = (offset + (off_t)len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t span = (size_t)(last - first) * BLOCK_SIZE;
+    ui8 *bounce = aligned_alloc(BLOCK_SIZE, span);
+    if(!bounce) return -1;
+    int result = full_pread(dev->fd, bounce, span, first * BLOCK_SIZE); //read-modify-write dei blocchi toccati
+    if(result == 0){
+        memcpy(bounce + (offset - first * BLOCK_SIZE), buffer, len);
+        result = full_pwrite(dev->fd, bounce, span, first * BLOCK_SIZE);
+    }
+    free(bounce);
+    return result;
+}
+
+struct io_ref {
+    block_t block;
+    ui32 index; //posizione nella lista del chiamante
+};
+
+static int cmp_io_ref(const void *a, const void *b){
+    block_t x = ((const struct io_ref *)a)->block, y = ((const struct io_ref *)b)->block;
+    return (x > y) - (x < y);
+}
+
+static int bdev_vectored(struct blockdev *dev, const block_t *blocks, void *const *buffers, ui32 n, bool write){
+    //ordina le richieste, fonde i blocchi adiacenti in tratti contigui e fa una preadv/pwritev per tratto
+    if(n == 0) return 0;
+    bool unaligned = false;
+    for(ui32 i = 0; i < n && dev->direct; i++){
+        if(!is_aligned(buffers[i])) unaligned = true;
+    }
+    if(dev->map || unaligned){ //mappatura o O_DIRECT con buffer non allineati: blocco per blocco
+        for(ui32 i = 0; i < n; i++){
+            int r = write ? bdev_write(dev, blocks[i], buffers[i]) : bdev_read(dev, blocks[i], buffers[i]);
+            if(r != 0) return -1;
+        }
+        return 0;
+    }
+    struct io_ref *refs = malloc(n * sizeof(struct io_ref));
+    struct iovec *iov = malloc(n * sizeof(struct iovec));
+    if(!refs || !iov){
+        free(refs);
+        free(iov);
+        return -1;
+    }
+    for(ui32 i = 0; i < n; i++){
+        refs[i].block = blocks[i];
+        refs[i].index = i;
+    }
+    qsort(refs, n, sizeof(struct io_ref), cmp_io_ref);
+    int result = 0;
+    ui32 i = 0;
+    while(i < n && result == 0){
+        ui32 runLen = 1; //i blocchi i..i+runLen-1 sono consecutivi sul disco
+        while(i + runLen < n && runLen < IOV_MAX && refs[i + runLen].block == refs[i].block + runLen){
+            runLen++;
+        }
+        for(ui32 k = 0; k < runLen; k++){
+            iov[k].iov_base = buffers[refs[i + k].index];
+            iov[k].iov_len = BLOCK_SIZE;
+        }
+        off_t offset = (off_t)refs[i].block * BLOCK_SIZE;
+        size_t expected = (size_t)runLen * BLOCK_SIZE;
+        ssize_t done;
+        do {
+            done = write ? pwritev(dev->fd, iov, (int)runLen, offset) : preadv(dev->fd, iov, (int)runLen, offset);
+        } while(done < 0 && errno == EINTR);
+        if(done != (ssize_t)expected){
+            //trasferimento parziale (raro): completiamo il tratto un blocco alla volta
+            for(ui32 k = 0; k < runLen && result == 0; k++){
+                ui32 idx = refs[i + k].index;
+                result = write ? bdev_write(dev, blocks[idx], buffers[idx]) : bdev_read(dev, blocks[idx], buffers[idx]);
+            }
+        }
+        i += runLen;
+    }
+    free(refs);
+    free(iov);
+    return result;
+}
+
+int bdev_readv(struct blockdev *dev, const block_t *blocks, void *const *buffers, ui32 n){
+    return bdev_vectored(dev, blocks, buffers, n, false);
+}
+
+int bdev_writev(struct blockdev *dev, const block_t *blocks, void *const *buffers, ui32 n){
+    return bdev_vectored(dev, blocks, buffers, n, true);
+}
+
+int read_block(FILE *F, block_t block_num, void *buffer){
+    //stessa firma di sempre, ma senza fseek né buffer stdio: pread posizionale sul descrittore del FILE
+    struct blockdev dev = { .fd = fileno(F), .direct = false };
+    return bdev_read(&dev, block_num, buffer);
+}
+
 int write_block(FILE *F, block_t block_num, void *buffer){
-    fseek(F, block_num * BLOCK_SIZE, SEEK_SET); //spostiamo la testina di scrittura nel blocco in cui vogliamo scrivere
-    size_t result = fwrite(buffer, BLOCK_SIZE, 1, F); //scriviamo il contenuto del buffer nel blocco
-    if(result !=1){
-        return -1; //errore nella scrittura del blocco
+    if(fflush(F) != 0){ //eventuali dati ancora nel buffer stdio del chiamante vanno scritti prima
+        return -1;
+    }
+    struct blockdev dev = { .fd = fileno(F), .direct = false };
+    return bdev_write(&dev, block_num, buffer); //pwrite posizionale del blocco
+}
+
+int fs_read_block(struct filesystem *fs, block_t block_num, void *buffer){
+    if(fs->journal && journal_read(fs->journal, block_num, buffer) == 0){
+        return 0; //metadato registrato nel journal e non ancora riportato al suo posto
+    }
+    if(fs->cache){
+        return bcache_read(fs->cache, block_num, buffer); //passiamo dal buffer cache
+    }
+    if(bdev_read(&fs->dev, block_num, buffer) != 0) return -1;
+    return fs->dev.map ? 0 : fs_verify_block(fs, block_num, buffer); //la mappatura è già in memoria: niente verifica
+}
+
+int fs_write_block(struct filesystem *fs, block_t block_num, void *buffer){
+    if(fs->cache){
+        return bcache_write(fs->cache, block_num, buffer); //il blocco resta sporco nel cache fino al flush
+    }
+    return bdev_write(&fs->dev, block_num, buffer);
+}
+
+int read_blocks(struct filesystem *fs, const block_t *blocks, void *const *buffers, ui32 n){
+    if(!fs->cache && !fs->journal){
+        int result = bdev_readv(&fs->dev, blocks, buffers, n);
+        for(ui32 i = 0; !fs->dev.map && i < n && result == 0; i++){
+            result = fs_verify_block(fs, blocks[i], buffers[i]);
+        }
+        return result;
+    }
+    //con il cache (o il journal): gli hit si copiano subito, i miss si leggono tutti insieme e poi si inseriscono nel cache
+    block_t *missBlocks = calloc(n, sizeof(block_t)); //azzerati: ne vengono riempiti solo misses
+    void **missBuffers = calloc(n, sizeof(void *));
+    if(!missBlocks || !missBuffers){
+        free(missBlocks);
+        free(missBuffers);
+        return -1;
+    }
+    ui32 misses = 0;
+    for(ui32 i = 0; i < n; i++){
+        if(fs->journal && journal_read(fs->journal, blocks[i], buffers[i]) == 0) continue;
+        if(!fs->cache || bcache_lookup(fs->cache, blocks[i], buffers[i]) != 0){
+            missBlocks[misses] = blocks[i];
+            missBuffers[misses] = buffers[i];
+            misses++;
+        }
+    }
+    int result = bdev_readv(&fs->dev, missBlocks, missBuffers, misses);
+    for(ui32 i = 0; i < misses && result == 0; i++){
+        result = fs_verify_block(fs, missBlocks[i], missBuffers[i]);
+        if(fs->cache && result == 0) bcache_fill(fs->cache, missBlocks[i], missBuffers[i]);
+    }
+    free(missBlocks);
+    free(missBuffers);
+    return result;
+}
+
+int write_blocks(struct filesystem *fs, const block_t *blocks, void *const *buffers, ui32 n){
+    if(!fs->cache){
+        return bdev_writev(&fs->dev, blocks, buffers, n);
+    }
+    for(ui32 i = 0; i < n; i++){
+        if(bcache_write(fs->cache, blocks[i], buffers[i]) != 0) return -1; //write-back: nessuna I/O immediata
     }
     return 0;
 }
 
-inode_t inode_alloc(struct filesystem *fs){
-    for(ui32 i=0; i<fs->sb.inode_count; i++){
-        if(fs->inodeTable[i].isUsed==0){ //se l'inode non è in uso
-            fs->inodeTable[i].isUsed=1; //lo segniamo come in uso
+int fs_prefetch_blocks(struct filesystem *fs, const block_t *blocks, ui32 n){
+    //porta nel cache, con una sola richiesta vettoriale per tratto contiguo, i blocchi che ancora mancano
+    if(!fs->cache || fs->dev.map) return 0; //senza cache (o con la mappatura) non c'è dove tenerli
+    ui32 misses = 0;
+    for(ui32 i = 0; i < n; i++){
+        if(blocks[i] != 0 && !bcache_contains(fs->cache, blocks[i])) misses++;
+    }
+    if(misses <= 1) return 0; //un solo blocco: lo leggerà la normale lettura
+    block_t *missBlocks = malloc(misses * sizeof(block_t));
+    ui8 *pool = aligned_alloc(BLOCK_SIZE, (size_t)misses * BLOCK_SIZE);
+    void **buffers = calloc(misses, sizeof(void *));
+    if(!missBlocks || !pool || !buffers){
+        free(missBlocks);
+        free(pool);
+        free(buffers);
+        return -1;
+    }
+    misses = 0;
+    for(ui32 i = 0; i < n; i++){
+        if(blocks[i] != 0 && !bcache_contains(fs->cache, blocks[i])) missBlocks[misses++] = blocks[i];
+    }
+    for(ui32 i = 0; i < misses; i++) buffers[i] = pool + (size_t)i * BLOCK_SIZE;
+    int result = bdev_readv(&fs->dev, missBlocks, buffers, misses);
+    for(ui32 i = 0; i < misses && result == 0; i++){
+        //un blocco che non corrisponde è danneggiato o ha una versione più recente non ancora scritta: lo gestirà la lettura vera
+        if(csum_matches(fs, missBlocks[i], buffers[i])) bcache_fill(fs->cache, missBlocks[i], buffers[i]);
+    }
+    free(missBlocks);
+    free(pool);
+    free(buffers);
+    return result;
+}
+
+const void *fs_block_ptr(struct filesystem *fs, block_t block_num){
+    //accesso senza copia al blocco in modalità mmap, NULL altrimenti
+    if(!fs->dev.map || block_num >= fs->sb.total_blocks) return NULL;
+    return fs->dev.map + (size_t)block_num * BLOCK_SIZE;
+}
+
+static const void *fs_block_view(struct filesystem *fs, block_t block_num, void *buffer){
+    //blocco in sola lettura: puntatore nella mappatura se disponibile, altrimenti copia in buffer
+    const void *p = fs_block_ptr(fs, block_num);
+    if(p) return p;
+    return fs_read_block(fs, block_num, buffer) == 0 ? buffer : NULL;
+}
+
+static int wbuf_flush(struct filesystem *fs);
+
+static void sb_update_counts(struct filesystem *fs){
+    //contatori dello spazio libero nel superblocco: il blocco 0 si riscrive solo se sono cambiati
+    ui32 freeBlocks = __atomic_load_n(&fs->freeBlocks, __ATOMIC_RELAXED);
+    ui32 freeInodes = __atomic_load_n(&fs->freeInodes, __ATOMIC_RELAXED);
+    if(fs->sb.free_blocks_count == freeBlocks && fs->sb.free_inodes_count == freeInodes) return;
+    fs->sb.free_blocks_count = freeBlocks;
+    fs->sb.free_inodes_count = freeInodes;
+    if(fs->dev.map){
+        fs->sb.checksum = sb_checksum(&fs->sb);
+        memcpy(fs->dev.map, &fs->sb, sizeof(struct superblock)); //il superblocco nella mappatura
+    } else {
+        meta_dirty(fs, 0);
+    }
+}
+
+int fs_flush(struct filesystem *fs){
+    int result = 0;
+    sb_update_counts(fs);
+    if(wbuf_flush(fs) != 0){
+        result = -1; //blocchi parziali di fs_pwrite non scritti
+    }
+    if(fs->cache && bcache_flush(fs->cache) != 0){
+        result = -1; //almeno un blocco non è stato scritto
+    }
+    if(meta_writeback(fs) != 0){
+        result = -1; //bitmap o tabella degli inode non scritte
+    }
+    if(fs->journal && fs_journal_wait(fs, fs_journal_commit(fs)) != 0){
+        result = -1; //i metadati sono sul disco quando la loro transazione lo è
+    }
+    if(fs->dev.map && fs->csum){
+        csum_refresh(fs, 0, fs->sb.csum_start); //in modalità mmap nessuno fotografa i blocchi: i checksum si aggiornano qui
+    }
+    if(fs->dev.map && msync(fs->dev.map, fs->dev.mapSize, MS_SYNC) != 0){
+        result = -1; //in modalità mmap il flush rende persistenti le pagine modificate
+    }
+    return result;
+}
+
+int fs_sync(struct filesystem *fs){
+    //fs_flush seguito da fdatasync: al ritorno dati e metadati sono sul disco
+    int result = fs_flush(fs);
+    if(!fs->dev.map && fdatasync(fs->dev.fd) != 0){
+        result = -1;
+    }
+    return result;
+}
+
+int close_fs(struct filesystem *fs){
+    if(fs == NULL) return -1;
+    int result = fs_sync(fs);
+    if(fs->journal && journal_close(fs->journal) != 0){
+        result = -1; //checkpoint non riuscito: il prossimo open riapplicherà il journal
+    }
+    bcache_destroy(fs->cache);
+    dcache_destroy(fs->dcache);
+    for(ui32 i = 0; fs->inodeLocks && i < fs->sb.inode_count; i++){
+        pthread_rwlock_destroy(&fs->inodeLocks[i]);
+    }
+    free(fs->inodeLocks);
+    pthread_mutex_destroy(&fs->txLock);
+    pthread_cond_destroy(&fs->txCond);
+    if(fs->wbuf){
+        free(fs->wbuf->data);
+        free(fs->wbuf);
+    }
+    free(fs->bmap);
+    meta_release(fs);
+    free(fs->wordFree);
+    free(fs->freeSummary);
+    free(fs->groupNext);
+    free(fs->groupFreeInodes);
+    free(fs->metaDirty);
+    if(fs->img){
+        fclose(fs->img); //chiude anche il descrittore di dev
+    } else {
+        close(fs->dev.fd);
+    }
+    free(fs);
+    return result;
+}
+
+ui64 fs_journal_commit(struct filesystem *fs){
+    //chiude la transazione in corso; il numero ritornato va passato a fs_journal_wait per renderla durevole
+    if(!fs->journal) return 0;
+    if(!fs->threadSafe) return journal_end_tx(fs->journal);
+    pthread_mutex_lock(&fs->txLock);
+    while(fs->txDepth > 0){ //operazioni in corso: si chiude appena finiscono, senza farne entrare altre
+        fs->txClosing = true;
+        pthread_cond_wait(&fs->txCond, &fs->txLock);
+    }
+    ui64 seq = journal_end_tx(fs->journal);
+    pthread_mutex_unlock(&fs->txLock);
+    return seq;
+}
+
+int fs_journal_wait(struct filesystem *fs, ui64 seq){
+    if(!fs->journal) return 0;
+    return journal_wait(fs->journal, seq);
+}
+
+static inline void inode_bit_set(struct filesystem *fs, inode_t i, bool used){
+    if(used) fs->inodeBitmap[i/8] |= (ui8)(1 << (i%8));
+    else fs->inodeBitmap[i/8] &= (ui8)~(1 << (i%8));
+}
+
+static void inode_bitmap_load(struct filesystem *fs){
+    //bitmap degli inode in RAM, a parole da 64 bit come quella dei blocchi: letta dal disco o, sulle immagini
+    //create prima che esistesse, ricostruita dai flag isUsed della tabella
+    ui32 words = (fs->sb.inode_count + 63) / 64;
+    if(!fs->dev.map || !fs->sb.inode_bitmap_start){
+        fs->inodeBitmap = calloc(words, sizeof(ui64));
+        if(fs->sb.inode_bitmap_start){
+            bdev_pread_bytes(&fs->dev, fs->inodeBitmap, (fs->sb.inode_count + 7) / 8, (off_t)BLOCK_SIZE * fs->sb.inode_bitmap_start);
+        } else {
+            for(inode_t i = 0; i < fs->sb.inode_count; i++){
+                if(fs->inodeTable[i].isUsed) inode_bit_set(fs, i, true);
+            }
+        }
+    }
+    for(ui32 i = fs->sb.inode_count; i < words * 64; i++){
+        inode_bit_set(fs, i, true); //bit di padding oltre l'ultimo inode: mai liberi
+    }
+}
+
+static void inode_table_map(struct filesystem *fs){
+    //tabella degli inode paginata su richiesta: mappatura privata della sua regione dell'immagine. Il montaggio non
+    //legge nulla; un blocco della tabella viene letto dal kernel al primo accesso e le pagine solo lette restano
+    //nella page cache, che le recupera quando serve memoria. Le modifiche restano private (copy-on-write) finché
+    //fs_flush non le scrive nella loro posizione con bitmap e journal, come per la tabella allocata
+    size_t len = (size_t)fs->sb.inode_table_blocks * BLOCK_SIZE;
+    off_t off = (off_t)fs->sb.inode_table_start * BLOCK_SIZE;
+    struct stat st;
+    fs->inodeTableMap = 0;
+    if(BLOCK_SIZE % sysconf(_SC_PAGESIZE) != 0 || fstat(fs->dev.fd, &st) != 0 || st.st_size < off + (off_t)len){
+        return; //blocchi non allineati alle pagine o immagine troncata: la tabella si legge in memoria
+    }
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fs->dev.fd, off);
+    if(p == MAP_FAILED) return;
+    fs->inodeTable = p;
+    fs->inodeTableMap = len;
+}
+
+static void inode_table_release(struct filesystem *fs, const block_t *blocks, ui32 n){
+    //blocchi della tabella appena scritti nella loro posizione: la copia privata si scarta e il prossimo accesso
+    //rilegge dall'immagine lo stesso contenuto, così in memoria restano solo i blocchi modificati dall'ultimo flush.
+    //Non con più thread (una modifica tra la copia e lo scarto andrebbe persa) né con il journal (il blocco arriva
+    //nella sua posizione solo al checkpoint)
+    if(!fs->inodeTableMap || fs->threadSafe || fs->journal) return;
+    for(ui32 i = 0; i < n; i++){
+        if(blocks[i] < fs->sb.inode_table_start || blocks[i] >= fs->sb.inode_table_start + fs->sb.inode_table_blocks) continue;
+        madvise((ui8 *)fs->inodeTable + (size_t)(blocks[i] - fs->sb.inode_table_start) * BLOCK_SIZE, BLOCK_SIZE, MADV_DONTNEED);
+    }
+}
+
+static void inode_table_load(struct filesystem *fs){
+    //legge i gruppi di inode che hanno almeno un bit a 1 nella bitmap, accorpando i gruppi consecutivi in una
+    //sola lettura: un gruppo senza inode in uso non è mai stato inizializzato o contiene solo inode liberi,
+    //che inode_alloc reimposta per intero, quindi resta a zero in memoria
+    ui32 count = fs->sb.inode_count;
+    ui32 first = bm_find_first_one(fs->inodeBitmap, 0, count);
+    while(first < count){
+        first -= first % fs->sb.group_inodes; //inizio del gruppo
+        ui32 last = first;
+        while(last < count){
+            ui32 end = last + fs->sb.group_inodes < count ? last + fs->sb.group_inodes : count;
+            if(bm_find_first_one(fs->inodeBitmap, last, end) >= end) break; //gruppo senza inode in uso
+            last = end;
+        }
+        bdev_pread_bytes(&fs->dev, fs->inodeTable + first, (size_t)(last - first) * sizeof(struct inode),
+                         (off_t)BLOCK_SIZE * fs->sb.inode_table_start + (off_t)first * sizeof(struct inode));
+        first = bm_find_first_one(fs->inodeBitmap, last, count);
+    }
+}
+
+static int csum_verify_blocks(struct filesystem *fs, block_t first, block_t end){
+    //blocchi di metadati letti al montaggio: il loro contenuto sul disco confrontato con la tabella dei checksum
+    _Alignas(BLOCK_SIZE) ui8 buffer[BLOCK_SIZE];
+    block_t tableEnd = fs->sb.inode_table_start + fs->sb.inode_table_blocks;
+    for(block_t b = first; b < end; b++){
+        if(fs->csum[b] == 0) continue; //nessun checksum: niente da leggere
+        const void *p = fs_block_ptr(fs, b);
+        if(!p && fs->inodeTableMap && b >= fs->sb.inode_table_start && b < tableEnd){
+            p = (const ui8 *)fs->inodeTable + (size_t)(b - fs->sb.inode_table_start) * BLOCK_SIZE; //pagina non ancora modificata
+        }
+        if(!p){
+            if(bdev_read(&fs->dev, b, buffer) != 0) return -1;
+            p = buffer;
+        }
+        if(fs_verify_block(fs, b, p) != 0) return -1;
+    }
+    return 0;
+}
+
+static int csum_table_load(struct filesystem *fs){
+    //tabella dei checksum in RAM (dopo il replay del journal, che può averla aggiornata) e verifica delle bitmap
+    fs->csum = NULL;
+    fs->csumStale = NULL;
+    if(fs->sb.version < 3 || fs->sb.csum_blocks == 0) return 0; //immagine senza checksum
+    size_t bytes = (size_t)fs->sb.csum_blocks * BLOCK_SIZE;
+    fs->csum = malloc(bytes);
+    fs->csumStale = calloc(fs->sb.csum_start, sizeof(ui8));
+    if(!fs->csum || !fs->csumStale || bdev_pread_bytes(&fs->dev, fs->csum, bytes, (off_t)BLOCK_SIZE * fs->sb.csum_start) != 0){
+        printf("Errore nella lettura della tabella dei checksum.\n");
+    } else if(csum_verify_blocks(fs, fs->sb.free_block_bitmap_start, fs->sb.inode_table_start) == 0){
+        return 0;
+    }
+    free(fs->csum);
+    free(fs->csumStale);
+    return -1;
+}
+
+static int inode_table_verify(struct filesystem *fs){
+    //blocchi della tabella con almeno un inode in uso: gli altri contengono solo inode liberi, che inode_alloc reimposta
+    ui32 count = fs->sb.inode_count, perBlock = BLOCK_SIZE / sizeof(struct inode);
+    ui32 i = bm_find_first_one(fs->inodeBitmap, 0, count);
+    while(i < count){
+        block_t b = fs->sb.inode_table_start + i / perBlock;
+        if(csum_verify_blocks(fs, b, b + 1) != 0) return -1;
+        ui32 next = (i / perBlock + 1) * perBlock;
+        i = next < count ? bm_find_first_one(fs->inodeBitmap, next, count) : count;
+    }
+    return 0;
+}
+
+static void meta_release(struct filesystem *fs){
+    //bitmap e tabelle degli inode e dei checksum: dentro la mappatura dell'immagine, mappate a parte o allocate
+    if(!fs->dev.map || !fs->sb.inode_bitmap_start){
+        free(fs->inodeBitmap); //ricostruita in RAM
+    }
+    if(fs->dev.map){
+        munmap(fs->dev.map, fs->dev.mapSize); //bitmap e tabella degli inode erano nella mappatura
+    } else {
+        free(fs->blockBitmap);
+        if(fs->inodeTableMap) munmap(fs->inodeTable, fs->inodeTableMap);
+        else free(fs->inodeTable);
+        free(fs->csum);
+    }
+    free(fs->csumStale);
+}
+
+static inode_t inode_alloc_from(struct filesystem *fs, ui32 group){
+    //primo bit libero nella bitmap degli inode a partire dal gruppo group, poi dall'inizio:
+    //la ricerca salta 64 inode per parola invece di leggere isUsed in ogni inode della tabella
+    ui32 first = (group % fs->inodeGroups) * fs->sb.group_inodes;
+    ui32 from[2] = { first, 0 }, to[2] = { fs->sb.inode_count, first };
+    for(int pass = 0; pass < 2; pass++){
+        ui32 i = from[pass];
+        while((i = bm_find_first_zero(fs->inodeBitmap, i, to[pass])) < to[pass]){
+            if(!fs->threadSafe){
+                inode_bit_set(fs, i, true);
+            } else if(!bitmap_claim(fs->inodeBitmap, i, 1)){
+                continue; //preso da un altro thread tra la ricerca e il compare-and-swap
+            }
+            meta_dirty_inode_bit(fs, i);
+            __atomic_sub_fetch(&fs->freeInodes, 1, __ATOMIC_RELAXED);
+            __atomic_sub_fetch(&fs->groupFreeInodes[i / fs->sb.group_inodes], 1, __ATOMIC_RELAXED);
+            if(__atomic_exchange_n(&fs->inodeTable[i].isUsed, 1, __ATOMIC_ACQ_REL) == 1){
+                i++;
+                continue; //già segnato in uso direttamente nella tabella: ora lo è anche nella bitmap
+            }
             fs->inodeTable[i].size=0; //inizializziamo la dimensione del file a 0
             fs->inodeTable[i].created_at = (ui32)time(NULL); //impostiamo il timestamp di creazione
             fs->inodeTable[i].modified_at = (ui32)time(NULL); //impostiamo
             fs->inodeTable[i].indirectBlock = 0; //inizializziamo il puntatore al blocco indiretto a 0
             memset(fs->inodeTable[i].directBlocks, 0, INODE_DIRECT * sizeof(ui32)); //inizializziamo i blocchi diretti legati al file a 0
+            memset(fs->inodeTable[i].inlineData, 0, INODE_INLINE_SIZE); //anche il resto dell'area condivisa con extent e dati inline
+            fs->inodeTable[i].flags = 0; //formato deciso al primo uso
+            bmap_forget(fs, i);
+            meta_dirty_inode(fs, i);
             return i; //ritorniamo il numero dell'inode allocato
         }
     }
     return (inode_t)-1; //nessun inode disponibile
 }
 
+inode_t inode_alloc(struct filesystem *fs){
+    return inode_alloc_from(fs, fs->threadSafe ? thread_group(fs) : 0); //con più thread ognuno parte dal proprio gruppo
+}
+
+static ui32 inode_group_for_dir(struct filesystem *fs){
+    //una nuova directory va nel gruppo con più inode liberi (a parità, il primo): i suoi file la seguiranno
+    ui32 best = 0, bestFree = 0;
+    for(ui32 g = 0; g < fs->inodeGroups; g++){
+        ui32 n = __atomic_load_n(&fs->groupFreeInodes[g], __ATOMIC_RELAXED);
+        if(n > bestFree){
+            best = g;
+            bestFree = n;
+        }
+    }
+    return best;
+}
+
 int free_inode(struct filesystem *fs, inode_t inodeNum){
-    if(fs->inodeTable[inodeNum].isUsed==1){
+    if(inodeNum >= fs->sb.inode_count) return -1;
+    if(fs->threadSafe){
+        if(__atomic_exchange_n(&fs->inodeTable[inodeNum].isUsed, 0, __ATOMIC_ACQ_REL) != 1) return -1;
+        bitmap_release(fs->inodeBitmap, inodeNum, 1);
+    } else if(fs->inodeTable[inodeNum].isUsed==1){
         fs->inodeTable[inodeNum].isUsed=0;
-        return 0;
+        inode_bit_set(fs, inodeNum, false);
+    } else {
+        return -1; //l'inode era già libero
     }
-    return -1; //l'inode era già libero
+    bmap_forget(fs, inodeNum);
+    meta_dirty_inode(fs, inodeNum);
+    meta_dirty_inode_bit(fs, inodeNum);
+    __atomic_add_fetch(&fs->freeInodes, 1, __ATOMIC_RELAXED); //bitmap e contatori restano allineati
+    __atomic_add_fetch(&fs->groupFreeInodes[inodeNum / fs->sb.group_inodes], 1, __ATOMIC_RELAXED);
+    return 0;
 }
 
 int inode_read(struct filesystem *fs, inode_t inodenum, struct inode *out){
     if (!fs || !out) return -1; //controlla il contenuto di fs e out, se non sono presenti restituisce un errore
     if (inodenum >= fs->sb.inode_count) return -1; //se il numero di inode non è valido cade in errore
-    if (fs->inodeTable[inodenum].isUsed == 1){ //se l'inode è in uso
+    if (__atomic_load_n(&fs->inodeTable[inodenum].isUsed, __ATOMIC_RELAXED) == 1){ //se l'inode è in uso
         memcpy(out, &fs->inodeTable[inodenum], sizeof(struct inode)); //lo copia nel buffer
         return 0; // successo
     }
@@ -211,45 +1713,289 @@ int inode_read(struct filesystem *fs, inode_t inodenum, struct inode *out){
 }
 
 int inode_write(struct filesystem *fs, inode_t inodenum){
-    if(fs->inodeTable[inodenum].isUsed==1){
+    if(__atomic_load_n(&fs->inodeTable[inodenum].isUsed, __ATOMIC_RELAXED)==1){
         fs->inodeTable[inodenum].modified_at = (ui32)time(NULL); //aggiorniamo il timestamp di modifica
-        fseek(fs->img, BLOCK_SIZE * fs->sb.inode_table_start + inodenum * sizeof(struct inode), SEEK_SET);
-        fwrite(&fs->inodeTable[inodenum], sizeof(struct inode), 1, fs->img);
-        return 0; //scrittura inode avvenuta con successo
+        meta_dirty_inode(fs, inodenum); //scritto per intero dal journal o da fs_flush (con la mappatura solo il suo checksum)
+        return 0;
     }
     return -1; //l'inode non è in uso
 }
 
-int dir_lookup(struct filesystem *fs, struct inode *dir_inode, const char* name, struct inode *result, inode_t *result_num){
+ui32 dir_name_hash(const char *name){
+    //FNV-1a a 32 bit sul nome (al massimo FNAME_LEN byte)
+    ui32 h = 2166136261u;
+    for(ui32 i = 0; i < FNAME_LEN && name[i] != '\0'; i++){
+        h ^= (ui8)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static bool dir_is_hashed(const struct inode *dir_inode){
+    return (dir_inode->flags & INODE_F_HASHDIR) != 0;
+}
+
+static inline struct dirRecord *bucket_rec(const void *block, ui32 off){
+    return (struct dirRecord *)((ui8 *)block + off);
+}
+
+static int bucket_scan(const void *block, const char *name, ui32 hash, int *prev){
+    //offset del record con quel nome nel bucket, -1 se assente: le stringhe si confrontano solo se l'hash coincide
+    //in prev l'offset del record precedente (-1 se è il primo), serve alla rimozione per fondere lo spazio
+    const struct dirBucketHeader *hdr = block;
+    size_t len = strnlen(name, FNAME_LEN);
+    if(hdr->magic != DIR_BUCKET_MAGIC || len == 0) return -1; //blocco non inizializzato o nome vuoto
+    int last = -1;
+    for(ui32 off = sizeof(struct dirBucketHeader); off < BLOCK_SIZE; ){
+        const struct dirRecord *rec = bucket_rec(block, off);
+        if(rec->rec_len < DIR_REC_LEN(0) || off + rec->rec_len > BLOCK_SIZE) return -1; //catena dei record corrotta
+        if(rec->name_len == len && rec->hash == hash && memcmp(rec->name, name, len) == 0){
+            if(prev) *prev = last;
+            return (int)off;
+        }
+        last = (int)off;
+        off += rec->rec_len;
+    }
+    return -1;
+}
+
+static uint16_t bucket_free_hint(const void *block){
+    //spazio libero contiguo più grande: quello in coda a ogni record (o il record stesso, se libero)
+    ui32 best = 0;
+    for(ui32 off = sizeof(struct dirBucketHeader); off < BLOCK_SIZE; ){
+        const struct dirRecord *rec = bucket_rec(block, off);
+        if(rec->rec_len < DIR_REC_LEN(0) || off + rec->rec_len > BLOCK_SIZE) return 0; //corrotto: nessun inserimento
+        ui32 used = rec->name_len ? DIR_REC_LEN(rec->name_len) : 0;
+        if(rec->rec_len - used > best) best = rec->rec_len - used;
+        off += rec->rec_len;
+    }
+    return (uint16_t)best;
+}
+
+static void bucket_init(void *block){
+    //bucket vuoto: un unico record libero che copre tutto il blocco
+    struct dirBucketHeader *hdr = block;
+    memset(block, 0, BLOCK_SIZE);
+    hdr->magic = DIR_BUCKET_MAGIC;
+    bucket_rec(block, sizeof(struct dirBucketHeader))->rec_len = BLOCK_SIZE - sizeof(struct dirBucketHeader);
+    hdr->freeHint = BLOCK_SIZE - sizeof(struct dirBucketHeader);
+}
+
+static int bucket_insert(void *block, const char *name, ui32 hash, inode_t inodeNum){
+    struct dirBucketHeader *hdr = block;
+    ui32 len = strnlen(name, FNAME_LEN);
+    ui32 need = DIR_REC_LEN(len);
+    if(hdr->freeHint < need) return -1; //nessuno spazio sufficiente, senza scorrere il bucket
+    for(ui32 off = sizeof(struct dirBucketHeader); off < BLOCK_SIZE; ){
+        struct dirRecord *rec = bucket_rec(block, off);
+        if(rec->rec_len < DIR_REC_LEN(0) || off + rec->rec_len > BLOCK_SIZE) break;
+        ui32 used = rec->name_len ? DIR_REC_LEN(rec->name_len) : 0;
+        if(rec->rec_len - used >= need){
+            if(used){ //lo spazio in coda al record diventa un nuovo record
+                struct dirRecord *next = bucket_rec(block, off + used);
+                next->rec_len = rec->rec_len - used;
+                rec->rec_len = used;
+                rec = next;
+            }
+            rec->hash = hash;
+            rec->inodeNum = inodeNum;
+            rec->name_len = (ui8)len;
+            memcpy(rec->name, name, len);
+            hdr->count++;
+            hdr->freeHint = bucket_free_hint(block);
+            return 0;
+        }
+        off += rec->rec_len;
+    }
+    hdr->freeHint = bucket_free_hint(block); //suggerimento non aggiornato: lo ricalcoliamo
+    return -1;
+}
+
+static void bucket_remove(void *block, ui32 off, int prev){
+    //il record rimosso viene assorbito dal precedente, così lo spazio libero resta contiguo
+    struct dirBucketHeader *hdr = block;
+    struct dirRecord *rec = bucket_rec(block, off);
+    memset(rec->name, 0, rec->name_len);
+    if(prev >= 0){
+        bucket_rec(block, (ui32)prev)->rec_len += rec->rec_len;
+        memset(rec, 0, sizeof(struct dirRecord));
+    } else { //primo record del bucket: resta come record libero
+        rec->name_len = 0;
+        rec->hash = 0;
+        rec->inodeNum = 0;
+    }
+    hdr->count--;
+    hdr->freeHint = bucket_free_hint(block);
+}
+
+bool dir_bucket_overflowed(const void *block){
+    const struct dirBucketHeader *hdr = block;
+    return hdr->magic == DIR_BUCKET_MAGIC && (hdr->flags & DIR_BUCKET_OVERFLOW) != 0;
+}
+
+int dir_scan_block(const struct inode *dir_inode, const void *block, const char *name, inode_t *inodeNum){
+    //cerca name in un blocco di directory già letto, usata anche dalla lookup asincrona
+    if(dir_is_hashed(dir_inode)){
+        int off = bucket_scan(block, name, dir_name_hash(name), NULL);
+        if(off < 0) return -1;
+        *inodeNum = bucket_rec(block, (ui32)off)->inodeNum;
+        return 0;
+    }
     int entries_per_block = BLOCK_SIZE / sizeof(struct dirEntry); //numero di entry contenute in un blocco
+    const struct dirEntry *entries = block;
+    for(ui32 j=0; j < entries_per_block; j++){ //scorriamo tutte le entries nel blocco
+        if(strncmp(entries[j].fname, name, FNAME_LEN)==0){ //compariamo il nome dell'entry con quello passato come parametro
+            *inodeNum = entries[j].inodeNum;
+            return 0;
+        }
+    }
+    return -1; //nome non presente nel blocco
+}
+
+static int hashdir_find(struct filesystem *fs, const struct inode *dir_inode, const char *name, void *buffer, ui32 *bucket, int *off, int *prev){
+    //segue la catena di sondaggio a partire dal bucket di name; a successo buffer contiene il bucket trovato
+    ui32 hash = dir_name_hash(name);
+    for(ui32 k = 0; k < INODE_DIRECT; k++){
+        ui32 b = (hash + k) % INODE_DIRECT;
+        if(dir_inode->directBlocks[b] == 0){
+            return -1; //bucket mai allocato: la catena finisce qui
+        }
+        if(fs_read_block(fs, dir_inode->directBlocks[b], buffer) != 0){
+            return -1; //errore nella lettura del bucket
+        }
+        int found = bucket_scan(buffer, name, hash, prev);
+        if(found >= 0){
+            *bucket = b;
+            *off = found;
+            return 0;
+        }
+        if(!dir_bucket_overflowed(buffer)){
+            return -1; //nessuna entry di questo hash è stata spostata oltre
+        }
+    }
+    return -1;
+}
+
+static int hashdir_add(struct filesystem *fs, inode_t dir_inode_num, const char *name, inode_t inodeNum){
+    struct inode *dir_inode = &fs->inodeTable[dir_inode_num];
+    char buffer[BLOCK_SIZE];
+    struct dirBucketHeader *hdr = (struct dirBucketHeader *)buffer;
+    ui32 hash = dir_name_hash(name);
+    if(strnlen(name, FNAME_LEN) >= FNAME_LEN){
+        return -1; //il nome non entra in name_len
+    }
+    for(ui32 k = 0; k < INODE_DIRECT; k++){
+        ui32 b = (hash + k) % INODE_DIRECT;
+        if(dir_inode->directBlocks[b] == 0){ //bucket vuoto: lo allochiamo solo ora
+            block_t newBlock = block_alloc_near(fs, dir_inode_num);
+            if(newBlock == (block_t)-1){
+                return -1; //errore nell'allocazione del blocco
+            }
+            bucket_init(buffer);
+            if(fs_write_meta(fs, newBlock, buffer) != 0){
+                free_block(fs, newBlock);
+                return -1;
+            }
+            dir_inode->directBlocks[b] = newBlock;
+            inode_write(fs, dir_inode_num); //persist the inode
+        } else if(fs_read_block(fs, dir_inode->directBlocks[b], buffer) != 0){
+            return -1; //il bucket non è leggibile
+        }
+        if(bucket_insert(buffer, name, hash, inodeNum) != 0){ //bucket pieno: l'entry andrà nel successivo
+            if(!(hdr->flags & DIR_BUCKET_OVERFLOW)){
+                hdr->flags |= DIR_BUCKET_OVERFLOW;
+                if(fs_write_meta(fs, dir_inode->directBlocks[b], buffer) != 0) return -1;
+            }
+            continue;
+        }
+        if(fs_write_meta(fs, dir_inode->directBlocks[b], buffer) != 0){
+            return -1; //errore nella scrittura del bucket
+        }
+        inode_write(fs, dir_inode_num); //aggiorna il timestamp di modifica della directory
+        return 0; //entry aggiunta con successo
+    }
+    return -1; //tutti i bucket sono pieni
+}
+
+static inode_t dir_inode_index(struct filesystem *fs, const struct inode *dir_inode){
+    //numero dell'inode se il puntatore è nella tabella, DCACHE_ANY se è una copia
+    if(dir_inode >= fs->inodeTable && dir_inode < fs->inodeTable + fs->sb.inode_count){
+        return (inode_t)(dir_inode - fs->inodeTable);
+    }
+    return DCACHE_ANY;
+}
+
+static int dir_read_child(struct filesystem *fs, const struct inode *dir_inode, inode_t found, struct inode *result){
+    //copia l'inode trovato tenendo il suo lock in lettura (dopo quello della directory, già preso dal chiamante)
+    bool lock = found != dir_inode_index(fs, dir_inode);
+    if(lock) inode_lock(fs, found, false);
+    int r = inode_read(fs, found, result);
+    if(lock) inode_unlock(fs, found);
+    return r;
+}
+
+static int do_dir_lookup(struct filesystem *fs, struct inode *dir_inode, const char* name, struct inode *result, inode_t *result_num){
     char buffer[BLOCK_SIZE]; //creiamo un buffer che conterrà il blocco letto volta per volta
-    struct dirEntry *entries = (struct dirEntry*)buffer; //eseguiamo il casting del buffer come nel metodo precedente
+    if(dir_is_hashed(dir_inode)){ //directory hash: si legge solo la catena del bucket di name
+        ui32 bucket;
+        int off, prev;
+        if(hashdir_find(fs, dir_inode, name, buffer, &bucket, &off, &prev) != 0) return -1;
+        inode_t found = bucket_rec(buffer, (ui32)off)->inodeNum;
+        if(dir_read_child(fs, dir_inode, found, result) != 0) return -1;
+        if(result_num) *result_num = found;
+        return 0;
+    }
+    fs_prefetch_blocks(fs, dir_inode->directBlocks, INODE_DIRECT); //tutti i blocchi della directory con una sola lettura vettoriale
     for (ui32 i=0; i<INODE_DIRECT; i++){ //scorriamo i blocchi diretti da leggere
         if(dir_inode->directBlocks[i]==0){
             continue; //se il blocco diretto è 0, salta al prossimo
         }
-        if(read_block(fs->img, dir_inode->directBlocks[i], buffer) != 0){ //legge il blocco diretto, se riceve -1 allora il blocco non è leggibile
+        const void *block = fs_block_view(fs, dir_inode->directBlocks[i], buffer); //in modalità mmap nessuna copia
+        if(block == NULL){ //se il blocco non è leggibile
             return -1; //errore nella lettura del blocco
         }
-        for(ui32 j=0; j < entries_per_block; j++){ //scorriamo tutte le entries nel blocco che abbiamo scritto nel nostro buffer
-            if(strncmp(entries[j].fname, name, FNAME_LEN)==0){ //compariamo il nome dell'entry con quello passato come parametro
-                if(inode_read(fs, entries[j].inodeNum, result) != 0) return -1; //leggiamo l'inode nel buffer result
-                if(result_num) *result_num = entries[j].inodeNum;
-                return 0; //file trovato con successo
-            }
+        inode_t found;
+        if(dir_scan_block(dir_inode, block, name, &found) == 0){
+            if(dir_read_child(fs, dir_inode, found, result) != 0) return -1; //leggiamo l'inode nel buffer result
+            if(result_num) *result_num = found;
+            return 0; //file trovato con successo
         }
     }
     return -1; //file non trovato
 }
 
-int dir_add_entry(struct filesystem *fs, inode_t dir_inode_num, const char *name, inode_t inodeNum){ //metodo che aggiungerà un file creato ad una directtory
+int dir_lookup(struct filesystem *fs, struct inode *dir_inode, const char* name, struct inode *result, inode_t *result_num){
+    inode_t dir_num = dir_inode_index(fs, dir_inode);
+    inode_lock(fs, dir_num, false); //in lettura: altre lookup nella stessa directory procedono insieme
+    int r = do_dir_lookup(fs, dir_inode, name, result, result_num);
+    inode_unlock(fs, dir_num);
+    return r;
+}
+
+static int do_dir_add_entry(struct filesystem *fs, inode_t dir_inode_num, const char *name, inode_t inodeNum){ //metodo che aggiungerà un file creato ad una directtory
     struct inode *dir_inode = &fs->inodeTable[dir_inode_num]; //prendiamo l'inode della directory
     char buffer[BLOCK_SIZE]; //creiamoun buffer che conterrà il blocco letto volta per volta
     struct dirEntry *entries = (struct dirEntry*)buffer; //eseguiamo il casting del buffer a struct dirEntry
     int entries_per_block = BLOCK_SIZE / sizeof(struct dirEntry); //numero di entry contenute in un blocco
+    if(name[0] == '\0'){
+        return -1; //il nome vuoto non è un nome valido
+    }
+    if(fs->dcache){
+        dcache_invalidate(fs->dcache, dir_inode_num, name, dir_name_hash(name)); //un'eventuale entry negativa non vale più
+    }
+    bool empty = true;
+    for(ui32 i=0; i<INODE_DIRECT; i++){
+        if(dir_inode->directBlocks[i]!=0) empty = false;
+    }
+    if(empty && !dir_is_hashed(dir_inode)){
+        dir_inode->flags |= INODE_F_HASHDIR; //le directory nuove nascono in formato hash, quelle lineari esistenti restano tali
+    }
+    if(dir_is_hashed(dir_inode)){
+        return hashdir_add(fs, dir_inode_num, name, inodeNum);
+    }
     for(ui32 i=0; i<INODE_DIRECT; i++){ //scorriamo i blocchi diretti della directory, in ogni bloccoscorreremo le relative entries
         if(dir_inode->directBlocks[i]!=0){ //se il blocco diretto non è 0, quindi esiste
-            if (read_block(fs->img,dir_inode->directBlocks[i], buffer)!=0) //legge il blocco diretto e se riceve -1, quindi il blocco non è leggibile, ritorna un errore
+            if (fs_read_block(fs, dir_inode->directBlocks[i], buffer)!=0) //legge il blocco diretto e se riceve -1, quindi il blocco non è leggibile, ritorna un errore
             {
                 //il contenuto del blocco, quindi le entries finiscono così in entries, il quale è un array di struct dirEntry
                 return -1; //il blocco non è leggibile
@@ -258,7 +2004,7 @@ int dir_add_entry(struct filesystem *fs, inode_t dir_inode_num, const char *name
                 if(entries[j].inodeNum==0){ //se l'inodeNum è 0, quindi l'entry è libera
                     strncpy(entries[j].fname, name, sizeof(entries[j].fname)); //copia il nome del file nella nuova entry della directory
                     entries[j].inodeNum=inodeNum; //imposta il riferimento all'inode nel file creato
-                    if(write_block(fs->img, dir_inode->directBlocks[i], buffer)!=0){ //scrive il blocco diretto
+                    if(fs_write_meta(fs, dir_inode->directBlocks[i], buffer)!=0){ //scrive il blocco diretto
                         //questo perchè il blocco aggiornato è ancora solo in locale
                         return -1; //errore nella scrittura del blocco
                     }
@@ -267,7 +2013,7 @@ int dir_add_entry(struct filesystem *fs, inode_t dir_inode_num, const char *name
                 }
             }
         } else {
-            block_t newBlock = block_alloc(fs); //allochiamo un nuovo blocco
+            block_t newBlock = block_alloc_near(fs, dir_inode_num); //allochiamo un nuovo blocco
             if(newBlock == (block_t)-1){
                 return -1; //errore nell'allocazione del blocco
             }
@@ -275,7 +2021,7 @@ int dir_add_entry(struct filesystem *fs, inode_t dir_inode_num, const char *name
             memset(buffer, 0, BLOCK_SIZE); //inizializziamo tutte le entries a 0
             strncpy(entries[0].fname, name, sizeof(entries[0].fname)); //copia il nome del file nella dirEntry
             entries[0].inodeNum = inodeNum; //impostiamo l'inodeNum nella dirEntry
-            if(write_block(fs->img, newBlock, buffer)!=0){
+            if(fs_write_meta(fs, newBlock, buffer)!=0){
                 return -1; //problema nella scrittura del blocco
             }
             inode_write(fs, dir_inode_num); //persist the inode
@@ -285,21 +2031,33 @@ int dir_add_entry(struct filesystem *fs, inode_t dir_inode_num, const char *name
     return -1; //nessuno spazio disponibile per nuove entry
 }
 
-int dir_remove_entry(struct filesystem *fs, struct inode *dir_inode, const char *name){
+static int do_dir_remove_entry(struct filesystem *fs, struct inode *dir_inode, const char *name){
     char buffer[BLOCK_SIZE]; //creiamo un buffer che conterrà il blocco letto volta per volta
     struct dirEntry *entries = (struct dirEntry*)buffer; //eseguiamo nuovamente il casting del buffer come nel metodo precedente
     int entries_per_block = BLOCK_SIZE / sizeof(struct dirEntry); //numero di entry contenute in un blocco
+    if(fs->dcache){
+        dcache_invalidate(fs->dcache, dir_inode_index(fs, dir_inode), name, dir_name_hash(name));
+    }
+    if(dir_is_hashed(dir_inode)){
+        ui32 bucket;
+        int off, prev;
+        if(hashdir_find(fs, dir_inode, name, buffer, &bucket, &off, &prev) != 0){
+            return -1; //il file non è stato trovato
+        }
+        bucket_remove(buffer, (ui32)off, prev); //il flag di overflow resta: entry successive possono dipendere da questo bucket
+        return fs_write_meta(fs, dir_inode->directBlocks[bucket], buffer);
+    }
     for(ui32 i=0; i<INODE_DIRECT; i++){ //scorriamo i blocchi diretti da leggere
         if(dir_inode->directBlocks[i]==0){
             continue; //se il blocco diretto è 0, salta al prossimo perchè non è allocato
         }
-        if(read_block(fs->img,dir_inode->directBlocks[i],buffer)!=0){ //leggiamo il blocco, se la lettura avviene correttamente restituisce zero
+        if(fs_read_block(fs, dir_inode->directBlocks[i],buffer)!=0){ //leggiamo il blocco, se la lettura avviene correttamente restituisce zero
             return -1; //errore nella lettura del blocco
         }
         for(ui32 j=0; j<entries_per_block; j++){ //leggiamo tutte le entries nel blocco
             if(strncmp(entries[j].fname, name, FNAME_LEN)==0){ //compariamo il nome
                 memset(&entries[j], 0, sizeof(struct dirEntry)); //azzera l'entry trovata in posizione i
-                if (write_block(fs->img, dir_inode->directBlocks[i], buffer)!=0){ //inserisce il blocco aggiornato al posto del precedente
+                if (fs_write_meta(fs, dir_inode->directBlocks[i], buffer)!=0){ //inserisce il blocco aggiornato al posto del precedente
                     //directBlocks[i] è il blocco della directory in cui si trova l'entry da rimuovere
                     return -1; //errore nell'aggiornamento del blocco
                 }
@@ -310,16 +2068,51 @@ int dir_remove_entry(struct filesystem *fs, struct inode *dir_inode, const char
     return -1; //il file non è stato trovato
 }
 
-int dir_list_entries(struct filesystem *fs, struct inode *dir_inode){
+int dir_add_entry(struct filesystem *fs, inode_t dir_inode_num, const char *name, inode_t inodeNum){
+    tx_begin(fs); //blocco della directory, inode della directory e bitmap nella stessa transazione
+    inode_lock(fs, dir_inode_num, true); //sempre dopo l'handle della transazione
+    int result = do_dir_add_entry(fs, dir_inode_num, name, inodeNum);
+    inode_unlock(fs, dir_inode_num);
+    tx_end(fs);
+    return result;
+}
+
+int dir_remove_entry(struct filesystem *fs, struct inode *dir_inode, const char *name){
+    inode_t dir_num = dir_inode_index(fs, dir_inode);
+    tx_begin(fs);
+    inode_lock(fs, dir_num, true);
+    int result = do_dir_remove_entry(fs, dir_inode, name);
+    inode_unlock(fs, dir_num);
+    tx_end(fs);
+    return result;
+}
+
+static int do_dir_list_entries(struct filesystem *fs, struct inode *dir_inode){
     char buffer[BLOCK_SIZE];
-    struct dirEntry *entries = (struct dirEntry*)buffer;
     int entries_per_block = BLOCK_SIZE / sizeof(struct dirEntry); //numero di entry contenute in un blocco
     printf("elenco dei file nella directory: \n");
+    fs_prefetch_blocks(fs, dir_inode->directBlocks, INODE_DIRECT);
     for( ui32 i=0; i<INODE_DIRECT; i++){
         if(dir_inode->directBlocks[i]==0){
             continue; //se il blocco diretto è 0, salta al prossimo perchè non è allocato
         }
-        if(read_block(fs->img, dir_inode->directBlocks[i], buffer)!=0){
+        if(dir_is_hashed(dir_inode)){ //bucket: le entry seguono l'header
+            const struct dirBucketHeader *hdr = fs_block_view(fs, dir_inode->directBlocks[i], buffer);
+            if(hdr == NULL){
+                return -1;
+            }
+            for(ui32 off = sizeof(struct dirBucketHeader); off < BLOCK_SIZE; ){
+                const struct dirRecord *rec = bucket_rec(hdr, off);
+                if(rec->rec_len < DIR_REC_LEN(0) || off + rec->rec_len > BLOCK_SIZE) break; //catena corrotta
+                if(rec->name_len != 0){
+                    printf("File: %.*s, Inode; %u\n", rec->name_len, rec->name, rec->inodeNum);
+                }
+                off += rec->rec_len;
+            }
+            continue;
+        }
+        const struct dirEntry *entries = fs_block_view(fs, dir_inode->directBlocks[i], buffer);
+        if(entries == NULL){
             return -1; //blocco letto non correttamente
         }
         for(ui32 j=0; j<entries_per_block; j++){
@@ -331,38 +2124,66 @@ int dir_list_entries(struct filesystem *fs, struct inode *dir_inode){
     return 0; //operazione completata
 }
 
+int dir_list_entries(struct filesystem *fs, struct inode *dir_inode){
+    inode_t dir_num = dir_inode_index(fs, dir_inode);
+    inode_lock(fs, dir_num, false);
+    int result = do_dir_list_entries(fs, dir_inode);
+    inode_unlock(fs, dir_num);
+    return result;
+}
+
 int fs_create_file(struct filesystem *fs, inode_t dir_inode_num, const char *name, uint32_t type){
-    inode_t new_inode = inode_alloc(fs); //allochiamo il nostro inode
+    tx_begin(fs); //inode nuovo ed entry della directory: o entrambi o nessuno dopo un crash
+    //allochiamo il nostro inode: un file accanto alla sua directory, una directory in un gruppo poco usato
+    inode_t new_inode = inode_alloc_from(fs, (type & FS_CREATE_DIR) ? inode_group_for_dir(fs) : dir_inode_num / fs->sb.group_inodes);
     if (new_inode==(inode_t)-1) //error handling
     {
+        tx_end(fs);
         return -1; //errore nell'allocazione dell'inode
     }
+    if(!(type & FS_CREATE_DIR) && (type & FS_CREATE_BLOCKMAP)){
+        fs->inodeTable[new_inode].flags |= INODE_F_BLOCKMAP; //la prima scrittura non lo rende inline o a extent
+        inode_write(fs, new_inode);
+    }
     if(dir_add_entry(fs, dir_inode_num, name, new_inode)!=0){ //tentiamo di aggiungere l'entry nella directory
+        tx_end(fs);
         return -1; //errore nell'aggiunta del file nella directory
     }
+    tx_end(fs);
     return 0; //come vediamo l'agguna nel file consiste nella creazione di un inode e nell'aggiunta del riferimento ad esso nella directory
 }
 
-int fs_delete_file(struct filesystem *fs, struct inode *dir, const char *name){
+static int do_delete_file(struct filesystem *fs, struct inode *dir, const char *name, inode_t inode_num){
     struct inode file_inode; //dichiariamo un inode che conterrà l'inode del file da eliminare
-    inode_t inode_num = 0;
-    if(dir_lookup(fs, dir, name, &file_inode, &inode_num) != 0){ //controlliamo se il file esiste nella directory
-        printf("File %s non trovato nella directory.\n", name);
-        return -1; //file non trovato
-    }
-    for(ui32 i = 0; i < INODE_DIRECT; i++){ //liberiamo tutti i blocchi diretti associati al file
-        if(file_inode.directBlocks[i] != 0){ //eliminiamo i blocchi dell'inode
-            if(free_block(fs, file_inode.directBlocks[i]) != 0){
-                printf("Errore nella liberazione del blocco %u.\n", file_inode.directBlocks[i]);
-                return -1; //errore nella liberazione del blocco
-            }
+    if(inode_read(fs, inode_num, &file_inode) != 0){
+        return -1; //l'inode non è più in uso
+    }
+    //può avere nomi nel cache solo una directory: hash, o lineare (a puntatori con almeno un blocco, come un file a puntatori)
+    bool maybeDir = (file_inode.flags & INODE_F_HASHDIR) ||
+                    (!(file_inode.flags & (INODE_F_INLINE | INODE_F_EXTENTS)) && file_inode.directBlocks[0] != 0);
+    if(file_inode.flags & INODE_F_INLINE){
+        memset(file_inode.inlineData, 0, INODE_INLINE_SIZE); //dati nell'inode: nessun blocco da liberare
+    }
+    if(file_inode.flags & INODE_F_EXTENTS){ //file a extent: un free_block_range per tratto
+        if(extent_free_all(fs, &file_inode) != 0){
+            printf("Errore nella liberazione degli extent dell'inode %u.\n", inode_num);
+            return -1;
         }
+        memset(&file_inode.extents, 0, sizeof(file_inode.extents)); //nessun puntatore da liberare qui sotto
+    }
+    if(!(file_inode.flags & (INODE_F_INLINE | INODE_F_EXTENTS)) && bmap_truncate(fs, inode_num, 0) != 0){
+        //blocchi diretti (o bucket di directory), poi l'albero dei puntatori indiretti a tratti contigui
+        printf("Errore nella liberazione dei blocchi dell'inode %u.\n", inode_num);
+        return -1;
+    }
+    if(fs->dcache && maybeDir){
+        dcache_invalidate_dir(fs->dcache, inode_num); //i nomi della directory eliminata non valgono più
     }
     if(free_inode(fs, inode_num) != 0){ //liberiamo l'inode del file
         printf("Errore nella liberazione dell'inode %u.\n", inode_num);
         return -1;
     }
-    if(dir_remove_entry(fs, dir, name) != 0){ //rimuoviamo la dirEntry dalla directory
+    if(do_dir_remove_entry(fs, dir, name) != 0){ //rimuoviamo la dirEntry dalla directory
         printf("Errore nella rimozione dell'entry %s dalla directory.\n", name);
         return -1;
     }
@@ -370,41 +2191,862 @@ int fs_delete_file(struct filesystem *fs, struct inode *dir, const char *name){
     return 0;
 }
 
+int fs_delete_file(struct filesystem *fs, struct inode *dir, const char *name){
+    //blocchi liberati, inode e entry della directory in una sola transazione; un file grande viene prima accorciato
+    //in transazioni separate (dopo un crash resta più corto), cercando ogni volta di nuovo il nome
+    inode_t dir_num = dir_inode_index(fs, dir);
+    int result;
+    do {
+        tx_begin(fs);
+        inode_lock(fs, dir_num, true); //prima la directory, poi il file
+        struct inode file_inode;
+        inode_t inode_num = 0;
+        result = -1;
+        if(do_dir_lookup(fs, dir, name, &file_inode, &inode_num) != 0){ //controlliamo se il file esiste nella directory
+            printf("File %s non trovato nella directory.\n", name);
+        } else {
+            bool lock = inode_num != dir_num;
+            if(lock) inode_lock(fs, inode_num, true); //nessuna lettura o scrittura del file è in corso mentre lo si elimina
+            ui32 keep = (ui32)FS_TX_CHUNK * BLOCK_SIZE; //l'ultimo tratto lo libera l'eliminazione stessa
+            result = 0;
+            if(lock && !(file_inode.flags & (INODE_F_HASHDIR | INODE_F_INLINE)) && file_inode.size > keep){
+                result = truncate_steps(fs, inode_num, keep);
+            }
+            if(result == 0) result = do_delete_file(fs, dir, name, inode_num);
+            if(lock) inode_unlock(fs, inode_num);
+        }
+        inode_unlock(fs, dir_num);
+        tx_end(fs);
+    } while(result == 1);
+    return result;
+}
+
+/* ---------------- dati dei file ---------------- */
+
+static int wbuf_find(struct filesystem *fs, block_t block_num){
+    if(!fs->wbuf) return -1;
+    for(ui32 i = 0; i < FS_WBUF_SLOTS; i++){
+        if(fs->wbuf->block[i] == block_num) return (int)i;
+    }
+    return -1;
+}
+
+static inline ui8 *wbuf_data(struct filesystem *fs, int slot){
+    return fs->wbuf->data + (size_t)slot * BLOCK_SIZE;
+}
+
+static int wbuf_flush_slot(struct filesystem *fs, int slot){
+    if(fs->wbuf->block[slot] == 0) return 0;
+    if(fs_write_block(fs, fs->wbuf->block[slot], wbuf_data(fs, slot)) != 0){
+        return -1; //lo slot resta occupato: riproveremo al prossimo flush
+    }
+    fs->wbuf->block[slot] = 0;
+    return 0;
+}
+
+static int wbuf_flush(struct filesystem *fs){
+    int result = 0;
+    for(int i = 0; fs->wbuf && i < FS_WBUF_SLOTS; i++){
+        if(wbuf_flush_slot(fs, i) != 0) result = -1;
+    }
+    return result;
+}
+
+static void wbuf_drop(struct filesystem *fs, block_t start, ui32 count){
+    for(ui32 i = 0; fs->wbuf && i < FS_WBUF_SLOTS; i++){
+        if(fs->wbuf->block[i] >= start && fs->wbuf->block[i] - start < count) fs->wbuf->block[i] = 0;
+    }
+}
+
+int fs_ordered_flush(struct filesystem *fs, const block_t *blocks, ui32 n){
+    //blocchi di dati allocati da una transazione che si sta chiudendo: dall'area di raccolta e dal buffer cache alla
+    //loro posizione, così il commit non rende raggiungibile il contenuto precedente del blocco
+    int result = 0;
+    for(ui32 i = 0; i < n; i++){
+        int slot = wbuf_find(fs, blocks[i]);
+        if(slot >= 0 && wbuf_flush_slot(fs, slot) != 0) result = -1;
+        if(fs->cache && bcache_writeback(fs->cache, blocks[i]) != 0) result = -1;
+    }
+    return result;
+}
+
+static int wbuf_get(struct filesystem *fs, block_t block_num, bool fresh){
+    //slot che raccoglie le scritture parziali di block_num, caricandolo se non c'è già
+    int slot = wbuf_find(fs, block_num);
+    if(slot >= 0) return slot;
+    slot = -1;
+    for(int i = 0; i < FS_WBUF_SLOTS && slot < 0; i++){
+        if(fs->wbuf->block[i] == 0) slot = i;
+    }
+    if(slot < 0){ //tutti occupati: si svuota il più vecchio
+        slot = (int)fs->wbuf->hand;
+        fs->wbuf->hand = (fs->wbuf->hand + 1) % FS_WBUF_SLOTS;
+        if(wbuf_flush_slot(fs, slot) != 0) return -1;
+    }
+    if(fresh){
+        memset(wbuf_data(fs, slot), 0, BLOCK_SIZE); //blocco appena allocato: il contenuto precedente non conta
+    } else if(fs_read_block(fs, block_num, wbuf_data(fs, slot)) != 0){
+        return -1;
+    }
+    fs->wbuf->block[slot] = block_num;
+    return slot;
+}
+
+static int extent_search(const struct extent *e, ui32 count, ui32 lbn){
+    //ricerca binaria: indice dell'ultimo extent con lstart <= lbn, -1 se lbn precede il primo
+    int lo = 0, hi = (int)count - 1, res = -1;
+    while(lo <= hi){
+        int mid = (lo + hi) / 2;
+        if(e[mid].lstart <= lbn){
+            res = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return res;
+}
+
+static int extent_find(struct filesystem *fs, const struct inode *in, ui32 lbn, struct extent *found, ui32 *next){
+    //0 se lbn è mappato (found è il suo extent), 1 se è un buco (next è il primo blocco mappato dopo), -1 errore
+    const struct extentRoot *root = &in->extents;
+    const struct extent *e = root->e;
+    ui32 count = root->count;
+    ui32 bound = UINT32_MAX;
+    ui32 leafbuf[BLOCK_SIZE / sizeof(ui32)]; //allineato a 4 come gli extent
+    if(root->depth == 1){ //radice di indice: una sola foglia da leggere
+        int i = extent_search(root->e, root->count, lbn);
+        if(i < 0) i = 0;
+        if((ui32)i + 1 < root->count) bound = root->e[i + 1].lstart;
+        if(fs_read_block(fs, root->e[i].pstart, leafbuf) != 0) return -1;
+        const struct extentLeaf *leaf = (const struct extentLeaf *)leafbuf;
+        if(leaf->magic != EXTENT_LEAF_MAGIC || leaf->count > EXTENT_PER_LEAF) return -1; //foglia corrotta
+        e = leaf->e;
+        count = leaf->count;
+    }
+    int k = extent_search(e, count, lbn);
+    if(k >= 0 && lbn - e[k].lstart < e[k].len){
+        *found = e[k];
+        return 0;
+    }
+    *next = (ui32)(k + 1) < count ? e[k + 1].lstart : bound;
+    return 1;
+}
+
+static int extent_put(struct extent *e, ui32 *count, ui32 cap, struct extent x){
+    //inserisce x mantenendo l'ordine e fondendolo con i vicini contigui sia logicamente sia fisicamente
+    int k = extent_search(e, *count, x.lstart);
+    if(k >= 0 && e[k].lstart + e[k].len == x.lstart && e[k].pstart + e[k].len == x.pstart){
+        e[k].len += x.len;
+        if((ui32)k + 1 < *count && e[k].lstart + e[k].len == e[k + 1].lstart && e[k].pstart + e[k].len == e[k + 1].pstart){
+            e[k].len += e[k + 1].len; //x ha chiuso il buco tra due extent
+            memmove(&e[k + 1], &e[k + 2], (*count - k - 2) * sizeof(struct extent));
+            (*count)--;
+        }
+        return 0;
+    }
+    if((ui32)k + 1 < *count && x.lstart + x.len == e[k + 1].lstart && x.pstart + x.len == e[k + 1].pstart){
+        e[k + 1].lstart = x.lstart;
+        e[k + 1].pstart = x.pstart;
+        e[k + 1].len += x.len;
+        return 0;
+    }
+    if(*count >= cap) return -1; //nessuno spazio
+    memmove(&e[k + 2], &e[k + 1], (*count - k - 1) * sizeof(struct extent));
+    e[k + 1] = x;
+    (*count)++;
+    return 0;
+}
+
+static int extent_add(struct filesystem *fs, inode_t ino, struct extent x){
+    struct inode *in = &fs->inodeTable[ino];
+    struct extentRoot *root = &in->extents;
+    ui32 leafbuf[BLOCK_SIZE / sizeof(ui32)];
+    struct extentLeaf *leaf = (struct extentLeaf *)leafbuf;
+    if(root->depth == 0){
+        ui32 count = root->count;
+        if(extent_put(root->e, &count, EXTENT_INLINE, x) == 0){
+            root->count = (uint16_t)count;
+            return 0;
+        }
+        //radice piena: gli extent passano in un blocco foglia e la radice diventa un indice
+        block_t leafBlk = block_alloc_near(fs, ino);
+        if(leafBlk == (block_t)-1) return -1;
+        memset(leafbuf, 0, BLOCK_SIZE);
+        leaf->magic = EXTENT_LEAF_MAGIC;
+        leaf->count = root->count;
+        memcpy(leaf->e, root->e, root->count * sizeof(struct extent));
+        if(fs_write_meta(fs, leafBlk, leafbuf) != 0){
+            free_block(fs, leafBlk);
+            return -1;
+        }
+        memset(root->e, 0, sizeof(root->e));
+        root->depth = 1;
+        root->count = 1;
+        root->e[0].lstart = 0; //la prima foglia copre tutto ciò che precede la seconda
+        root->e[0].pstart = leafBlk;
+    }
+    int i = extent_search(root->e, root->count, x.lstart);
+    if(i < 0) i = 0;
+    if(fs_read_block(fs, root->e[i].pstart, leafbuf) != 0 || leaf->magic != EXTENT_LEAF_MAGIC) return -1;
+    if(extent_put(leaf->e, &leaf->count, EXTENT_PER_LEAF, x) == 0){
+        return fs_write_meta(fs, root->e[i].pstart, leafbuf);
+    }
+    //foglia piena: metà degli extent vanno in una foglia nuova, indicizzata subito dopo
+    if(root->count >= EXTENT_INLINE) return -1; //file troppo frammentato
+    block_t newBlk = block_alloc_near(fs, ino);
+    if(newBlk == (block_t)-1) return -1;
+    ui32 newbuf[BLOCK_SIZE / sizeof(ui32)];
+    struct extentLeaf *right = (struct extentLeaf *)newbuf;
+    memset(newbuf, 0, BLOCK_SIZE);
+    right->magic = EXTENT_LEAF_MAGIC;
+    right->count = leaf->count / 2;
+    leaf->count -= right->count;
+    memcpy(right->e, &leaf->e[leaf->count], right->count * sizeof(struct extent));
+    memset(&leaf->e[leaf->count], 0, right->count * sizeof(struct extent));
+    if(x.lstart >= right->e[0].lstart) extent_put(right->e, &right->count, EXTENT_PER_LEAF, x);
+    else extent_put(leaf->e, &leaf->count, EXTENT_PER_LEAF, x);
+    if(fs_write_meta(fs, newBlk, newbuf) != 0 || fs_write_meta(fs, root->e[i].pstart, leafbuf) != 0){
+        return -1;
+    }
+    memmove(&root->e[i + 2], &root->e[i + 1], (root->count - i - 1) * sizeof(struct extent));
+    root->e[i + 1].lstart = right->e[0].lstart;
+    root->e[i + 1].pstart = newBlk;
+    root->e[i + 1].len = 0;
+    root->count++;
+    return 0;
+}
+
+static int extent_map(struct filesystem *fs, inode_t ino, ui32 first, ui32 n, block_t *out, bool *fresh, bool alloc){
+    //come file_map per gli inode a extent: ogni extent trovato copre più blocchi in una volta
+    //e un buco da riempire viene allocato come un unico tratto contiguo, quindi un unico extent
+    struct inode *in = &fs->inodeTable[ino];
+    ui32 i = 0;
+    while(i < n){
+        ui32 lbn = first + i;
+        struct extent ext;
+        ui32 next;
+        int r = extent_find(fs, in, lbn, &ext, &next);
+        if(r < 0) return -1;
+        if(r == 0){
+            ui32 k = ext.lstart + ext.len - lbn;
+            if(k > n - i) k = n - i;
+            for(ui32 j = 0; j < k; j++){
+                out[i + j] = ext.pstart + (lbn - ext.lstart) + j;
+                if(fresh) fresh[i + j] = false;
+            }
+            i += k;
+            continue;
+        }
+        ui32 k = next - lbn; //lunghezza del buco
+        if(k > n - i) k = n - i;
+        if(!alloc){
+            memset(out + i, 0, k * sizeof(block_t));
+            i += k;
+            continue;
+        }
+        block_t start;
+        ui32 got;
+        if(block_alloc_range_from(fs, alloc_cursor(fs, ino), k, 1, &start, &got) != 0) return -1; //spazio esaurito
+        struct extent x = { lbn, start, got };
+        if(extent_add(fs, ino, x) != 0){
+            free_block_range(fs, start, got);
+            return -1;
+        }
+        for(ui32 j = 0; j < got; j++){
+            out[i + j] = start + j;
+            if(fresh) fresh[i + j] = true;
+        }
+        i += got;
+    }
+    return 0;
+}
+
+static int extent_free_all(struct filesystem *fs, struct inode *in){
+    //libera tutti i tratti e le foglie dell'albero
+    struct extentRoot *root = &in->extents;
+    int result = 0;
+    if(root->depth == 0){
+        for(ui32 i = 0; i < root->count; i++){
+            if(free_block_range(fs, root->e[i].pstart, root->e[i].len) != 0) result = -1;
+        }
+        return result;
+    }
+    ui32 leafbuf[BLOCK_SIZE / sizeof(ui32)];
+    const struct extentLeaf *leaf = (const struct extentLeaf *)leafbuf;
+    for(ui32 i = 0; i < root->count; i++){
+        if(fs_read_block(fs, root->e[i].pstart, leafbuf) != 0 || leaf->magic != EXTENT_LEAF_MAGIC){
+            result = -1;
+            continue;
+        }
+        for(ui32 j = 0; j < leaf->count; j++){
+            if(free_block_range(fs, leaf->e[j].pstart, leaf->e[j].len) != 0) result = -1;
+        }
+        if(free_block(fs, root->e[i].pstart) != 0) result = -1;
+    }
+    return result;
+}
+
+static inline ui32 *bmap_root(struct inode *in, ui32 h){
+    //puntatore dell'inode al nodo più alto del livello di indirezione h + 1
+    return h == 0 ? &in->indirectBlock : h == 1 ? &in->doubleIndirect : &in->tripleIndirect;
+}
+
+static void bmap_forget(struct filesystem *fs, inode_t ino){
+    //i nodi in cache non appartengono più a ino (albero liberato o inode riassegnato)
+    if(fs->bmap && fs->bmap[ino % FS_BMAP_SLOTS].ino == ino){
+        fs->bmap[ino % FS_BMAP_SLOTS].ino = (inode_t)-1;
+    }
+}
+
+static int bmap_flush(struct filesystem *fs, struct fs_bmap_cache *c){
+    //scrive i nodi modificati: alla fine di ogni file_map il cache non contiene nulla che manchi sul disco o nel journal
+    int result = 0;
+    for(ui32 h = 0; h < FS_BMAP_LEVELS; h++){
+        if(c->dirty[h] && fs_write_meta(fs, c->node[h], c->ptrs[h]) != 0) result = -1;
+        c->dirty[h] = false;
+    }
+    return result;
+}
+
+static int bmap_load(struct filesystem *fs, struct fs_bmap_cache *c, ui32 h, block_t blk, bool fresh){
+    //porta nel cache il nodo blk di altezza h; un nodo appena allocato parte vuoto senza essere letto
+    if(c->node[h] == blk && !fresh) return 0;
+    if(c->dirty[h] && fs_write_meta(fs, c->node[h], c->ptrs[h]) != 0) return -1;
+    c->dirty[h] = fresh;
+    c->node[h] = 0;
+    if(fresh){
+        memset(c->ptrs[h], 0, sizeof(c->ptrs[h]));
+    } else if(fs_read_block(fs, blk, c->ptrs[h]) != 0){
+        return -1;
+    }
+    c->node[h] = blk;
+    return 0;
+}
+
+static int bmap_lookup(struct filesystem *fs, struct fs_bmap_cache *c, inode_t ino, ui32 lbn, bool alloc, block_t *out, bool *fresh){
+    //un blocco logico di un file a puntatori: scende dal puntatore dell'inode fino al nodo che punta ai dati.
+    //Ogni altezza tiene in cache l'ultimo nodo visto, quindi un accesso sequenziale non rilegge nulla per
+    //PTRS_PER_BLOCK blocchi e uno casuale legge al più il nodo più basso (e quelli sopra, se cambiano)
+    struct inode *in = &fs->inodeTable[ino];
+    ui32 *slot;
+    int slotH = -1; //altezza del nodo che contiene slot, -1 se è nell'inode
+    *fresh = false;
+    if(lbn < INODE_DIRECT){
+        slot = &in->directBlocks[lbn];
+    } else {
+        ui64 rel = lbn - INODE_DIRECT, span = PTRS_PER_BLOCK;
+        ui32 levels = 1;
+        while(rel >= span){
+            rel -= span;
+            span *= PTRS_PER_BLOCK;
+            if(++levels > (fs->legacyInodes ? 1 : FS_BMAP_LEVELS)){ //il formato originale ha solo l'indiretto singolo
+                *out = 0;
+                return alloc ? -1 : 0; //oltre la dimensione massima di un file
+            }
+        }
+        slot = bmap_root(in, levels - 1);
+        for(int h = (int)levels - 1; h >= 0; h--){
+            span /= PTRS_PER_BLOCK; //blocchi coperti da ogni puntatore del nodo di altezza h
+            bool isNew = false;
+            if(*slot == 0){
+                if(!alloc){
+                    *out = 0;
+                    return 0; //buco
+                }
+                block_t b = block_alloc_near(fs, ino);
+                if(b == (block_t)-1) return -1;
+                *slot = b;
+                if(slotH >= 0) c->dirty[slotH] = true;
+                isNew = true;
+            }
+            if(bmap_load(fs, c, (ui32)h, *slot, isNew) != 0) return -1;
+            slot = &c->ptrs[h][rel / span];
+            slotH = h;
+            rel %= span;
+        }
+    }
+    if(*slot == 0 && alloc){
+        block_t b = block_alloc_near(fs, ino); //il cursore next-fit del gruppo rende contigui i blocchi di una stessa scrittura
+        if(b == (block_t)-1) return -1; //spazio esaurito
+        *slot = b;
+        if(slotH >= 0) c->dirty[slotH] = true;
+        *fresh = true;
+    }
+    *out = *slot;
+    return 0;
+}
+
+static int file_map(struct filesystem *fs, inode_t ino, ui32 first, ui32 n, block_t *out, bool *fresh, bool alloc){
+    //traduce i blocchi logici [first, first + n) in blocchi fisici (0 per i buchi); con alloc li crea.
+    //Con un solo thread i nodi di puntatori restano nello slot dell'inode tra una chiamata e l'altra;
+    //in modalità thread-safe lo slot è locale alla chiamata
+    struct inode *in = &fs->inodeTable[ino];
+    if(in->flags & INODE_F_EXTENTS){
+        return extent_map(fs, ino, first, n, out, fresh, alloc);
+    }
+    struct fs_bmap_cache *c = fs->bmap ? &fs->bmap[ino % FS_BMAP_SLOTS] : malloc(sizeof(struct fs_bmap_cache));
+    if(!c) return -1;
+    if(!fs->bmap || c->ino != ino){ //slot di un altro file (già scritto): si riparte da vuoto
+        memset(c->node, 0, sizeof(c->node));
+        memset(c->dirty, 0, sizeof(c->dirty));
+        c->ino = ino;
+    }
+    int result = 0;
+    for(ui32 i = 0; i < n && result == 0; i++){
+        bool isNew;
+        result = bmap_lookup(fs, c, ino, first + i, alloc, &out[i], &isNew);
+        if(fresh) fresh[i] = isNew;
+    }
+    if(bmap_flush(fs, c) != 0) result = -1;
+    if(result != 0 && fs->bmap) c->ino = (inode_t)-1; //stato incerto dopo un errore
+    if(!fs->bmap) free(c);
+    return result;
+}
+
+struct free_run {
+    block_t start; //tratto contiguo di blocchi da liberare con un solo free_block_range
+    ui32 len;
+};
+
+static int run_add(struct filesystem *fs, struct free_run *r, block_t b){
+    if(b == 0) return 0;
+    if(r->len && r->start + r->len == b){
+        r->len++;
+        return 0;
+    }
+    int result = r->len && free_block_range(fs, r->start, r->len) != 0 ? -1 : 0;
+    r->start = b;
+    r->len = 1;
+    return result;
+}
+
+static int bmap_trim(struct filesystem *fs, struct free_run *r, ui32 *slot, ui32 h, ui64 from, bool *parentDirty){
+    //libera nel sottoalbero di altezza h puntato da *slot i blocchi a partire dalla posizione relativa from;
+    //con from == 0 se ne va anche il nodo e *slot si azzera, altrimenti il nodo accorciato viene riscritto
+    if(*slot == 0) return 0;
+    ui32 ptrs[PTRS_PER_BLOCK];
+    if(fs_read_block(fs, *slot, ptrs) != 0) return -1;
+    ui64 per = 1; //blocchi coperti da ogni puntatore del nodo
+    for(ui32 k = 0; k < h; k++) per *= PTRS_PER_BLOCK;
+    int result = 0;
+    bool dirty = false;
+    for(ui32 i = (ui32)(from / per); i < PTRS_PER_BLOCK; i++){
+        if(ptrs[i] == 0) continue;
+        ui64 sub = (ui64)i * per < from ? from - (ui64)i * per : 0;
+        if(h == 0){
+            if(run_add(fs, r, ptrs[i]) != 0) result = -1;
+            ptrs[i] = 0;
+            dirty = true;
+        } else if(bmap_trim(fs, r, &ptrs[i], h - 1, sub, &dirty) != 0){
+            result = -1;
+        }
+    }
+    if(from == 0){
+        if(run_add(fs, r, *slot) != 0) result = -1;
+        *slot = 0;
+        *parentDirty = true;
+    } else if(dirty && fs_write_meta(fs, *slot, ptrs) != 0){
+        result = -1;
+    }
+    return result;
+}
+
+static int bmap_truncate(struct filesystem *fs, inode_t ino, ui32 keep){
+    //libera i blocchi logici da keep in poi di un file a puntatori, nodi di indirezione compresi: i blocchi
+    //fisicamente contigui (dati e nodi allocati in sequenza) si liberano con un solo free_block_range
+    struct inode *in = &fs->inodeTable[ino];
+    struct free_run r = { 0, 0 };
+    int result = 0;
+    bool dirty = false;
+    for(ui32 i = keep; i < INODE_DIRECT; i++){
+        if(run_add(fs, &r, in->directBlocks[i]) != 0) result = -1;
+        in->directBlocks[i] = 0;
+    }
+    ui64 base = INODE_DIRECT, span = PTRS_PER_BLOCK;
+    for(ui32 h = 0; h < FS_BMAP_LEVELS; h++){
+        ui64 from = keep > base ? keep - base : 0;
+        if(from < span && bmap_trim(fs, &r, bmap_root(in, h), h, from, &dirty) != 0) result = -1;
+        base += span;
+        span *= PTRS_PER_BLOCK;
+    }
+    if(r.len && free_block_range(fs, r.start, r.len) != 0) result = -1;
+    bmap_forget(fs, ino);
+    return result;
+}
+
+static int extent_trim(struct filesystem *fs, struct extent *e, ui32 *count, ui32 keep){
+    //accorcia una lista ordinata di extent ai blocchi logici prima di keep
+    int result = 0;
+    ui32 n = *count;
+    while(n > 0 && e[n - 1].lstart + e[n - 1].len > keep){
+        struct extent *x = &e[n - 1];
+        ui32 kept = x->lstart < keep ? keep - x->lstart : 0;
+        if(free_block_range(fs, x->pstart + kept, x->len - kept) != 0) result = -1;
+        x->len = kept;
+        if(kept > 0) break;
+        memset(x, 0, sizeof(*x));
+        n--;
+    }
+    *count = n;
+    return result;
+}
+
+static int extent_truncate(struct filesystem *fs, inode_t ino, ui32 keep){
+    //come bmap_truncate per i file a extent: tratti accorciati o liberati per intero, foglie vuote liberate
+    struct extentRoot *root = &fs->inodeTable[ino].extents;
+    int result = 0;
+    ui32 count = root->count;
+    if(root->depth == 0){
+        result = extent_trim(fs, root->e, &count, keep);
+        root->count = (uint16_t)count;
+        return result;
+    }
+    ui32 leafbuf[BLOCK_SIZE / sizeof(ui32)];
+    struct extentLeaf *leaf = (struct extentLeaf *)leafbuf;
+    while(root->count > 0){
+        struct extent *idx = &root->e[root->count - 1];
+        if(fs_read_block(fs, idx->pstart, leafbuf) != 0 || leaf->magic != EXTENT_LEAF_MAGIC) return -1;
+        if(extent_trim(fs, leaf->e, &leaf->count, keep) != 0) result = -1;
+        if(leaf->count > 0){ //la foglia resta: quelle prima non contengono blocchi oltre keep
+            if(fs_write_meta(fs, idx->pstart, leafbuf) != 0) result = -1;
+            break;
+        }
+        if(free_block(fs, idx->pstart) != 0) result = -1;
+        memset(idx, 0, sizeof(*idx));
+        root->count--;
+    }
+    if(root->count == 0) root->depth = 0; //nessuna foglia: la radice torna a contenere gli extent
+    return result;
+}
+
+static ui32 readahead_window(struct filesystem *fs, inode_t ino, ui32 first, ui32 last){
+    //una lettura che riparte dal blocco dove è finita la precedente (o dal suo ultimo, se parziale) è sequenziale
+    struct fs_readahead *ra = &fs->readahead[ino % FS_READAHEAD_SLOTS];
+    if(ra->ino == ino && (first == ra->nextBlock || first + 1 == ra->nextBlock)){
+        ra->window = ra->window ? ra->window * 2 : 4;
+        if(ra->window > FS_READAHEAD_MAX) ra->window = FS_READAHEAD_MAX;
+    } else {
+        ra->ino = ino;
+        ra->window = 0; //accesso casuale: niente readahead
+    }
+    ra->nextBlock = last + 1;
+    return ra->window;
+}
+
+static ssize_t do_pwrite(struct filesystem *fs, inode_t ino, const void *buf, size_t len, off_t off);
+
+static int inline_to_blocks(struct filesystem *fs, inode_t ino){
+    //il file supera lo spazio inline: i dati passano in un blocco e l'inode diventa a extent
+    struct inode *in = &fs->inodeTable[ino];
+    ui8 data[INODE_INLINE_SIZE];
+    ui32 size = in->size;
+    memcpy(data, in->inlineData, INODE_INLINE_SIZE);
+    memset(in->inlineData, 0, INODE_INLINE_SIZE);
+    in->flags = (in->flags & ~INODE_F_INLINE) | INODE_F_EXTENTS;
+    in->size = 0;
+    if(size > 0 && do_pwrite(fs, ino, data, size, 0) != (ssize_t)size){
+        extent_free_all(fs, in); //ripristina lo stato inline
+        memcpy(in->inlineData, data, INODE_INLINE_SIZE);
+        in->flags = (in->flags & ~INODE_F_EXTENTS) | INODE_F_INLINE;
+        in->size = size;
+        return -1;
+    }
+    return 0;
+}
+
+static ssize_t do_pread(struct filesystem *fs, inode_t ino, void *buf, size_t len, off_t off){
+    if(ino >= fs->sb.inode_count || fs->inodeTable[ino].isUsed != 1 || off < 0) return -1;
+    ui32 size = fs->inodeTable[ino].size;
+    if((ui64)off >= size || len == 0) return 0; //oltre la fine del file
+    if(len > size - (ui64)off) len = size - (size_t)off;
+    if(fs->inodeTable[ino].flags & INODE_F_INLINE){
+        memcpy(buf, fs->inodeTable[ino].inlineData + off, len); //la tabella degli inode è già in memoria
+        return (ssize_t)len;
+    }
+    ui32 first = (ui32)(off / BLOCK_SIZE);
+    ui32 last = (ui32)((off + len - 1) / BLOCK_SIZE);
+    ui32 n = last - first + 1;
+    ui32 window = fs->threadSafe ? 0 : readahead_window(fs, ino, first, last); //lo stato del readahead non è protetto
+    ui32 fileBlocks = (ui32)(((ui64)size + BLOCK_SIZE - 1) / BLOCK_SIZE); //size può arrivare a UINT32_MAX
+    if(last + 1 + window > fileBlocks) window = fileBlocks - (last + 1); //niente readahead oltre la fine
+    block_t *map = malloc((n + window) * sizeof(block_t));
+    block_t *rblocks = calloc(n, sizeof(block_t)); //azzerati: ne vengono riempiti solo nr
+    void **rbufs = calloc(n, sizeof(void *));
+    ui8 *bounce = aligned_alloc(BLOCK_SIZE, 2 * BLOCK_SIZE); //solo il primo e l'ultimo blocco possono essere parziali
+    ssize_t result = -1;
+    if(!map || !rblocks || !rbufs || !bounce || file_map(fs, ino, first, n + window, map, NULL, false) != 0){
+        goto out;
+    }
+    //blocchi interi: letti direttamente nel buffer del chiamante con una sola richiesta vettoriale
+    ui32 nr = 0;
+    for(ui32 i = 0; i < n; i++){
+        size_t blockOff = i == 0 ? (size_t)(off % BLOCK_SIZE) : 0;
+        size_t dest = i == 0 ? 0 : (size_t)i * BLOCK_SIZE - (size_t)(off % BLOCK_SIZE);
+        bool full = blockOff == 0 && dest + BLOCK_SIZE <= len;
+        if(map[i] == 0 || wbuf_find(fs, map[i]) >= 0) continue; //buco o blocco in raccolta: copiati dopo
+        rblocks[nr] = map[i];
+        rbufs[nr] = full ? (ui8 *)buf + dest : bounce + (i == 0 ? 0 : BLOCK_SIZE);
+        nr++;
+    }
+    if(read_blocks(fs, rblocks, rbufs, nr) != 0){
+        goto out;
+    }
+    for(ui32 i = 0; i < n; i++){ //blocchi parziali, buchi e blocchi in raccolta
+        size_t blockOff = i == 0 ? (size_t)(off % BLOCK_SIZE) : 0;
+        size_t dest = i == 0 ? 0 : (size_t)i * BLOCK_SIZE - (size_t)(off % BLOCK_SIZE);
+        size_t chunk = BLOCK_SIZE - blockOff < len - dest ? BLOCK_SIZE - blockOff : len - dest;
+        int slot = map[i] ? wbuf_find(fs, map[i]) : -1;
+        if(map[i] == 0){
+            memset((ui8 *)buf + dest, 0, chunk); //buco: si legge come zeri
+        } else if(slot >= 0){
+            memcpy((ui8 *)buf + dest, wbuf_data(fs, slot) + blockOff, chunk); //la copia in raccolta è la più recente
+        } else if(blockOff != 0 || chunk != BLOCK_SIZE){
+            memcpy((ui8 *)buf + dest, bounce + (i == 0 ? 0 : BLOCK_SIZE) + blockOff, chunk);
+        }
+    }
+    if(window > 0){
+        fs_prefetch_blocks(fs, map + n, window); //i blocchi successivi arrivano nel cache prima di essere chiesti
+    }
+    result = (ssize_t)len;
+out:
+    free(map);
+    free(rblocks);
+    free(rbufs);
+    free(bounce);
+    return result;
+}
+
+ssize_t fs_pread(struct filesystem *fs, inode_t ino, void *buf, size_t len, off_t off){
+    inode_lock(fs, ino, false);
+    ssize_t result = do_pread(fs, ino, buf, len, off);
+    inode_unlock(fs, ino);
+    return result;
+}
+
+static ssize_t do_pwrite(struct filesystem *fs, inode_t ino, const void *buf, size_t len, off_t off){
+    if(ino >= fs->sb.inode_count || fs->inodeTable[ino].isUsed != 1 || off < 0) return -1;
+    if(len == 0) return 0;
+    struct inode *in = &fs->inodeTable[ino];
+    if(in->size == 0 && !(in->flags & (INODE_F_EXTENTS | INODE_F_HASHDIR | INODE_F_BLOCKMAP)) && in->indirectBlock == 0){
+        bool empty = true;
+        for(ui32 i = 0; i < INODE_DIRECT; i++){
+            if(in->directBlocks[i] != 0) empty = false;
+        }
+        if(empty){ //i file nuovi nascono inline o a extent, quelli con puntatori restano tali
+            bool fits = (ui64)off + len <= INODE_INLINE_SIZE && !fs->legacyInodes; //nel formato originale i dati inline non entrano
+            in->flags |= fits ? INODE_F_INLINE : INODE_F_EXTENTS;
+            memset(in->inlineData, 0, INODE_INLINE_SIZE);
+        }
+    }
+    if(in->flags & INODE_F_INLINE){
+        if((ui64)off + len <= INODE_INLINE_SIZE){ //il file resta nell'inode: nessun blocco toccato
+            memcpy(in->inlineData + off, buf, len);
+            if((ui64)off + len > in->size) in->size = (ui32)(off + len);
+            inode_write(fs, ino);
+            return (ssize_t)len;
+        }
+        if(inline_to_blocks(fs, ino) != 0){
+            return -1; //il file non è cresciuto: resta inline
+        }
+    }
+    ui64 maxSize = (ui64)(fs->legacyInodes ? FS_V0_MAX_FILE_BLOCKS : FS_MAX_FILE_BLOCKS) * BLOCK_SIZE; //dimensione indirizzabile dai puntatori, ma size è a 32 bit
+    if((in->flags & INODE_F_EXTENTS) || maxSize > UINT32_MAX) maxSize = UINT32_MAX;
+    if((ui64)off >= maxSize) return -1; //oltre la dimensione massima di un file
+    if(len > maxSize - (ui64)off) len = (size_t)(maxSize - (ui64)off); //scrittura parziale fino al limite
+    ui32 first = (ui32)(off / BLOCK_SIZE);
+    ui32 last = (ui32)((off + len - 1) / BLOCK_SIZE);
+    ui32 n = last - first + 1;
+    block_t *map = malloc(n * sizeof(block_t));
+    bool *fresh = malloc(n * sizeof(bool));
+    block_t *wblocks = malloc(n * sizeof(block_t));
+    void **wbufs = malloc(n * sizeof(void *));
+    ssize_t result = -1;
+    if(!map || !fresh || !wblocks || !wbufs || file_map(fs, ino, first, n, map, fresh, true) != 0){
+        goto out;
+    }
+    for(ui32 i = 0; fs->journal && i < n; i++){
+        if(fresh[i] && journal_ordered(fs->journal, map[i]) != 0) goto out; //scritto prima del commit che lo rende raggiungibile
+    }
+    ui32 nw = 0;
+    for(ui32 i = 0; i < n; i++){
+        size_t blockOff = i == 0 ? (size_t)(off % BLOCK_SIZE) : 0;
+        size_t src = i == 0 ? 0 : (size_t)i * BLOCK_SIZE - (size_t)(off % BLOCK_SIZE);
+        size_t chunk = BLOCK_SIZE - blockOff < len - src ? BLOCK_SIZE - blockOff : len - src;
+        if(chunk == BLOCK_SIZE){ //blocco intero: nessuna lettura, va nella scrittura vettoriale
+            wbuf_drop(fs, map[i], 1); //la copia in raccolta è superata
+            wblocks[nw] = map[i];
+            wbufs[nw] = (ui8 *)buf + src;
+            nw++;
+            continue;
+        }
+        if(fs->wbuf){ //blocco parziale: raccolto in memoria finché non viene completato o sfrattato
+            int slot = wbuf_get(fs, map[i], fresh[i]);
+            if(slot < 0) goto out;
+            memcpy(wbuf_data(fs, slot) + blockOff, (const ui8 *)buf + src, chunk);
+            if(blockOff + chunk == BLOCK_SIZE && wbuf_flush_slot(fs, slot) != 0){ //lo scrittore è arrivato a fine blocco
+                goto out;
+            }
+            continue;
+        }
+        char tmp[BLOCK_SIZE]; //senza area di raccolta: read-modify-write immediato
+        if(fresh[i]) memset(tmp, 0, BLOCK_SIZE);
+        else if(fs_read_block(fs, map[i], tmp) != 0) goto out;
+        memcpy(tmp + blockOff, (const ui8 *)buf + src, chunk);
+        if(fs_write_block(fs, map[i], tmp) != 0) goto out;
+    }
+    if(write_blocks(fs, wblocks, wbufs, nw) != 0){
+        goto out;
+    }
+    if((ui64)off + len > in->size){
+        in->size = (ui32)(off + len); //il file cresce
+    }
+    inode_write(fs, ino); //aggiorna modified_at e rende persistenti size e puntatori
+    result = (ssize_t)len;
+out:
+    free(map);
+    free(fresh);
+    free(wblocks);
+    free(wbufs);
+    return result;
+}
+
+ssize_t fs_pwrite(struct filesystem *fs, inode_t ino, const void *buf, size_t len, off_t off){
+    //nella transazione solo mappatura, bitmap e inode; i blocchi nuovi vengono scritti prima del suo commit.
+    //A passi di FS_TX_CHUNK blocchi: tra un passo e l'altro il file è coerente e una transazione cresciuta si chiude
+    size_t done = 0;
+    ssize_t result;
+    tx_begin(fs);
+    inode_lock(fs, ino, true);
+    for(;;){
+        size_t chunk = (size_t)FS_TX_CHUNK * BLOCK_SIZE - (size_t)((off + (off_t)done) % BLOCK_SIZE);
+        if(chunk > len - done) chunk = len - done;
+        result = do_pwrite(fs, ino, (const ui8 *)buf + done, chunk, off + (off_t)done);
+        if(result <= 0) break;
+        done += (size_t)result;
+        if(done == len || (size_t)result < chunk) break; //fine, o limite della dimensione di un file
+        tx_restart(fs, ino);
+    }
+    inode_unlock(fs, ino);
+    tx_end(fs);
+    return done > 0 ? (ssize_t)done : result;
+}
+
+static int do_truncate(struct filesystem *fs, inode_t ino, ui32 size){
+    if(ino >= fs->sb.inode_count || fs->inodeTable[ino].isUsed != 1) return -1;
+    struct inode *in = &fs->inodeTable[ino];
+    if(in->flags & INODE_F_HASHDIR) return -1; //i bucket di una directory non sono dati
+    if(in->flags & INODE_F_INLINE){
+        if(size > INODE_INLINE_SIZE && inline_to_blocks(fs, ino) != 0) return -1;
+        if(size < in->size && (in->flags & INODE_F_INLINE)){
+            memset(in->inlineData + size, 0, INODE_INLINE_SIZE - size); //un allungamento successivo legge zeri
+        }
+    }
+    if(!(in->flags & INODE_F_INLINE) && size < in->size){
+        ui32 keep = (ui32)(((ui64)size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        block_t tail = 0;
+        if(size % BLOCK_SIZE && file_map(fs, ino, size / BLOCK_SIZE, 1, &tail, NULL, false) != 0) return -1;
+        if(tail){ //l'ultimo blocco rimasto si azzera oltre la nuova fine
+            char zeros[BLOCK_SIZE] = { 0 };
+            if(do_pwrite(fs, ino, zeros, BLOCK_SIZE - size % BLOCK_SIZE, size) < 0) return -1;
+        }
+        int result = (in->flags & INODE_F_EXTENTS) ? extent_truncate(fs, ino, keep) : bmap_truncate(fs, ino, keep);
+        if(result != 0){
+            printf("Errore nella liberazione dei blocchi dell'inode %u.\n", ino);
+            return -1;
+        }
+    }
+    in->size = size;
+    inode_write(fs, ino);
+    return 0;
+}
+
+static int truncate_steps(struct filesystem *fs, inode_t ino, ui32 size){
+    //accorcia verso size liberando al più FS_TX_CHUNK blocchi per passo, finché la transazione resta sotto tx_limit:
+    //0 a size raggiunta, 1 se la transazione va chiusa prima di continuare, -1 errore
+    for(;;){
+        if(ino >= fs->sb.inode_count || fs->inodeTable[ino].isUsed != 1) return -1;
+        ui32 cur = fs->inodeTable[ino].size;
+        ui32 step = size;
+        if(cur > size && cur - size > (ui32)FS_TX_CHUNK * BLOCK_SIZE && !(fs->inodeTable[ino].flags & INODE_F_INLINE)){
+            step = (cur - FS_TX_CHUNK * BLOCK_SIZE) / BLOCK_SIZE * BLOCK_SIZE; //a fine blocco: nessun azzeramento
+            if(step < size) step = size;
+        }
+        if(do_truncate(fs, ino, step) != 0) return -1;
+        if(step == size) return 0;
+        if(fs->journal && journal_tx_size(fs->journal) >= tx_limit(fs)) return 1;
+    }
+}
+
+int fs_truncate(struct filesystem *fs, inode_t ino, ui32 size){
+    //blocchi liberati, nodi accorciati e inode nella stessa transazione; un accorciamento lungo si divide in più
+    //transazioni, ognuna delle quali lascia un file più corto ma coerente
+    tx_begin(fs);
+    inode_lock(fs, ino, true);
+    int result;
+    while((result = truncate_steps(fs, ino, size)) == 1){
+        tx_restart(fs, ino);
+    }
+    inode_unlock(fs, ino);
+    tx_end(fs);
+    return result;
+}
+
 int path_solver(struct filesystem *fs, const char *path,struct inode *result ){
-    //Dobbiamo iniziare dividendo il path in componenti
-    char temp[256]; //buffer che conterrà il path 
-    strcpy(temp, path); //copia del path nel buffer
+    //scorre il path componente per componente senza copiarlo né modificarlo: niente strtok, quindi rientrante
     inode_t current_inode = 0; //inode root
     struct inode current; //struttura che conterrà gli inode
-    if(inode_read(fs, current_inode, &current) != 0){ //lettura dell'inode
+    inode_lock(fs, current_inode, false);
+    int r = inode_read(fs, current_inode, &current); //lettura dell'inode
+    inode_unlock(fs, current_inode);
+    if(r != 0){
         return -1;
     }
-    char *token = strtok(temp, "/"); //tokenization della stringa
-    while(token != NULL){ //finché ci sono token nel path
+    const char *cursor = path;
+    while(*cursor != '\0'){
+        while(*cursor == '/') cursor++; //separatori multipli o finali
+        if(*cursor == '\0') break;
+        size_t len = strcspn(cursor, "/"); //lunghezza del componente corrente
+        if(len >= FNAME_LEN){
+            return -1; //componente più lungo di qualunque nome valido
+        }
+        char name[FNAME_LEN]; //solo il componente, terminato
+        memcpy(name, cursor, len);
+        name[len] = '\0';
+        cursor += len;
+
+        ui32 hash = dir_name_hash(name);
+        inode_t next_num;
         struct inode next; //struttura che conterrà il prossimo inode
-        inode_t next_num; //numero del prossimo inode
-        if(dir_lookup(fs, &current, token, &next, &next_num) != 0){ //cerchiamo il token della directory
-            //se lo troviamo next e next_nume conterranno ciò che devono contenere
-            return -1; //errore nella risoluzione del path
+        struct inode *dir = &fs->inodeTable[current_inode];
+        //la directory resta bloccata in lettura anche mentre si aggiorna il cache dei nomi:
+        //chi la modifica invalida le entry con il lock in scrittura, quindi non può inserirsi in mezzo
+        inode_lock(fs, current_inode, false);
+        int cached = fs->dcache ? dcache_lookup(fs->dcache, current_inode, name, hash, &next_num) : -1;
+        if(cached == 1 && dir_read_child(fs, dir, next_num, &next) != 0){
+            cached = -1; //l'inode non è più in uso: si rifà la lookup
+        }
+        if(cached == -1){
+            if(do_dir_lookup(fs, dir, name, &next, &next_num) != 0){ //cerchiamo il componente nella directory
+                if(fs->dcache) dcache_insert(fs->dcache, current_inode, name, hash, DCACHE_NEGATIVE);
+                cached = 0;
+            } else if(fs->dcache){
+                dcache_insert(fs->dcache, current_inode, name, hash, next_num);
+            }
+        }
+        inode_unlock(fs, current_inode);
+        if(cached == 0){
+            return -1; //il nome non esiste (entry negativa o lookup fallita)
         }
-        current_inode = next_num; //aggiornamento dell'inode corrente
-        current = next; //aggiornamento del numero di inode corrente
-        token = strtok(NULL, "/"); //passaggio al token successivo 
+        current_inode = next_num; //aggiornamento del numero di inode corrente
+        current = next; //aggiornamento dell'inode corrente
     }
     *result=current; //salviamo nella variabile puntata da result l'inode corrente
     return 0; 
 }
 
 int count_free_blocks(ui8 *bitmap, ui32 total_blocks){
-    ui32 free_blocks=0; //accumulatore
-    for (block_t b = 0; b < total_blocks; ++b) { //iteriamo su ogni bit
-        ui8 byte = bitmap[b / 8]; //per ogni bit arrotondiamo all'apposito byte
-        ui8 bit  = (byte >> (b % 8)) & 1; // estrae il bit                                                  
-        if (!bit) {
-            free_blocks+=1;
-        }
-    }
-    return free_blocks;
+    return (int)bm_count_zeros(bitmap, 0, total_blocks); //popcount vettoriale sui byte interi, bit singoli solo ai bordi
 }
 
 int count_free_bytes(ui8 *bitmap, ui32 total_blocks){
@@ -413,4 +3055,126 @@ int count_free_bytes(ui8 *bitmap, ui32 total_blocks){
  int count_free_mBs(ui8 *bitmap, ui32 total_blocks){
     return count_free_bytes(bitmap, total_blocks) / 1000;
  }
+
+ui32 fs_count_free_blocks(struct filesystem *fs){
+    return fs->freeBlocks; //mantenuto in modo incrementale da block_alloc e free_block
+}
+
+ui32 fs_count_free_inodes(struct filesystem *fs){
+    return __atomic_load_n(&fs->freeInodes, __ATOMIC_RELAXED); //mantenuto da inode_alloc e free_inode, come "df -i"
+}
+
+ui64 fs_count_free_bytes(struct filesystem *fs){
+    return (ui64)fs_count_free_blocks(fs) * BLOCK_SIZE; //spazio libero in bytes
+}
+
+ui64 fs_count_free_mBs(struct filesystem *fs){
+    return fs_count_free_bytes(fs) / 1000;
+}
+static int fsck_ref(struct filesystem *fs, ui8 *referenced, inode_t n, block_t b){
+    //segna b come raggiunto dall'inode n: ritorna il numero di incoerenze trovate
+    int errors = 0;
+    if(b == 0) return 0;
+    if(b < fs->sb.data_start || b >= fs->sb.total_blocks){
+        printf("fsck: inode %u punta al blocco %u fuori dall'area dati\n", n, b);
+        return 1;
+    }
+    if(((fs->blockBitmap[b/8] >> (b%8)) & 1) == 0){
+        printf("fsck: il blocco %u dell'inode %u è segnato come libero\n", b, n);
+        errors++;
+    }
+    if((referenced[b/8] >> (b%8)) & 1){
+        printf("fsck: il blocco %u è referenziato più di una volta\n", b);
+        errors++;
+    }
+    referenced[b/8] |= (ui8)(1 << (b%8));
+    return errors;
+}
+
+static int fsck_extents(struct filesystem *fs, ui8 *referenced, inode_t n, const struct extent *e, ui32 count){
+    int errors = 0;
+    for(ui32 i = 0; i < count; i++){
+        if(e[i].len > fs->sb.total_blocks){
+            printf("fsck: extent di %u blocchi nell'inode %u\n", e[i].len, n);
+            errors++;
+            continue;
+        }
+        for(ui32 j = 0; j < e[i].len; j++) errors += fsck_ref(fs, referenced, n, e[i].pstart + j);
+    }
+    return errors;
+}
+
+static int fsck_bmap(struct filesystem *fs, ui8 *referenced, inode_t n, block_t b, ui32 h){
+    //nodo di puntatori di altezza h (0: punta ai dati) e tutto ciò che raggiunge
+    int errors = fsck_ref(fs, referenced, n, b);
+    ui32 ptrs[PTRS_PER_BLOCK];
+    if(b == 0 || errors || fs_read_block(fs, b, ptrs) != 0) return errors;
+    for(ui32 j = 0; j < PTRS_PER_BLOCK; j++){
+        if(ptrs[j] == 0) continue;
+        errors += h == 0 ? fsck_ref(fs, referenced, n, ptrs[j]) : fsck_bmap(fs, referenced, n, ptrs[j], h - 1);
+    }
+    return errors;
+}
+
+int fs_check_bitmap(struct filesystem *fs){
+    //controllo in stile fsck della bitmap: ritorna il numero di incoerenze trovate
+    int errors = 0;
+    ui32 total = fs->sb.total_blocks;
+    ui32 freeScan = bm_count_zeros(fs->blockBitmap, 0, total);
+    if(freeScan != fs->freeBlocks){
+        printf("fsck: contatore dei blocchi liberi %u, nella bitmap %u\n", fs->freeBlocks, freeScan);
+        errors++;
+    }
+    ui32 firstFree = bm_find_first_zero(fs->blockBitmap, 0, fs->sb.data_start);
+    if(firstFree < fs->sb.data_start){
+        printf("fsck: il blocco di metadati %u risulta libero\n", firstFree);
+        errors++;
+    }
+    ui8 *referenced = calloc((total + 7) / 8, 1); //blocchi raggiungibili dagli inode in uso
+    ui32 indirect[BLOCK_SIZE / sizeof(ui32)];
+    for(inode_t n = 0; n < fs->sb.inode_count; n++){
+        struct inode *in = &fs->inodeTable[n];
+        if(!in->isUsed || (in->flags & INODE_F_INLINE)) continue; //i dati inline non occupano blocchi
+        if(in->flags & INODE_F_EXTENTS){ //tratti nella radice o nelle foglie
+            if(in->extents.depth == 0){
+                errors += fsck_extents(fs, referenced, n, in->extents.e, in->extents.count);
+                continue;
+            }
+            for(ui32 i = 0; i < in->extents.count && i < EXTENT_INLINE; i++){
+                errors += fsck_ref(fs, referenced, n, in->extents.e[i].pstart);
+                const struct extentLeaf *leaf = (const struct extentLeaf *)indirect;
+                if(in->extents.e[i].pstart >= total || fs_read_block(fs, in->extents.e[i].pstart, indirect) != 0 ||
+                   leaf->magic != EXTENT_LEAF_MAGIC || leaf->count > EXTENT_PER_LEAF){
+                    printf("fsck: foglia di extent %u dell'inode %u non valida\n", in->extents.e[i].pstart, n);
+                    errors++;
+                    continue;
+                }
+                errors += fsck_extents(fs, referenced, n, leaf->e, leaf->count);
+            }
+            continue;
+        }
+        for(ui32 j = 0; j < INODE_DIRECT; j++) errors += fsck_ref(fs, referenced, n, in->directBlocks[j]);
+        for(ui32 h = 0; h < FS_BMAP_LEVELS; h++) errors += fsck_bmap(fs, referenced, n, *bmap_root(in, h), h);
+    }
+    ui32 freeInodes = 0;
+    for(inode_t n = 0; n < fs->sb.inode_count; n++){ //bitmap degli inode contro i flag della tabella
+        bool bit = (fs->inodeBitmap[n/8] >> (n%8)) & 1;
+        if(bit != (fs->inodeTable[n].isUsed == 1)){
+            printf("fsck: l'inode %u è %s nella bitmap degli inode ma non nella tabella\n", n, bit ? "in uso" : "libero");
+            errors++;
+        }
+        freeInodes += !bit;
+    }
+    if(freeInodes != fs->freeInodes){
+        printf("fsck: contatore degli inode liberi %u, nella bitmap %u\n", fs->freeInodes, freeInodes);
+        errors++;
+    }
+    ui32 used = (total - fs->sb.data_start) - bm_count_zeros(fs->blockBitmap, fs->sb.data_start, total);
+    ui32 reachable = bm_count_ones(referenced, fs->sb.data_start, total);
+    if(used > reachable){
+        printf("fsck: %u blocchi occupati non sono raggiungibili da nessun inode\n", used - reachable); //solo informativo
+    }
+    free(referenced);
+    return errors;
+}
 // main moved to tests/test_main.c
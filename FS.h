@@ -8,24 +8,46 @@
 #include <sys/stat.h>
 #include <unistd.h> 
 #include <sys/types.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <time.h>
+#include <pthread.h>
 
 #define FS_MAGIC 0xF5F15F5F //magic number del file system
+#define FS_VERSION 3 //versione del formato scritta da init_fs (le immagini create prima della versione sono la 0)
 #define BLOCK_SIZE 4096 //dimensione di un blocco di byte (4 KB)
-#define MAX_BLOCKS 8192 //numero massimo di blocchi nel file system
+#define MAX_BLOCKS 8192 //dimensione di riferimento delle immagini (init_fs ne accetta qualsiasi)
 //avremo 4096*8192=32MB di spazio totale
-#define MAX_INODES 1024 //massimo numero di inode
+#define MAX_INODES 1024 //numero di inode di default di init_fs (init_fs_opts ne accetta un altro)
 #define INODE_DIRECT 12 //numero di blocchi diretti in un inode
 #define INODE_INDIRECT 1 //numero di blocchi indiretti in un inode
 //ogni inode può puntare ad un altro blocco con altri puntatori
 #define FNAME_LEN 256 //lunghezza massima del nome del file
+#define FS_DEFAULT_CACHE_BLOCKS 256 //frame del buffer cache se non specificato (1 MB)
+#define FS_DEFAULT_DENTRY_CACHE 4096 //entry del cache dei nomi se non specificato
+#define PTRS_PER_BLOCK (BLOCK_SIZE / sizeof(ui32)) //puntatori contenuti in un blocco indiretto
+#define FS_BMAP_LEVELS 3 //livelli di indirezione dei file a puntatori: singolo, doppio e triplo
+#define FS_MAX_FILE_BLOCKS (INODE_DIRECT + PTRS_PER_BLOCK + (ui64)PTRS_PER_BLOCK * PTRS_PER_BLOCK + \
+                            (ui64)PTRS_PER_BLOCK * PTRS_PER_BLOCK * PTRS_PER_BLOCK) //blocchi indirizzabili da un inode
+#define FS_BMAP_SLOTS 8 //slot del cache delle traduzioni dei file a puntatori
+#define FS_READAHEAD_SLOTS 16 //file seguiti contemporaneamente dal rilevamento dell'accesso sequenziale
+#define FS_READAHEAD_MAX 64 //finestra massima di readahead in blocchi (256 KB)
+#define FS_WBUF_SLOTS 8 //blocchi scritti parzialmente che fs_pwrite tiene in memoria
+#define FS_TX_CHUNK 256 //blocchi per passo di fs_pwrite e degli accorciamenti: tra un passo e l'altro la transazione si può chiudere
+#define FS_JOURNAL_MIN 16 //blocchi minimi dell'area del journal
+#define FS_JOURNAL_MAX 1024 //blocchi massimi dell'area del journal (4 MB)
+#define FS_GROUP_BLOCKS 1024 //blocchi dati per gruppo di allocazione di default (128 byte di bitmap, 2 linee di cache)
+#define FS_GROUP_INODES 128 //inode per gruppo di allocazione di default (4 blocchi della tabella)
+#define FS_CSUM_PER_BLOCK (BLOCK_SIZE / sizeof(ui32)) //checksum contenuti in un blocco della tabella dei checksum
+#define FS_CREATE_DIR 0x1 //tipo per fs_create_file: il nuovo inode è una directory
+#define FS_CREATE_BLOCKMAP 0x2 //tipo per fs_create_file: file a puntatori (blocchi diretti e indiretti) invece che a extent
 
 typedef uint32_t block_t; //dimensione di un blocco 
 typedef uint32_t inode_t; //dimensione di un inode
 typedef uint32_t ui32; //unsigned int a 32 bit
 typedef uint8_t ui8; //unsigned int a 8 bit
+typedef uint64_t ui64; //unsigned int a 64 bit, parola della bitmap
 
 struct superblock {
     ui32 magic; //magic number del file system
@@ -36,47 +58,306 @@ struct superblock {
     ui32 free_block_bitmap_start; //blocco di inizio della bitmap dei blocchi liberi
     ui32 inode_table_start; //blocco di inizio della tabella degli inode
     ui32 data_start;       //blocco di inizio dell'area dati        
+    ui32 journal_start;    //primo blocco dell'area del journal (tra la tabella degli inode e i dati)
+    ui32 journal_blocks;   //dimensione dell'area del journal, 0 se l'immagine non ne ha
+    ui32 inode_bitmap_start; //primo blocco della bitmap degli inode (tra le due), 0 se l'immagine non ne ha
+    ui32 free_blocks_count;  //blocchi liberi all'ultimo fs_flush
+    ui32 free_inodes_count;  //inode liberi all'ultimo fs_flush
+    ui32 version;            //FS_VERSION dell'immagine, 0 per le immagini create prima della versione
+    ui32 group_blocks;       //blocchi dati per gruppo di allocazione, 0 per FS_GROUP_BLOCKS
+    ui32 group_inodes;       //inode per gruppo di allocazione, 0 per FS_GROUP_INODES
+    ui32 csum_start;         //primo blocco della tabella dei checksum (tra la tabella degli inode e il journal)
+    ui32 csum_blocks;        //dimensione della tabella dei checksum, 0 se l'immagine non ne ha
+    ui32 checksum;           //CRC32C del superblocco con questo campo a 0 (dalla versione 3)
 };
 
+struct mkfs_options {
+    ui32 inode_count;  //inode dell'immagine, 0 per MAX_INODES
+    ui32 group_blocks; //blocchi dati per gruppo di allocazione, 0 per FS_GROUP_BLOCKS
+    ui32 group_inodes; //inode per gruppo di allocazione, 0 per FS_GROUP_INODES
+    bool no_checksums; //immagine senza tabella dei checksum dei metadati
+};
+
+/*
+Checksum dei metadati (CRC32C, vedi crc32c.h). Il superblocco porta il proprio nel campo checksum; per gli altri
+blocchi la tabella dei checksum contiene un ui32 per blocco dell'immagine, 0 se il blocco non ne ha uno (mai
+scritto dal file system, o blocco di dati). Hanno un checksum bitmap, tabella degli inode e i blocchi scritti con
+fs_write_meta (directory, blocchi indiretti, foglie di extent); un blocco liberato lo perde.
+Con il journal la tabella in RAM descrive i blocchi come sono nella loro posizione: la aggiorna il checkpoint (e il
+replay) con i checksum delle versioni che scrive, insieme ai blocchi, quindi le transazioni non la contengono e il
+percorso di scrittura non calcola nulla. Senza journal i checksum si aggiornano a ogni fs_write_meta e, per bitmap
+e tabella degli inode, quando fs_flush scrive il blocco della tabella che li contiene.
+La verifica avviene quando un blocco viene letto dal disco: superblocco, bitmap e blocchi della tabella degli inode
+con inode in uso al montaggio (che fallisce se non corrispondono), gli altri a ogni lettura che non trova il
+blocco nel buffer cache o nel journal (la lettura ritorna -1). In modalità mmap i blocchi di directory si leggono
+dalla mappatura e non vengono verificati.
+*/
+
+struct extent{
+    ui32 lstart; //primo blocco logico del tratto
+    ui32 pstart; //primo blocco fisico (nella radice con depth 1: blocco foglia)
+    ui32 len;    //blocchi del tratto (non usato nelle entry di indice)
+};
+
+#define EXTENT_INLINE 4 //extent nella radice dentro l'inode
+#define EXTENT_LEAF_MAGIC 0x45585446 //"EXTF"
+
+struct extentRoot{
+    uint16_t count; //entry usate in e[]
+    uint16_t depth; //0: e[] contiene gli extent; 1: e[] indicizza blocchi foglia (lstart, blocco)
+    struct extent e[EXTENT_INLINE];
+};
+
+struct extentLeaf{
+    ui32 magic; //EXTENT_LEAF_MAGIC
+    ui32 count; //extent usati nella foglia
+    struct extent e[]; //ordinati per lstart
+};
+
+#define EXTENT_PER_LEAF ((BLOCK_SIZE - sizeof(struct extentLeaf)) / sizeof(struct extent))
+
+#define INODE_INLINE_SIZE 108 //byte di dati inline: porta struct inode a 128 byte, 32 per blocco
+
 struct inode{
     ui32 size; //dimensione del file in byte
-    ui32 directBlocks[INODE_DIRECT]; //puntatori diretti ai blocchi di dati 
-    ui32 indirectBlock; //puntatore indiretto ai blocchi di dati
+    union {
+        struct {
+            ui32 directBlocks[INODE_DIRECT]; //puntatori diretti ai blocchi di dati 
+            ui32 indirectBlock; //puntatore indiretto ai blocchi di dati
+            ui32 doubleIndirect; //blocco di puntatori a blocchi indiretti
+            ui32 tripleIndirect; //blocco di puntatori a blocchi doppi indiretti
+        };
+        struct extentRoot extents; //con INODE_F_EXTENTS: tratti (logico, fisico, lunghezza) al posto dei puntatori
+        ui8 inlineData[INODE_INLINE_SIZE]; //con INODE_F_INLINE: il contenuto del file, nessun blocco dati
+    };
     ui32 isUsed; //indica se l'inode è in uso, true quando il file esiste
     ui32 created_at; //timestamp di creazione
     ui32 modified_at; //timestamp di ultima modifica
+    ui32 flags; //INODE_F_*: formato del contenuto
+};
+
+#define INODE_F_HASHDIR 0x1 //directory in formato hash: directBlocks[i] è il bucket i
+#define INODE_F_EXTENTS 0x2 //file mappato a extent
+#define INODE_F_INLINE 0x4 //contenuto del file dentro l'inode
+#define INODE_F_BLOCKMAP 0x8 //file creato con FS_CREATE_BLOCKMAP: resta a puntatori anche da vuoto
+
+/*
+Immagini del formato originale, create prima del campo flags: la tabella contiene record da 68 byte contigui,
+che possono stare a cavallo di due blocchi. Al montaggio ogni record viene convertito in struct inode e
+fs_meta_snapshot lo riconverte quando scrive il blocco, quindi il formato sul disco non cambia e l'immagine resta
+leggibile da chi la conosceva. I flag INODE_F_* stanno nei bit alti di isUsed (0 per gli inode del formato originale,
+che hanno tutti directory lineari e file a puntatori); i file nuovi sono a extent, che occupano gli stessi 52 byte
+di directBlocks e indirectBlock, mai inline, e i file a puntatori hanno solo il livello indiretto singolo.
+Il formato originale non scriveva la bitmap dei blocchi: al montaggio si ricostruisce dai puntatori degli inode in uso.
+*/
+struct inode_v0{
+    ui32 size;
+    ui32 directBlocks[INODE_DIRECT];
+    ui32 indirectBlock;
+    ui32 isUsed; //1 se in uso, nei bit da INODE_V0_FLAGS_SHIFT i flag INODE_F_*
+    ui32 created_at;
+    ui32 modified_at;
 };
 
+#define INODE_V0_FLAGS_SHIFT 16
+#define INODE_V0_PTR_BYTES (sizeof(ui32) * (INODE_DIRECT + 1)) //directBlocks e indirectBlock (o la radice degli extent)
+#define FS_V0_MAX_FILE_BLOCKS (INODE_DIRECT + PTRS_PER_BLOCK) //blocchi indirizzabili da un inode del formato originale
+
 struct dirEntry{
     char fname[FNAME_LEN]; //nome del file
     inode_t inodeNum; //numero dell'inode corrispondente 
 };
 
+/*
+Directory hash: il nome viene ridotto a un hash a 32 bit e il bucket di partenza è hash % INODE_DIRECT.
+Ogni bucket è un blocco con un header seguito da record di lunghezza variabile (stile ext2): rec_len
+porta al record successivo e include lo spazio libero che lo segue, così la catena copre sempre l'intero
+blocco. La lookup legge un solo blocco e confronta le stringhe solo quando l'hash coincide. Se il bucket
+non ha spazio l'entry va nel bucket successivo (sondaggio lineare) e il bucket pieno viene marcato
+DIR_BUCKET_OVERFLOW: la lookup prosegue al successivo solo se trova questo flag.
+*/
+#define DIR_BUCKET_MAGIC 0x44485348 //"HSHD"
+#define DIR_BUCKET_OVERFLOW 0x1
+
+struct dirBucketHeader{
+    ui32 magic; //DIR_BUCKET_MAGIC
+    uint16_t count; //record occupati nel bucket
+    uint16_t flags; //DIR_BUCKET_*
+    uint16_t freeHint; //spazio libero contiguo più grande nel bucket: dir_add_entry salta i bucket senza posto
+    uint16_t pad;
+};
+
+struct dirRecord{
+    ui32 hash; //hash del nome
+    inode_t inodeNum; //numero dell'inode corrispondente
+    uint16_t rec_len; //distanza dal record successivo in byte
+    ui8 name_len; //lunghezza del nome, 0 se il record è libero
+    ui8 pad;
+    char name[]; //nome senza terminatore
+};
+
+#define DIR_REC_LEN(name_len) ((ui32)(sizeof(struct dirRecord) + (name_len) + 3) & ~3u) //record allineati a 4 byte
+
+struct fs_options {
+    ui32 cache_blocks; //numero di frame da BLOCK_SIZE del buffer cache, 0 per disabilitarlo
+    bool direct_io;    //apre l'immagine con O_DIRECT (bypassa la page cache del kernel)
+    bool use_mmap;     //mappa l'intera immagine in memoria: bitmap, inode e blocchi puntano direttamente nella mappatura
+    ui32 dentry_cache; //entry del cache dei nomi usato da path_solver, 0 per disabilitarlo
+    bool journal;      //metadati scritti attraverso il journal (ignorato con use_mmap); il replay avviene comunque
+    bool thread_safe;  //operazioni chiamabili da più thread insieme (vedi sotto)
+};
+
+/*
+Gruppi di allocazione (la geometria è nel superblocco, bitmap e tabella restano regioni uniche): l'area dati è
+divisa in gruppi da sb.group_blocks blocchi e la tabella degli inode in gruppi da sb.group_inodes inode; il gruppo
+di inode g è associato al gruppo di blocchi g * groupCount / inodeGroups.
+- l'inode di un file va nel gruppo della sua directory, quello di una directory (FS_CREATE_DIR) nel gruppo con
+  più inode liberi: directory diverse finiscono in gruppi diversi
+- i blocchi di un inode si cercano a partire dal cursore del gruppo associato al suo gruppo di inode, quindi i
+  dati di una directory restano vicini sul disco e lontani da quelli delle altre
+- block_alloc e inode_alloc chiamati senza un inode di riferimento partono dal cursore globale (e dall'inode 0);
+  in modalità thread-safe ogni thread riceve invece un gruppo proprio, assegnato a rotazione al primo uso
+*/
+
+/*
+Modalità thread-safe (fs_options.thread_safe). Possono essere chiamate da più thread insieme dir_lookup,
+dir_add_entry, dir_remove_entry, dir_list_entries, fs_create_file, fs_delete_file, fs_pread, fs_pwrite,
+fs_truncate, path_solver, block_alloc, free_block (e le varianti a tratti), inode_alloc, free_inode, fs_flush e fs_sync.
+- ogni inode ha un lock lettore/scrittore: lookup, elenco e lettura lo prendono in lettura, le modifiche in
+  scrittura. Ordine: prima la directory, poi l'inode che contiene (solo mentre lo si copia o lo si elimina).
+  Nessuna operazione tiene due directory, quindi le lookup in directory diverse non si toccano e quelle
+  nella stessa directory procedono insieme finché nessuno la modifica
+- bitmap dei blocchi e flag isUsed degli inode si aggiornano con compare-and-swap, senza lock; il riepilogo
+  dello spazio libero con operazioni atomiche
+- con il journal ogni operazione che modifica tiene un handle sulla transazione in corso, preso prima dei lock
+  degli inode: la transazione si chiude quando non ci sono handle aperti, oppure, se supera un quarto del log,
+  i nuovi handle aspettano che quelli aperti finiscano
+- buffer cache, cache dei nomi e journal hanno i propri lock
+Limiti: la directory passata per puntatore deve essere un elemento di fs->inodeTable (una copia non è
+protetta), la gerarchia deve essere un albero (un nome che punta a un antenato inverte l'ordine dei lock),
+readahead e raccolta delle scritture parziali sono disattivati, l'API asincrona (aio.h) e close_fs vanno usate
+senza altre operazioni in corso.
+*/
+
+struct blockdev {
+    int fd;       //descrittore del file immagine, acceduto solo con pread/pwrite posizionali
+    bool direct;  //aperto con O_DIRECT: offset, lunghezze e buffer devono essere allineati a BLOCK_SIZE
+    ui8 *map;     //immagine mappata con mmap (NULL se non in modalità mmap)
+    size_t mapSize; //dimensione della mappatura in byte
+};
+
+struct bcache;
+struct dcache;
+struct fs_wbuf;
+struct journal;
+
+struct fs_readahead {
+    inode_t ino;    //file seguito da questo slot, (inode_t)-1 se nessuno
+    ui32 nextBlock; //blocco logico che una lettura sequenziale chiederebbe adesso
+    ui32 window;    //blocchi letti in anticipo, raddoppia a ogni lettura sequenziale
+};
+
+struct fs_bmap_cache {
+    inode_t ino;                     //file a cui appartengono i nodi, (inode_t)-1 se nessuno
+    block_t node[FS_BMAP_LEVELS];    //blocco di puntatori tenuto per ogni altezza (0: punta ai dati), 0 se nessuno
+    bool dirty[FS_BMAP_LEVELS];      //modificato e non ancora scritto
+    ui32 ptrs[FS_BMAP_LEVELS][PTRS_PER_BLOCK];
+};
+
 struct filesystem {
-    FILE *img;                 //file immagine del file system
+    FILE *img;                 //file immagine del file system (stesso descrittore di dev, senza buffer stdio)
+    struct blockdev dev;       //dispositivo a blocchi usato da tutte le letture e scritture
     struct superblock sb;       //superblocco del file system
     ui8 *blockBitmap;          //bitmap dei blocchi liberi
+    ui8 *inodeBitmap;          //bitmap degli inode in uso, parole da 64 bit (bit di padding a 1)
+    ui32 freeInodes;           //numero totale di inode liberi
+    ui32 *csum;                //tabella dei checksum, un ui32 per blocco (NULL se l'immagine non ne ha)
+    ui8 *csumStale;            //senza journal: un flag per blocco di bitmap e tabella degli inode modificato dall'ultimo calcolo del checksum
     struct inode *inodeTable;   //tabella degli inode
+    size_t inodeTableMap;       //byte della mappatura privata della tabella (caricata su richiesta), 0 se allocata
+    block_t nextFree;          //cursore di allocazione: primo blocco da cui riprendere la ricerca
+    ui32 groupCount;           //gruppi di allocazione dell'area dati
+    ui32 inodeGroups;          //gruppi di allocazione della tabella degli inode
+    block_t *groupNext;        //cursore di allocazione di ogni gruppo di blocchi
+    ui32 *groupFreeInodes;     //inode liberi in ogni gruppo di inode
+    ui32 threadGroups;         //modalità thread-safe: gruppi già assegnati ai thread
+    ui8 *wordFree;             //riepilogo: numero di blocchi liberi in ogni parola da 64 bit della bitmap
+    ui64 *freeSummary;         //riepilogo: un bit per parola, 1 se la parola ha almeno un blocco libero
+    ui32 freeBlocks;           //numero totale di blocchi liberi
+    struct bcache *cache;      //buffer cache dei blocchi (NULL se disabilitato)
+    struct dcache *dcache;     //cache dei nomi di path_solver (NULL se disabilitato)
+    struct fs_readahead readahead[FS_READAHEAD_SLOTS]; //stato del readahead, indicizzato per inode
+    struct fs_bmap_cache *bmap; //ultimi blocchi di puntatori letti, FS_BMAP_SLOTS slot per inode (NULL con più thread)
+    struct fs_wbuf *wbuf;      //blocchi parziali di fs_pwrite in attesa di essere completati
+    struct journal *journal;   //journal dei metadati (NULL se disabilitato)
+    ui32 txDepth;              //operazioni annidate nella transazione in corso (thread-safe: handle aperti)
+    bool threadSafe;           //fs_options.thread_safe
+    pthread_rwlock_t *inodeLocks; //un lock lettore/scrittore per inode, NULL fuori dalla modalità thread-safe
+    pthread_mutex_t txLock;    //protegge txDepth e txClosing
+    pthread_cond_t txCond;     //la transazione è stata chiusa
+    bool txClosing;            //la transazione va chiusa: i nuovi handle aspettano
+    ui8 *metaDirty;            //senza journal: un flag per blocco di bitmap e tabella degli inode modificato in memoria
+    ui32 metaDirtyCount;       //blocchi segnati in metaDirty
+    bool legacyInodes;         //immagine del formato originale: tabella di struct inode_v0 convertita in memoria
 };
 
 // Function prototypes
 int init_fs(const char *img, ui32 totalBlocks);
+int init_fs_opts(const char *img, ui32 totalBlocks, const struct mkfs_options *opts);
 struct filesystem *open_fs(const char *img, bool printBlocks, bool printInodes);
+struct filesystem *open_fs_opts(const char *img, const struct fs_options *opts);
+int close_fs(struct filesystem *fs);
 void printBitmap(struct filesystem *fs);
 void printInodeTable(struct filesystem *fs);
 block_t block_alloc(struct filesystem *fs);
 int free_block(struct filesystem *fs, block_t blockNum);
+int block_alloc_range(struct filesystem *fs, ui32 want, ui32 min, block_t *start, ui32 *count);
+int free_block_range(struct filesystem *fs, block_t start, ui32 count);
+int bdev_open(struct blockdev *dev, const char *path, bool direct);
+int bdev_map(struct blockdev *dev, size_t size);
+int bdev_read(struct blockdev *dev, block_t block_num, void *buffer);
+int bdev_write(struct blockdev *dev, block_t block_num, const void *buffer);
+int bdev_pread_bytes(struct blockdev *dev, void *buffer, size_t len, off_t offset);
+int bdev_pwrite_bytes(struct blockdev *dev, const void *buffer, size_t len, off_t offset);
+int bdev_readv(struct blockdev *dev, const block_t *blocks, void *const *buffers, ui32 n);
+int bdev_writev(struct blockdev *dev, const block_t *blocks, void *const *buffers, ui32 n);
 int read_block(FILE *F, block_t block_num, void *buffer);
 int write_block(FILE *F, block_t block_num, void *buffer);
+int fs_read_block(struct filesystem *fs, block_t block_num, void *buffer);
+int fs_write_block(struct filesystem *fs, block_t block_num, void *buffer);
+int read_blocks(struct filesystem *fs, const block_t *blocks, void *const *buffers, ui32 n);
+int write_blocks(struct filesystem *fs, const block_t *blocks, void *const *buffers, ui32 n);
+int fs_prefetch_blocks(struct filesystem *fs, const block_t *blocks, ui32 n);
+const void *fs_block_ptr(struct filesystem *fs, block_t block_num);
+int fs_verify_block(struct filesystem *fs, block_t block_num, const void *data); //blocco letto dal disco: -1 se non corrisponde al checksum
+ui32 fs_block_csum(const void *data); //valore nella tabella dei checksum per un blocco con questo contenuto (mai 0)
+int fs_flush(struct filesystem *fs);
+int fs_sync(struct filesystem *fs);
+void fs_meta_snapshot(struct filesystem *fs, block_t block_num, void *out);
+int fs_ordered_flush(struct filesystem *fs, const block_t *blocks, ui32 n); //dati dei blocchi appena allocati, prima del commit
+ui64 fs_journal_commit(struct filesystem *fs);
+int fs_journal_wait(struct filesystem *fs, ui64 seq);
 inode_t inode_alloc(struct filesystem *fs);
 int free_inode(struct filesystem *fs, inode_t inodeNum);
 int inode_read(struct filesystem *fs, inode_t inodenum, struct inode *out);
 int inode_write(struct filesystem *fs, inode_t inodenum);
+ui32 dir_name_hash(const char *name);
+int dir_scan_block(const struct inode *dir_inode, const void *block, const char *name, inode_t *inodeNum);
+bool dir_bucket_overflowed(const void *block);
 int dir_lookup(struct filesystem *fs, struct inode *dir_inode, const char* name, struct inode *result, inode_t *result_num);
 int dir_add_entry(struct filesystem *fs, inode_t dir_inode_num, const char *name, inode_t inodeNum);
 int dir_remove_entry(struct filesystem *fs, struct inode *dir_inode, const char *name);
 int fs_create_file(struct filesystem *fs, inode_t dir_inode_num, const char *name, uint32_t type);
+int fs_delete_file(struct filesystem *fs, struct inode *dir, const char *name);
+ssize_t fs_pread(struct filesystem *fs, inode_t ino, void *buf, size_t len, off_t off);
+ssize_t fs_pwrite(struct filesystem *fs, inode_t ino, const void *buf, size_t len, off_t off);
+int fs_truncate(struct filesystem *fs, inode_t ino, ui32 size); //accorcia (liberando i blocchi) o allunga con un buco
 int dir_list_entries(struct filesystem *fs, struct inode *dir_inode);
 int path_solver(struct filesystem *fs, const char *path,struct inode *result );
+ui32 fs_count_free_blocks(struct filesystem *fs);
+ui32 fs_count_free_inodes(struct filesystem *fs);
+ui64 fs_count_free_bytes(struct filesystem *fs);
+ui64 fs_count_free_mBs(struct filesystem *fs);
+int fs_check_bitmap(struct filesystem *fs);
 
 #endif
@@ -0,0 +1,536 @@
+#include "./aio.h"
+#include "./bcache.h"
+#include "./journal.h"
+#include <pthread.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#ifdef FS_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+struct aio_req {
+    struct aio_req *next;
+    block_t block;
+    void *buffer;
+    bool write;
+    bool fromDisk; //letto dal dispositivo: va confrontato con il checksum al completamento
+    int result;
+    aio_callback cb;
+    void *arg;
+};
+
+struct aio_engine {
+    struct filesystem *fs;
+    ui32 depth;                  //richieste massime in volo verso il dispositivo
+    ui32 inflight;               //richieste inviate e non ancora raccolte da aio_poll
+    pthread_mutex_t lock;        //protegge la coda dei completamenti (e quella del lavoro nel pool)
+    pthread_cond_t doneCond;
+    struct aio_req *doneHead, *doneTail; //completamenti in attesa di aio_poll
+    int eventFd;
+#ifdef FS_HAVE_LIBURING
+    struct io_uring ring;
+    ui32 queued;                 //sqe preparate ma non ancora inviate con io_uring_submit
+    ui32 inKernel;               //richieste di cui aspettiamo la cqe
+#else
+    pthread_cond_t workCond;
+    struct aio_req *workHead, *workTail;
+    pthread_t *threads;
+    ui32 threadCount;
+    bool stop;
+#endif
+};
+
+static void signal_event(struct aio_engine *eng){
+    if(eng->eventFd >= 0){
+        uint64_t one = 1;
+        ssize_t r = write(eng->eventFd, &one, sizeof(one)); //sveglia il ciclo di eventi
+        (void)r;
+    }
+}
+
+static void push_done(struct aio_engine *eng, struct aio_req *req){
+    pthread_mutex_lock(&eng->lock);
+    req->next = NULL;
+    if(eng->doneTail) eng->doneTail->next = req; else eng->doneHead = req;
+    eng->doneTail = req;
+    pthread_cond_signal(&eng->doneCond);
+    pthread_mutex_unlock(&eng->lock);
+    signal_event(eng);
+}
+
+static void do_sync_io(struct aio_engine *eng, struct aio_req *req){
+    req->result = req->write ? bdev_write(&eng->fs->dev, req->block, req->buffer)
+                             : bdev_read(&eng->fs->dev, req->block, req->buffer);
+}
+
+/* ---------------- backend: io_uring ---------------- */
+
+#ifdef FS_HAVE_LIBURING
+static int backend_init(struct aio_engine *eng, ui32 threads){
+    (void)threads;
+    if(io_uring_queue_init(eng->depth, &eng->ring, 0) < 0) return -1;
+    if(eng->eventFd >= 0) io_uring_register_eventfd(&eng->ring, eng->eventFd); //i completamenti del kernel svegliano il ciclo di eventi
+    return 0;
+}
+
+static void reap_kernel(struct aio_engine *eng, bool wait){
+    struct io_uring_cqe *cqe;
+    if(wait && eng->inKernel > 0){
+        if(eng->queued){
+            io_uring_submit(&eng->ring);
+            eng->queued = 0;
+        }
+        if(io_uring_wait_cqe(&eng->ring, &cqe) < 0) return;
+    }
+    while(io_uring_peek_cqe(&eng->ring, &cqe) == 0){
+        struct aio_req *req = io_uring_cqe_get_data(cqe);
+        req->result = cqe->res == BLOCK_SIZE ? 0 : -1; //letture/scritture corte trattate come errore
+        io_uring_cqe_seen(&eng->ring, cqe);
+        eng->inKernel--;
+        push_done(eng, req);
+    }
+}
+
+static int backend_enqueue(struct aio_engine *eng, struct aio_req *req){
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&eng->ring);
+    if(sqe == NULL){ //coda di invio piena: inviamo quello che c'è e raccogliamo almeno un completamento
+        io_uring_submit(&eng->ring);
+        eng->queued = 0;
+        reap_kernel(eng, true);
+        sqe = io_uring_get_sqe(&eng->ring);
+        if(sqe == NULL) return -1;
+    }
+    off_t offset = (off_t)req->block * BLOCK_SIZE;
+    if(req->write) io_uring_prep_write(sqe, eng->fs->dev.fd, req->buffer, BLOCK_SIZE, offset);
+    else io_uring_prep_read(sqe, eng->fs->dev.fd, req->buffer, BLOCK_SIZE, offset);
+    io_uring_sqe_set_data(sqe, req);
+    eng->queued++;
+    eng->inKernel++;
+    return 0;
+}
+
+static int backend_submit(struct aio_engine *eng){
+    if(eng->queued == 0) return 0;
+    int r = io_uring_submit(&eng->ring); //una sola system call per tutte le richieste accodate
+    eng->queued = 0;
+    return r < 0 ? -1 : 0;
+}
+
+static void backend_wait(struct aio_engine *eng, bool block){
+    reap_kernel(eng, block);
+}
+
+static void backend_shutdown(struct aio_engine *eng){
+    backend_submit(eng);
+    while(eng->inKernel > 0) reap_kernel(eng, true);
+    io_uring_queue_exit(&eng->ring);
+}
+
+static const char *backend_name(void){
+    return "io_uring";
+}
+
+/* ---------------- backend: pool di thread ---------------- */
+
+#else
+static void *worker_main(void *p){
+    struct aio_engine *eng = p;
+    for(;;){
+        pthread_mutex_lock(&eng->lock);
+        while(!eng->stop && eng->workHead == NULL){
+            pthread_cond_wait(&eng->workCond, &eng->lock);
+        }
+        struct aio_req *req = eng->workHead;
+        if(req == NULL){ //stop richiesto e coda vuota
+            pthread_mutex_unlock(&eng->lock);
+            return NULL;
+        }
+        eng->workHead = req->next;
+        if(eng->workHead == NULL) eng->workTail = NULL;
+        pthread_mutex_unlock(&eng->lock);
+        do_sync_io(eng, req); //pread/pwrite posizionali: più worker sullo stesso descrittore sono sicuri
+        push_done(eng, req);
+    }
+}
+
+static int backend_init(struct aio_engine *eng, ui32 threads){
+    if(threads == 0) threads = eng->depth < 64 ? eng->depth : 64;
+    pthread_cond_init(&eng->workCond, NULL);
+    eng->threads = calloc(threads, sizeof(pthread_t));
+    if(!eng->threads) return -1;
+    for(ui32 i = 0; i < threads; i++){
+        if(pthread_create(&eng->threads[i], NULL, worker_main, eng) != 0) break;
+        eng->threadCount++;
+    }
+    return eng->threadCount > 0 ? 0 : -1;
+}
+
+static int backend_enqueue(struct aio_engine *eng, struct aio_req *req){
+    pthread_mutex_lock(&eng->lock);
+    req->next = NULL;
+    if(eng->workTail) eng->workTail->next = req; else eng->workHead = req;
+    eng->workTail = req;
+    pthread_cond_signal(&eng->workCond);
+    pthread_mutex_unlock(&eng->lock);
+    return 0;
+}
+
+static int backend_submit(struct aio_engine *eng){
+    (void)eng; //i worker prendono le richieste appena accodate
+    return 0;
+}
+
+static void backend_wait(struct aio_engine *eng, bool block){
+    if(!block) return;
+    pthread_mutex_lock(&eng->lock);
+    while(eng->doneHead == NULL){
+        pthread_cond_wait(&eng->doneCond, &eng->lock);
+    }
+    pthread_mutex_unlock(&eng->lock);
+}
+
+static void backend_shutdown(struct aio_engine *eng){
+    pthread_mutex_lock(&eng->lock);
+    eng->stop = true;
+    pthread_cond_broadcast(&eng->workCond);
+    pthread_mutex_unlock(&eng->lock);
+    for(ui32 i = 0; i < eng->threadCount; i++){
+        pthread_join(eng->threads[i], NULL); //i worker svuotano la coda prima di uscire
+    }
+    free(eng->threads);
+    pthread_cond_destroy(&eng->workCond);
+}
+
+static const char *backend_name(void){
+    return "thread-pool";
+}
+#endif
+
+/* ---------------- interfaccia comune ---------------- */
+
+struct aio_engine *aio_create(struct filesystem *fs, ui32 queue_depth, ui32 threads){
+    if(!fs || queue_depth == 0) return NULL;
+    struct aio_engine *eng = calloc(1, sizeof(struct aio_engine));
+    if(!eng) return NULL;
+    eng->fs = fs;
+    eng->depth = queue_depth;
+    pthread_mutex_init(&eng->lock, NULL);
+    pthread_cond_init(&eng->doneCond, NULL);
+    eng->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(backend_init(eng, threads) != 0){
+        if(eng->eventFd >= 0) close(eng->eventFd);
+        pthread_mutex_destroy(&eng->lock);
+        pthread_cond_destroy(&eng->doneCond);
+        free(eng);
+        return NULL;
+    }
+    return eng;
+}
+
+void aio_destroy(struct aio_engine *eng){
+    if(!eng) return;
+    backend_shutdown(eng);
+    aio_poll(eng, 0); //consegna le ultime callback
+    if(eng->eventFd >= 0) close(eng->eventFd);
+    pthread_mutex_destroy(&eng->lock);
+    pthread_cond_destroy(&eng->doneCond);
+    free(eng);
+}
+
+const char *aio_backend_name(const struct aio_engine *eng){
+    (void)eng;
+    return backend_name();
+}
+
+int aio_event_fd(const struct aio_engine *eng){
+    return eng->eventFd;
+}
+
+static int submit(struct aio_engine *eng, block_t block_num, void *buffer, bool write, aio_callback cb, void *arg){
+    struct filesystem *fs = eng->fs;
+    if(block_num >= fs->sb.total_blocks) return -1;
+    struct aio_req *req = malloc(sizeof(struct aio_req));
+    if(!req) return -1;
+    req->block = block_num;
+    req->buffer = buffer;
+    req->write = write;
+    req->result = 0;
+    req->fromDisk = false;
+    req->cb = cb;
+    req->arg = arg;
+    eng->inflight++;
+    //percorsi senza I/O: mappatura, journal o buffer cache. La callback arriva comunque da aio_poll
+    if(fs->dev.map){
+        do_sync_io(eng, req);
+        push_done(eng, req);
+        return 0;
+    }
+    if(!write && fs->journal && journal_read(fs->journal, block_num, buffer) == 0){
+        push_done(eng, req); //metadato ancora nel journal: la copia sul disco è vecchia
+        return 0;
+    }
+    if(fs->cache){
+        if(write){
+            req->result = bcache_write(fs->cache, block_num, buffer); //write-back, come le scritture sincrone
+            push_done(eng, req);
+            return 0;
+        }
+        if(bcache_lookup(fs->cache, block_num, buffer) == 0){
+            push_done(eng, req);
+            return 0;
+        }
+    }
+    req->fromDisk = !write;
+    if(backend_enqueue(eng, req) != 0){
+        eng->inflight--;
+        free(req);
+        return -1;
+    }
+    return 0;
+}
+
+int aio_submit_read(struct aio_engine *eng, block_t block_num, void *buffer, aio_callback cb, void *arg){
+    return submit(eng, block_num, buffer, false, cb, arg);
+}
+
+int aio_submit_write(struct aio_engine *eng, block_t block_num, const void *buffer, aio_callback cb, void *arg){
+    return submit(eng, block_num, (void *)buffer, true, cb, arg);
+}
+
+int aio_submit(struct aio_engine *eng){
+    return backend_submit(eng);
+}
+
+ui32 aio_pending(const struct aio_engine *eng){
+    return eng->inflight;
+}
+
+int aio_poll(struct aio_engine *eng, ui32 min_complete){
+    if(eng->eventFd >= 0){
+        uint64_t count;
+        ssize_t r = read(eng->eventFd, &count, sizeof(count)); //azzera la notifica, non blocca
+        (void)r;
+    }
+    backend_submit(eng);
+    int delivered = 0;
+    for(;;){
+        backend_wait(eng, false);
+        pthread_mutex_lock(&eng->lock);
+        struct aio_req *list = eng->doneHead;
+        eng->doneHead = eng->doneTail = NULL;
+        pthread_mutex_unlock(&eng->lock);
+        while(list){ //le callback girano nel thread del chiamante, senza lock: possono inviare nuove richieste
+            struct aio_req *req = list;
+            list = req->next;
+            eng->inflight--;
+            if(req->fromDisk && req->result == 0){
+                req->result = fs_verify_block(eng->fs, req->block, req->buffer);
+            }
+            if(req->cb) req->cb(req->arg, req->result);
+            free(req);
+            delivered++;
+        }
+        if((ui32)delivered >= min_complete || eng->inflight == 0) break;
+        backend_submit(eng); //le callback possono aver accodato altre richieste
+        backend_wait(eng, true);
+    }
+    return delivered;
+}
+
+static int defer(struct aio_engine *eng, aio_callback cb, void *arg){
+    //completamento senza I/O: la callback verrà chiamata dal prossimo aio_poll, mai in modo sincrono
+    struct aio_req *req = calloc(1, sizeof(struct aio_req));
+    if(!req) return -1;
+    req->cb = cb;
+    req->arg = arg;
+    eng->inflight++;
+    push_done(eng, req);
+    return 0;
+}
+
+/* ---------------- lookup asincrone ---------------- */
+
+struct lookup_op {
+    struct aio_engine *eng;
+    char name[FNAME_LEN];
+    aio_lookup_callback cb;
+    void *arg;
+    ui32 outstanding;   //letture di blocchi non ancora completate
+    struct inode dir;   //copia dell'inode della directory: il chiamante può modificarlo durante la lookup
+    ui32 probe;         //directory hash: passo corrente della catena di sondaggio
+    bool found;
+    inode_t result;
+    ui8 *blocks;        //un buffer allineato per ogni blocco diretto
+    struct lookup_part { struct lookup_op *op; ui32 index; } parts[INODE_DIRECT];
+};
+
+static void lookup_finish(struct lookup_op *op){
+    int result = -1;
+    if(op->found){
+        struct inode tmp;
+        result = inode_read(op->eng->fs, op->result, &tmp); //l'entry deve puntare a un inode in uso
+    }
+    op->cb(op->arg, result, op->found ? op->result : (inode_t)-1);
+    free(op->blocks);
+    free(op);
+}
+
+static void lookup_block_done(void *p, int result){
+    struct lookup_part *part = p;
+    struct lookup_op *op = part->op;
+    if(result == 0 && !op->found){
+        inode_t num;
+        if(dir_scan_block(&op->dir, op->blocks + (size_t)part->index * BLOCK_SIZE, op->name, &num) == 0){
+            op->found = true;
+            op->result = num;
+        }
+    }
+    if(--op->outstanding == 0){
+        lookup_finish(op);
+    }
+}
+
+static int bucket_submit(struct lookup_op *op);
+
+static void lookup_bucket_done(void *p, int result){
+    //directory hash: un bucket alla volta, il successivo solo se questo è marcato in overflow
+    struct lookup_op *op = p;
+    if(result == 0){
+        inode_t num;
+        if(dir_scan_block(&op->dir, op->blocks, op->name, &num) == 0){
+            op->found = true;
+            op->result = num;
+        } else if(dir_bucket_overflowed(op->blocks) && ++op->probe < INODE_DIRECT){
+            if(bucket_submit(op) == 0) return;
+        }
+    }
+    lookup_finish(op);
+}
+
+static int bucket_submit(struct lookup_op *op){
+    block_t blk = op->dir.directBlocks[(dir_name_hash(op->name) + op->probe) % INODE_DIRECT];
+    if(blk == 0) return -1; //bucket mai allocato: la catena finisce qui
+    if(aio_submit_read(op->eng, blk, op->blocks, lookup_bucket_done, op) != 0) return -1;
+    aio_submit(op->eng); //se fallisce qui la richiesta resta in coda e parte al prossimo aio_poll
+    return 0;
+}
+
+static void lookup_empty_done(void *p, int result){
+    (void)result;
+    lookup_finish(p); //directory senza blocchi: nessuna entry
+}
+
+int aio_dir_lookup(struct aio_engine *eng, const struct inode *dir_inode, const char *name, aio_lookup_callback cb, void *arg){
+    struct lookup_op *op = calloc(1, sizeof(struct lookup_op));
+    if(!op) return -1;
+    op->eng = eng;
+    strncpy(op->name, name, FNAME_LEN - 1);
+    op->cb = cb;
+    op->arg = arg;
+    op->dir = *dir_inode;
+    op->blocks = aligned_alloc(BLOCK_SIZE, (size_t)INODE_DIRECT * BLOCK_SIZE); //allineati anche per O_DIRECT
+    if(!op->blocks){
+        free(op);
+        return -1;
+    }
+    ui32 count = 0;
+    for(ui32 i = 0; i < INODE_DIRECT; i++){
+        if(dir_inode->directBlocks[i] != 0) count++;
+    }
+    if(count > 0 && (dir_inode->flags & INODE_F_HASHDIR)){ //directory hash: si parte dal bucket del nome
+        if(bucket_submit(op) == 0) return 0;
+        count = 0; //bucket di partenza vuoto: nessuna entry
+    }
+    if(count == 0){
+        if(defer(eng, lookup_empty_done, op) != 0){
+            free(op->blocks);
+            free(op);
+            return -1;
+        }
+        return 0;
+    }
+    op->outstanding = count;
+    for(ui32 i = 0; i < INODE_DIRECT; i++){ //tutti i blocchi della directory vengono richiesti insieme
+        if(dir_inode->directBlocks[i] == 0) continue;
+        op->parts[i].op = op;
+        op->parts[i].index = i;
+        if(aio_submit_read(eng, dir_inode->directBlocks[i], op->blocks + (size_t)i * BLOCK_SIZE, lookup_block_done, &op->parts[i]) != 0){
+            lookup_block_done(&op->parts[i], -1); //conta comunque il blocco come completato
+        }
+    }
+    return aio_submit(eng);
+}
+
+struct path_op {
+    struct aio_engine *eng;
+    char *path;         //copia del path: il chiamante può liberare il suo
+    const char *cursor; //prossimo componente da risolvere
+    inode_t current;
+    aio_lookup_callback cb;
+    void *arg;
+};
+
+static void path_step(struct path_op *op);
+
+static void path_component_done(void *p, int result, inode_t inodeNum){
+    struct path_op *op = p;
+    if(result != 0){
+        op->cb(op->arg, -1, (inode_t)-1); //componente non trovato
+        free(op->path);
+        free(op);
+        return;
+    }
+    op->current = inodeNum;
+    path_step(op);
+}
+
+static void path_step(struct path_op *op){
+    while(*op->cursor == '/') op->cursor++;
+    if(*op->cursor == '\0'){ //path risolto
+        op->cb(op->arg, 0, op->current);
+        free(op->path);
+        free(op);
+        return;
+    }
+    char name[FNAME_LEN];
+    size_t len = strcspn(op->cursor, "/");
+    if(len >= FNAME_LEN){
+        path_component_done(op, -1, 0);
+        return;
+    }
+    memcpy(name, op->cursor, len);
+    name[len] = '\0';
+    op->cursor += len;
+    struct filesystem *fs = op->eng->fs;
+    if(aio_dir_lookup(op->eng, &fs->inodeTable[op->current], name, path_component_done, op) != 0){
+        path_component_done(op, -1, 0);
+    }
+}
+
+static void path_start(void *p, int result){
+    (void)result;
+    path_step(p);
+}
+
+int aio_path_solver(struct aio_engine *eng, const char *path, aio_lookup_callback cb, void *arg){
+    struct inode root;
+    if(inode_read(eng->fs, 0, &root) != 0) return -1; //la root (inode 0) deve essere in uso
+    struct path_op *op = malloc(sizeof(struct path_op));
+    if(!op) return -1;
+    op->eng = eng;
+    op->path = strdup(path);
+    if(!op->path){
+        free(op);
+        return -1;
+    }
+    op->cursor = op->path;
+    op->current = 0;
+    op->cb = cb;
+    op->arg = arg;
+    if(defer(eng, path_start, op) != 0){ //anche un path vuoto ("/") risponde da aio_poll
+        free(op->path);
+        free(op);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef MY_AIO_H
+#define MY_AIO_H
+
+#include "FS.h"
+
+/*
+Motore di I/O asincrono sui blocchi dell'immagine.
+Compilato con -DFS_HAVE_LIBURING (e -luring) usa io_uring; altrimenti un pool di thread
+che eseguono pread/pwrite. In entrambi i casi le callback di completamento vengono chiamate
+solo dentro aio_poll, quindi nel thread del ciclo di eventi del chiamante: aio_event_fd
+diventa leggibile quando ci sono completamenti da raccogliere.
+*/
+
+typedef void (*aio_callback)(void *arg, int result); //result: 0 successo, -1 errore
+typedef void (*aio_lookup_callback)(void *arg, int result, inode_t inodeNum);
+
+struct aio_engine;
+
+struct aio_engine *aio_create(struct filesystem *fs, ui32 queue_depth, ui32 threads); //threads usato solo dal pool
+void aio_destroy(struct aio_engine *eng); //attende le richieste in volo
+const char *aio_backend_name(const struct aio_engine *eng);
+int aio_event_fd(const struct aio_engine *eng); //eventfd da registrare nel ciclo di eventi, -1 se non disponibile
+
+int aio_submit_read(struct aio_engine *eng, block_t block_num, void *buffer, aio_callback cb, void *arg);
+int aio_submit_write(struct aio_engine *eng, block_t block_num, const void *buffer, aio_callback cb, void *arg);
+int aio_submit(struct aio_engine *eng); //invia al kernel le richieste accodate (io_uring), no-op per il pool
+int aio_poll(struct aio_engine *eng, ui32 min_complete); //raccoglie i completamenti e chiama le callback, ritorna quanti
+ui32 aio_pending(const struct aio_engine *eng); //richieste inviate e non ancora completate
+
+//varianti asincrone delle operazioni sulle directory: il risultato arriva nella callback
+int aio_dir_lookup(struct aio_engine *eng, const struct inode *dir_inode, const char *name, aio_lookup_callback cb, void *arg);
+int aio_path_solver(struct aio_engine *eng, const char *path, aio_lookup_callback cb, void *arg);
+
+#endif
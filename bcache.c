@@ -0,0 +1,308 @@
+#include "./bcache.h"
+#include <pthread.h>
+
+#define BCACHE_NONE ((ui32)-1) //indice di frame nullo
+#define BCACHE_RETRY ((ui32)-2) //claim_frame ha rilasciato il lock: la ricerca del blocco va ripetuta
+#define BCACHE_ALIGN 4096      //allineamento dei frame, compatibile con O_DIRECT
+
+struct bcache_frame {
+    block_t block;  //blocco contenuto nel frame
+    ui32 next;      //frame successivo nella stessa catena della tabella hash
+    bool valid;     //il frame contiene un blocco
+    bool dirty;     //il contenuto non è ancora stato scritto sul dispositivo
+    bool referenced; //bit di riferimento per l'algoritmo CLOCK
+    bool busy;      //I/O in corso senza lock (lettura del blocco o scrittura differita): il frame non si tocca
+};
+
+struct bcache {
+    ui32 frameCount;
+    ui32 bucketCount;            //potenza di 2
+    ui32 *buckets;               //testa della catena per ogni bucket
+    struct bcache_frame *frames;
+    ui8 *pool;                   //frameCount * BLOCK_SIZE byte allineati
+    ui32 hand;                   //lancetta del CLOCK
+    bcache_io_fn read_fn;
+    bcache_io_fn write_fn;
+    void *ctx;
+    struct bcache_stats stats;
+    pthread_mutex_t lock;        //un solo lock per tutto il cache, mai tenuto durante le I/O sul dispositivo
+    pthread_cond_t idle;         //un frame ha finito la sua I/O
+};
+
+static inline ui32 bucket_of(const struct bcache *cache, block_t block_num){
+    return (block_num * 2654435761u) & (cache->bucketCount - 1); //hash moltiplicativo di Knuth
+}
+
+static inline ui8 *frame_data(const struct bcache *cache, ui32 f){
+    return cache->pool + (size_t)f * BLOCK_SIZE;
+}
+
+struct bcache *bcache_create(ui32 frames, bcache_io_fn read_fn, bcache_io_fn write_fn, void *ctx){
+    if(frames == 0 || !read_fn || !write_fn) return NULL;
+    struct bcache *cache = calloc(1, sizeof(struct bcache));
+    if(!cache) return NULL;
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->idle, NULL);
+    cache->frameCount = frames;
+    cache->bucketCount = 1;
+    while(cache->bucketCount < frames * 2) cache->bucketCount <<= 1; //fattore di carico massimo 0.5
+    cache->buckets = malloc(cache->bucketCount * sizeof(ui32));
+    cache->frames = calloc(frames, sizeof(struct bcache_frame));
+    cache->pool = aligned_alloc(BCACHE_ALIGN, (size_t)frames * BLOCK_SIZE); //pool preallocato: nessuna malloc sul percorso caldo
+    if(!cache->buckets || !cache->frames || !cache->pool){
+        bcache_destroy(cache);
+        return NULL;
+    }
+    memset(cache->buckets, 0xFF, cache->bucketCount * sizeof(ui32)); //tutte le catene vuote
+    cache->read_fn = read_fn;
+    cache->write_fn = write_fn;
+    cache->ctx = ctx;
+    return cache;
+}
+
+void bcache_destroy(struct bcache *cache){
+    if(!cache) return;
+    pthread_mutex_destroy(&cache->lock);
+    pthread_cond_destroy(&cache->idle);
+    free(cache->buckets);
+    free(cache->frames);
+    free(cache->pool);
+    free(cache);
+}
+
+static ui32 lookup(struct bcache *cache, block_t block_num){
+    for(ui32 f = cache->buckets[bucket_of(cache, block_num)]; f != BCACHE_NONE; f = cache->frames[f].next){
+        if(cache->frames[f].block == block_num) return f;
+    }
+    return BCACHE_NONE;
+}
+
+static void unlink_frame(struct bcache *cache, ui32 f){
+    ui32 *link = &cache->buckets[bucket_of(cache, cache->frames[f].block)];
+    while(*link != f) link = &cache->frames[*link].next;
+    *link = cache->frames[f].next;
+    cache->frames[f].valid = false;
+}
+
+static int frame_io(struct bcache *cache, ui32 f, bool write){
+    //legge o scrive il blocco del frame senza il lock: nel frattempo il frame resta nella tabella ma è busy,
+    //quindi chi lo cerca aspetta e il CLOCK lo salta
+    struct bcache_frame *fr = &cache->frames[f];
+    block_t block_num = fr->block;
+    fr->busy = true;
+    pthread_mutex_unlock(&cache->lock);
+    int r = write ? cache->write_fn(cache->ctx, block_num, frame_data(cache, f))
+                  : cache->read_fn(cache->ctx, block_num, frame_data(cache, f));
+    pthread_mutex_lock(&cache->lock);
+    fr->busy = false;
+    pthread_cond_broadcast(&cache->idle);
+    return r;
+}
+
+static ui32 claim_frame(struct bcache *cache, block_t block_num){
+    //CLOCK: la lancetta salta i frame referenziati (togliendo il bit) e quelli con I/O in corso e si ferma sul primo
+    //non referenziato. Un frame sporco viene prima scritto senza lock: al ritorno la ricerca va ripetuta
+    for(ui32 scanned = 0; ; scanned++){
+        if(scanned >= 2 * cache->frameCount){ //due giri senza trovare nulla: tutti i frame hanno I/O in corso
+            pthread_cond_wait(&cache->idle, &cache->lock);
+            return BCACHE_RETRY;
+        }
+        ui32 f = cache->hand;
+        cache->hand = (cache->hand + 1) % cache->frameCount;
+        struct bcache_frame *fr = &cache->frames[f];
+        if(fr->busy) continue;
+        if(fr->valid && fr->referenced){
+            fr->referenced = false; //seconda possibilità
+            continue;
+        }
+        if(fr->valid && fr->dirty){
+            cache->hand = f; //il prossimo tentativo riparte da questo frame, ormai pulito
+            if(frame_io(cache, f, true) != 0){
+                return BCACHE_NONE; //impossibile liberare il frame senza perdere dati
+            }
+            fr->dirty = false;
+            cache->stats.writebacks++;
+            return BCACHE_RETRY;
+        }
+        if(fr->valid){
+            unlink_frame(cache, f);
+            cache->stats.evictions++;
+        }
+        fr->block = block_num;
+        fr->valid = true;
+        fr->dirty = false;
+        fr->referenced = true;
+        ui32 b = bucket_of(cache, block_num);
+        fr->next = cache->buckets[b];
+        cache->buckets[b] = f;
+        return f;
+    }
+}
+
+static ui32 find_idle(struct bcache *cache, block_t block_num){
+    //frame del blocco, aspettando che finisca la sua I/O (che può anche scartarlo): BCACHE_NONE se non c'è
+    for(;;){
+        ui32 f = lookup(cache, block_num);
+        if(f == BCACHE_NONE || !cache->frames[f].busy) return f;
+        pthread_cond_wait(&cache->idle, &cache->lock);
+    }
+}
+
+static ui32 get_frame(struct bcache *cache, block_t block_num, bool *found){
+    //frame già presente (*found) o appena assegnato al blocco, BCACHE_NONE se non se ne può liberare uno
+    for(;;){
+        ui32 f = find_idle(cache, block_num);
+        *found = f != BCACHE_NONE;
+        if(*found) return f;
+        f = claim_frame(cache, block_num);
+        if(f != BCACHE_RETRY) return f;
+    }
+}
+
+int bcache_read(struct bcache *cache, block_t block_num, void *buffer){
+    pthread_mutex_lock(&cache->lock);
+    int result = 0;
+    bool found;
+    ui32 f = get_frame(cache, block_num, &found);
+    if(found){
+        cache->stats.hits++;
+        cache->frames[f].referenced = true;
+        memcpy(buffer, frame_data(cache, f), BLOCK_SIZE);
+        goto out;
+    }
+    cache->stats.misses++;
+    if(f == BCACHE_NONE){
+        result = -1;
+        goto out;
+    }
+    if(frame_io(cache, f, false) != 0){
+        unlink_frame(cache, f); //lettura fallita: il frame torna libero
+        result = -1;
+        goto out;
+    }
+    memcpy(buffer, frame_data(cache, f), BLOCK_SIZE);
+out:
+    pthread_mutex_unlock(&cache->lock);
+    return result;
+}
+
+bool bcache_contains(const struct bcache *cache, block_t block_num){
+    struct bcache *c = (struct bcache *)cache;
+    pthread_mutex_lock(&c->lock);
+    bool found = lookup(c, block_num) != BCACHE_NONE;
+    pthread_mutex_unlock(&c->lock);
+    return found;
+}
+
+int bcache_lookup(struct bcache *cache, block_t block_num, void *buffer){
+    pthread_mutex_lock(&cache->lock);
+    ui32 f = find_idle(cache, block_num); //un blocco in scrittura non è ancora sul disco: non è un miss
+    if(f != BCACHE_NONE){ //il miss viene contato da chi poi legge il blocco e lo inserisce con bcache_fill
+        cache->stats.hits++;
+        cache->frames[f].referenced = true;
+        memcpy(buffer, frame_data(cache, f), BLOCK_SIZE);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return f != BCACHE_NONE ? 0 : -1;
+}
+
+int bcache_fill(struct bcache *cache, block_t block_num, const void *buffer){
+    pthread_mutex_lock(&cache->lock);
+    int result = 0;
+    bool found;
+    ui32 f = get_frame(cache, block_num, &found);
+    if(!found){ //se già presente può essere più recente (sporco): resta com'è
+        cache->stats.misses++;
+        if(f == BCACHE_NONE) result = -1;
+        else memcpy(frame_data(cache, f), buffer, BLOCK_SIZE);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return result;
+}
+
+int bcache_write(struct bcache *cache, block_t block_num, const void *buffer){
+    pthread_mutex_lock(&cache->lock);
+    bool found;
+    ui32 f = get_frame(cache, block_num, &found); //il blocco viene sovrascritto per intero: nessuna lettura preventiva
+    if(found){
+        cache->stats.hits++;
+    } else {
+        cache->stats.misses++;
+    }
+    if(f != BCACHE_NONE){
+        memcpy(frame_data(cache, f), buffer, BLOCK_SIZE);
+        cache->frames[f].dirty = true;
+        cache->frames[f].referenced = true;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return f != BCACHE_NONE ? 0 : -1;
+}
+
+struct dirty_ref {
+    block_t block;
+};
+
+static int cmp_dirty_ref(const void *a, const void *b){
+    block_t x = ((const struct dirty_ref *)a)->block, y = ((const struct dirty_ref *)b)->block;
+    return (x > y) - (x < y);
+}
+
+int bcache_flush(struct bcache *cache){
+    struct dirty_ref *dirty = malloc(cache->frameCount * sizeof(struct dirty_ref));
+    if(!dirty) return -1;
+    pthread_mutex_lock(&cache->lock);
+    ui32 n = 0;
+    for(ui32 f = 0; f < cache->frameCount; f++){
+        if(cache->frames[f].valid && cache->frames[f].dirty){
+            dirty[n].block = cache->frames[f].block;
+            n++;
+        }
+    }
+    qsort(dirty, n, sizeof(struct dirty_ref), cmp_dirty_ref); //scritture in ordine crescente di blocco
+    int result = 0;
+    for(ui32 i = 0; i < n; i++){ //il lock si rilascia a ogni scrittura: il frame va ricontrollato
+        ui32 f = find_idle(cache, dirty[i].block);
+        if(f == BCACHE_NONE || !cache->frames[f].dirty) continue; //scartato o già scritto da un rimpiazzamento
+        if(frame_io(cache, f, true) != 0){
+            result = -1;
+            continue;
+        }
+        cache->frames[f].dirty = false;
+        cache->stats.writebacks++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    free(dirty);
+    return result;
+}
+
+int bcache_writeback(struct bcache *cache, block_t block_num){
+    pthread_mutex_lock(&cache->lock);
+    int result = 0;
+    ui32 f = find_idle(cache, block_num);
+    if(f != BCACHE_NONE && cache->frames[f].dirty){
+        result = frame_io(cache, f, true);
+        if(result == 0){
+            cache->frames[f].dirty = false;
+            cache->stats.writebacks++;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return result;
+}
+
+void bcache_invalidate(struct bcache *cache, block_t block_num){
+    pthread_mutex_lock(&cache->lock);
+    ui32 f = find_idle(cache, block_num);
+    if(f != BCACHE_NONE){
+        unlink_frame(cache, f);
+        cache->frames[f].dirty = false;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void bcache_get_stats(const struct bcache *cache, struct bcache_stats *out){
+    struct bcache *c = (struct bcache *)cache;
+    pthread_mutex_lock(&c->lock);
+    *out = c->stats;
+    pthread_mutex_unlock(&c->lock);
+}
@@ -0,0 +1,35 @@
+#ifndef MY_BCACHE_H
+#define MY_BCACHE_H
+
+#include "FS.h"
+
+/*
+Buffer cache dei blocchi: un pool preallocato di frame da BLOCK_SIZE allineati a 4 KB,
+indicizzati per numero di blocco, con rimpiazzamento CLOCK e scrittura differita (write-back).
+Il cache non conosce il file immagine: legge e scrive attraverso le due funzioni passate a bcache_create.
+Tutte le funzioni sono thread-safe (un mutex per cache). Le letture dei miss e le scritture dei blocchi sporchi
+avvengono senza il mutex: il frame resta nella tabella segnato come occupato e chi cerca quel blocco aspetta.
+*/
+
+typedef int (*bcache_io_fn)(void *ctx, block_t block_num, void *buffer);
+
+struct bcache_stats {
+    ui64 hits;       //richieste servite dal cache
+    ui64 misses;     //richieste che hanno richiesto una lettura dal dispositivo
+    ui64 evictions;  //frame riutilizzati per un altro blocco
+    ui64 writebacks; //blocchi sporchi scritti sul dispositivo
+};
+
+struct bcache *bcache_create(ui32 frames, bcache_io_fn read_fn, bcache_io_fn write_fn, void *ctx);
+void bcache_destroy(struct bcache *cache); //non scrive i blocchi sporchi: chiamare prima bcache_flush
+int bcache_read(struct bcache *cache, block_t block_num, void *buffer);
+int bcache_write(struct bcache *cache, block_t block_num, const void *buffer);
+bool bcache_contains(const struct bcache *cache, block_t block_num);
+int bcache_lookup(struct bcache *cache, block_t block_num, void *buffer); //solo hit: -1 se il blocco non è nel cache
+int bcache_fill(struct bcache *cache, block_t block_num, const void *buffer); //inserisce un blocco pulito appena letto
+int bcache_flush(struct bcache *cache); //scrive tutti i blocchi sporchi in ordine di numero di blocco
+int bcache_writeback(struct bcache *cache, block_t block_num); //scrive il blocco se è sporco, resta nel cache
+void bcache_invalidate(struct bcache *cache, block_t block_num); //scarta il blocco senza scriverlo
+void bcache_get_stats(const struct bcache *cache, struct bcache_stats *out);
+
+#endif
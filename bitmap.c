@@ -0,0 +1,240 @@
+#include "./bitmap.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BM_X86 1
+#endif
+
+//ogni kernel fornisce due primitive sui byte, tutto il resto è costruito sopra di esse
+struct bm_impl {
+    const char *name;
+    ui64 (*popcount)(const ui8 *p, size_t n);            //bit a 1 in n byte
+    size_t (*find_byte_not)(const ui8 *p, size_t n, ui8 v); //primo byte diverso da v, n se non esiste
+};
+
+/* ---------------- versione portabile ---------------- */
+
+static ui64 popcount_scalar(const ui8 *p, size_t n){
+    ui64 count = 0;
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8){ //SWAR: conteggio a 64 bit senza istruzioni dedicate
+        ui64 v;
+        memcpy(&v, p + i, sizeof(v));
+        v = v - ((v >> 1) & 0x5555555555555555ULL);
+        v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+        v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+        count += (v * 0x0101010101010101ULL) >> 56;
+    }
+    for(; i < n; i++){
+        ui8 b = p[i];
+        b = b - ((b >> 1) & 0x55);
+        b = (b & 0x33) + ((b >> 2) & 0x33);
+        count += (b + (b >> 4)) & 0x0F;
+    }
+    return count;
+}
+
+static size_t find_byte_not_scalar(const ui8 *p, size_t n, ui8 v){
+    ui64 pattern = 0x0101010101010101ULL * v;
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8){ //confronto 8 byte alla volta
+        ui64 w;
+        memcpy(&w, p + i, sizeof(w));
+        if(w != pattern) break;
+    }
+    for(; i < n; i++){
+        if(p[i] != v) return i;
+    }
+    return n;
+}
+
+/* ---------------- SSE2 + POPCNT ---------------- */
+
+#ifdef BM_X86
+__attribute__((target("popcnt")))
+static ui64 popcount_sse(const ui8 *p, size_t n){
+    ui64 count = 0;
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8){
+        ui64 v;
+        memcpy(&v, p + i, sizeof(v));
+        count += (ui64)_mm_popcnt_u64(v); //un'istruzione POPCNT per parola
+    }
+    for(; i < n; i++){
+        count += (ui64)_mm_popcnt_u32(p[i]);
+    }
+    return count;
+}
+
+__attribute__((target("sse2")))
+static size_t find_byte_not_sse(const ui8 *p, size_t n, ui8 v){
+    __m128i pattern = _mm_set1_epi8((char)v);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16){
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(p + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern)); //bit a 1 per ogni byte uguale a v
+        if(mask != 0xFFFF){
+            return i + (size_t)__builtin_ctz(~mask);
+        }
+    }
+    return i + find_byte_not_scalar(p + i, n - i, v);
+}
+
+/* ---------------- AVX2 ---------------- */
+
+__attribute__((target("avx2")))
+static ui64 popcount_avx2(const ui8 *p, size_t n){
+    //popcount vettoriale: tabella dei bit per nibble con vpshufb, somme orizzontali con vpsadbw
+    const __m256i lookup = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                            0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i low = _mm256_set1_epi8(0x0F);
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32){
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(chunk, low));
+        __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(chunk, 4), low));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+    }
+    ui64 count = (ui64)_mm256_extract_epi64(acc, 0) + (ui64)_mm256_extract_epi64(acc, 1)
+               + (ui64)_mm256_extract_epi64(acc, 2) + (ui64)_mm256_extract_epi64(acc, 3);
+    return count + popcount_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t find_byte_not_avx2(const ui8 *p, size_t n, ui8 v){
+    __m256i pattern = _mm256_set1_epi8((char)v);
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32){
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(p + i));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, pattern));
+        if(mask != 0xFFFFFFFFu){
+            return i + (size_t)__builtin_ctz(~mask);
+        }
+    }
+    return i + find_byte_not_scalar(p + i, n - i, v);
+}
+#endif
+
+static const struct bm_impl impls[BM_KERNEL_COUNT] = {
+    [BM_KERNEL_SCALAR] = { "scalar", popcount_scalar, find_byte_not_scalar },
+#ifdef BM_X86
+    [BM_KERNEL_SSE]    = { "sse", popcount_sse, find_byte_not_sse },
+    [BM_KERNEL_AVX2]   = { "avx2", popcount_avx2, find_byte_not_avx2 },
+#else
+    [BM_KERNEL_SSE]    = { "sse", NULL, NULL },
+    [BM_KERNEL_AVX2]   = { "avx2", NULL, NULL },
+#endif
+};
+
+static const struct bm_impl *active = NULL; //kernel in uso, scelto al primo utilizzo
+static enum bm_kernel activeKind = BM_KERNEL_SCALAR;
+
+static bool kernel_supported(enum bm_kernel kernel){
+    switch(kernel){
+        case BM_KERNEL_SCALAR: return true;
+#ifdef BM_X86
+        case BM_KERNEL_SSE: return __builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt");
+        case BM_KERNEL_AVX2: return __builtin_cpu_supports("avx2");
+#endif
+        default: return false;
+    }
+}
+
+int bm_select_kernel(enum bm_kernel kernel){
+    if(kernel == BM_KERNEL_AUTO){
+        kernel = BM_KERNEL_SCALAR;
+        if(kernel_supported(BM_KERNEL_SSE)) kernel = BM_KERNEL_SSE;
+        if(kernel_supported(BM_KERNEL_AVX2)) kernel = BM_KERNEL_AVX2;
+    }
+    if(kernel < 0 || kernel >= BM_KERNEL_COUNT || !kernel_supported(kernel)){
+        return -1; //kernel non disponibile su questa CPU
+    }
+    activeKind = kernel;
+    active = &impls[kernel];
+    return 0;
+}
+
+enum bm_kernel bm_active_kernel(void){
+    if(!active) bm_select_kernel(BM_KERNEL_AUTO);
+    return activeKind;
+}
+
+const char *bm_kernel_name(enum bm_kernel kernel){
+    if(kernel < 0 || kernel >= BM_KERNEL_COUNT) return "auto";
+    return impls[kernel].name;
+}
+
+static inline const struct bm_impl *impl(void){
+    if(!active) bm_select_kernel(BM_KERNEL_AUTO);
+    return active;
+}
+
+static inline int get_bit(const ui8 *bitmap, ui32 i){
+    return (bitmap[i/8] >> (i%8)) & 1;
+}
+
+ui64 bm_popcount_bytes(const ui8 *bytes, size_t n){
+    return impl()->popcount(bytes, n);
+}
+
+ui32 bm_count_ones(const ui8 *bitmap, ui32 from, ui32 to){
+    ui32 count = 0;
+    while(from < to && (from % 8) != 0){ //bit di testa fino al confine di byte
+        count += get_bit(bitmap, from++);
+    }
+    if(from >= to) return count;
+    ui32 byteFrom = from / 8, byteTo = to / 8;
+    count += (ui32)impl()->popcount(bitmap + byteFrom, byteTo - byteFrom); //byte interi
+    for(ui32 i = byteTo * 8; i < to; i++){ //bit di coda
+        count += get_bit(bitmap, i);
+    }
+    return count;
+}
+
+ui32 bm_count_zeros(const ui8 *bitmap, ui32 from, ui32 to){
+    if(from >= to) return 0;
+    return (to - from) - bm_count_ones(bitmap, from, to);
+}
+
+static ui32 find_bit(const ui8 *bitmap, ui32 from, ui32 to, int value){
+    //primo bit uguale a value in [from, to): i byte interi si saltano cercando il primo byte "diverso dal pieno"
+    ui8 skip = value ? 0x00 : 0xFF;
+    while(from < to && (from % 8) != 0){
+        if(get_bit(bitmap, from) == value) return from;
+        from++;
+    }
+    if(from >= to) return to;
+    ui32 byteFrom = from / 8, byteTo = to / 8;
+    size_t k = impl()->find_byte_not(bitmap + byteFrom, byteTo - byteFrom, skip);
+    if(k < byteTo - byteFrom){
+        ui8 b = bitmap[byteFrom + k];
+        unsigned bits = value ? b : (ui8)~b;
+        return (byteFrom + (ui32)k) * 8 + (ui32)__builtin_ctz(bits);
+    }
+    for(ui32 i = byteTo * 8; i < to; i++){
+        if(get_bit(bitmap, i) == value) return i;
+    }
+    return to;
+}
+
+ui32 bm_find_first_zero(const ui8 *bitmap, ui32 from, ui32 to){
+    return find_bit(bitmap, from, to, 0);
+}
+
+ui32 bm_find_first_one(const ui8 *bitmap, ui32 from, ui32 to){
+    return find_bit(bitmap, from, to, 1);
+}
+
+ui32 bm_find_zero_run(const ui8 *bitmap, ui32 from, ui32 to, ui32 n){
+    if(n == 0) return from < to ? from : to;
+    ui32 pos = from;
+    while(pos < to){
+        ui32 start = bm_find_first_zero(bitmap, pos, to);
+        if(start >= to || to - start < n) return to; //non c'è più spazio per un tratto di n zeri
+        ui32 end = bm_find_first_one(bitmap, start, start + n); //basta guardare i successivi n bit
+        if(end >= start + n) return start;
+        pos = end;
+    }
+    return to;
+}
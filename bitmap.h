@@ -0,0 +1,32 @@
+#ifndef MY_BITMAP_H
+#define MY_BITMAP_H
+
+#include "FS.h"
+
+/*
+Kernel per le bitmap del file system. Il bit i si trova nel byte i/8, posizione i%8
+(stessa convenzione di blockBitmap). Le funzioni lavorano su intervalli di bit [from, to)
+e non leggono mai oltre il byte che contiene il bit to-1.
+Le versioni AVX2 e SSE vengono scelte a runtime in base alla CPU, con un fallback portabile.
+*/
+
+enum bm_kernel {
+    BM_KERNEL_AUTO = -1,  //sceglie la versione migliore supportata dalla CPU
+    BM_KERNEL_SCALAR = 0, //C portabile (SWAR a 64 bit)
+    BM_KERNEL_SSE,        //SSE2 per la ricerca, istruzione POPCNT per il conteggio
+    BM_KERNEL_AVX2,       //AVX2 per la ricerca e popcount vettoriale con lookup a nibble
+    BM_KERNEL_COUNT
+};
+
+int bm_select_kernel(enum bm_kernel kernel); //-1 se la CPU non supporta il kernel richiesto
+enum bm_kernel bm_active_kernel(void);
+const char *bm_kernel_name(enum bm_kernel kernel);
+
+ui64 bm_popcount_bytes(const ui8 *bytes, size_t n); //numero di bit a 1 in n byte
+ui32 bm_count_ones(const ui8 *bitmap, ui32 from, ui32 to);
+ui32 bm_count_zeros(const ui8 *bitmap, ui32 from, ui32 to);
+ui32 bm_find_first_zero(const ui8 *bitmap, ui32 from, ui32 to); //to se non trovato
+ui32 bm_find_first_one(const ui8 *bitmap, ui32 from, ui32 to);  //to se non trovato
+ui32 bm_find_zero_run(const ui8 *bitmap, ui32 from, ui32 to, ui32 n); //inizio del primo tratto di n zeri, to se non trovato
+
+#endif
@@ -0,0 +1,202 @@
+#include "./crc32c.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC_X86 1 //l'istruzione crc32 a 64 bit esiste solo in modalità a 64 bit
+#endif
+
+#define CRC_POLY 0x82F63B78u //polinomio di Castagnoli, bit riflessi
+#define CRC_LONG 1024        //byte di ciascun flusso nei tratti lunghi: 3 KB per iterazione
+#define CRC_SHORT 256        //byte di ciascun flusso nei tratti corti: un blocco da 4 KB è 3 KB + 768 + 256
+
+struct crc_impl {
+    const char *name;
+    ui32 (*update)(ui32 crc, const ui8 *p, size_t n); //crc già invertito in ingresso e in uscita
+};
+
+static ui32 slice8[8][256]; //slice8[k][b]: contributo del byte b seguito da k byte a zero
+static ui32 shiftLong[4][256], shiftShort[4][256]; //spostano un crc in avanti di CRC_LONG o CRC_SHORT byte a zero
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
+
+/* ---------------- tabelle ---------------- */
+
+static ui32 gf2_times(const ui32 *mat, ui32 vec){
+    ui32 sum = 0;
+    for(; vec; vec >>= 1, mat++){
+        if(vec & 1) sum ^= *mat;
+    }
+    return sum;
+}
+
+static void gf2_square(ui32 *square, const ui32 *mat){
+    for(int n = 0; n < 32; n++){
+        square[n] = gf2_times(mat, mat[n]);
+    }
+}
+
+static void zeros_op(ui32 *even, size_t len){
+    //matrice che applica a un crc len byte a zero (len potenza di 2): operatore di un bit elevato al quadrato
+    ui32 odd[32];
+    odd[0] = CRC_POLY;
+    for(int n = 1; n < 32; n++){
+        odd[n] = 1u << (n - 1);
+    }
+    gf2_square(even, odd); //2 bit
+    gf2_square(odd, even); //4 bit
+    do {
+        gf2_square(even, odd);
+        len >>= 1;
+        if(len == 0) return;
+        gf2_square(odd, even);
+        len >>= 1;
+    } while(len);
+    memcpy(even, odd, sizeof(odd));
+}
+
+static void shift_table(ui32 table[4][256], size_t len){
+    ui32 op[32];
+    zeros_op(op, len);
+    for(ui32 n = 0; n < 256; n++){
+        table[0][n] = gf2_times(op, n);
+        table[1][n] = gf2_times(op, n << 8);
+        table[2][n] = gf2_times(op, n << 16);
+        table[3][n] = gf2_times(op, n << 24);
+    }
+}
+
+static void build_tables(void){
+    for(ui32 n = 0; n < 256; n++){
+        ui32 crc = n;
+        for(int k = 0; k < 8; k++){
+            crc = crc & 1 ? (crc >> 1) ^ CRC_POLY : crc >> 1;
+        }
+        slice8[0][n] = crc;
+    }
+    for(ui32 n = 0; n < 256; n++){
+        for(int k = 1; k < 8; k++){
+            slice8[k][n] = (slice8[k - 1][n] >> 8) ^ slice8[0][slice8[k - 1][n] & 0xFF];
+        }
+    }
+    shift_table(shiftLong, CRC_LONG);
+    shift_table(shiftShort, CRC_SHORT);
+}
+
+static inline ui32 crc_shift(ui32 table[4][256], ui32 crc){
+    return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+}
+
+/* ---------------- versione portabile ---------------- */
+
+static ui32 update_slice8(ui32 crc, const ui8 *p, size_t n){
+    size_t i = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for(; i + 8 <= n; i += 8){ //8 byte per iterazione, una lookup indipendente per byte
+        ui64 w;
+        memcpy(&w, p + i, sizeof(w));
+        w ^= crc;
+        crc = slice8[7][w & 0xFF] ^ slice8[6][(w >> 8) & 0xFF] ^
+              slice8[5][(w >> 16) & 0xFF] ^ slice8[4][(w >> 24) & 0xFF] ^
+              slice8[3][(w >> 32) & 0xFF] ^ slice8[2][(w >> 40) & 0xFF] ^
+              slice8[1][(w >> 48) & 0xFF] ^ slice8[0][w >> 56];
+    }
+#endif
+    for(; i < n; i++){
+        crc = (crc >> 8) ^ slice8[0][(crc ^ p[i]) & 0xFF];
+    }
+    return crc;
+}
+
+/* ---------------- SSE4.2 ---------------- */
+
+#ifdef CRC_X86
+__attribute__((target("sse4.2")))
+static ui64 crc_words(ui64 crc, const ui8 *p, size_t n){
+    for(size_t i = 0; i < n; i += 8){
+        ui64 w;
+        memcpy(&w, p + i, sizeof(w));
+        crc = _mm_crc32_u64(crc, w);
+    }
+    return crc;
+}
+
+__attribute__((target("sse4.2")))
+static ui32 update_sse42(ui32 crc, const ui8 *p, size_t n){
+    //crc32 ha latenza 3 e throughput 1: tre flussi indipendenti tengono occupata l'unità, poi i crc parziali
+    //si ricombinano spostando il primo in avanti della lunghezza del secondo (e del terzo)
+    ui64 crc0 = crc;
+    while(n >= 3 * CRC_SHORT){
+        size_t len = n >= 3 * CRC_LONG ? CRC_LONG : CRC_SHORT;
+        ui64 crc1 = 0, crc2 = 0;
+        for(size_t i = 0; i < len; i += 8){
+            ui64 w0, w1, w2;
+            memcpy(&w0, p + i, sizeof(w0));
+            memcpy(&w1, p + len + i, sizeof(w1));
+            memcpy(&w2, p + 2 * len + i, sizeof(w2));
+            crc0 = _mm_crc32_u64(crc0, w0);
+            crc1 = _mm_crc32_u64(crc1, w1);
+            crc2 = _mm_crc32_u64(crc2, w2);
+        }
+        ui32 (*table)[256] = len == CRC_LONG ? shiftLong : shiftShort;
+        crc0 = crc_shift(table, (ui32)crc0) ^ (ui32)crc1;
+        crc0 = crc_shift(table, (ui32)crc0) ^ (ui32)crc2;
+        p += 3 * len;
+        n -= 3 * len;
+    }
+    crc0 = crc_words(crc0, p, n & ~(size_t)7);
+    ui32 c = (ui32)crc0;
+    for(size_t i = n & ~(size_t)7; i < n; i++){
+        c = _mm_crc32_u8(c, p[i]);
+    }
+    return c;
+}
+#endif
+
+static const struct crc_impl impls[CRC_KERNEL_COUNT] = {
+    [CRC_KERNEL_SLICE8] = { "slice-by-8", update_slice8 },
+#ifdef CRC_X86
+    [CRC_KERNEL_SSE42]  = { "sse4.2", update_sse42 },
+#else
+    [CRC_KERNEL_SSE42]  = { "sse4.2", NULL },
+#endif
+};
+
+static const struct crc_impl *active = NULL; //kernel in uso, scelto al primo utilizzo
+static enum crc_kernel activeKind = CRC_KERNEL_SLICE8;
+
+static bool kernel_supported(enum crc_kernel kernel){
+    switch(kernel){
+        case CRC_KERNEL_SLICE8: return true;
+#ifdef CRC_X86
+        case CRC_KERNEL_SSE42: return __builtin_cpu_supports("sse4.2");
+#endif
+        default: return false;
+    }
+}
+
+int crc32c_select_kernel(enum crc_kernel kernel){
+    pthread_once(&tablesOnce, build_tables); //servono a entrambi i kernel
+    if(kernel == CRC_KERNEL_AUTO){
+        kernel = kernel_supported(CRC_KERNEL_SSE42) ? CRC_KERNEL_SSE42 : CRC_KERNEL_SLICE8;
+    }
+    if(kernel < 0 || kernel >= CRC_KERNEL_COUNT || !kernel_supported(kernel)){
+        return -1; //kernel non disponibile su questa CPU
+    }
+    activeKind = kernel;
+    active = &impls[kernel];
+    return 0;
+}
+
+enum crc_kernel crc32c_active_kernel(void){
+    if(!active) crc32c_select_kernel(CRC_KERNEL_AUTO);
+    return activeKind;
+}
+
+const char *crc32c_kernel_name(enum crc_kernel kernel){
+    if(kernel < 0 || kernel >= CRC_KERNEL_COUNT) return "auto";
+    return impls[kernel].name;
+}
+
+ui32 crc32c(ui32 crc, const void *buf, size_t len){
+    if(!active) crc32c_select_kernel(CRC_KERNEL_AUTO);
+    return ~active->update(~crc, buf, len);
+}
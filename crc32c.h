@@ -0,0 +1,27 @@
+#ifndef MY_CRC32C_H
+#define MY_CRC32C_H
+
+#include "FS.h"
+
+/*
+CRC32C (polinomio di Castagnoli, 0x1EDC6F41 riflesso in 0x82F63B78), lo stesso di ext4 e iSCSI.
+crc32c(0, p, n) è il checksum di n byte; passando il risultato come crc si prosegue con i byte successivi,
+quindi crc32c(crc32c(0, a, n), b, m) è il checksum di a seguito da b.
+La versione con l'istruzione crc32 di SSE4.2 (tre flussi intrecciati, ricombinati con tabelle di shift) viene
+scelta a runtime in base alla CPU, con un fallback portabile slice-by-8.
+*/
+
+enum crc_kernel {
+    CRC_KERNEL_AUTO = -1,  //sceglie la versione migliore supportata dalla CPU
+    CRC_KERNEL_SLICE8 = 0, //C portabile: 8 tabelle da 256 entry, 8 byte per iterazione
+    CRC_KERNEL_SSE42,      //istruzione crc32 a 64 bit su tre flussi indipendenti
+    CRC_KERNEL_COUNT
+};
+
+int crc32c_select_kernel(enum crc_kernel kernel); //-1 se la CPU non supporta il kernel richiesto
+enum crc_kernel crc32c_active_kernel(void);
+const char *crc32c_kernel_name(enum crc_kernel kernel);
+
+ui32 crc32c(ui32 crc, const void *buf, size_t len);
+
+#endif
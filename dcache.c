@@ -0,0 +1,128 @@
+#include "./dcache.h"
+#include <pthread.h>
+
+#define DCACHE_WAYS 4 //entry per insieme
+
+struct dcache_entry {
+    inode_t parent;   //directory in cui è stato cercato il nome
+    inode_t child;    //inode trovato, DCACHE_NEGATIVE se il nome non esiste
+    ui32 hash;        //hash del nome (dir_name_hash)
+    ui8 name_len;     //0: entry libera
+    bool referenced;  //bit di riferimento per scegliere la vittima nell'insieme
+    char name[DCACHE_NAME_LEN];
+};
+
+struct dcache {
+    ui32 setCount;                //potenza di 2
+    struct dcache_entry *entries; //setCount * DCACHE_WAYS
+    pthread_mutex_t lock;
+    struct dcache_stats stats;
+};
+
+static inline struct dcache_entry *set_of(const struct dcache *cache, inode_t parent, ui32 hash){
+    ui32 s = (hash ^ (parent * 2654435761u)) & (cache->setCount - 1); //anche la directory entra nell'indice
+    return cache->entries + (size_t)s * DCACHE_WAYS;
+}
+
+static inline bool entry_matches(const struct dcache_entry *e, inode_t parent, const char *name, size_t len, ui32 hash){
+    return e->name_len == len && e->hash == hash && (parent == DCACHE_ANY || e->parent == parent) && memcmp(e->name, name, len) == 0;
+}
+
+struct dcache *dcache_create(ui32 entries){
+    if(entries < DCACHE_WAYS) return NULL;
+    struct dcache *cache = calloc(1, sizeof(struct dcache));
+    if(!cache) return NULL;
+    cache->setCount = 1;
+    while(cache->setCount * 2 * DCACHE_WAYS <= entries) cache->setCount <<= 1;
+    cache->entries = calloc((size_t)cache->setCount * DCACHE_WAYS, sizeof(struct dcache_entry));
+    if(!cache->entries){
+        free(cache);
+        return NULL;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+void dcache_destroy(struct dcache *cache){
+    if(!cache) return;
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->entries);
+    free(cache);
+}
+
+int dcache_lookup(struct dcache *cache, inode_t parent, const char *name, ui32 hash, inode_t *child){
+    size_t len = strnlen(name, FNAME_LEN);
+    int result = -1;
+    pthread_mutex_lock(&cache->lock);
+    if(len > 0 && len <= DCACHE_NAME_LEN){
+        struct dcache_entry *set = set_of(cache, parent, hash);
+        for(ui32 w = 0; w < DCACHE_WAYS; w++){
+            if(entry_matches(&set[w], parent, name, len, hash)){
+                set[w].referenced = true;
+                *child = set[w].child;
+                result = set[w].child == DCACHE_NEGATIVE ? 0 : 1;
+                break;
+            }
+        }
+    }
+    if(result == 1) cache->stats.hits++;
+    else if(result == 0) cache->stats.negative_hits++;
+    else cache->stats.misses++;
+    pthread_mutex_unlock(&cache->lock);
+    return result;
+}
+
+void dcache_insert(struct dcache *cache, inode_t parent, const char *name, ui32 hash, inode_t child){
+    size_t len = strnlen(name, FNAME_LEN);
+    if(len == 0 || len > DCACHE_NAME_LEN) return; //nome non memorizzabile: la lookup andrà sempre sulla directory
+    pthread_mutex_lock(&cache->lock);
+    struct dcache_entry *set = set_of(cache, parent, hash);
+    struct dcache_entry *victim = NULL;
+    for(ui32 w = 0; w < DCACHE_WAYS && !victim; w++){
+        if(set[w].name_len == 0 || entry_matches(&set[w], parent, name, len, hash)) victim = &set[w]; //libera o stessa chiave
+    }
+    for(ui32 pass = 0; !victim; pass++){ //seconda possibilità: si toglie il bit di riferimento finché una via non ne è priva
+        for(ui32 w = 0; w < DCACHE_WAYS && !victim; w++){
+            if(!set[w].referenced) victim = &set[w];
+            else set[w].referenced = false;
+        }
+    }
+    victim->parent = parent;
+    victim->child = child;
+    victim->hash = hash;
+    victim->name_len = (ui8)len;
+    victim->referenced = true;
+    memcpy(victim->name, name, len);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void dcache_invalidate(struct dcache *cache, inode_t parent, const char *name, ui32 hash){
+    size_t len = strnlen(name, FNAME_LEN);
+    if(len == 0 || len > DCACHE_NAME_LEN) return; //mai memorizzato
+    pthread_mutex_lock(&cache->lock);
+    if(parent == DCACHE_ANY){ //directory sconosciuta: l'insieme dipende dalla directory, quindi si scorre tutto
+        for(size_t i = 0; i < (size_t)cache->setCount * DCACHE_WAYS; i++){
+            if(entry_matches(&cache->entries[i], DCACHE_ANY, name, len, hash)) cache->entries[i].name_len = 0;
+        }
+    } else {
+        struct dcache_entry *set = set_of(cache, parent, hash);
+        for(ui32 w = 0; w < DCACHE_WAYS; w++){
+            if(entry_matches(&set[w], parent, name, len, hash)) set[w].name_len = 0;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void dcache_invalidate_dir(struct dcache *cache, inode_t parent){
+    pthread_mutex_lock(&cache->lock);
+    for(size_t i = 0; i < (size_t)cache->setCount * DCACHE_WAYS; i++){
+        if(cache->entries[i].parent == parent) cache->entries[i].name_len = 0;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void dcache_get_stats(struct dcache *cache, struct dcache_stats *out){
+    pthread_mutex_lock(&cache->lock);
+    *out = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
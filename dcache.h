@@ -0,0 +1,32 @@
+#ifndef MY_DCACHE_H
+#define MY_DCACHE_H
+
+#include "FS.h"
+
+/*
+Cache dei nomi (dentry cache) usato da path_solver: associa (inode della directory, nome) all'inode
+trovato, oppure ricorda che il nome non esiste (entry negativa). È associativo a insiemi da
+DCACHE_WAYS vie, indicizzato con l'hash del nome già calcolato per le directory hash, e protetto da
+un mutex perché path_solver può essere chiamato da più thread.
+*/
+
+#define DCACHE_NAME_LEN 40       //nomi più lunghi non vengono memorizzati
+#define DCACHE_ANY ((inode_t)-1) //per dcache_invalidate: il nome in qualunque directory
+#define DCACHE_NEGATIVE ((inode_t)-1) //valore di child per le entry negative
+
+struct dcache_stats {
+    ui64 hits;          //nome trovato nel cache
+    ui64 negative_hits; //nome che il cache sa essere assente
+    ui64 misses;        //lookup che sono dovute andare sulla directory
+};
+
+struct dcache *dcache_create(ui32 entries);
+void dcache_destroy(struct dcache *cache);
+//1 hit positivo (child valido), 0 hit negativo, -1 miss
+int dcache_lookup(struct dcache *cache, inode_t parent, const char *name, ui32 hash, inode_t *child);
+void dcache_insert(struct dcache *cache, inode_t parent, const char *name, ui32 hash, inode_t child);
+void dcache_invalidate(struct dcache *cache, inode_t parent, const char *name, ui32 hash);
+void dcache_invalidate_dir(struct dcache *cache, inode_t parent); //tutte le entry di una directory
+void dcache_get_stats(struct dcache *cache, struct dcache_stats *out);
+
+#endif
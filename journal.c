@@ -0,0 +1,703 @@
+#include "./journal.h"
+#include "./bcache.h"
+#include "./crc32c.h"
+#include <pthread.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+
+#define JOURNAL_NO_TAG ((ui32)-1) //blocco registrato solo in transazioni già chiuse
+
+struct jentry {
+    struct jentry *next; //catena della tabella hash
+    block_t block;
+    ui32 tag;            //indice nel tag della transazione in corso, JOURNAL_NO_TAG se non ne fa parte
+    ui8 *data;           //ultima versione registrata del blocco
+};
+
+struct jtx {
+    struct jtx *next;
+    ui64 seq;
+    ui32 pos;    //primo blocco della transazione nel log, relativo a journal_start
+    ui32 blocks; //descrittore + dati + commit
+    ui8 *image;  //la transazione così come va scritta nel log
+    bool ordered; //ha scritto dati nella loro posizione: vanno resi durevoli prima del commit
+};
+
+struct journal {
+    struct filesystem *fs;
+    block_t start;
+    ui32 blocks;
+    struct jentry **buckets; //blocchi registrati dall'ultimo checkpoint, per numero di blocco
+    ui32 bucketMask;
+    struct journal_tag *run; //tag della transazione in corso
+    ui32 runCount, runCap;
+    ui8 *memDirty;           //blocchi di bitmap e tabella degli inode toccati dalla transazione in corso
+    block_t *memList;
+    ui32 memCount;
+    block_t memLimit;        //i blocchi in memoria stanno tutti prima dell'area del journal
+    block_t *ordered;        //blocchi di dati allocati dalla transazione in corso
+    ui32 orderedCount, orderedCap;
+    ui64 nextSeq;            //sequenza della prossima transazione chiusa
+    ui32 head;               //prossimo blocco libero del log
+    struct jtx *txHead, *txTail; //transazioni chiuse dall'ultimo checkpoint, in ordine di sequenza
+    pthread_rwlock_t mapLock; //protegge mappa, tag e blocchi in memoria della transazione in corso, head e nextSeq
+    pthread_t thread;
+    pthread_mutex_t lock;    //protegge la lista delle transazioni, le sequenze e le statistiche
+    pthread_cond_t work;     //nuove transazioni per il thread di commit
+    pthread_cond_t done;     //durableSeq è avanzata
+    ui64 closedSeq;          //ultima transazione accodata
+    ui64 durableSeq;         //ultima transazione sul disco (scritta e seguita da fdatasync)
+    bool stop;
+    bool failed;             //una scrittura del log è fallita: il journal non garantisce più nulla
+    struct journal_stats stats;
+};
+
+static ui32 journal_checksum(ui32 type, const ui8 *p, size_t len){
+    if(type == JOURNAL_CSUM_CRC32C){
+        return crc32c(0, p, len);
+    }
+    //FNV-1a a 32 bit, un byte per moltiplicazione: resta per i log scritti prima del CRC32C
+    ui32 h = 2166136261u;
+    for(size_t i = 0; i < len; i++){
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static ui32 desc_data_blocks(const struct journal_desc *desc){
+    ui32 n = 0;
+    for(ui32 i = 0; i < desc->count; i++){
+        if(!(desc->tags[i].flags & JOURNAL_TAG_REVOKE)) n++;
+    }
+    return n;
+}
+
+static int write_header(struct blockdev *dev, block_t start, ui32 blocks, ui64 seq){
+    ui8 *buf = aligned_alloc(BLOCK_SIZE, BLOCK_SIZE);
+    if(!buf) return -1;
+    memset(buf, 0, BLOCK_SIZE);
+    struct journal_header *hdr = (struct journal_header *)buf;
+    hdr->magic = JOURNAL_MAGIC;
+    hdr->blocks = blocks;
+    hdr->seq = seq;
+    int result = bdev_write(dev, start, buf);
+    if(result == 0 && fdatasync(dev->fd) != 0) result = -1; //il checkpoint vale solo quando l'header è sul disco
+    free(buf);
+    return result;
+}
+
+static int read_header(struct blockdev *dev, block_t start, ui32 blocks, struct journal_header *out){
+    ui8 *buf = aligned_alloc(BLOCK_SIZE, BLOCK_SIZE);
+    if(!buf) return -1;
+    int result = bdev_read(dev, start, buf);
+    memcpy(out, buf, sizeof(struct journal_header));
+    free(buf);
+    if(result != 0 || out->magic != JOURNAL_MAGIC || out->blocks != blocks) return -1;
+    return 0;
+}
+
+struct apply_ref {
+    block_t block;
+    ui32 order;       //posizione nel log: a parità di blocco vince la più recente
+    const ui8 *data;  //NULL per un revoke
+};
+
+static int cmp_apply_ref(const void *a, const void *b){
+    const struct apply_ref *x = a, *y = b;
+    if(x->block != y->block) return (x->block > y->block) - (x->block < y->block);
+    return (x->order > y->order) - (x->order < y->order);
+}
+
+static int apply_txs(struct blockdev *dev, struct bcache *cache, const struct superblock *sb, ui32 *csum,
+                     const struct jtx *txs, const struct journal_tag *extra, ui32 extraCount){
+    //riporta nella loro posizione i blocchi delle transazioni: per ogni blocco solo l'ultima versione,
+    //nessuna se l'ultimo tag è un revoke (il blocco è stato liberato e forse riusato per dati);
+    //con la tabella dei checksum (csum non NULL) ne aggiorna le voci e riscrive i blocchi della tabella toccati
+    ui32 total = extraCount;
+    for(const struct jtx *t = txs; t; t = t->next){
+        total += ((const struct journal_desc *)t->image)->count;
+    }
+    if(total == 0) return 0;
+    struct apply_ref *refs = malloc(total * sizeof(struct apply_ref));
+    block_t *blocks = malloc(total * sizeof(block_t));
+    void **bufs = malloc(total * sizeof(void *));
+    ui8 *tableDirty = csum ? calloc(sb->csum_blocks, sizeof(ui8)) : NULL;
+    if(!refs || !blocks || !bufs || (csum && !tableDirty)){
+        free(refs);
+        free(blocks);
+        free(bufs);
+        free(tableDirty);
+        return -1;
+    }
+    ui32 n = 0;
+    for(const struct jtx *t = txs; t; t = t->next){
+        const struct journal_desc *desc = (const struct journal_desc *)t->image;
+        const ui8 *data = t->image + BLOCK_SIZE;
+        for(ui32 i = 0; i < desc->count; i++, n++){
+            refs[n].block = desc->tags[i].block;
+            refs[n].order = n;
+            refs[n].data = NULL;
+            if(!(desc->tags[i].flags & JOURNAL_TAG_REVOKE)){
+                refs[n].data = data;
+                data += BLOCK_SIZE;
+            }
+        }
+    }
+    for(ui32 i = 0; i < extraCount; i++, n++){ //revoke della transazione ancora aperta
+        refs[n].block = extra[i].block;
+        refs[n].order = n;
+        refs[n].data = NULL;
+    }
+    qsort(refs, n, sizeof(struct apply_ref), cmp_apply_ref);
+    ui32 w = 0;
+    for(ui32 i = 0; i < n; i++){
+        if(i + 1 < n && refs[i + 1].block == refs[i].block) continue; //esiste una versione più recente
+        if(csum && refs[i].block != 0 && refs[i].block < sb->total_blocks){
+            __atomic_store_n(&csum[refs[i].block], refs[i].data ? fs_block_csum(refs[i].data) : 0, __ATOMIC_RELAXED);
+            tableDirty[refs[i].block / FS_CSUM_PER_BLOCK] = 1; //anche se la voce in RAM era già a 0 (blocco liberato)
+        }
+        if(!refs[i].data) continue;
+        blocks[w] = refs[i].block;
+        bufs[w] = (void *)refs[i].data;
+        w++;
+    }
+    int result = bdev_writev(dev, blocks, bufs, w); //in ordine di blocco, tratti contigui fusi
+    for(ui32 i = 0; cache && i < w; i++){
+        bcache_invalidate(cache, blocks[i]); //un'eventuale copia nel cache è precedente
+    }
+    w = 0;
+    for(ui32 k = 0; tableDirty && k < sb->csum_blocks; k++){
+        if(!tableDirty[k]) continue;
+        blocks[w] = sb->csum_start + k; //al più un blocco della tabella per blocco riportato
+        bufs[w] = (ui8 *)csum + (size_t)k * BLOCK_SIZE;
+        w++;
+    }
+    if(w && bdev_writev(dev, blocks, bufs, w) != 0) result = -1;
+    free(tableDirty);
+    free(refs);
+    free(blocks);
+    free(bufs);
+    return result;
+}
+
+static void free_txs(struct jtx *t){
+    while(t){
+        struct jtx *next = t->next;
+        free(t->image);
+        free(t);
+        t = next;
+    }
+}
+
+int journal_replay(struct blockdev *dev, const struct superblock *sb){
+    if(sb->journal_blocks < FS_JOURNAL_MIN) return 0; //immagine senza journal
+    struct journal_header hdr;
+    if(read_header(dev, sb->journal_start, sb->journal_blocks, &hdr) != 0){
+        printf("Errore: header del journal non valido.\n");
+        return -1;
+    }
+    struct jtx *head = NULL, **tail = &head;
+    ui8 *desc = aligned_alloc(BLOCK_SIZE, BLOCK_SIZE);
+    if(!desc) return -1;
+    ui64 seq = hdr.seq;
+    ui32 pos = 1, replayed = 0;
+    //le transazioni valide sono consecutive a partire da hdr.seq: ci si ferma alla prima mancante o incompleta
+    while(pos + 2 <= sb->journal_blocks){
+        if(bdev_read(dev, sb->journal_start + pos, desc) != 0) break;
+        const struct journal_desc *d = (const struct journal_desc *)desc;
+        if(d->magic != JOURNAL_DESC_MAGIC || d->seq != seq || d->count > JOURNAL_MAX_TAGS) break;
+        ui32 blocks = 2 + desc_data_blocks(d);
+        if(pos + blocks > sb->journal_blocks) break;
+        ui8 *image = aligned_alloc(BLOCK_SIZE, (size_t)blocks * BLOCK_SIZE);
+        struct jtx *t = malloc(sizeof(struct jtx));
+        if(!image || !t || bdev_pread_bytes(dev, image, (size_t)blocks * BLOCK_SIZE, (off_t)(sb->journal_start + pos) * BLOCK_SIZE) != 0){
+            free(image);
+            free(t);
+            break;
+        }
+        const struct journal_commit *c = (const struct journal_commit *)(image + (size_t)(blocks - 1) * BLOCK_SIZE);
+        if(c->magic != JOURNAL_COMMIT_MAGIC || c->seq != seq ||
+           c->checksum != journal_checksum(c->csum_type, image, (size_t)(blocks - 1) * BLOCK_SIZE)){
+            free(image); //commit assente o strappato: la transazione non è mai stata confermata
+            free(t);
+            break;
+        }
+        t->next = NULL;
+        t->seq = seq;
+        t->pos = pos;
+        t->blocks = blocks;
+        t->image = image;
+        *tail = t;
+        tail = &t->next;
+        pos += blocks;
+        seq++;
+        replayed++;
+    }
+    free(desc);
+    int result = 0;
+    ui32 *csum = NULL;
+    if(head && sb->version >= 3 && sb->csum_blocks){ //la tabella dei checksum sul disco descrive i blocchi prima del replay
+        size_t bytes = (size_t)sb->csum_blocks * BLOCK_SIZE;
+        csum = malloc(bytes);
+        if(!csum || bdev_pread_bytes(dev, csum, bytes, (off_t)BLOCK_SIZE * sb->csum_start) != 0) result = -1;
+    }
+    if(head){
+        if(result != 0 || apply_txs(dev, NULL, sb, csum, head, NULL, 0) != 0 || fdatasync(dev->fd) != 0 ||
+           write_header(dev, sb->journal_start, sb->journal_blocks, seq) != 0){
+            printf("Errore nel replay del journal.\n");
+            result = -1;
+        }
+    }
+    free(csum);
+    free_txs(head);
+    return result == 0 ? (int)replayed : -1;
+}
+
+static int write_batch(struct journal *j, struct jtx *t, ui64 target){
+    //scrive le transazioni fino a target: quelle contigue nel log con una sola pwritev
+    struct iovec iov[64];
+    int result = 0;
+    while(t && t->seq <= target){
+        ui32 pos = t->pos, blocks = 0;
+        int n = 0;
+        while(t && t->seq <= target && t->pos == pos + blocks && n < 64){
+            iov[n].iov_base = t->image;
+            iov[n].iov_len = (size_t)t->blocks * BLOCK_SIZE;
+            blocks += t->blocks;
+            n++;
+            t = t->seq < target ? t->next : NULL; //oltre target la lista può essere allungata da queue_tx
+        }
+        off_t offset = (off_t)(j->start + pos) * BLOCK_SIZE;
+        ssize_t done;
+        do {
+            done = pwritev(j->fs->dev.fd, iov, n, offset);
+        } while(done < 0 && errno == EINTR);
+        if(done != (ssize_t)blocks * BLOCK_SIZE){
+            for(int i = 0; i < n; i++){ //scrittura parziale: si riscrive una transazione alla volta
+                if(bdev_pwrite_bytes(&j->fs->dev, iov[i].iov_base, iov[i].iov_len, offset) != 0) result = -1;
+                offset += (off_t)iov[i].iov_len;
+            }
+        }
+        pthread_mutex_lock(&j->lock);
+        j->stats.blocks += blocks;
+        pthread_mutex_unlock(&j->lock);
+    }
+    return result;
+}
+
+static void *commit_thread(void *arg){
+    //group commit: tutte le transazioni chiuse mentre la fdatasync precedente era in corso vanno insieme
+    struct journal *j = arg;
+    pthread_mutex_lock(&j->lock);
+    for(;;){
+        while(j->durableSeq == j->closedSeq && !j->stop){
+            pthread_cond_wait(&j->work, &j->lock);
+        }
+        if(j->durableSeq == j->closedSeq) break; //arresto senza nulla in sospeso
+        ui64 target = j->closedSeq;
+        struct jtx *first = j->txHead;
+        while(first && first->seq <= j->durableSeq) first = first->next;
+        bool ordered = false;
+        for(struct jtx *t = first; t && t->seq <= target; t = t->next) ordered |= t->ordered;
+        pthread_mutex_unlock(&j->lock);
+        int result = 0;
+        if(ordered && fdatasync(j->fs->dev.fd) != 0) result = -1; //i dati prima dei commit che li rendono raggiungibili
+        if(result == 0) result = write_batch(j, first, target);
+        if(result == 0 && fdatasync(j->fs->dev.fd) != 0) result = -1;
+        pthread_mutex_lock(&j->lock);
+        if(result != 0) j->failed = true;
+        j->durableSeq = target;
+        j->stats.commits++;
+        pthread_cond_broadcast(&j->done);
+    }
+    pthread_mutex_unlock(&j->lock);
+    return NULL;
+}
+
+struct journal *journal_open(struct filesystem *fs){
+    const struct superblock *sb = &fs->sb;
+    if(sb->journal_blocks < FS_JOURNAL_MIN || fs->dev.map) return NULL; //con la mappatura non c'è un ordine di scrittura da garantire
+    struct journal_header hdr;
+    if(read_header(&fs->dev, sb->journal_start, sb->journal_blocks, &hdr) != 0){
+        printf("Errore: header del journal non valido.\n");
+        return NULL;
+    }
+    struct journal *j = calloc(1, sizeof(struct journal));
+    if(!j) return NULL;
+    j->fs = fs;
+    j->start = sb->journal_start;
+    j->blocks = sb->journal_blocks;
+    ui32 buckets = 1;
+    while(buckets < j->blocks * 2) buckets <<= 1;
+    j->bucketMask = buckets - 1;
+    j->buckets = calloc(buckets, sizeof(struct jentry *));
+    j->memLimit = sb->journal_start;
+    j->memDirty = calloc(j->memLimit, sizeof(ui8));
+    j->memList = malloc(j->memLimit * sizeof(block_t));
+    j->nextSeq = hdr.seq;
+    j->closedSeq = j->durableSeq = hdr.seq - 1;
+    j->head = 1;
+    if(!j->buckets || !j->memDirty || !j->memList){
+        free(j->buckets);
+        free(j->memDirty);
+        free(j->memList);
+        free(j);
+        return NULL;
+    }
+    pthread_rwlock_init(&j->mapLock, NULL);
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_cond_init(&j->work, NULL);
+    pthread_cond_init(&j->done, NULL);
+    if(pthread_create(&j->thread, NULL, commit_thread, j) != 0){
+        pthread_rwlock_destroy(&j->mapLock);
+        pthread_mutex_destroy(&j->lock);
+        pthread_cond_destroy(&j->work);
+        pthread_cond_destroy(&j->done);
+        free(j->buckets);
+        free(j->memDirty);
+        free(j->memList);
+        free(j);
+        return NULL;
+    }
+    return j;
+}
+
+static inline ui32 entry_bucket(const struct journal *j, block_t block_num){
+    return (block_num * 2654435761u) & j->bucketMask;
+}
+
+static struct jentry *entry_find(struct journal *j, block_t block_num){
+    for(struct jentry *e = j->buckets[entry_bucket(j, block_num)]; e; e = e->next){
+        if(e->block == block_num) return e;
+    }
+    return NULL;
+}
+
+static void entry_remove(struct journal *j, struct jentry *e){
+    struct jentry **link = &j->buckets[entry_bucket(j, e->block)];
+    while(*link != e) link = &(*link)->next;
+    *link = e->next;
+    free(e->data);
+    free(e);
+}
+
+static int run_append(struct journal *j, block_t block_num, ui32 flags){
+    if(j->runCount == j->runCap){
+        ui32 cap = j->runCap ? j->runCap * 2 : 64;
+        struct journal_tag *run = realloc(j->run, cap * sizeof(struct journal_tag));
+        if(!run) return -1;
+        j->run = run;
+        j->runCap = cap;
+    }
+    j->run[j->runCount].block = block_num;
+    j->run[j->runCount].flags = flags;
+    j->runCount++;
+    return 0;
+}
+
+void journal_dirty_mem(struct journal *j, block_t block_num){
+    if(block_num >= j->memLimit) return;
+    pthread_rwlock_wrlock(&j->mapLock);
+    if(!j->memDirty[block_num]){
+        j->memDirty[block_num] = 1;
+        j->memList[j->memCount++] = block_num;
+    }
+    pthread_rwlock_unlock(&j->mapLock);
+}
+
+static int do_log(struct journal *j, block_t block_num, const void *data){
+    struct jentry *e = entry_find(j, block_num);
+    if(!e){
+        e = malloc(sizeof(struct jentry));
+        if(!e) return -1;
+        e->data = malloc(BLOCK_SIZE);
+        if(!e->data){
+            free(e);
+            return -1;
+        }
+        e->block = block_num;
+        e->tag = JOURNAL_NO_TAG;
+        ui32 b = entry_bucket(j, block_num);
+        e->next = j->buckets[b];
+        j->buckets[b] = e;
+    }
+    if(e->tag == JOURNAL_NO_TAG){
+        if(run_append(j, block_num, 0) != 0) return -1;
+        e->tag = j->runCount - 1;
+    }
+    memcpy(e->data, data, BLOCK_SIZE); //la transazione prende il contenuto quando viene chiusa
+    if(j->fs->cache){
+        bcache_invalidate(j->fs->cache, block_num); //le letture passano dal journal fino al checkpoint
+    }
+    return 0;
+}
+
+int journal_log(struct journal *j, block_t block_num, const void *data){
+    pthread_rwlock_wrlock(&j->mapLock);
+    int result = do_log(j, block_num, data);
+    pthread_rwlock_unlock(&j->mapLock);
+    return result;
+}
+
+int journal_read(struct journal *j, block_t block_num, void *buffer){
+    pthread_rwlock_rdlock(&j->mapLock);
+    struct jentry *e = entry_find(j, block_num);
+    if(e) memcpy(buffer, e->data, BLOCK_SIZE);
+    pthread_rwlock_unlock(&j->mapLock);
+    return e ? 0 : -1;
+}
+
+void journal_forget(struct journal *j, block_t block_num){
+    pthread_rwlock_wrlock(&j->mapLock);
+    struct jentry *e = entry_find(j, block_num);
+    if(!e){
+        if(j->fs->csum && __atomic_load_n(&j->fs->csum[block_num], __ATOMIC_RELAXED) != 0){
+            run_append(j, block_num, JOURNAL_TAG_REVOKE); //non registrato, ma il checkpoint deve azzerarne il checksum
+        }
+        pthread_rwlock_unlock(&j->mapLock);
+        return; //mai registrato dall'ultimo checkpoint: niente da revocare
+    }
+    if(e->tag != JOURNAL_NO_TAG){
+        j->run[e->tag].flags |= JOURNAL_TAG_REVOKE; //la transazione in corso non lo scrive più
+    } else {
+        run_append(j, block_num, JOURNAL_TAG_REVOKE);
+    }
+    if(j->fs->cache){
+        bcache_invalidate(j->fs->cache, block_num);
+    }
+    entry_remove(j, e);
+    pthread_rwlock_unlock(&j->mapLock);
+}
+
+int journal_ordered(struct journal *j, block_t block_num){
+    pthread_rwlock_wrlock(&j->mapLock);
+    int result = 0;
+    if(j->orderedCount == j->orderedCap){
+        ui32 cap = j->orderedCap ? j->orderedCap * 2 : 64;
+        block_t *ordered = realloc(j->ordered, cap * sizeof(block_t));
+        if(ordered){
+            j->ordered = ordered;
+            j->orderedCap = cap;
+        } else {
+            result = -1;
+        }
+    }
+    if(result == 0) j->ordered[j->orderedCount++] = block_num;
+    pthread_rwlock_unlock(&j->mapLock);
+    return result;
+}
+
+ui32 journal_tx_size(struct journal *j){
+    pthread_rwlock_rdlock(&j->mapLock);
+    ui32 n = j->memCount + j->runCount;
+    pthread_rwlock_unlock(&j->mapLock);
+    return n;
+}
+
+static int do_checkpoint(struct journal *j);
+
+static int queue_tx(struct journal *j, ui8 *image, ui32 blocks, bool ordered){
+    if(j->head + blocks > j->blocks && do_checkpoint(j) != 0){
+        return -1; //log pieno e checkpoint fallito
+    }
+    struct jtx *t = malloc(sizeof(struct jtx));
+    if(!t) return -1;
+    ui64 seq = j->nextSeq++;
+    struct journal_desc *desc = (struct journal_desc *)image;
+    struct journal_commit *c = (struct journal_commit *)(image + (size_t)(blocks - 1) * BLOCK_SIZE);
+    desc->seq = seq;
+    c->seq = seq;
+    c->csum_type = JOURNAL_CSUM_CRC32C;
+    c->checksum = journal_checksum(c->csum_type, image, (size_t)(blocks - 1) * BLOCK_SIZE);
+    t->next = NULL;
+    t->seq = seq;
+    t->pos = j->head;
+    t->blocks = blocks;
+    t->image = image;
+    t->ordered = ordered;
+    j->head += blocks;
+    pthread_mutex_lock(&j->lock);
+    if(j->txTail) j->txTail->next = t; else j->txHead = t;
+    j->txTail = t;
+    j->closedSeq = seq;
+    j->stats.transactions++;
+    pthread_cond_signal(&j->work);
+    pthread_mutex_unlock(&j->lock);
+    return 0;
+}
+
+ui64 journal_end_tx(struct journal *j){
+    //la transazione diventa un'immagine (descrittore, dati, commit) accodata al thread di commit. Prima i blocchi
+    //di dati che ha allocato vanno nella loro posizione, senza il lock della mappa (il flush passa dal buffer cache).
+    //Non viene mai divisa: se non sta in un descrittore o nel log viene rifiutata e il journal non conferma più nulla
+    pthread_rwlock_wrlock(&j->mapLock);
+    block_t *ordered = j->ordered;
+    ui32 orderedCount = j->orderedCount;
+    j->ordered = NULL;
+    j->orderedCount = j->orderedCap = 0;
+    pthread_rwlock_unlock(&j->mapLock);
+    bool dataFailed = orderedCount > 0 && fs_ordered_flush(j->fs, ordered, orderedCount) != 0;
+    free(ordered);
+    if(dataFailed) printf("Errore nella scrittura dei dati della transazione: non viene confermata.\n");
+
+    pthread_rwlock_wrlock(&j->mapLock);
+    ui32 total = j->memCount + j->runCount;
+    ui32 data = j->memCount;
+    for(ui32 k = 0; k < j->runCount; k++){
+        if(!(j->run[k].flags & JOURNAL_TAG_REVOKE)) data++;
+    }
+    pthread_mutex_lock(&j->lock);
+    bool failed = j->failed || dataFailed;
+    pthread_mutex_unlock(&j->lock);
+    if(total > 0 && !failed && (total > JOURNAL_MAX_TAGS || data > j->blocks - 3)){ //header, descrittore e commit
+        printf("Errore: transazione di %u blocchi troppo grande per il journal: non viene confermata.\n", total);
+        failed = true;
+    }
+    ui32 blocks = data + 2;
+    ui8 *image = total > 0 && !failed ? aligned_alloc(BLOCK_SIZE, (size_t)blocks * BLOCK_SIZE) : NULL;
+    if(image){
+        memset(image, 0, BLOCK_SIZE);
+        memset(image + (size_t)(blocks - 1) * BLOCK_SIZE, 0, BLOCK_SIZE);
+        struct journal_desc *desc = (struct journal_desc *)image;
+        struct journal_commit *c = (struct journal_commit *)(image + (size_t)(blocks - 1) * BLOCK_SIZE);
+        desc->magic = JOURNAL_DESC_MAGIC;
+        c->magic = JOURNAL_COMMIT_MAGIC;
+        ui8 *out = image + BLOCK_SIZE;
+        for(ui32 i = 0; i < total; i++){
+            struct journal_tag tag;
+            if(i < j->memCount){
+                tag.block = j->memList[i];
+                tag.flags = 0;
+                fs_meta_snapshot(j->fs, tag.block, out);
+            } else {
+                tag = j->run[i - j->memCount];
+                if(!(tag.flags & JOURNAL_TAG_REVOKE)){
+                    struct jentry *e = entry_find(j, tag.block);
+                    memcpy(out, e->data, BLOCK_SIZE);
+                }
+            }
+            desc->tags[desc->count++] = tag;
+            if(!(tag.flags & JOURNAL_TAG_REVOKE)) out += BLOCK_SIZE;
+        }
+        if(queue_tx(j, image, blocks, orderedCount > 0) != 0){
+            free(image);
+            failed = true;
+        }
+    } else if(total > 0){
+        failed = true;
+    }
+    if(failed){
+        pthread_mutex_lock(&j->lock);
+        j->failed = true;
+        pthread_mutex_unlock(&j->lock);
+    }
+    for(ui32 k = 0; k < j->memCount; k++){
+        j->memDirty[j->memList[k]] = 0;
+    }
+    for(ui32 k = 0; k < j->runCount; k++){
+        if(j->run[k].flags & JOURNAL_TAG_REVOKE) continue;
+        struct jentry *e = entry_find(j, j->run[k].block);
+        if(e) e->tag = JOURNAL_NO_TAG; //da qui in poi appartiene a una transazione chiusa
+    }
+    j->memCount = 0;
+    j->runCount = 0;
+    ui64 seq = j->nextSeq - 1;
+    pthread_rwlock_unlock(&j->mapLock);
+    return seq;
+}
+
+int journal_wait(struct journal *j, ui64 seq){
+    pthread_mutex_lock(&j->lock);
+    while(j->durableSeq < seq && j->closedSeq >= seq){
+        pthread_cond_wait(&j->done, &j->lock);
+    }
+    int result = j->failed ? -1 : 0;
+    pthread_mutex_unlock(&j->lock);
+    return result;
+}
+
+static int do_checkpoint(struct journal *j){
+    //1. tutte le transazioni chiuse sul log, 2. i loro blocchi nella posizione definitiva,
+    //3. header con la nuova sequenza di partenza: da qui il log può ripartire dall'inizio
+    pthread_mutex_lock(&j->lock);
+    ui64 target = j->closedSeq;
+    pthread_mutex_unlock(&j->lock);
+    if(journal_wait(j, target) != 0) return -1;
+    pthread_mutex_lock(&j->lock);
+    struct jtx *txs = j->txHead;
+    j->txHead = j->txTail = NULL;
+    pthread_mutex_unlock(&j->lock);
+    struct journal_tag *revokes = malloc((j->runCount ? j->runCount : 1) * sizeof(struct journal_tag));
+    ui32 nrev = 0;
+    for(ui32 k = 0; revokes && k < j->runCount; k++){
+        if(j->run[k].flags & JOURNAL_TAG_REVOKE) revokes[nrev++] = j->run[k];
+    }
+    int result = (revokes && apply_txs(&j->fs->dev, j->fs->cache, &j->fs->sb, j->fs->csum, txs, revokes, nrev) == 0) ? 0 : -1;
+    free(revokes);
+    if(result == 0 && fdatasync(j->fs->dev.fd) != 0) result = -1;
+    if(result == 0) result = write_header(&j->fs->dev, j->start, j->blocks, j->nextSeq);
+    if(result != 0){
+        pthread_mutex_lock(&j->lock);
+        j->txHead = txs; //le transazioni restano sul log: il replay le riapplicherà
+        j->txTail = txs;
+        while(j->txTail && j->txTail->next) j->txTail = j->txTail->next;
+        j->failed = true;
+        pthread_mutex_unlock(&j->lock);
+        return -1;
+    }
+    free_txs(txs);
+    j->head = 1;
+    for(ui32 b = 0; b <= j->bucketMask; b++){ //i blocchi delle transazioni chiuse ora si leggono dalla loro posizione
+        struct jentry *e = j->buckets[b];
+        while(e){
+            struct jentry *next = e->next;
+            if(e->tag == JOURNAL_NO_TAG) entry_remove(j, e);
+            e = next;
+        }
+    }
+    pthread_mutex_lock(&j->lock);
+    j->stats.checkpoints++;
+    pthread_mutex_unlock(&j->lock);
+    return 0;
+}
+
+int journal_checkpoint(struct journal *j){
+    pthread_rwlock_wrlock(&j->mapLock);
+    int result = do_checkpoint(j);
+    pthread_rwlock_unlock(&j->mapLock);
+    return result;
+}
+
+int journal_close(struct journal *j){
+    if(!j) return 0;
+    journal_end_tx(j);
+    int result = journal_checkpoint(j);
+    pthread_mutex_lock(&j->lock);
+    j->stop = true;
+    pthread_cond_signal(&j->work);
+    pthread_mutex_unlock(&j->lock);
+    pthread_join(j->thread, NULL);
+    pthread_rwlock_destroy(&j->mapLock);
+    pthread_mutex_destroy(&j->lock);
+    pthread_cond_destroy(&j->work);
+    pthread_cond_destroy(&j->done);
+    for(ui32 b = 0; b <= j->bucketMask; b++){
+        while(j->buckets[b]) entry_remove(j, j->buckets[b]);
+    }
+    free_txs(j->txHead);
+    free(j->buckets);
+    free(j->run);
+    free(j->memDirty);
+    free(j->memList);
+    free(j->ordered);
+    free(j);
+    return result;
+}
+
+void journal_get_stats(struct journal *j, struct journal_stats *out){
+    pthread_mutex_lock(&j->lock);
+    *out = j->stats;
+    pthread_mutex_unlock(&j->lock);
+}
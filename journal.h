@@ -0,0 +1,88 @@
+#ifndef MY_JOURNAL_H
+#define MY_JOURNAL_H
+
+#include "FS.h"
+
+/*
+Journal dei metadati (write-ahead, a blocchi fisici, in stile jbd).
+L'area [journal_start, journal_start + journal_blocks) contiene nel primo blocco un header con la
+sequenza della prima transazione non ancora riportata a casa, poi il log. Ogni transazione è un
+blocco descrittore (sequenza e lista dei blocchi), le copie dei blocchi e un blocco di commit con
+il checksum (CRC32C): una transazione senza commit valido viene ignorata al replay.
+
+Bitmap e tabella degli inode sono in memoria: la transazione ne fotografa i blocchi sporchi quando
+viene chiusa. Gli altri metadati (bucket di directory, blocchi indiretti, foglie di extent) passano
+da journal_log e restano in una mappa in memoria fino al checkpoint, che li scrive nella loro
+posizione e aggiorna i loro checksum nella tabella dei checksum (lo stesso fa il replay). Le transazioni chiuse vengono scritte da un thread di group commit: tutte quelle in coda
+con una sola scrittura sequenziale e una sola fdatasync.
+I dati dei file non passano dal journal, ma sono ordinati (come il data=ordered di ext3): i blocchi che una
+transazione ha allocato (journal_ordered) vengono scritti nella loro posizione quando la transazione si chiude, e il
+thread di commit fa una fdatasync prima di scrivere il suo commit. Dopo un crash un puntatore confermato non indica
+mai il contenuto precedente del blocco (per esempio i dati di un file eliminato). Le sovrascritture di blocchi già
+del file non sono ordinate: dopo un crash il file può contenere una parte della scrittura.
+Una transazione non viene mai divisa: deve stare in un descrittore (JOURNAL_MAX_TAGS) e nel log. Le operazioni lunghe
+si dividono da sole tra più transazioni in punti coerenti (FS_TX_CHUNK); una transazione più grande viene rifiutata
+e da lì il journal non conferma più nulla.
+Tutte le funzioni possono essere chiamate da più thread: la transazione in corso è protetta da un lock
+lettore/scrittore (journal_read in lettura, le altre in scrittura).
+*/
+
+#define JOURNAL_MAGIC 0x4A524E4C        //"JRNL": header dell'area
+#define JOURNAL_DESC_MAGIC 0x4A444553   //blocco descrittore
+#define JOURNAL_COMMIT_MAGIC 0x4A434D54 //blocco di commit
+#define JOURNAL_TAG_REVOKE 0x1          //il blocco è stato liberato: le versioni precedenti non vanno riapplicate
+
+struct journal_header {
+    ui32 magic;
+    ui32 blocks; //dimensione dell'area, header compreso
+    ui64 seq;    //prima transazione da cercare nel log
+};
+
+struct journal_tag {
+    ui32 block; //blocco di destinazione
+    ui32 flags; //JOURNAL_TAG_*
+};
+
+struct journal_desc {
+    ui32 magic;
+    ui32 count; //tag che seguono; solo quelli senza REVOKE hanno un blocco di dati nel log
+    ui64 seq;
+    struct journal_tag tags[];
+};
+
+#define JOURNAL_CSUM_FNV 0    //FNV-1a: log scritti prima del CRC32C
+#define JOURNAL_CSUM_CRC32C 1
+
+struct journal_commit {
+    ui32 magic;
+    ui32 checksum; //sul descrittore e sui blocchi di dati
+    ui64 seq;
+    ui32 csum_type; //JOURNAL_CSUM_*
+};
+
+#define JOURNAL_MAX_TAGS ((BLOCK_SIZE - sizeof(struct journal_desc)) / sizeof(struct journal_tag))
+
+struct journal_stats {
+    ui64 transactions; //transazioni chiuse
+    ui64 commits;      //scritture di gruppo (una fdatasync ciascuna)
+    ui64 blocks;       //blocchi scritti nel log, descrittori e commit compresi
+    ui64 checkpoints;
+};
+
+struct journal;
+
+int journal_replay(struct blockdev *dev, const struct superblock *sb); //riapplica le transazioni complete
+struct journal *journal_open(struct filesystem *fs);
+int journal_close(struct journal *j); //chiude la transazione in corso, checkpoint e arresto del thread
+void journal_dirty_mem(struct journal *j, block_t block_num); //blocco della bitmap o della tabella degli inode
+int journal_log(struct journal *j, block_t block_num, const void *data);
+int journal_read(struct journal *j, block_t block_num, void *buffer); //ultima versione registrata, -1 se assente
+void journal_forget(struct journal *j, block_t block_num); //il blocco è stato liberato
+int journal_ordered(struct journal *j, block_t block_num); //blocco di dati appena allocato: scritto prima del commit
+ui32 journal_tx_size(struct journal *j); //blocchi nella transazione in corso
+ui64 journal_end_tx(struct journal *j); //chiude la transazione in corso e la accoda, ritorna la sua sequenza
+int journal_wait(struct journal *j, ui64 seq); //attende che seq sia sul disco
+int journal_checkpoint(struct journal *j);
+void journal_get_stats(struct journal *j, struct journal_stats *out);
+
+#endif
@@ -0,0 +1,102 @@
+#include "../FS.h"
+#include "../aio.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Queue-depth benchmark: random 4 KB block reads over a fully written image,
+// synchronous read path vs the async engine at increasing queue depths.
+// The image is opened with O_DIRECT (when supported) so reads reach the device.
+
+#define READS 20000
+
+static double now_s(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned seed = 7;
+static block_t random_block(struct filesystem *fs){
+    seed = seed * 1103515245u + 12345u;
+    return fs->sb.data_start + (seed >> 8) % (fs->sb.total_blocks - fs->sb.data_start);
+}
+
+struct slot {
+    struct aio_engine *eng;
+    struct filesystem *fs;
+    ui8 *buffer;
+    ui32 *issued;
+    ui32 *completed;
+};
+
+static void on_read(void *arg, int result){
+    struct slot *s = arg;
+    (void)result;
+    (*s->completed)++;
+    if (*s->issued < READS){ // keep the queue full: every completion issues the next read
+        (*s->issued)++;
+        aio_submit_read(s->eng, random_block(s->fs), s->buffer, on_read, s);
+    }
+}
+
+int main(void){
+    const char *img = "bench_aio.img";
+    init_fs(img, MAX_BLOCKS);
+    // write every data block once so the image is fully allocated on disk
+    struct filesystem *setup = open_fs(img, false, false);
+    static char block[BLOCK_SIZE];
+    for (block_t b = setup->sb.data_start; b < setup->sb.total_blocks; b++){
+        memset(block, (int)b, BLOCK_SIZE);
+        write_block(setup->img, b, block);
+    }
+    close_fs(setup);
+
+    struct fs_options opts = { .cache_blocks = 0, .direct_io = true };
+    struct filesystem *fs = open_fs_opts(img, &opts);
+    if (!fs){
+        opts.direct_io = false; // e.g. tmpfs: fall back to buffered I/O
+        fs = open_fs_opts(img, &opts);
+    }
+    if (!fs){
+        printf("open_fs_opts failed\n");
+        return 1;
+    }
+    printf("random 4 KB reads, %d per run, O_DIRECT=%s\n", READS, opts.direct_io ? "yes" : "no");
+
+    ui8 *buf = aligned_alloc(BLOCK_SIZE, BLOCK_SIZE);
+    double t0 = now_s();
+    for (int i = 0; i < READS; i++) fs_read_block(fs, random_block(fs), buf);
+    double sync_iops = READS / (now_s() - t0);
+    printf("  sync read_block  : %10.0f IOPS\n", sync_iops);
+    free(buf);
+
+    ui32 depths[] = { 1, 2, 4, 8, 16, 32, 64 };
+    for (ui32 d = 0; d < sizeof(depths) / sizeof(depths[0]); d++){
+        ui32 qd = depths[d];
+        struct aio_engine *eng = aio_create(fs, qd, qd);
+        if (!eng){
+            printf("aio_create failed\n");
+            return 1;
+        }
+        ui32 issued = 0, completed = 0;
+        struct slot *slots = calloc(qd, sizeof(struct slot));
+        ui8 *pool = aligned_alloc(BLOCK_SIZE, (size_t)qd * BLOCK_SIZE);
+        t0 = now_s();
+        for (ui32 i = 0; i < qd; i++){
+            slots[i] = (struct slot){ eng, fs, pool + (size_t)i * BLOCK_SIZE, &issued, &completed };
+            issued++;
+            aio_submit_read(eng, random_block(fs), slots[i].buffer, on_read, &slots[i]);
+        }
+        aio_submit(eng);
+        while (completed < READS) aio_poll(eng, 1);
+        double iops = READS / (now_s() - t0);
+        printf("  %-11s QD=%-3u: %10.0f IOPS (%5.2fx sync)\n", aio_backend_name(eng), qd, iops, iops / sync_iops);
+        aio_destroy(eng);
+        free(slots);
+        free(pool);
+    }
+    close_fs(fs);
+    remove(img);
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include "../FS.h"
+#include "../crc32c.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Cost of the metadata checksums: raw CRC32C throughput of each kernel on 4 KB blocks, then the
+// same workload on an image made with and without checksums (group-committed creates, lookups
+// from the cache, lookups right after a mount that read and verify every bucket from disk).
+// With the journal the checksums are computed by the checkpoint, so creates should cost the same.
+// Each figure is the best of RUNS runs.
+
+#define FILES 800 //the twelve buckets of a directory hold a bit more than this
+#define PASSES 200 //cached lookups are repeated to get past the timer resolution
+#define MOUNTS 20  //and so are the mounts followed by lookups from disk
+#define GROUP 64
+#define RUNS 5
+#define CRC_BLOCKS 65536
+
+static double now_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void kernels(void){
+    static ui8 block[BLOCK_SIZE];
+    for (size_t i = 0; i < sizeof(block); i++) block[i] = (ui8)(i * 7 + 3);
+    for (int k = 0; k < CRC_KERNEL_COUNT; k++){
+        if (crc32c_select_kernel(k) != 0){
+            printf("%-12s not supported by this CPU\n", crc32c_kernel_name(k));
+            continue;
+        }
+        volatile ui32 sink = 0;
+        double best = 1e30;
+        for (int r = 0; r < RUNS; r++){
+            double t0 = now_ms();
+            for (int i = 0; i < CRC_BLOCKS; i++) sink ^= crc32c(0, block, sizeof(block));
+            double t = now_ms() - t0;
+            if (t < best) best = t;
+        }
+        (void)sink;
+        printf("%-12s %8.0f MB/s %8.0f ns per block\n", crc32c_kernel_name(k),
+               CRC_BLOCKS * (double)BLOCK_SIZE / (best / 1000.0) / 1e6, best * 1e6 / CRC_BLOCKS);
+    }
+    crc32c_select_kernel(CRC_KERNEL_AUTO);
+}
+
+struct times { double create, warm, cold; };
+
+static int lookups(struct filesystem *fs, inode_t dir){
+    struct inode res;
+    char name[32];
+    int missing = 0;
+    for (int i = 0; i < FILES; i++){
+        snprintf(name, sizeof(name), "file%d", i);
+        if (dir_lookup(fs, &fs->inodeTable[dir], name, &res, NULL) != 0) missing++;
+    }
+    return missing;
+}
+
+static int run(bool checksums, struct times *t){
+    const char *img = "bench_checksum.img";
+    struct mkfs_options mk = { .no_checksums = !checksums };
+    struct fs_options opts = { .cache_blocks = FS_DEFAULT_CACHE_BLOCKS, .journal = true };
+    if (init_fs_opts(img, MAX_BLOCKS, &mk) != 0) return -1;
+    struct filesystem *fs = open_fs_opts(img, &opts);
+    if (!fs) return -1;
+    inode_t root = inode_alloc(fs), dir;
+    struct inode res;
+    char name[32];
+    if (fs_create_file(fs, root, "d", FS_CREATE_DIR) != 0 || dir_lookup(fs, &fs->inodeTable[root], "d", &res, &dir) != 0){
+        close_fs(fs);
+        return -1;
+    }
+    fs_flush(fs);
+    double t0 = now_ms();
+    for (int i = 0; i < FILES; i++){
+        snprintf(name, sizeof(name), "file%d", i);
+        fs_create_file(fs, dir, name, 0);
+        if ((i + 1) % GROUP == 0 || i + 1 == FILES) fs_journal_wait(fs, fs_journal_commit(fs));
+    }
+    t->create = now_ms() - t0;
+    t0 = now_ms();
+    int missing = 0;
+    for (int p = 0; p < PASSES; p++) missing += lookups(fs, dir);
+    t->warm = now_ms() - t0;
+    close_fs(fs);
+
+    t->cold = 0;
+    for (int m = 0; m < MOUNTS; m++){
+        fs = open_fs_opts(img, &opts);
+        if (!fs) return -1;
+        t0 = now_ms();
+        missing += lookups(fs, dir);
+        t->cold += now_ms() - t0;
+        close_fs(fs);
+    }
+    remove(img);
+    return missing ? -1 : 0;
+}
+
+static void keep_best(bool checksums, struct times *best){
+    struct times t;
+    if (run(checksums, &t) != 0){
+        printf("%s: run failed\n", checksums ? "checksums" : "no checksums");
+        return;
+    }
+    if (t.create < best->create) best->create = t.create;
+    if (t.warm < best->warm) best->warm = t.warm;
+    if (t.cold < best->cold) best->cold = t.cold;
+}
+
+static void row(const char *label, double off, double on){
+    printf("%-24s %10.0f ops/s %10.0f ops/s %+7.1f%%\n", label, FILES / (off / 1000.0), FILES / (on / 1000.0), (on - off) / off * 100.0);
+}
+
+int main(void){
+    printf("CRC32C on %d blocks of %d bytes\n", CRC_BLOCKS, BLOCK_SIZE);
+    kernels();
+    struct times off = { 1e30, 1e30, 1e30 }, on = off;
+    for (int r = 0; r < RUNS; r++){ //alternated, so that a slower phase of the machine hits both
+        keep_best(false, &off);
+        keep_best(true, &on);
+    }
+    printf("\n%d files in one directory, journal + cache, kernel %s\n", FILES, crc32c_kernel_name(crc32c_active_kernel()));
+    printf("%-24s %16s %16s %8s\n", "", "no checksums", "checksums", "cost");
+    row("creates (group commit)", off.create, on.create);
+    row("lookups, cached", off.warm / PASSES, on.warm / PASSES);
+    row("lookups after mount", off.cold / MOUNTS, on.cold / MOUNTS);
+    return 0;
+}
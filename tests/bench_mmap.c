@@ -0,0 +1,72 @@
+#include "../FS.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Compares the mmap mount mode with the pread path (with and without the block cache)
+// on mount time, a lookup-heavy and an allocation-heavy workload.
+
+#define NFILES 150
+#define LOOKUPS 200000
+#define CHURN 20000
+
+static double now_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void run(const char *label, const struct fs_options *opts){
+    const char *img = "bench_mmap.img";
+    char name[32];
+    init_fs(img, MAX_BLOCKS);
+
+    double t0 = now_ms();
+    struct filesystem *fs = open_fs_opts(img, opts);
+    double t_mount = now_ms() - t0;
+    if (!fs){
+        printf("%-14s: open_fs_opts failed\n", label);
+        return;
+    }
+
+    inode_t dir = inode_alloc(fs);
+    for (int i = 0; i < NFILES; i++){
+        snprintf(name, sizeof(name), "file_%03d.cfg", i);
+        fs_create_file(fs, dir, name, 0);
+    }
+
+    // lookup-heavy: resolve random names of a full directory
+    struct inode result;
+    inode_t num;
+    unsigned seed = 42;
+    t0 = now_ms();
+    for (int i = 0; i < LOOKUPS; i++){
+        seed = seed * 1103515245u + 12345u;
+        snprintf(name, sizeof(name), "file_%03u.cfg", (seed >> 16) % NFILES);
+        dir_lookup(fs, &fs->inodeTable[dir], name, &result, &num);
+    }
+    double t_lookup = now_ms() - t0;
+
+    // allocation-heavy: create and delete a file over and over
+    t0 = now_ms();
+    for (int i = 0; i < CHURN; i++){
+        fs_create_file(fs, dir, "churn.tmp", 0);
+        fs_delete_file(fs, &fs->inodeTable[dir], "churn.tmp");
+    }
+    double t_churn = now_ms() - t0;
+
+    printf("%-14s: mount %7.3f ms | %d lookups %8.2f ms (%6.2f us/op) | %d create+delete %8.2f ms (%6.2f us/op)\n",
+           label, t_mount, LOOKUPS, t_lookup, t_lookup * 1e3 / LOOKUPS, CHURN, t_churn, t_churn * 1e3 / CHURN);
+    close_fs(fs);
+    remove(img);
+}
+
+int main(void){
+    struct fs_options pread_nocache = { .cache_blocks = 0 };
+    struct fs_options pread_cache = { .cache_blocks = FS_DEFAULT_CACHE_BLOCKS };
+    struct fs_options mapped = { .use_mmap = true };
+    run("pread", &pread_nocache);
+    run("pread + cache", &pread_cache);
+    run("mmap", &mapped);
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "../FS.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+// Thread-safe mode scaling: the same total number of creates and lookups split among 1, 2, 4, 8 and 16
+// threads, each working in its own directory. Speedup is relative to one thread; linear scaling would
+// match the thread count (as long as there are that many CPUs: the program prints how many it sees).
+
+#define CREATES 960     //divisibile per 16; resta sotto MAX_INODES
+#define LOOKUPS 192000
+
+static struct filesystem *fs;
+static inode_t dirs[16];
+static int nthreads;
+static pthread_barrier_t barrier;
+
+static double now_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void *create_worker(void *arg){
+    int t = (int)(long)arg;
+    char name[32];
+    pthread_barrier_wait(&barrier);
+    for (int i = 0; i < CREATES / nthreads; i++){
+        snprintf(name, sizeof(name), "file%d", i);
+        fs_create_file(fs, dirs[t], name, 0);
+    }
+    return NULL;
+}
+
+static void *lookup_worker(void *arg){
+    int t = (int)(long)arg;
+    int per = CREATES / nthreads;
+    char name[32];
+    struct inode res;
+    pthread_barrier_wait(&barrier);
+    for (int i = 0; i < LOOKUPS / nthreads; i++){
+        snprintf(name, sizeof(name), "file%d", i % per);
+        dir_lookup(fs, &fs->inodeTable[dirs[t]], name, &res, NULL);
+    }
+    return NULL;
+}
+
+static double timed(void *(*fn)(void *)){
+    pthread_t th[16];
+    pthread_barrier_init(&barrier, NULL, (unsigned)nthreads + 1);
+    for (long t = 0; t < nthreads; t++) pthread_create(&th[t], NULL, fn, (void *)t);
+    pthread_barrier_wait(&barrier);
+    double t0 = now_ms();
+    for (int t = 0; t < nthreads; t++) pthread_join(th[t], NULL);
+    double ms = now_ms() - t0;
+    pthread_barrier_destroy(&barrier);
+    return ms;
+}
+
+int main(void){
+    const char *img = "bench_threads.img";
+    printf("%d creates and %d lookups split among the threads, %ld CPUs online\n", CREATES, LOOKUPS, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %12s %8s %12s %8s\n", "threads", "creates/s", "speedup", "lookups/s", "speedup");
+    double baseCreate = 0, baseLookup = 0;
+    for (nthreads = 1; nthreads <= 16; nthreads *= 2){
+        init_fs(img, MAX_BLOCKS);
+        struct fs_options opts = { .cache_blocks = FS_DEFAULT_CACHE_BLOCKS, .journal = true, .thread_safe = true };
+        fs = open_fs_opts(img, &opts);
+        if (!fs){
+            printf("open_fs_opts failed\n");
+            return 1;
+        }
+        inode_t root = inode_alloc(fs);
+        char name[32];
+        struct inode res;
+        for (int t = 0; t < nthreads; t++){ // directories spread over the allocation groups
+            snprintf(name, sizeof(name), "dir%d", t);
+            fs_create_file(fs, root, name, FS_CREATE_DIR);
+            dir_lookup(fs, &fs->inodeTable[root], name, &res, &dirs[t]);
+        }
+        double create = CREATES / (timed(create_worker) / 1000.0);
+        double lookup = LOOKUPS / (timed(lookup_worker) / 1000.0);
+        if (nthreads == 1){
+            baseCreate = create;
+            baseLookup = lookup;
+        }
+        printf("%8d %12.0f %7.2fx %12.0f %7.2fx\n", nthreads, create, create / baseCreate, lookup, lookup / baseLookup);
+        close_fs(fs);
+        remove(img);
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "../FS.h"
+#include "../aio.h"
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+
+// async lookups driven by a small poll() event loop, checked against the synchronous versions
+
+struct result {
+    bool done;
+    int status;
+    inode_t inodeNum;
+};
+
+static void on_lookup(void *arg, int status, inode_t inodeNum){
+    struct result *r = arg;
+    r->done = true;
+    r->status = status;
+    r->inodeNum = inodeNum;
+}
+
+static void run_loop(struct aio_engine *eng, struct result *r){
+    struct pollfd pfd = { .fd = aio_event_fd(eng), .events = POLLIN };
+    while (!r->done){
+        if (pfd.fd >= 0) poll(&pfd, 1, 1000);
+        aio_poll(eng, 0);
+    }
+}
+
+static int check(struct aio_engine *eng, const char *label, int (*start)(struct aio_engine *, struct result *), int status, inode_t expected){
+    struct result r = { 0 };
+    if (start(eng, &r) != 0){
+        printf("  FAIL: %s could not be submitted\n", label);
+        return 1;
+    }
+    run_loop(eng, &r);
+    if (r.status != status || (status == 0 && r.inodeNum != expected)){
+        printf("  FAIL: %s -> status %d inode %u (expected %d / %u)\n", label, r.status, r.inodeNum, status, expected);
+        return 1;
+    }
+    printf("  PASS: %s -> status %d inode %d\n", label, r.status, status == 0 ? (int)r.inodeNum : -1);
+    return 0;
+}
+
+static struct filesystem *fs;
+static inode_t root, etc, passwd;
+
+static int lookup_etc(struct aio_engine *eng, struct result *r){ return aio_dir_lookup(eng, &fs->inodeTable[root], "etc", on_lookup, r); }
+static int lookup_missing(struct aio_engine *eng, struct result *r){ return aio_dir_lookup(eng, &fs->inodeTable[root], "nope", on_lookup, r); }
+static int path_passwd(struct aio_engine *eng, struct result *r){ return aio_path_solver(eng, "/etc/passwd", on_lookup, r); }
+static int path_root(struct aio_engine *eng, struct result *r){ return aio_path_solver(eng, "/", on_lookup, r); }
+static int path_missing(struct aio_engine *eng, struct result *r){ return aio_path_solver(eng, "/etc/shadow", on_lookup, r); }
+
+int main(void){
+    const char *img = "aio_test.img";
+    int fails = 0;
+    if (init_fs(img, 1024) != 0) return 1;
+    struct fs_options opts = { .cache_blocks = 0 }; // no cache: every block read goes through the engine
+    fs = open_fs_opts(img, &opts);
+    if (!fs) return 1;
+
+    root = inode_alloc(fs);            // inode 0
+    etc = inode_alloc(fs);
+    passwd = inode_alloc(fs);
+    char name[32];
+    for (int i = 0; i < 40; i++){      // spread the root directory over several blocks
+        snprintf(name, sizeof(name), "filler_%02d", i);
+        fs_create_file(fs, root, name, 0);
+    }
+    dir_add_entry(fs, root, "etc", etc);
+    dir_add_entry(fs, etc, "passwd", passwd);
+
+    struct aio_engine *eng = aio_create(fs, 16, 4);
+    if (!eng){
+        printf("aio_create failed\n");
+        return 1;
+    }
+    printf("backend: %s\n", aio_backend_name(eng));
+    fails += check(eng, "aio_dir_lookup(etc)", lookup_etc, 0, etc);
+    fails += check(eng, "aio_dir_lookup(nope)", lookup_missing, -1, 0);
+    fails += check(eng, "aio_path_solver(/etc/passwd)", path_passwd, 0, passwd);
+    fails += check(eng, "aio_path_solver(/)", path_root, 0, root);
+    fails += check(eng, "aio_path_solver(/etc/shadow)", path_missing, -1, 0);
+
+    struct inode sync_result;
+    if (path_solver(fs, "/etc/passwd", &sync_result) != 0 || memcmp(&sync_result, &fs->inodeTable[passwd], sizeof(struct inode)) != 0){
+        printf("  FAIL: synchronous path_solver disagrees\n");
+        fails++;
+    }
+    if (aio_pending(eng) != 0){ printf("  FAIL: requests left in flight\n"); fails++; }
+    aio_destroy(eng);
+    close_fs(fs);
+    remove(img);
+    if (fails == 0) printf("All aio tests passed\n");
+    else printf("%d aio tests failed\n", fails);
+    return fails ? 1 : 0;
+}
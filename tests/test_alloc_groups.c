@@ -0,0 +1,97 @@
+#include "../FS.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+// allocation groups: directories spread over the inode groups, files follow their directory
+// (inode and data blocks), threads in thread-safe mode start from different groups
+
+static ui32 data_group(struct filesystem *fs, block_t b){
+    return (b - fs->sb.data_start) / FS_GROUP_BLOCKS;
+}
+
+static ui32 group_of_inode(struct filesystem *fs, inode_t ino){
+    return (ino / FS_GROUP_INODES) * fs->groupCount / fs->inodeGroups;
+}
+
+static struct filesystem *tsfs;
+static inode_t threadInode[2];
+
+static void *alloc_one(void *arg){
+    threadInode[(long)arg] = inode_alloc(tsfs);
+    return NULL;
+}
+
+int main(void){
+    const char *img = "groups_test.img";
+    int fails = 0;
+    if (init_fs(img, MAX_BLOCKS) != 0){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    struct filesystem *fs = open_fs_opts(img, NULL);
+    if (!fs){
+        printf("open_fs_opts failed\n");
+        return 1;
+    }
+    printf("%u data groups, %u inode groups\n", fs->groupCount, fs->inodeGroups);
+    inode_t root = inode_alloc(fs);
+    inode_t dirs[2];
+    struct inode res;
+    const char *names[2] = { "a", "b" };
+    for (int d = 0; d < 2; d++){
+        if (fs_create_file(fs, root, names[d], FS_CREATE_DIR) != 0 || dir_lookup(fs, &fs->inodeTable[root], names[d], &res, &dirs[d]) != 0){
+            printf("FAIL: mkdir %s\n", names[d]); fails++;
+            dirs[d] = root;
+        }
+    }
+    ui32 ga = dirs[0] / FS_GROUP_INODES, gb = dirs[1] / FS_GROUP_INODES;
+    if (ga == root / FS_GROUP_INODES || gb == root / FS_GROUP_INODES || ga == gb){
+        printf("FAIL: directories in inode groups %u and %u (root in %u)\n", ga, gb, root / FS_GROUP_INODES); fails++;
+    }
+
+    char name[32], data[3 * BLOCK_SIZE];
+    memset(data, 'g', sizeof(data));
+    int stray = 0;
+    for (int d = 0; d < 2; d++){
+        for (int i = 0; i < 10; i++){
+            snprintf(name, sizeof(name), "f%d", i);
+            inode_t num;
+            if (fs_create_file(fs, dirs[d], name, 0) != 0 || dir_lookup(fs, &fs->inodeTable[dirs[d]], name, &res, &num) != 0){ fails++; continue; }
+            if (num / FS_GROUP_INODES != dirs[d] / FS_GROUP_INODES) stray++;
+            if (fs_pwrite(fs, num, data, sizeof(data), 0) != (ssize_t)sizeof(data)){ fails++; continue; }
+            const struct extent *e = &fs->inodeTable[num].extents.e[0];
+            if (data_group(fs, e->pstart) != group_of_inode(fs, num) || data_group(fs, e->pstart + e->len - 1) != group_of_inode(fs, num)) stray++;
+        }
+        for (int b = 0; b < INODE_DIRECT; b++){ // the directory's own buckets
+            block_t bucket = fs->inodeTable[dirs[d]].directBlocks[b];
+            if (bucket && data_group(fs, bucket) != group_of_inode(fs, dirs[d])) stray++;
+        }
+    }
+    if (stray){ printf("FAIL: %d inodes or blocks outside their directory's group\n", stray); fails++; }
+    if (fs_check_bitmap(fs) != 0){ printf("FAIL: fsck\n"); fails++; }
+    printf("directories in inode groups %u and %u, files and data alongside: %s\n", ga, gb, stray ? "FAIL" : "PASS");
+    close_fs(fs);
+
+    // thread-safe mode: each thread gets its own group for allocations without a directory
+    struct fs_options opts = { .cache_blocks = FS_DEFAULT_CACHE_BLOCKS, .journal = true, .thread_safe = true };
+    tsfs = open_fs_opts(img, &opts);
+    if (!tsfs){
+        printf("FAIL: open thread-safe\n");
+        return 1;
+    }
+    pthread_t th[2];
+    for (long t = 0; t < 2; t++){
+        pthread_create(&th[t], NULL, alloc_one, (void *)t);
+        pthread_join(th[t], NULL);
+    }
+    if (threadInode[0] == (inode_t)-1 || threadInode[1] == (inode_t)-1 || threadInode[0] / FS_GROUP_INODES == threadInode[1] / FS_GROUP_INODES){
+        printf("FAIL: threads allocated inodes %u and %u in the same group\n", threadInode[0], threadInode[1]); fails++;
+    }
+    close_fs(tsfs);
+
+    remove(img);
+    if (fails == 0) printf("All allocation group tests passed\n");
+    else printf("%d allocation group tests failed\n", fails);
+    return fails ? 1 : 0;
+}
@@ -1,6 +1,8 @@
 #include "../FS.h"
+#include "../bitmap.h"
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 // count functions are defined in FS.c but not declared in FS.h; declare here
 extern int count_free_blocks(ui8 *bitmap, ui32 total_blocks);
@@ -28,6 +30,133 @@ int run_case(ui32 total_blocks, ui8 *bitmap, int expected_blocks){
     return 0;
 }
 
+// the fs-level counters are kept incrementally; they must always match a full scan
+int run_fs_case(void){
+    const char *img = "bitmap_counts.img";
+    if (init_fs(img, 1000) != 0) return 1;
+    struct filesystem *fs = open_fs(img, false, false);
+    if (!fs) return 1;
+    int fails = 0;
+    ui32 expected = fs->sb.total_blocks - fs->sb.data_start; // only the data area is free after mkfs
+    block_t allocated[300];
+    for (int i = 0; i < 300; i++) allocated[i] = block_alloc(fs);
+    expected -= 300;
+    for (int i = 0; i < 300; i += 3) { if (free_block(fs, allocated[i]) == 0) expected++; }
+    block_t start; ui32 count;
+    if (block_alloc_range(fs, 40, 40, &start, &count) == 0) expected -= count;
+    ui32 scanned = (ui32)count_free_blocks(fs->blockBitmap, fs->sb.total_blocks);
+    ui32 counted = fs_count_free_blocks(fs);
+    printf("fs counters: free_blocks=%u (scan %u, expected %u), free_bytes=%llu\n",
+           counted, scanned, expected, (unsigned long long)fs_count_free_bytes(fs));
+    if (counted != scanned || counted != expected) { printf("  FAIL: counter mismatch\n"); fails++; }
+    else if (fs_check_bitmap(fs) != 0) { printf("  FAIL: fs_check_bitmap reported errors\n"); fails++; }
+    else printf("  PASS\n");
+    close_fs(fs);
+    remove(img);
+    return fails;
+}
+
+// scalar references for the bitmap kernels: one bit at a time
+static int ref_bit(const ui8 *bm, ui32 i){ return (bm[i/8] >> (i%8)) & 1; }
+static ui32 ref_count_ones(const ui8 *bm, ui32 from, ui32 to){
+    ui32 c = 0;
+    for (ui32 i = from; i < to; i++) c += ref_bit(bm, i);
+    return c;
+}
+static ui32 ref_find(const ui8 *bm, ui32 from, ui32 to, int value){
+    for (ui32 i = from; i < to; i++) if (ref_bit(bm, i) == value) return i;
+    return to;
+}
+static ui32 ref_zero_run(const ui8 *bm, ui32 from, ui32 to, ui32 n){
+    ui32 len = 0;
+    for (ui32 i = from; i < to; i++){
+        len = ref_bit(bm, i) ? 0 : len + 1;
+        if (len == n) return i + 1 - n;
+    }
+    return to;
+}
+
+#define RAND_BITMAP_BYTES 4096
+#define RAND_ROUNDS 300
+
+// cross-check every available kernel against the scalar reference on random bitmaps
+int run_kernel_cases(void){
+    int fails = 0;
+    static ui8 bm[RAND_BITMAP_BYTES];
+    ui32 nbits = RAND_BITMAP_BYTES * 8;
+    for (int k = BM_KERNEL_SCALAR; k < BM_KERNEL_COUNT; k++){
+        if (bm_select_kernel((enum bm_kernel)k) != 0){
+            printf("kernel %s: not supported on this CPU, skipped\n", bm_kernel_name((enum bm_kernel)k));
+            continue;
+        }
+        srand(1234);
+        int kfails = 0;
+        for (int r = 0; r < RAND_ROUNDS; r++){
+            // density from almost empty to almost full, with long runs of 0xFF/0x00
+            int density = rand() % 101;
+            for (ui32 i = 0; i < RAND_BITMAP_BYTES; i++){
+                int mode = rand() % 8;
+                if (mode == 0) bm[i] = 0xFF;
+                else if (mode == 1) bm[i] = 0x00;
+                else {
+                    ui8 b = 0;
+                    for (int j = 0; j < 8; j++) if (rand() % 100 < density) b |= (ui8)(1 << j);
+                    bm[i] = b;
+                }
+            }
+            if (r % 3 == 0) memset(bm + rand() % 2048, 0xFF, rand() % 2048); // a long full region
+            ui32 from = rand() % nbits, to = from + rand() % (nbits - from + 1);
+            ui32 n = 1 + rand() % 40;
+            if (bm_count_ones(bm, from, to) != ref_count_ones(bm, from, to) ||
+                bm_find_first_zero(bm, from, to) != ref_find(bm, from, to, 0) ||
+                bm_find_first_one(bm, from, to) != ref_find(bm, from, to, 1) ||
+                bm_find_zero_run(bm, from, to, n) != ref_zero_run(bm, from, to, n)){
+                printf("  FAIL: kernel %s, round %d, range [%u,%u) n=%u\n", bm_kernel_name((enum bm_kernel)k), r, from, to, n);
+                kfails++;
+                break;
+            }
+        }
+        printf("kernel %s: %d random bitmaps cross-checked -> %s\n", bm_kernel_name((enum bm_kernel)k), RAND_ROUNDS, kfails ? "FAIL" : "PASS");
+        fails += kfails;
+    }
+    bm_select_kernel(BM_KERNEL_AUTO);
+    return fails;
+}
+
+static double now_s(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// throughput of each kernel on a 1 MB bitmap (the find kernels scan a fully used one end to end)
+void report_kernel_throughput(void){
+    size_t bytes = 1 << 20;
+    int reps = 200;
+    ui8 *bm = malloc(bytes);
+    for (int k = BM_KERNEL_SCALAR; k < BM_KERNEL_COUNT; k++){
+        if (bm_select_kernel((enum bm_kernel)k) != 0) continue;
+        for (size_t i = 0; i < bytes; i++) bm[i] = (ui8)(i * 37);
+        volatile ui64 sink = 0;
+        double t0 = now_s();
+        for (int r = 0; r < reps; r++) sink += bm_popcount_bytes(bm, bytes);
+        double t_pop = now_s() - t0;
+        memset(bm, 0xFF, bytes);
+        t0 = now_s();
+        for (int r = 0; r < reps; r++) sink += bm_find_first_zero(bm, 0, (ui32)bytes * 8);
+        double t_zero = now_s() - t0;
+        t0 = now_s();
+        for (int r = 0; r < reps; r++) sink += bm_find_zero_run(bm, 0, (ui32)bytes * 8, 16);
+        double t_run = now_s() - t0;
+        double gb = (double)bytes * reps / 1e9;
+        printf("kernel %-6s: popcount %6.2f GB/s, first zero %6.2f GB/s, zero run %6.2f GB/s\n",
+               bm_kernel_name((enum bm_kernel)k), gb / t_pop, gb / t_zero, gb / t_run);
+        (void)sink;
+    }
+    free(bm);
+    bm_select_kernel(BM_KERNEL_AUTO);
+}
+
 int main(void){
     int fails = 0;
 
@@ -63,6 +192,13 @@ int main(void){
     bm4[9/8] &= ~(1u << (9%8));
     fails += run_case(tb4, bm4, 1);
 
+    // Case 5: incremental fs counters vs full scan
+    fails += run_fs_case();
+
+    // Case 6: every bitmap kernel against the scalar reference
+    fails += run_kernel_cases();
+    report_kernel_throughput();
+
     if (fails == 0) printf("All bitmap count tests passed\n");
     else printf("%d tests failed\n", fails);
 
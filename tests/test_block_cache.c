@@ -0,0 +1,151 @@
+#include "../FS.h"
+#include "../bcache.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// exercises the write-back block cache with a deliberately tiny pool (4 frames)
+
+static void fill_block(char *buf, block_t b){
+    memset(buf, 0, BLOCK_SIZE);
+    snprintf(buf, BLOCK_SIZE, "blocco %u", b);
+}
+
+// a device whose read of SLOW_BLOCK stays in flight until the test releases it (or two seconds pass)
+#define SLOW_BLOCK 99
+static int inFlight, release, slowReads;
+
+static int slow_read(void *ctx, block_t block_num, void *buffer){
+    (void)ctx;
+    if (block_num == SLOW_BLOCK){
+        __atomic_add_fetch(&slowReads, 1, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&inFlight, 1, __ATOMIC_SEQ_CST);
+        for (int i = 0; i < 2000 && !__atomic_load_n(&release, __ATOMIC_SEQ_CST); i++) usleep(1000);
+    }
+    fill_block(buffer, block_num);
+    __atomic_store_n(&inFlight, 0, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+static int null_write(void *ctx, block_t block_num, void *buffer){
+    (void)ctx; (void)block_num; (void)buffer;
+    return 0;
+}
+
+struct reader {
+    struct bcache *cache;
+    int ok;
+};
+
+static void *read_slow(void *arg){
+    struct reader *r = arg;
+    char buf[BLOCK_SIZE], expect[BLOCK_SIZE];
+    fill_block(expect, SLOW_BLOCK);
+    r->ok = bcache_read(r->cache, SLOW_BLOCK, buf) == 0 && memcmp(buf, expect, BLOCK_SIZE) == 0;
+    return NULL;
+}
+
+static int check_io_unlocked(void){
+    // while a miss is being read from the device, hits on other blocks are served and a second
+    // reader of the same block waits for that read instead of issuing its own
+    int fails = 0;
+    char buf[BLOCK_SIZE], expect[BLOCK_SIZE];
+    struct bcache *cache = bcache_create(4, slow_read, null_write, NULL);
+    if (!cache) return 1;
+    fill_block(expect, 1);
+    bcache_fill(cache, 1, expect);
+    struct reader a = { cache, 0 }, b = { cache, 0 };
+    pthread_t ta, tb;
+    pthread_create(&ta, NULL, read_slow, &a);
+    while (!__atomic_load_n(&inFlight, __ATOMIC_SEQ_CST)) usleep(100);
+    pthread_create(&tb, NULL, read_slow, &b);
+    if (bcache_read(cache, 1, buf) != 0 || memcmp(buf, expect, BLOCK_SIZE) != 0){ printf("FAIL: hit during a miss\n"); fails++; }
+    if (!__atomic_load_n(&inFlight, __ATOMIC_SEQ_CST)){ printf("FAIL: hit waited for the device read of another block\n"); fails++; }
+    __atomic_store_n(&release, 1, __ATOMIC_SEQ_CST);
+    pthread_join(ta, NULL);
+    pthread_join(tb, NULL);
+    if (!a.ok || !b.ok){ printf("FAIL: concurrent readers of a miss\n"); fails++; }
+    if (slowReads != 1){ printf("FAIL: block read %d times from the device\n", slowReads); fails++; }
+    bcache_destroy(cache);
+    printf("device I/O outside the cache lock: %s\n", fails ? "FAIL" : "PASS");
+    return fails;
+}
+
+int main(void){
+    const char *img = "cache_test.img";
+    int fails = 0;
+    if (init_fs(img, 256) != 0){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    struct fs_options opts = { .cache_blocks = 4 };
+    struct filesystem *fs = open_fs_opts(img, &opts);
+    if (!fs || !fs->cache){
+        printf("open_fs_opts failed\n");
+        return 1;
+    }
+
+    char buf[BLOCK_SIZE], expect[BLOCK_SIZE];
+    block_t first = fs->sb.data_start;
+
+    // write 8 blocks through a 4-frame cache: the first 4 must be written back on eviction
+    for (block_t b = first; b < first + 8; b++){
+        fill_block(buf, b);
+        if (fs_write_block(fs, b, buf) != 0){ printf("FAIL: fs_write_block %u\n", b); fails++; }
+    }
+    struct bcache_stats st;
+    bcache_get_stats(fs->cache, &st);
+    printf("after 8 writes: hits=%llu misses=%llu evictions=%llu writebacks=%llu\n",
+           (unsigned long long)st.hits, (unsigned long long)st.misses,
+           (unsigned long long)st.evictions, (unsigned long long)st.writebacks);
+    if (st.evictions != 4 || st.writebacks != 4){ printf("  FAIL: expected 4 evictions and 4 writebacks\n"); fails++; }
+
+    // the last 4 blocks are still cached: reading them must hit and not touch the image
+    for (block_t b = first + 4; b < first + 8; b++){
+        fill_block(expect, b);
+        if (fs_read_block(fs, b, buf) != 0 || memcmp(buf, expect, BLOCK_SIZE) != 0){ printf("FAIL: cached read %u\n", b); fails++; }
+    }
+    bcache_get_stats(fs->cache, &st);
+    if (st.hits != 4){ printf("  FAIL: expected 4 hits, got %llu\n", (unsigned long long)st.hits); fails++; }
+
+    // dirty blocks are not on the image until fs_flush
+    if (read_block(fs->img, first + 7, buf) == 0 && memcmp(buf, expect, BLOCK_SIZE) == 0){
+        printf("  FAIL: block %u reached the image before flush\n", first + 7); fails++;
+    }
+    if (fs_flush(fs) != 0){ printf("FAIL: fs_flush\n"); fails++; }
+    for (block_t b = first; b < first + 8; b++){
+        fill_block(expect, b);
+        if (read_block(fs->img, b, buf) != 0 || memcmp(buf, expect, BLOCK_SIZE) != 0){ printf("FAIL: block %u not persisted\n", b); fails++; }
+    }
+
+    // evicted blocks come back from the image as misses
+    fill_block(expect, first);
+    if (fs_read_block(fs, first, buf) != 0 || memcmp(buf, expect, BLOCK_SIZE) != 0){ printf("FAIL: re-read of evicted block\n"); fails++; }
+    bcache_get_stats(fs->cache, &st);
+    printf("final: hits=%llu misses=%llu evictions=%llu writebacks=%llu\n",
+           (unsigned long long)st.hits, (unsigned long long)st.misses,
+           (unsigned long long)st.evictions, (unsigned long long)st.writebacks);
+
+    // batched I/O: unordered list with two contiguous runs, first without then with the cache
+    block_t list[6] = { first + 12, first + 3, first + 10, first + 2, first + 11, first + 4 };
+    static char bufs[6][BLOCK_SIZE];
+    void *ptrs[6];
+    for (int i = 0; i < 6; i++){ ptrs[i] = bufs[i]; fill_block(bufs[i], list[i]); }
+    if (bdev_writev(&fs->dev, list, ptrs, 6) != 0){ printf("FAIL: bdev_writev\n"); fails++; }
+    for (int i = 0; i < 6; i++) memset(bufs[i], 0, BLOCK_SIZE);
+    if (read_blocks(fs, list, ptrs, 6) != 0){ printf("FAIL: read_blocks\n"); fails++; }
+    for (int i = 0; i < 6; i++){
+        fill_block(expect, list[i]);
+        if (memcmp(bufs[i], expect, BLOCK_SIZE) != 0){ printf("FAIL: read_blocks returned wrong data for %u\n", list[i]); fails++; }
+    }
+    if (!bcache_contains(fs->cache, first + 4)){ printf("FAIL: read_blocks did not fill the cache\n"); fails++; }
+    printf("batched read of %d blocks: %s\n", 6, fails ? "FAIL" : "PASS");
+
+    close_fs(fs);
+    remove(img);
+    fails += check_io_unlocked();
+    if (fails == 0) printf("All block cache tests passed\n");
+    else printf("%d block cache tests failed\n", fails);
+    return fails ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+#include "../FS.h"
+#include "../crc32c.h"
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+// metadata checksums: CRC32C test vectors on every kernel the CPU supports, checksums kept up to date
+// across unmounts, journal replay, no journal and mmap, damaged superblock, bitmap, inode table and
+// directory blocks detected when they are read
+
+static int vectors(void){
+    int fails = 0;
+    static ui8 buf[10000];
+    static ui32 ref[10000];
+    ui8 zeros[32], ones[32];
+    memset(zeros, 0, sizeof(zeros));
+    memset(ones, 0xFF, sizeof(ones));
+    for (size_t i = 0; i < sizeof(buf); i++) buf[i] = (ui8)(i * 131 + (i >> 7));
+    for (int k = 0; k < CRC_KERNEL_COUNT; k++){
+        if (crc32c_select_kernel(k) != 0){
+            printf("%-10s not supported by this CPU\n", crc32c_kernel_name(k));
+            continue;
+        }
+        int bad = 0;
+        if (crc32c(0, "123456789", 9) != 0xE3069283 || crc32c(0, zeros, 32) != 0x8A9136AA || crc32c(0, ones, 32) != 0x62A8AB43) bad++;
+        for (size_t n = 0; n < sizeof(buf) - 3; n += n < 64 ? 1 : 61){
+            ui32 c = crc32c(0, buf + 3, n); // unaligned start, every remainder of the 8-byte and 3-stream loops
+            if (k == 0) ref[n] = c;
+            else if (ref[n] != c) bad++;
+            if (crc32c(crc32c(0, buf + 3, n / 3), buf + 3 + n / 3, n - n / 3) != c) bad++;
+        }
+        printf("%-10s %s\n", crc32c_kernel_name(k), bad ? "FAIL" : "PASS");
+        fails += bad ? 1 : 0;
+    }
+    crc32c_select_kernel(CRC_KERNEL_AUTO);
+    return fails;
+}
+
+static int patch_byte(const char *img, off_t off, ui8 *value){
+    // swaps the byte at off with *value: a second call puts the original back
+    FILE *f = fopen(img, "r+b");
+    ui8 old;
+    if (!f || fseek(f, off, SEEK_SET) != 0 || fread(&old, 1, 1, f) != 1){
+        if (f) fclose(f);
+        return -1;
+    }
+    fseek(f, off, SEEK_SET);
+    fwrite(value, 1, 1, f);
+    *value = old;
+    return fclose(f);
+}
+
+static int lookups(struct filesystem *fs, inode_t dir, int n){
+    struct inode res;
+    char name[32];
+    int missing = 0;
+    for (int i = 0; i < n; i++){
+        snprintf(name, sizeof(name), "f%d", i);
+        if (dir_lookup(fs, &fs->inodeTable[dir], name, &res, NULL) != 0) missing++;
+    }
+    return missing;
+}
+
+int main(void){
+    const char *img = "checksum_test.img";
+    int fails = vectors();
+    if (init_fs(img, 8192) != 0){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    struct fs_options journal = { .cache_blocks = FS_DEFAULT_CACHE_BLOCKS, .journal = true };
+    struct fs_options plain = { .cache_blocks = FS_DEFAULT_CACHE_BLOCKS, .journal = false };
+    struct fs_options mapped = { .use_mmap = true };
+    struct filesystem *fs = open_fs_opts(img, &journal);
+    if (!fs || !fs->csum || fs->sb.csum_blocks != 8 || fs->sb.journal_start != fs->sb.csum_start + fs->sb.csum_blocks){
+        printf("FAIL: image without a checksum table\n");
+        return 1;
+    }
+    inode_t root = inode_alloc(fs), dir;
+    struct inode res;
+    char name[32];
+    if (fs_create_file(fs, root, "d", FS_CREATE_DIR) != 0 || dir_lookup(fs, &fs->inodeTable[root], "d", &res, &dir) != 0){
+        printf("FAIL: mkdir\n");
+        return 1;
+    }
+    for (int i = 0; i < 100; i++){
+        snprintf(name, sizeof(name), "f%d", i);
+        if (fs_create_file(fs, dir, name, 0) != 0) fails++;
+    }
+    block_t bucket = fs->inodeTable[dir].directBlocks[dir_name_hash("f7") % INODE_DIRECT];
+    fs_flush(fs);
+
+    // crash after the commit: fs is abandoned, the replay writes the checksums of the blocks it puts back
+    fs = open_fs_opts(img, &journal);
+    if (!fs || lookups(fs, dir, 100) != 0 || fs_check_bitmap(fs) != 0){ printf("FAIL: checksums after replay\n"); fails++; }
+    if (fs && (fs->csum[bucket] == 0 || fs->csum[fs->sb.inode_table_start] == 0 || fs->csum[fs->sb.inode_bitmap_start] == 0)){
+        printf("FAIL: replay without checksums\n"); fails++;
+    }
+    for (int i = 100; fs && i < 150; i++){
+        snprintf(name, sizeof(name), "f%d", i);
+        if (fs_create_file(fs, dir, name, 0) != 0) fails++;
+    }
+    if (fs && fs_delete_file(fs, &fs->inodeTable[dir], "f120") != 0) fails++;
+    close_fs(fs);
+
+    // without the journal, then in mmap mode: each reopen verifies what the previous mount wrote
+    const struct fs_options *modes[] = { &plain, &mapped, &journal };
+    const char *labels[] = { "no journal", "mmap", "journal" };
+    for (int m = 0; m < 3; m++){
+        fs = open_fs_opts(img, modes[m]);
+        if (!fs || lookups(fs, dir, 100) != 0){ printf("FAIL: %s: reopen\n", labels[m]); fails++; continue; }
+        snprintf(name, sizeof(name), "g%d", m);
+        inode_t g = (inode_t)-1;
+        if (fs_create_file(fs, dir, name, 0) != 0 || dir_lookup(fs, &fs->inodeTable[dir], name, &res, &g) != 0) fails++;
+        fs_flush(fs);
+        if (g != (inode_t)-1 && fs_pwrite(fs, g, name, sizeof(name), BLOCK_SIZE) != (ssize_t)sizeof(name)) fails++; // only the inode changes after the flush
+        close_fs(fs);
+    }
+    fs = open_fs_opts(img, &journal);
+    if (!fs || dir_lookup(fs, &fs->inodeTable[dir], "g1", &res, NULL) != 0 || res.size != BLOCK_SIZE + sizeof(name)){ printf("FAIL: file written in mmap mode\n"); fails++; }
+    struct superblock sb = fs ? fs->sb : (struct superblock){ 0 };
+    close_fs(fs);
+    printf("unmount, replay, no journal, mmap: %s\n", fails ? "FAIL" : "PASS");
+
+    // damage: the superblock, a bitmap or a used inode-table block stop the mount, a directory bucket fails its lookups
+    struct { const char *what; off_t off; } meta[] = {
+        { "superblock", offsetof(struct superblock, free_inodes_count) },
+        { "block bitmap", (off_t)sb.free_block_bitmap_start * BLOCK_SIZE + 100 },
+        { "inode bitmap", (off_t)sb.inode_bitmap_start * BLOCK_SIZE + 2000 },
+        { "inode table", (off_t)sb.inode_table_start * BLOCK_SIZE + 7 },
+    };
+    for (int i = 0; i < 4; i++){
+        ui8 v = 0x5A;
+        if (patch_byte(img, meta[i].off, &v) != 0){ fails++; continue; }
+        fs = open_fs_opts(img, &journal);
+        if (fs){ printf("FAIL: damaged %s mounted\n", meta[i].what); fails++; close_fs(fs); }
+        patch_byte(img, meta[i].off, &v);
+    }
+    ui8 v = 0x5A;
+    patch_byte(img, (off_t)bucket * BLOCK_SIZE + BLOCK_SIZE - 1, &v);
+    fs = open_fs_opts(img, &journal);
+    if (!fs || dir_lookup(fs, &fs->inodeTable[dir], "f7", &res, NULL) == 0){ printf("FAIL: damaged directory bucket read\n"); fails++; }
+    int missing = fs ? lookups(fs, dir, 100) : 0;
+    if (missing == 0 || missing > 30){ printf("FAIL: %d lookups failed with one damaged bucket\n", missing); fails++; }
+    close_fs(fs);
+    patch_byte(img, (off_t)bucket * BLOCK_SIZE + BLOCK_SIZE - 1, &v);
+    fs = open_fs_opts(img, &journal);
+    if (!fs || lookups(fs, dir, 100) != 0){ printf("FAIL: repaired image\n"); fails++; }
+    close_fs(fs);
+
+    // images created without checksums keep the old layout
+    struct mkfs_options mk = { .no_checksums = true };
+    if (init_fs_opts(img, 8192, &mk) != 0 || !(fs = open_fs_opts(img, &journal)) || fs->csum || fs->sb.csum_blocks != 0 ||
+        fs->sb.journal_start != fs->sb.inode_table_start + fs->sb.inode_table_blocks){
+        printf("FAIL: image without checksums\n"); fails++;
+    }
+    close_fs(fs);
+
+    remove(img);
+    if (fails == 0) printf("All checksum tests passed\n");
+    else printf("%d checksum tests failed\n", fails);
+    return fails ? 1 : 0;
+}
@@ -0,0 +1,78 @@
+#include "../FS.h"
+#include "../dcache.h"
+#include <stdio.h>
+#include <string.h>
+
+// dentry cache behind path_solver: positive and negative hits, invalidation on add/remove/delete and on directory delete
+
+int main(void){
+    const char *img = "dcache_test.img";
+    int fails = 0;
+    if (init_fs(img, 512) != 0){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    struct filesystem *fs = open_fs_opts(img, NULL);
+    if (!fs || !fs->dcache){
+        printf("open_fs_opts failed\n");
+        return 1;
+    }
+
+    inode_t root = inode_alloc(fs);
+    inode_t usr = inode_alloc(fs);
+    inode_t bin = inode_alloc(fs);
+    dir_add_entry(fs, root, "usr", usr);
+    dir_add_entry(fs, usr, "bin", bin);
+    fs_create_file(fs, bin, "ls", 0);
+
+    struct inode res;
+    struct dcache_stats st;
+    for (int i = 0; i < 3; i++){
+        if (path_solver(fs, "/usr/bin/ls", &res) != 0){ printf("FAIL: resolve /usr/bin/ls\n"); fails++; }
+    }
+    dcache_get_stats(fs->dcache, &st);
+    printf("3 resolutions: hits=%llu misses=%llu\n", (unsigned long long)st.hits, (unsigned long long)st.misses);
+    if (st.misses != 3 || st.hits != 6){ printf("  FAIL: expected 3 misses then 6 hits\n"); fails++; }
+
+    // negative entry: the second miss on the same name does not touch the directory
+    if (path_solver(fs, "/usr/bin/cat", &res) == 0){ printf("FAIL: missing file resolved\n"); fails++; }
+    if (path_solver(fs, "/usr/bin/cat", &res) == 0){ printf("FAIL: missing file resolved twice\n"); fails++; }
+    dcache_get_stats(fs->dcache, &st);
+    if (st.negative_hits != 1){ printf("FAIL: expected 1 negative hit, got %llu\n", (unsigned long long)st.negative_hits); fails++; }
+
+    // creating the file must drop the negative entry
+    if (fs_create_file(fs, bin, "cat", 0) != 0 || path_solver(fs, "/usr/bin/cat", &res) != 0){ printf("FAIL: cat not visible after create\n"); fails++; }
+
+    // deleting must drop the positive entry
+    if (fs_delete_file(fs, &fs->inodeTable[bin], "ls") != 0){ printf("FAIL: delete ls\n"); fails++; }
+    if (path_solver(fs, "/usr/bin/ls", &res) == 0){ printf("FAIL: deleted file still resolves\n"); fails++; }
+
+    // deleting a directory drops the names cached under it (its inode may come back as another directory)
+    inode_t dnum = inode_alloc(fs), child;
+    if (dir_add_entry(fs, root, "d", dnum) != 0 || fs_create_file(fs, dnum, "x", 0) != 0 || path_solver(fs, "/d/x", &res) != 0 ||
+        dcache_lookup(fs->dcache, dnum, "x", dir_name_hash("x"), &child) != 1){
+        printf("FAIL: resolve /d/x\n"); fails++;
+    }
+    if (fs_delete_file(fs, &fs->inodeTable[root], "d") != 0 || dcache_lookup(fs->dcache, dnum, "x", dir_name_hash("x"), &child) != -1){
+        printf("FAIL: name of a deleted directory still cached\n"); fails++;
+    }
+
+    // removal through a copy of the directory inode falls back to invalidating the name everywhere
+    struct inode usr_copy = fs->inodeTable[usr];
+    if (dir_remove_entry(fs, &usr_copy, "bin") != 0){ printf("FAIL: remove bin\n"); fails++; }
+    if (path_solver(fs, "/usr/bin/cat", &res) == 0){ printf("FAIL: removed directory still resolves\n"); fails++; }
+
+    // trailing and repeated separators, over-long components
+    if (path_solver(fs, "//usr//", &res) != 0 || memcmp(&res, &fs->inodeTable[usr], sizeof(struct inode)) != 0){ printf("FAIL: //usr//\n"); fails++; }
+    char longpath[600];
+    memset(longpath, 'a', sizeof(longpath) - 1);
+    longpath[0] = '/';
+    longpath[sizeof(longpath) - 1] = '\0';
+    if (path_solver(fs, longpath, &res) == 0){ printf("FAIL: over-long component resolved\n"); fails++; }
+
+    close_fs(fs);
+    remove(img);
+    if (fails == 0) printf("All dentry cache tests passed\n");
+    else printf("%d dentry cache tests failed\n", fails);
+    return fails ? 1 : 0;
+}
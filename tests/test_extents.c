@@ -0,0 +1,79 @@
+#include "../FS.h"
+#include <stdio.h>
+#include <string.h>
+
+// extent-mapped files: contiguous writes collapse into few extents, files grow past the 4 MB
+// pointer limit, fragmentation spills into leaf blocks, and delete returns every block
+
+static unsigned char pattern(size_t i){
+    return (unsigned char)(i * 7 + (i >> 12) * 3);
+}
+
+int main(void){
+    const char *img = "extents_test.img";
+    int fails = 0;
+    if (init_fs(img, MAX_BLOCKS) != 0){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    struct filesystem *fs = open_fs_opts(img, NULL);
+    if (!fs){
+        printf("open_fs_opts failed\n");
+        return 1;
+    }
+    inode_t root = inode_alloc(fs);
+    struct inode tmp;
+    inode_t big, frag;
+    fs_create_file(fs, root, "big", 0);
+    fs_create_file(fs, root, "frag", 0);
+    dir_lookup(fs, &fs->inodeTable[root], "big", &tmp, &big);
+    dir_lookup(fs, &fs->inodeTable[root], "frag", &tmp, &frag);
+    ui32 freeBefore = fs_count_free_blocks(fs);
+
+    // 8 MB written in 1 MB chunks: twice the pointer-mapped limit, a handful of extents
+    size_t bigSize = 8u << 20;
+    static unsigned char chunk[1u << 20];
+    for (size_t off = 0; off < bigSize; off += sizeof(chunk)){
+        for (size_t i = 0; i < sizeof(chunk); i++) chunk[i] = pattern(off + i);
+        if (fs_pwrite(fs, big, chunk, sizeof(chunk), off) != sizeof(chunk)){ printf("FAIL: write at %zu\n", off); fails++; break; }
+    }
+    struct inode *bi = &fs->inodeTable[big];
+    if (!(bi->flags & INODE_F_EXTENTS)){ printf("FAIL: new file is not extent-mapped\n"); fails++; }
+    printf("8 MB file: depth %u, %u extents\n", bi->extents.depth, bi->extents.count);
+    if (bi->extents.depth != 0 || bi->extents.count > 2){ printf("FAIL: sequential file should map through 1-2 extents\n"); fails++; }
+    for (size_t off = 0; off < bigSize; off += sizeof(chunk)){
+        if (fs_pread(fs, big, chunk, sizeof(chunk), off) != sizeof(chunk)){ printf("FAIL: read at %zu\n", off); fails++; break; }
+        for (size_t i = 0; i < sizeof(chunk); i++) if (chunk[i] != pattern(off + i)){ printf("FAIL: data at %zu\n", off + i); fails++; off = bigSize; break; }
+    }
+    printf("large file: %s\n", fails ? "FAIL" : "PASS");
+
+    // every other block: each write is its own extent, enough to need leaf blocks and a split
+    unsigned char blk[BLOCK_SIZE];
+    ui32 pieces = 500;
+    for (ui32 b = 0; b < pieces; b++){
+        memset(blk, (int)(b & 0xFF), sizeof(blk));
+        if (fs_pwrite(fs, frag, blk, BLOCK_SIZE, (off_t)b * 2 * BLOCK_SIZE) != BLOCK_SIZE){ printf("FAIL: fragmented write %u\n", b); fails++; break; }
+        fs_pwrite(fs, big, blk, 1, 0); // interleave allocations so the pieces are not physically adjacent
+    }
+    struct inode *fi = &fs->inodeTable[frag];
+    printf("fragmented file: depth %u, %u leaves\n", fi->extents.depth, fi->extents.count);
+    if (fi->extents.depth != 1 || fi->extents.count < 2){ printf("FAIL: expected a split leaf\n"); fails++; }
+    for (ui32 b = 0; b < pieces; b++){
+        memset(chunk, 0xEE, 2 * BLOCK_SIZE);
+        fs_pread(fs, frag, chunk, 2 * BLOCK_SIZE, (off_t)b * 2 * BLOCK_SIZE);
+        if (chunk[0] != (unsigned char)(b & 0xFF) || chunk[BLOCK_SIZE - 1] != (unsigned char)(b & 0xFF)){ printf("FAIL: fragmented data %u\n", b); fails++; break; }
+        if (b + 1 < pieces && chunk[BLOCK_SIZE] != 0){ printf("FAIL: hole %u not zero\n", b); fails++; break; }
+    }
+    if (fs_check_bitmap(fs) != 0){ printf("FAIL: fsck found inconsistencies\n"); fails++; }
+    printf("fragmented file: %s\n", fails ? "FAIL" : "PASS");
+
+    fs_delete_file(fs, &fs->inodeTable[root], "big");
+    fs_delete_file(fs, &fs->inodeTable[root], "frag");
+    if (fs_count_free_blocks(fs) != freeBefore){ printf("FAIL: %d blocks leaked\n", (int)(freeBefore - fs_count_free_blocks(fs))); fails++; }
+
+    close_fs(fs);
+    remove(img);
+    if (fails == 0) printf("All extent tests passed\n");
+    else printf("%d extent tests failed\n", fails);
+    return fails ? 1 : 0;
+}
@@ -0,0 +1,89 @@
+#include "../FS.h"
+#include "../bcache.h"
+#include <stdio.h>
+#include <string.h>
+
+// fs_pread/fs_pwrite: block mapping through direct and indirect pointers, holes, partial-block
+// coalescing, sequential readahead and freeing of the whole mapping on delete
+
+#define FILE_BYTES (200 * BLOCK_SIZE + 123) // crosses into the indirect block
+
+static unsigned char pattern(size_t i){
+    return (unsigned char)(i * 31 + (i >> 12));
+}
+
+int main(void){
+    const char *img = "file_io_test.img";
+    int fails = 0;
+    if (init_fs(img, 1024) != 0){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    struct filesystem *fs = open_fs_opts(img, NULL);
+    if (!fs){
+        printf("open_fs_opts failed\n");
+        return 1;
+    }
+    inode_t root = inode_alloc(fs);
+    fs_create_file(fs, root, "data", FS_CREATE_BLOCKMAP); // pointer-mapped: the extent path has its own test
+    struct inode tmp;
+    inode_t ino;
+    dir_lookup(fs, &fs->inodeTable[root], "data", &tmp, &ino);
+    fs_create_file(fs, root, "sparse", 0);
+    inode_t sparse;
+    dir_lookup(fs, &fs->inodeTable[root], "sparse", &tmp, &sparse);
+    ui32 freeBefore = fs_count_free_blocks(fs);
+
+    static unsigned char src[FILE_BYTES], dst[FILE_BYTES];
+    for (size_t i = 0; i < FILE_BYTES; i++) src[i] = pattern(i);
+
+    // small sequential appends: coalesced into whole blocks
+    for (size_t off = 0; off < FILE_BYTES; off += 1000){
+        size_t n = FILE_BYTES - off < 1000 ? FILE_BYTES - off : 1000;
+        if (fs_pwrite(fs, ino, src + off, n, off) != (ssize_t)n){ printf("FAIL: pwrite at %zu\n", off); fails++; break; }
+    }
+    if (fs->inodeTable[ino].size != FILE_BYTES){ printf("FAIL: size %u\n", fs->inodeTable[ino].size); fails++; }
+    if (fs->inodeTable[ino].indirectBlock == 0){ printf("FAIL: indirect block not allocated\n"); fails++; }
+    if (fs_pread(fs, ino, dst, FILE_BYTES, 0) != FILE_BYTES || memcmp(src, dst, FILE_BYTES) != 0){ printf("FAIL: read back\n"); fails++; }
+
+    // unaligned overwrite spanning several blocks, then the data must survive a flush
+    memset(src + 5000, 0xAB, 3 * BLOCK_SIZE);
+    if (fs_pwrite(fs, ino, src + 5000, 3 * BLOCK_SIZE, 5000) != 3 * BLOCK_SIZE){ printf("FAIL: overwrite\n"); fails++; }
+    if (fs_flush(fs) != 0){ printf("FAIL: flush\n"); fails++; }
+    memset(dst, 0, sizeof(dst));
+    if (fs_pread(fs, ino, dst, FILE_BYTES, 0) != FILE_BYTES || memcmp(src, dst, FILE_BYTES) != 0){ printf("FAIL: read after overwrite\n"); fails++; }
+
+    // reads clamp at EOF
+    if (fs_pread(fs, ino, dst, 1000, FILE_BYTES - 10) != 10){ printf("FAIL: short read at EOF\n"); fails++; }
+    if (fs_pread(fs, ino, dst, 10, FILE_BYTES) != 0){ printf("FAIL: read past EOF\n"); fails++; }
+    printf("read/write: %s\n", fails ? "FAIL" : "PASS");
+
+    // sparse file: a hole reads as zeros
+    if (fs_pwrite(fs, sparse, "end", 3, 50 * BLOCK_SIZE) != 3){ printf("FAIL: sparse write\n"); fails++; }
+    unsigned char hole[BLOCK_SIZE];
+    memset(hole, 0xFF, sizeof(hole));
+    if (fs_pread(fs, sparse, hole, BLOCK_SIZE, 20 * BLOCK_SIZE) != BLOCK_SIZE){ printf("FAIL: hole read\n"); fails++; }
+    for (int i = 0; i < BLOCK_SIZE; i++) if (hole[i] != 0){ printf("FAIL: hole not zero\n"); fails++; break; }
+    printf("holes: %s\n", fails ? "FAIL" : "PASS");
+
+    // sequential 4 KB reads: after the first few, readahead serves them from the cache
+    struct bcache_stats before, after;
+    bcache_get_stats(fs->cache, &before);
+    for (ui32 b = 0; b < 200; b++){
+        if (fs_pread(fs, ino, dst, BLOCK_SIZE, (off_t)b * BLOCK_SIZE) != BLOCK_SIZE){ printf("FAIL: sequential read %u\n", b); fails++; break; }
+    }
+    bcache_get_stats(fs->cache, &after);
+    printf("sequential reads: %llu hits, %llu misses\n", (unsigned long long)(after.hits - before.hits), (unsigned long long)(after.misses - before.misses));
+    if (fs->readahead[ino % FS_READAHEAD_SLOTS].window != FS_READAHEAD_MAX){ printf("FAIL: readahead window did not grow\n"); fails++; }
+
+    // deleting the files returns every data block and the indirect block
+    fs_delete_file(fs, &fs->inodeTable[root], "data");
+    fs_delete_file(fs, &fs->inodeTable[root], "sparse");
+    if (fs_count_free_blocks(fs) != freeBefore){ printf("FAIL: %u blocks leaked\n", freeBefore - fs_count_free_blocks(fs)); fails++; }
+
+    close_fs(fs);
+    remove(img);
+    if (fails == 0) printf("All file I/O tests passed\n");
+    else printf("%d file I/O tests failed\n", fails);
+    return fails ? 1 : 0;
+}
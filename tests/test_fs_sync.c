@@ -0,0 +1,67 @@
+#include "../FS.h"
+#include <stdio.h>
+#include <string.h>
+
+// without the journal: inode table and bitmap changes stay in memory as dirty blocks,
+// fs_sync writes each dirty block once, close_fs + open_fs brings everything back
+
+#define NFILES 1000
+
+int main(void){
+    const char *img = "sync_test.img";
+    int fails = 0;
+    if (init_fs(img, 4096) != 0){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    struct fs_options opts = { .cache_blocks = FS_DEFAULT_CACHE_BLOCKS, .journal = false };
+    struct filesystem *fs = open_fs_opts(img, &opts);
+    if (!fs || fs->journal || !fs->metaDirty){
+        printf("open_fs_opts failed\n");
+        return 1;
+    }
+
+    inode_t root = inode_alloc(fs);
+    char name[32];
+    for (int i = 0; i < NFILES; i++){
+        snprintf(name, sizeof(name), "file%d", i);
+        if (fs_create_file(fs, root, name, 0) != 0){ printf("FAIL: create %s\n", name); fails++; break; }
+    }
+    // 1001 inodes span 32 inode-table blocks, block and inode bitmaps are a single block each, their checksums and
+    // those of the directory blocks sit in one block of the checksum table
+    printf("%d creates: %u dirty metadata blocks\n", NFILES, fs->metaDirtyCount);
+    if (fs->metaDirtyCount == 0 || fs->metaDirtyCount > fs->sb.inode_table_blocks + 3){ printf("  FAIL: expected at most %u dirty blocks\n", fs->sb.inode_table_blocks + 3); fails++; }
+
+    // nothing has reached the image yet
+    struct inode table[BLOCK_SIZE / sizeof(struct inode)];
+    if (read_block(fs->img, fs->sb.inode_table_start, table) != 0 || table[root].isUsed != 0){ printf("FAIL: inode written before fs_sync\n"); fails++; }
+
+    if (fs_sync(fs) != 0){ printf("FAIL: fs_sync\n"); fails++; }
+    if (fs->metaDirtyCount != 0){ printf("FAIL: %u blocks still dirty after fs_sync\n", fs->metaDirtyCount); fails++; }
+    if (read_block(fs->img, fs->sb.inode_table_start, table) != 0 || table[root].isUsed != 1){ printf("FAIL: inode not written by fs_sync\n"); fails++; }
+    if (fs_sync(fs) != 0){ printf("FAIL: second fs_sync\n"); fails++; }
+
+    ui32 freeBefore = fs_count_free_blocks(fs);
+    if (close_fs(fs) != 0){ printf("FAIL: close_fs\n"); fails++; }
+
+    fs = open_fs_opts(img, &opts);
+    if (!fs){
+        printf("FAIL: reopen\n");
+        return 1;
+    }
+    struct inode res;
+    int missing = 0;
+    for (int i = 0; i < NFILES; i++){
+        snprintf(name, sizeof(name), "file%d", i);
+        if (dir_lookup(fs, &fs->inodeTable[root], name, &res, NULL) != 0) missing++;
+    }
+    if (missing){ printf("FAIL: %d files missing after reopen\n", missing); fails++; }
+    if (fs_count_free_blocks(fs) != freeBefore){ printf("FAIL: bitmap not persisted (%u free, expected %u)\n", fs_count_free_blocks(fs), freeBefore); fails++; }
+    if (fs_check_bitmap(fs) != 0){ printf("FAIL: fsck after reopen\n"); fails++; }
+    close_fs(fs);
+
+    remove(img);
+    if (fails == 0) printf("All fs_sync tests passed\n");
+    else printf("%d fs_sync tests failed\n", fails);
+    return fails ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+#include "../FS.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// versioned superblock: init_fs_opts records inode count and group geometry, open_fs uses them and
+// rejects images with another block size, a newer version or an unknown layout; a 4 GB image with a million inodes
+// mounts and allocates like a small one
+
+#define BIG_BLOCKS (1u << 20)  //4 GB
+#define BIG_INODES (1u << 20)
+
+static double now_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int patch_superblock(const char *img, ui32 blockSize, ui32 version, ui32 tableBlocks){
+    struct superblock sb;
+    FILE *f = fopen(img, "r+b");
+    if (!f || fread(&sb, sizeof(sb), 1, f) != 1){
+        if (f) fclose(f);
+        return -1;
+    }
+    sb.block_size = blockSize;
+    sb.version = version;
+    if (tableBlocks) sb.inode_table_blocks = tableBlocks;
+    fseek(f, 0, SEEK_SET);
+    fwrite(&sb, sizeof(sb), 1, f);
+    return fclose(f);
+}
+
+int main(void){
+    const char *img = "geometry_test.img";
+    int fails = 0;
+    struct mkfs_options mk = { .inode_count = BIG_INODES, .group_blocks = 8192, .group_inodes = 1024 };
+    if (init_fs_opts(img, 64, &mk) == 0){ printf("FAIL: 64 blocks accepted for a million inodes\n"); fails++; }
+
+    double t0 = now_ms();
+    if (init_fs_opts(img, BIG_BLOCKS, &mk) != 0){
+        printf("init_fs_opts failed\n");
+        return 1;
+    }
+    double mkfs = now_ms() - t0;
+    struct fs_options opts = { .cache_blocks = FS_DEFAULT_CACHE_BLOCKS, .journal = true };
+    t0 = now_ms();
+    struct filesystem *fs = open_fs_opts(img, &opts);
+    double mount = now_ms() - t0;
+    if (!fs){
+        printf("FAIL: open_fs_opts\n");
+        return 1;
+    }
+    printf("4 GB, %u inodes: mkfs %.2f ms, mount %.2f ms, %u data groups, %u inode groups\n",
+           fs->sb.inode_count, mkfs, mount, fs->groupCount, fs->inodeGroups);
+    if (fs->sb.version != FS_VERSION || fs->sb.inode_count != BIG_INODES || fs->sb.group_blocks != 8192 || fs->sb.group_inodes != 1024 ||
+        fs->inodeGroups != BIG_INODES / 1024 || fs_count_free_inodes(fs) != BIG_INODES){
+        printf("FAIL: geometry not recorded\n"); fails++;
+    }
+
+    // directories spread over the inode groups, the last inode of the table is reachable
+    inode_t root = inode_alloc(fs);
+    struct inode res;
+    inode_t dirs[4];
+    char name[32], data[BLOCK_SIZE];
+    memset(data, 'G', sizeof(data));
+    for (int d = 0; d < 4; d++){
+        snprintf(name, sizeof(name), "d%d", d);
+        if (fs_create_file(fs, root, name, FS_CREATE_DIR) != 0 || dir_lookup(fs, &fs->inodeTable[root], name, &res, &dirs[d]) != 0){ fails++; dirs[d] = root; continue; }
+        if (fs_create_file(fs, dirs[d], "f", 0) != 0 || dir_lookup(fs, &fs->inodeTable[dirs[d]], "f", &res, NULL) != 0) fails++;
+    }
+    if (dirs[0] / 1024 == dirs[1] / 1024 || dirs[1] / 1024 == dirs[2] / 1024){ printf("FAIL: directories in the same inode group\n"); fails++; }
+    if (fs_check_bitmap(fs) != 0){ printf("FAIL: fsck on the large image\n"); fails++; }
+    close_fs(fs);
+
+    fs = open_fs_opts(img, &opts);
+    if (!fs || dir_lookup(fs, &fs->inodeTable[dirs[3]], "f", &res, NULL) != 0 || fs_count_free_inodes(fs) != BIG_INODES - 9){
+        printf("FAIL: large image after reopen\n"); fails++;
+    }
+    close_fs(fs);
+
+    // another block size or a newer format is refused
+    if (patch_superblock(img, 8192, FS_VERSION, 0) != 0 || open_fs_opts(img, &opts) != NULL){ printf("FAIL: 8 KB blocks accepted\n"); fails++; }
+    if (patch_superblock(img, BLOCK_SIZE, FS_VERSION + 1, 0) != 0 || open_fs_opts(img, &opts) != NULL){ printf("FAIL: newer version accepted\n"); fails++; }
+
+    // an image from before the version field has the same layout and mounts; one whose inode table
+    // has neither the original nor the current size is refused, and version 1 never had a layout
+    struct superblock sb;
+    FILE *f = fopen(img, "rb");
+    if (!f || fread(&sb, sizeof(sb), 1, f) != 1){ printf("FAIL: read superblock\n"); fails++; }
+    if (f) fclose(f);
+    if (patch_superblock(img, BLOCK_SIZE, 0, 0) != 0 || (fs = open_fs_opts(img, &opts)) == NULL){
+        printf("FAIL: unversioned image refused\n"); fails++;
+    } else {
+        close_fs(fs);
+    }
+    if (patch_superblock(img, BLOCK_SIZE, 0, sb.inode_table_blocks + 1) != 0 || open_fs_opts(img, &opts) != NULL){
+        printf("FAIL: unversioned image with another inode size accepted\n"); fails++;
+    }
+    if (patch_superblock(img, BLOCK_SIZE, 1, sb.inode_table_blocks) != 0 || open_fs_opts(img, &opts) != NULL){ printf("FAIL: version 1 accepted\n"); fails++; }
+    if (patch_superblock(img, BLOCK_SIZE, 2, 0) != 0 || (fs = open_fs_opts(img, &opts)) == NULL){
+        printf("FAIL: version 2 refused\n"); fails++;
+    } else {
+        close_fs(fs);
+    }
+
+    remove(img);
+    if (fails == 0) printf("All geometry tests passed\n");
+    else printf("%d geometry tests failed\n", fails);
+    return fails ? 1 : 0;
+}
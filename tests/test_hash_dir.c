@@ -0,0 +1,105 @@
+#include "../FS.h"
+#include <stdio.h>
+#include <string.h>
+
+// hashed directories: packed records, lookup through the bucket chain, overflow into the next bucket,
+// removal with coalescing, and legacy linear directories that must keep working unchanged
+
+#define NAMES 2350 // ~196 of the 204 short records per bucket: some of the 12 buckets overflow
+#define LONG_NAMES 150 // 250-byte names: fit only if the freed space was merged back
+
+int main(void){
+    const char *img = "hash_dir_test.img";
+    int fails = 0;
+    if (init_fs(img, 1024) != 0){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    struct filesystem *fs = open_fs_opts(img, NULL);
+    if (!fs){
+        printf("open_fs_opts failed\n");
+        return 1;
+    }
+
+    inode_t dir = inode_alloc(fs);
+    char name[32];
+    for (int i = 0; i < NAMES; i++){
+        snprintf(name, sizeof(name), "file%04d", i);
+        if (dir_add_entry(fs, dir, name, dir) != 0){ printf("FAIL: add %s\n", name); fails++; }
+    }
+    if (!(fs->inodeTable[dir].flags & INODE_F_HASHDIR)){ printf("FAIL: new directory is not hashed\n"); fails++; }
+
+    ui32 overflowed = 0;
+    char buf[BLOCK_SIZE];
+    for (ui32 b = 0; b < INODE_DIRECT; b++){
+        if (fs->inodeTable[dir].directBlocks[b] && fs_read_block(fs, fs->inodeTable[dir].directBlocks[b], buf) == 0 && dir_bucket_overflowed(buf)) overflowed++;
+    }
+    printf("%d entries, %u overflowed buckets\n", NAMES, overflowed);
+
+    struct inode res;
+    inode_t num;
+    for (int i = 0; i < NAMES; i++){
+        snprintf(name, sizeof(name), "file%04d", i);
+        if (dir_lookup(fs, &fs->inodeTable[dir], name, &res, &num) != 0){ printf("FAIL: lookup %s\n", name); fails++; }
+    }
+    if (dir_lookup(fs, &fs->inodeTable[dir], "missing", &res, &num) == 0){ printf("FAIL: lookup of a missing name succeeded\n"); fails++; }
+
+    // remove the even names: the odd ones must still be reachable past the overflow flags
+    for (int i = 0; i < NAMES; i += 2){
+        snprintf(name, sizeof(name), "file%04d", i);
+        if (dir_remove_entry(fs, &fs->inodeTable[dir], name) != 0){ printf("FAIL: remove %s\n", name); fails++; }
+    }
+    for (int i = 0; i < NAMES; i++){
+        snprintf(name, sizeof(name), "file%04d", i);
+        int found = dir_lookup(fs, &fs->inodeTable[dir], name, &res, &num) == 0;
+        if (found != (i % 2)){ printf("FAIL: %s %s after delete\n", name, found ? "found" : "missing"); fails++; }
+    }
+    if (dir_add_entry(fs, dir, "again", dir) != 0 || dir_lookup(fs, &fs->inodeTable[dir], "again", &res, &num) != 0 || num != dir){
+        printf("FAIL: re-add into freed slot\n"); fails++;
+    }
+    printf("hashed directory: %s\n", fails ? "FAIL" : "PASS");
+
+    // empty the directory, then refill it with long names
+    for (int i = 1; i < NAMES; i += 2){
+        snprintf(name, sizeof(name), "file%04d", i);
+        if (dir_remove_entry(fs, &fs->inodeTable[dir], name) != 0){ printf("FAIL: remove %s\n", name); fails++; }
+    }
+    dir_remove_entry(fs, &fs->inodeTable[dir], "again");
+    char longname[FNAME_LEN];
+    for (int i = 0; i < LONG_NAMES; i++){
+        memset(longname, 'x', 250);
+        snprintf(longname + 250, sizeof(longname) - 250, "%03d", i);
+        if (dir_add_entry(fs, dir, longname, dir) != 0){ printf("FAIL: add long name %d\n", i); fails++; }
+    }
+    for (int i = 0; i < LONG_NAMES; i++){
+        memset(longname, 'x', 250);
+        snprintf(longname + 250, sizeof(longname) - 250, "%03d", i);
+        if (dir_lookup(fs, &fs->inodeTable[dir], longname, &res, &num) != 0){ printf("FAIL: lookup long name %d\n", i); fails++; }
+    }
+    printf("coalescing: %s\n", fails ? "FAIL" : "PASS");
+
+    // legacy directory: a linear block of struct dirEntry written by hand
+    // (entries point at the directory itself: the linear format treats inode 0 as a free slot)
+    inode_t legacy = inode_alloc(fs);
+    block_t blk = block_alloc(fs);
+    memset(buf, 0, BLOCK_SIZE);
+    struct dirEntry *entries = (struct dirEntry *)buf;
+    strcpy(entries[0].fname, "old");
+    entries[0].inodeNum = legacy;
+    fs_write_block(fs, blk, buf);
+    fs->inodeTable[legacy].directBlocks[0] = blk;
+    if (dir_lookup(fs, &fs->inodeTable[legacy], "old", &res, &num) != 0 || num != legacy){ printf("FAIL: legacy lookup\n"); fails++; }
+    if (dir_add_entry(fs, legacy, "new", legacy) != 0){ printf("FAIL: legacy add\n"); fails++; }
+    if (fs->inodeTable[legacy].flags & INODE_F_HASHDIR){ printf("FAIL: legacy directory was converted\n"); fails++; }
+    if (dir_lookup(fs, &fs->inodeTable[legacy], "new", &res, &num) != 0){ printf("FAIL: legacy lookup after add\n"); fails++; }
+    if (dir_remove_entry(fs, &fs->inodeTable[legacy], "old") != 0 || dir_lookup(fs, &fs->inodeTable[legacy], "old", &res, &num) == 0){
+        printf("FAIL: legacy remove\n"); fails++;
+    }
+    printf("legacy directory: %s\n", fails ? "FAIL" : "PASS");
+
+    close_fs(fs);
+    remove(img);
+    if (fails == 0) printf("All hashed directory tests passed\n");
+    else printf("%d hashed directory tests failed\n", fails);
+    return fails ? 1 : 0;
+}
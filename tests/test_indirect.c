@@ -0,0 +1,117 @@
+#include "../FS.h"
+#include "../bcache.h"
+#include <stdio.h>
+#include <string.h>
+
+// pointer-mapped files (created with FS_CREATE_BLOCKMAP): direct, single, double indirect blocks (and the
+// 4 GB limit), the translation cache (a random read touches at most one pointer block besides the data),
+// truncation and deletion free the tree
+
+#define SEQ_BLOCKS 2500 //12 direct + 1024 single indirect + the rest under the double indirect block
+
+static ui64 lookups(struct filesystem *fs){
+    struct bcache_stats st;
+    bcache_get_stats(fs->cache, &st);
+    return st.hits + st.misses;
+}
+
+static inode_t pointer_file(struct filesystem *fs, inode_t root, const char *name){
+    struct inode res;
+    inode_t ino = (inode_t)-1;
+    if (fs_create_file(fs, root, name, FS_CREATE_BLOCKMAP) != 0 || dir_lookup(fs, &fs->inodeTable[root], name, &res, &ino) != 0) return (inode_t)-1;
+    if (!(res.flags & INODE_F_BLOCKMAP)) return (inode_t)-1;
+    return ino;
+}
+
+int main(void){
+    const char *img = "indirect_test.img";
+    int fails = 0;
+    if (init_fs(img, 16384) != 0){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    struct fs_options opts = { .cache_blocks = FS_DEFAULT_CACHE_BLOCKS, .journal = false };
+    struct filesystem *fs = open_fs_opts(img, &opts);
+    if (!fs || !fs->cache){
+        printf("open_fs_opts failed\n");
+        return 1;
+    }
+    inode_t root = inode_alloc(fs);
+    ui32 freeStart = fs_count_free_blocks(fs);
+    inode_t ino = pointer_file(fs, root, "big");
+    static ui32 blk[BLOCK_SIZE / sizeof(ui32)], back[BLOCK_SIZE / sizeof(ui32)];
+    for (ui32 b = 0; b < SEQ_BLOCKS; b++){
+        blk[0] = b;
+        blk[1] = ~b;
+        if (fs_pwrite(fs, ino, blk, BLOCK_SIZE, (off_t)b * BLOCK_SIZE) != BLOCK_SIZE){ printf("FAIL: write block %u\n", b); fails++; break; }
+    }
+    struct inode *in = &fs->inodeTable[ino];
+    if (in->flags & INODE_F_EXTENTS || in->indirectBlock == 0 || in->doubleIndirect == 0){ printf("FAIL: file not mapped through the double indirect block\n"); fails++; }
+    fs_flush(fs);
+
+    // sequential reads reuse the cached pointer blocks, random reads read at most one of them
+    int bad = 0;
+    static ui32 whole[SEQ_BLOCKS][BLOCK_SIZE / sizeof(ui32)];
+    ui64 before = lookups(fs);
+    if (fs_pread(fs, ino, whole, sizeof(whole), 0) != (ssize_t)sizeof(whole)) bad++;
+    ui64 seq = lookups(fs) - before;
+    for (ui32 b = 0; b < SEQ_BLOCKS; b++){
+        if (whole[b][0] != b || whole[b][1] != ~b) bad++;
+    }
+    ui32 worst = 0;
+    for (ui32 k = 0; k < 200; k++){
+        ui32 b = INODE_DIRECT + PTRS_PER_BLOCK + (k * 7919) % (SEQ_BLOCKS - INODE_DIRECT - PTRS_PER_BLOCK);
+        before = lookups(fs);
+        if (fs_pread(fs, ino, back, BLOCK_SIZE, (off_t)b * BLOCK_SIZE) != BLOCK_SIZE || back[0] != b) bad++;
+        if (lookups(fs) - before > worst) worst = (ui32)(lookups(fs) - before);
+    }
+    printf("%u blocks: %llu block reads sequentially, at most %u per random read\n", SEQ_BLOCKS, (unsigned long long)seq, worst);
+    if (bad){ printf("FAIL: %d blocks read back wrong\n", bad); fails++; }
+    if (seq > SEQ_BLOCKS + 4 || worst > 2){ printf("FAIL: pointer blocks re-read\n"); fails++; }
+
+    // truncation frees the tail of the tree and zeroes the rest of the last block
+    if (fs_truncate(fs, ino, 20 * BLOCK_SIZE + 100) != 0 || in->size != 20 * BLOCK_SIZE + 100 || in->doubleIndirect != 0 || in->indirectBlock == 0){
+        printf("FAIL: truncate into the single indirect range\n"); fails++;
+    }
+    if (fs_truncate(fs, ino, 21 * BLOCK_SIZE) != 0 || fs_pread(fs, ino, back, BLOCK_SIZE, 20 * BLOCK_SIZE) != BLOCK_SIZE ||
+        back[0] != 20 || back[25] != 0 || back[1000] != 0){
+        printf("FAIL: data past the truncation point came back\n"); fails++;
+    }
+    if (fs_check_bitmap(fs) != 0){ printf("FAIL: fsck after truncate\n"); fails++; }
+    if (fs_truncate(fs, ino, 5 * BLOCK_SIZE) != 0 || in->indirectBlock != 0 || in->directBlocks[5] != 0 || in->directBlocks[4] == 0){
+        printf("FAIL: truncate into the direct blocks\n"); fails++;
+    }
+
+    // a write just below 4 GB lands under the double indirect block of a sparse file
+    inode_t sparse = pointer_file(fs, root, "sparse");
+    off_t far = (off_t)UINT32_MAX - BLOCK_SIZE + 1;
+    if (fs_pwrite(fs, sparse, blk, BLOCK_SIZE - 1, far) != BLOCK_SIZE - 1 || fs->inodeTable[sparse].size != UINT32_MAX ||
+        fs_pread(fs, sparse, back, BLOCK_SIZE - 1, far) != BLOCK_SIZE - 1 || memcmp(blk, back, BLOCK_SIZE - 1) != 0){
+        printf("FAIL: write near 4 GB\n"); fails++;
+    }
+    if (fs_pwrite(fs, sparse, blk, 1, (off_t)UINT32_MAX) > 0){ printf("FAIL: write past 4 GB accepted\n"); fails++; }
+    if (fs_check_bitmap(fs) != 0){ printf("FAIL: fsck with a sparse 4 GB file\n"); fails++; }
+
+    // a small file created pointer-mapped is not made inline by its first write
+    inode_t tiny = pointer_file(fs, root, "tiny");
+    if (fs_pwrite(fs, tiny, "tiny", 4, 0) != 4 || (fs->inodeTable[tiny].flags & (INODE_F_INLINE | INODE_F_EXTENTS)) ||
+        fs->inodeTable[tiny].directBlocks[0] == 0){
+        printf("FAIL: small pointer-mapped file\n"); fails++;
+    }
+
+    // deleting the files gives every block back, pointer blocks included
+    if (fs_delete_file(fs, &fs->inodeTable[root], "big") != 0 || fs_delete_file(fs, &fs->inodeTable[root], "sparse") != 0 ||
+        fs_delete_file(fs, &fs->inodeTable[root], "tiny") != 0){
+        printf("FAIL: delete\n"); fails++;
+    }
+    ui32 rootBlocks = 0; // the root's directory buckets stay
+    for (ui32 i = 0; i < INODE_DIRECT; i++) if (fs->inodeTable[root].directBlocks[i]) rootBlocks++;
+    if (fs_count_free_blocks(fs) + rootBlocks != freeStart){ printf("FAIL: %u free blocks after delete, expected %u\n", fs_count_free_blocks(fs), freeStart - rootBlocks); fails++; }
+    if (fs_check_bitmap(fs) != 0){ printf("FAIL: fsck after delete\n"); fails++; }
+    close_fs(fs);
+
+    remove(img);
+    if (fails == 0) printf("All indirect block tests passed\n");
+    else printf("%d indirect block tests failed\n", fails);
+    return fails ? 1 : 0;
+}
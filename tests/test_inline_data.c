@@ -0,0 +1,63 @@
+#include "../FS.h"
+#include "../bcache.h"
+#include <stdio.h>
+#include <string.h>
+
+// inline data: small files live in the inode slot and move to blocks once they outgrow it
+
+int main(void){
+    const char *img = "inline_test.img";
+    int fails = 0;
+    if (init_fs(img, 512) != 0){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    struct filesystem *fs = open_fs_opts(img, NULL);
+    if (!fs){
+        printf("open_fs_opts failed\n");
+        return 1;
+    }
+    if (sizeof(struct inode) != 128){ printf("FAIL: struct inode is %zu bytes\n", sizeof(struct inode)); fails++; }
+
+    inode_t root = inode_alloc(fs);
+    fs_create_file(fs, root, "app.conf", 0);
+    struct inode tmp;
+    inode_t ino;
+    dir_lookup(fs, &fs->inodeTable[root], "app.conf", &tmp, &ino);
+    ui32 freeBefore = fs_count_free_blocks(fs);
+
+    const char *conf = "listen=0.0.0.0:8080\nworkers=4\nlog=/var/log/app.log\n";
+    size_t clen = strlen(conf);
+    if (fs_pwrite(fs, ino, conf, clen, 0) != (ssize_t)clen){ printf("FAIL: inline write\n"); fails++; }
+    if (!(fs->inodeTable[ino].flags & INODE_F_INLINE)){ printf("FAIL: small file is not inline\n"); fails++; }
+    if (fs_count_free_blocks(fs) != freeBefore){ printf("FAIL: inline file used a block\n"); fails++; }
+
+    struct bcache_stats before, after;
+    bcache_get_stats(fs->cache, &before);
+    char out[256] = {0};
+    if (fs_pread(fs, ino, out, sizeof(out), 0) != (ssize_t)clen || memcmp(out, conf, clen) != 0){ printf("FAIL: inline read\n"); fails++; }
+    bcache_get_stats(fs->cache, &after);
+    if (after.hits + after.misses != before.hits + before.misses){ printf("FAIL: inline read touched the block layer\n"); fails++; }
+    if (fs_check_bitmap(fs) != 0){ printf("FAIL: fsck with an inline file\n"); fails++; }
+    printf("inline file: %s\n", fails ? "FAIL" : "PASS");
+
+    // growing past INODE_INLINE_SIZE moves the data to a block and keeps the old bytes
+    char more[200];
+    memset(more, 'z', sizeof(more));
+    if (fs_pwrite(fs, ino, more, sizeof(more), clen) != (ssize_t)sizeof(more)){ printf("FAIL: growing write\n"); fails++; }
+    if (fs->inodeTable[ino].flags & INODE_F_INLINE){ printf("FAIL: file still inline after growing\n"); fails++; }
+    if (fs->inodeTable[ino].size != clen + sizeof(more)){ printf("FAIL: size %u after growing\n", fs->inodeTable[ino].size); fails++; }
+    memset(out, 0, sizeof(out));
+    if (fs_pread(fs, ino, out, sizeof(out), 0) != (ssize_t)(clen + sizeof(more)) || memcmp(out, conf, clen) != 0 || out[clen] != 'z'){ printf("FAIL: data lost while moving out of the inode\n"); fails++; }
+    if (fs_count_free_blocks(fs) != freeBefore - 1){ printf("FAIL: expected one data block\n"); fails++; }
+    printf("conversion: %s\n", fails ? "FAIL" : "PASS");
+
+    fs_delete_file(fs, &fs->inodeTable[root], "app.conf");
+    if (fs_count_free_blocks(fs) != freeBefore){ printf("FAIL: blocks leaked\n"); fails++; }
+
+    close_fs(fs);
+    remove(img);
+    if (fails == 0) printf("All inline data tests passed\n");
+    else printf("%d inline data tests failed\n", fails);
+    return fails ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+#include "../FS.h"
+#include <stdio.h>
+#include <string.h>
+
+// inode bitmap: inode_alloc and free_inode keep bitmap, table and free-inode counter in step,
+// the bitmap and the superblock counters survive an unmount (journal, no journal, mmap)
+
+#define N 300
+
+static int check_counts(struct filesystem *fs, ui32 expected, const char *when){
+    if (fs_count_free_inodes(fs) != expected || fs_check_bitmap(fs) != 0){
+        printf("FAIL: %s: %u free inodes, expected %u\n", when, fs_count_free_inodes(fs), expected);
+        return 1;
+    }
+    return 0;
+}
+
+static int run(const char *img, const struct fs_options *opts, const char *label){
+    int fails = 0;
+    if (init_fs(img, 4096) != 0){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    struct filesystem *fs = open_fs_opts(img, opts);
+    if (!fs){
+        printf("FAIL: %s: open_fs_opts\n", label);
+        return 1;
+    }
+    ui32 total = fs->sb.inode_count;
+    if (fs->sb.inode_bitmap_start == 0 || fs->sb.free_inodes_count != total){ printf("FAIL: %s: superblock without inode bitmap\n", label); fails++; }
+    fails += check_counts(fs, total, "fresh image");
+
+    inode_t got[N];
+    for (int i = 0; i < N; i++){
+        got[i] = inode_alloc(fs);
+        if (got[i] == (inode_t)-1){ printf("FAIL: %s: inode_alloc %d\n", label, i); fails++; break; }
+    }
+    fails += check_counts(fs, total - N, "after allocation");
+    for (int i = 0; i < N; i += 3){
+        if (free_inode(fs, got[i]) != 0) fails++;
+    }
+    if (free_inode(fs, got[0]) == 0){ printf("FAIL: %s: double free accepted\n", label); fails++; }
+    ui32 expected = total - N + (N + 2) / 3;
+    fails += check_counts(fs, expected, "after free");
+    inode_t again = inode_alloc(fs); // freed slots are reused first
+    if (again != got[0]){ printf("FAIL: %s: reallocated inode %u, expected %u\n", label, again, got[0]); fails++; }
+    expected--;
+    if (close_fs(fs) != 0){ printf("FAIL: %s: close_fs\n", label); fails++; }
+
+    // the superblock on disk carries the counters written by the last flush
+    struct superblock sb;
+    FILE *f = fopen(img, "rb");
+    if (!f || fread(&sb, sizeof(sb), 1, f) != 1 || sb.free_inodes_count != expected){
+        printf("FAIL: %s: superblock counter %u, expected %u\n", label, f ? sb.free_inodes_count : 0, expected); fails++;
+    }
+    if (f) fclose(f);
+
+    fs = open_fs_opts(img, opts);
+    if (!fs){
+        printf("FAIL: %s: reopen\n", label);
+        return fails + 1;
+    }
+    fails += check_counts(fs, expected, "after reopen");
+    if (fs->sb.free_blocks_count != fs_count_free_blocks(fs)){ printf("FAIL: %s: block counter %u, bitmap %u\n", label, fs->sb.free_blocks_count, fs_count_free_blocks(fs)); fails++; }
+    close_fs(fs);
+    remove(img);
+    printf("%-10s %d allocations, %d frees: %s\n", label, N, (N + 2) / 3, fails ? "FAIL" : "PASS");
+    return fails;
+}
+
+int main(void){
+    int fails = 0;
+    struct fs_options journal = { .cache_blocks = FS_DEFAULT_CACHE_BLOCKS, .journal = true };
+    struct fs_options plain = { .cache_blocks = FS_DEFAULT_CACHE_BLOCKS, .journal = false };
+    struct fs_options mapped = { .use_mmap = true };
+    fails += run("inode_bitmap_test.img", &journal, "journal");
+    fails += run("inode_bitmap_test.img", &plain, "no journal");
+    fails += run("inode_bitmap_test.img", &mapped, "mmap");
+    if (fails == 0) printf("All inode bitmap tests passed\n");
+    else printf("%d inode bitmap tests failed\n", fails);
+    return fails ? 1 : 0;
+}
@@ -0,0 +1,231 @@
+#include "../FS.h"
+#include "../journal.h"
+#include <stdio.h>
+#include <string.h>
+
+// metadata journal: nothing reaches its home location before a checkpoint, a second open
+// (the "crash") replays the committed transactions, revoked blocks are not clobbered, the log wraps,
+// new file data is written before the commit that maps it, no transaction is committed in part (long
+// operations split themselves at coherent points), and images without a journal area mount without a journal
+
+int main(void){
+    const char *img = "journal_test.img";
+    int fails = 0;
+    if (init_fs(img, 8192) != 0){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    struct filesystem *fs = open_fs_opts(img, NULL);
+    if (!fs || !fs->journal){
+        printf("open_fs_opts failed\n");
+        return 1;
+    }
+    if (fs->sb.journal_blocks != 512 || fs->sb.data_start != fs->sb.journal_start + fs->sb.journal_blocks){
+        printf("FAIL: journal area %u+%u, data at %u\n", fs->sb.journal_start, fs->sb.journal_blocks, fs->sb.data_start); fails++;
+    }
+
+    inode_t root = inode_alloc(fs);
+    char name[32];
+    for (int i = 0; i < 50; i++){
+        snprintf(name, sizeof(name), "f%d", i);
+        if (fs_create_file(fs, root, name, 0) != 0){ printf("FAIL: create %s\n", name); fails++; }
+    }
+    struct inode big;
+    inode_t big_num;
+    static char data[10000], back[10000];
+    for (size_t i = 0; i < sizeof(data); i++) data[i] = (char)(i * 7);
+    if (dir_lookup(fs, &fs->inodeTable[root], "f7", &big, &big_num) != 0 ||
+        fs_pwrite(fs, big_num, data, sizeof(data), 0) != (ssize_t)sizeof(data)){ printf("FAIL: write f7\n"); fails++; }
+    if (fs_flush(fs) != 0){ printf("FAIL: fs_flush\n"); fails++; }
+    struct journal_stats st;
+    journal_get_stats(fs->journal, &st);
+    printf("52 operations: transactions=%llu commits=%llu blocks=%llu checkpoints=%llu\n",
+           (unsigned long long)st.transactions, (unsigned long long)st.commits,
+           (unsigned long long)st.blocks, (unsigned long long)st.checkpoints);
+    if (st.transactions < 51 || st.commits == 0 || st.commits > st.transactions || st.checkpoints != 0){ printf("  FAIL: unexpected counters\n"); fails++; }
+
+    // write-ahead: the inode table on the image is still the one written by init_fs
+    struct inode table[BLOCK_SIZE / sizeof(struct inode)];
+    if (read_block(fs->img, fs->sb.inode_table_start, table) != 0 || table[root].isUsed != 0){
+        printf("FAIL: inode table reached its home location before a checkpoint\n"); fails++;
+    }
+    ui32 freeBefore = fs_count_free_blocks(fs);
+
+    // crash: fs is abandoned without a checkpoint, the next open replays the log
+    struct filesystem *fs2 = open_fs_opts(img, NULL);
+    if (!fs2){
+        printf("FAIL: reopen\n");
+        return 1;
+    }
+    struct inode res;
+    int missing = 0;
+    for (int i = 0; i < 50; i++){
+        snprintf(name, sizeof(name), "f%d", i);
+        if (dir_lookup(fs2, &fs2->inodeTable[root], name, &res, NULL) != 0) missing++;
+    }
+    if (missing){ printf("FAIL: %d files lost after replay\n", missing); fails++; }
+    if (fs_pread(fs2, big_num, back, sizeof(back), 0) != (ssize_t)sizeof(back) || memcmp(data, back, sizeof(data)) != 0){
+        printf("FAIL: f7 content after replay\n"); fails++;
+    }
+    if (fs_count_free_blocks(fs2) != freeBefore){ printf("FAIL: bitmap after replay: %u free, expected %u\n", fs_count_free_blocks(fs2), freeBefore); fails++; }
+    if (fs_check_bitmap(fs2) != 0){ printf("FAIL: fsck after replay\n"); fails++; }
+    printf("replay of 50 creates and one write: %s\n", fails ? "FAIL" : "PASS");
+
+    // revoke: a directory bucket logged, freed and reused for file data must not be replayed over the data
+    inode_t sub = inode_alloc(fs2);
+    dir_add_entry(fs2, root, "sub", sub);
+    dir_add_entry(fs2, sub, "x", root);
+    block_t bucket = 0;
+    for (int i = 0; i < INODE_DIRECT; i++){
+        if (fs2->inodeTable[sub].directBlocks[i]) bucket = fs2->inodeTable[sub].directBlocks[i];
+    }
+    fs_journal_wait(fs2, fs_journal_commit(fs2));
+    if (fs_delete_file(fs2, &fs2->inodeTable[root], "sub") != 0){ printf("FAIL: delete sub\n"); fails++; }
+    if (fs_create_file(fs2, root, "reuse", 0) != 0 || dir_lookup(fs2, &fs2->inodeTable[root], "reuse", &res, &big_num) != 0){ printf("FAIL: create reuse\n"); fails++; }
+    char block[BLOCK_SIZE];
+    memset(block, 'R', sizeof(block));
+    if (fs_pwrite(fs2, big_num, block, sizeof(block), 0) != (ssize_t)sizeof(block)){ printf("FAIL: write reuse\n"); fails++; }
+    if (fs2->inodeTable[big_num].extents.e[0].pstart != bucket){
+        printf("  (bucket %u was not reused, revoke path not exercised)\n", bucket);
+    }
+    fs_flush(fs2);
+
+    struct filesystem *fs3 = open_fs_opts(img, NULL);
+    if (!fs3 || fs_pread(fs3, big_num, back, BLOCK_SIZE, 0) != BLOCK_SIZE || memcmp(back, block, BLOCK_SIZE) != 0){
+        printf("FAIL: data in a revoked block was overwritten by replay\n"); fails++;
+    }
+    if (fs3 && dir_lookup(fs3, &fs3->inodeTable[root], "sub", &res, NULL) == 0){ printf("FAIL: deleted directory came back\n"); fails++; }
+    printf("revoke of freed block %u: %s\n", bucket, fails ? "FAIL" : "PASS");
+
+    // the log wraps: 300 transactions of ~5 blocks do not fit in 511 blocks, checkpoints make room
+    for (int i = 0; i < 300; i++){
+        snprintf(name, sizeof(name), "w%d", i);
+        if (fs_create_file(fs3, root, name, 0) != 0){ printf("FAIL: create %s\n", name); fails++; break; }
+    }
+    fs_flush(fs3);
+    journal_get_stats(fs3->journal, &st);
+    printf("300 creates: transactions=%llu commits=%llu checkpoints=%llu\n",
+           (unsigned long long)st.transactions, (unsigned long long)st.commits, (unsigned long long)st.checkpoints);
+    if (st.checkpoints == 0){ printf("  FAIL: the log never wrapped\n"); fails++; }
+    struct filesystem *fs4 = open_fs_opts(img, NULL);
+    missing = 0;
+    for (int i = 0; fs4 && i < 300; i++){
+        snprintf(name, sizeof(name), "w%d", i);
+        if (dir_lookup(fs4, &fs4->inodeTable[root], name, &res, NULL) != 0) missing++;
+    }
+    if (!fs4 || missing || fs_check_bitmap(fs4) != 0){ printf("FAIL: %d files lost across checkpoints\n", missing); fails++; }
+
+    // ordered data: blocks of a deleted file reused by new files hold the new data once the
+    // transaction that maps them is durable, even if the process dies before any flush
+    static char big_data[256 * 1024];
+    memset(big_data, 'S', sizeof(big_data));
+    struct filesystem *fs5 = open_fs_opts(img, NULL);
+    inode_t s_num = 0, small_num = 0, mid_num = 0;
+    if (!fs5 || fs_create_file(fs5, root, "secret", 0) != 0 || dir_lookup(fs5, &fs5->inodeTable[root], "secret", &res, &s_num) != 0 ||
+        fs_pwrite(fs5, s_num, big_data, sizeof(big_data), 0) != (ssize_t)sizeof(big_data) ||
+        fs_delete_file(fs5, &fs5->inodeTable[root], "secret") != 0 || fs_flush(fs5) != 0){
+        printf("FAIL: secret file\n"); fails++;
+    }
+    static char small[200], mid[8192];
+    memset(small, 'a', sizeof(small));
+    memset(mid, 'b', sizeof(mid));
+    fs5 = open_fs_opts(img, NULL);
+    if (!fs5 || fs_create_file(fs5, root, "small", 0) != 0 || dir_lookup(fs5, &fs5->inodeTable[root], "small", &res, &small_num) != 0 ||
+        fs_create_file(fs5, root, "mid", 0) != 0 || dir_lookup(fs5, &fs5->inodeTable[root], "mid", &res, &mid_num) != 0 ||
+        fs_pwrite(fs5, small_num, small, sizeof(small), 0) != (ssize_t)sizeof(small) ||
+        fs_pwrite(fs5, mid_num, mid, sizeof(mid), 0) != (ssize_t)sizeof(mid) ||
+        fs_journal_wait(fs5, fs_journal_commit(fs5)) != 0){
+        printf("FAIL: files over the freed blocks\n"); fails++;
+    }
+    struct filesystem *fs6 = open_fs_opts(img, NULL); //fs5 is abandoned with the data still in its caches
+    static char check[8192];
+    if (!fs6 || fs_pread(fs6, small_num, check, sizeof(small), 0) != (ssize_t)sizeof(small) || memcmp(check, small, sizeof(small)) != 0 ||
+        fs_pread(fs6, mid_num, check, sizeof(mid), 0) != (ssize_t)sizeof(mid) || memcmp(check, mid, sizeof(mid)) != 0){
+        printf("FAIL: committed files show old data after a crash\n"); fails++;
+    }
+    printf("ordered data over freed blocks: %s\n", fails ? "FAIL" : "PASS");
+
+    // a transaction is never split: one that cannot fit in a descriptor is refused as a whole
+    // and nothing more is committed
+    if (init_fs(img, 8192) != 0 || !(fs5 = open_fs_opts(img, NULL))){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    root = inode_alloc(fs5);
+    static char one[BLOCK_SIZE];
+    memset(one, 'p', sizeof(one));
+    block_t base = fs5->sb.data_start + 4000;
+    for (ui32 i = 0; i <= JOURNAL_MAX_TAGS; i++) journal_log(fs5->journal, base + i, one);
+    if (fs_journal_wait(fs5, fs_journal_commit(fs5)) == 0){ printf("FAIL: oversized transaction committed\n"); fails++; }
+    if (fs_create_file(fs5, root, "after", 0) != 0 || fs_flush(fs5) == 0){ printf("FAIL: commit after a refused transaction\n"); fails++; }
+    fs6 = open_fs_opts(img, NULL);
+    if (!fs6 || fs_read_block(fs6, base, back) != 0 || memcmp(back, one, BLOCK_SIZE) == 0 ||
+        dir_lookup(fs6, &fs6->inodeTable[root], "after", &res, NULL) == 0){
+        printf("FAIL: part of a refused transaction replayed\n"); fails++;
+    }
+    printf("oversized transaction: %s\n", fails ? "FAIL" : "PASS");
+
+    // images created before the journal have no journal area: they mount without one
+    if (init_fs(img, 8192) != 0){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    struct superblock sb;
+    FILE *f = fopen(img, "r+b");
+    if (!f || fread(&sb, sizeof(sb), 1, f) != 1){
+        printf("cannot read the superblock\n");
+        return 1;
+    }
+    sb.journal_start = sb.journal_blocks = 0; //i campi non esistevano: nel blocco 0 erano a zero
+    sb.version = sb.csum_start = sb.csum_blocks = sb.checksum = 0; //come quelli aggiunti dopo
+    fseek(f, 0, SEEK_SET);
+    fwrite(&sb, sizeof(sb), 1, f);
+    fclose(f);
+    fs5 = open_fs_opts(img, NULL);
+    inode_t plain = 0;
+    if (!fs5 || fs5->journal || (root = inode_alloc(fs5)) != 0 || fs_create_file(fs5, root, "plain", 0) != 0 ||
+        dir_lookup(fs5, &fs5->inodeTable[root], "plain", &res, &plain) != 0 || fs_pwrite(fs5, plain, one, sizeof(one), 0) != BLOCK_SIZE ||
+        fs_flush(fs5) != 0){
+        printf("FAIL: image without a journal area\n"); fails++;
+    }
+    fs6 = open_fs_opts(img, NULL);
+    if (!fs6 || fs6->journal || fs_pread(fs6, plain, back, BLOCK_SIZE, 0) != BLOCK_SIZE || memcmp(back, one, BLOCK_SIZE) != 0){
+        printf("FAIL: image without a journal area after remount\n"); fails++;
+    }
+    printf("image without a journal: %s\n", fails ? "FAIL" : "PASS");
+
+    // long operations close their transaction on the way: deleting a file revokes the 150 pointer blocks
+    // logged since the last checkpoint, more than one transaction should hold (1024-block log)
+    if (init_fs(img, 65536) != 0 || !(fs5 = open_fs_opts(img, NULL))){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    root = inode_alloc(fs5);
+    inode_t sparse = 0;
+    if (fs_create_file(fs5, root, "sparse", FS_CREATE_BLOCKMAP) != 0 || dir_lookup(fs5, &fs5->inodeTable[root], "sparse", &res, &sparse) != 0){
+        printf("FAIL: create sparse\n"); fails++;
+    }
+    for (ui32 i = 0; i < 150; i++){ //one new pointer block per write, all in the log at the same time
+        if (fs_pwrite(fs5, sparse, one, sizeof(one), (off_t)(INODE_DIRECT + PTRS_PER_BLOCK + i * PTRS_PER_BLOCK) * BLOCK_SIZE) != BLOCK_SIZE){
+            printf("FAIL: sparse write %u\n", i); fails++;
+            break;
+        }
+    }
+    struct journal_stats before, after;
+    journal_get_stats(fs5->journal, &before);
+    if (fs_delete_file(fs5, &fs5->inodeTable[root], "sparse") != 0){ printf("FAIL: delete of a file with 150 pointer blocks\n"); fails++; }
+    journal_get_stats(fs5->journal, &after);
+    if (after.transactions - before.transactions < 2){ printf("FAIL: delete committed as a single transaction\n"); fails++; }
+    if (fs_flush(fs5) != 0){ printf("FAIL: flush after the delete\n"); fails++; }
+    fs6 = open_fs_opts(img, NULL);
+    if (!fs6 || dir_lookup(fs6, &fs6->inodeTable[root], "sparse", &res, NULL) == 0 || fs_check_bitmap(fs6) != 0 ||
+        fs_count_free_blocks(fs6) != fs_count_free_blocks(fs5)){
+        printf("FAIL: state after replay of the split delete\n"); fails++;
+    }
+    printf("delete split across transactions: %s\n", fails ? "FAIL" : "PASS");
+
+    remove(img);
+    if (fails == 0) printf("All journal tests passed\n");
+    else printf("%d journal tests failed\n", fails);
+    return fails ? 1 : 0;
+}
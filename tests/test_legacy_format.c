@@ -0,0 +1,168 @@
+#include "../FS.h"
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+// images in the original format (68-byte inodes, linear directories), built by hand the way the
+// first init_fs laid them out: they mount, their linear directory and pointer-mapped files read back,
+// new entries land in the same 68-byte records and the image stays in that format
+
+#define V0_BLOCKS 8192
+#define V0_TABLE_START 2
+#define V0_TABLE_BLOCKS 17 //1024 * 68 byte
+#define V0_DATA_START (V0_TABLE_START + V0_TABLE_BLOCKS)
+#define STRADDLE 60 //il record 60 va dal byte 4080 al 4148: a cavallo tra il primo e il secondo blocco della tabella
+
+static int write_at(FILE *f, long off, const void *p, size_t len){
+    fseek(f, off, SEEK_SET);
+    return fwrite(p, len, 1, f) == 1 ? 0 : -1;
+}
+
+static int make_v0_image(const char *img){
+    FILE *f = fopen(img, "wb");
+    if (!f) return -1;
+    struct superblock sb = { 0 };
+    sb.magic = FS_MAGIC;
+    sb.block_size = BLOCK_SIZE;
+    sb.total_blocks = V0_BLOCKS;
+    sb.inode_table_blocks = V0_TABLE_BLOCKS;
+    sb.inode_count = MAX_INODES;
+    sb.free_block_bitmap_start = 1;
+    sb.inode_table_start = V0_TABLE_START;
+    sb.data_start = V0_DATA_START;
+    int r = write_at(f, 0, &sb, sizeof(sb));
+    //il formato originale non scriveva mai la bitmap: resta tutta a zero
+
+    static struct inode_v0 table[MAX_INODES];
+    memset(table, 0, sizeof(table));
+    table[0].isUsed = 1; //root: directory lineare nel primo blocco dati
+    table[0].directBlocks[0] = V0_DATA_START;
+    table[0].size = BLOCK_SIZE;
+    table[1].isUsed = 1; //file di due blocchi
+    table[1].directBlocks[0] = V0_DATA_START + 1;
+    table[1].directBlocks[1] = V0_DATA_START + 2;
+    table[1].size = BLOCK_SIZE + 904;
+    table[STRADDLE].isUsed = 1;
+    table[STRADDLE].directBlocks[0] = V0_DATA_START + 3;
+    table[STRADDLE].size = 10;
+    r |= write_at(f, (long)BLOCK_SIZE * V0_TABLE_START, table, sizeof(table));
+
+    static char block[BLOCK_SIZE];
+    struct dirEntry *entries = (struct dirEntry *)block;
+    memset(block, 0, sizeof(block));
+    strcpy(entries[0].fname, "hello");
+    entries[0].inodeNum = 1;
+    strcpy(entries[1].fname, "straddle");
+    entries[1].inodeNum = STRADDLE;
+    r |= write_at(f, (long)BLOCK_SIZE * V0_DATA_START, block, sizeof(block));
+    for (int i = 0; i < BLOCK_SIZE; i++) block[i] = (char)('a' + i % 26);
+    r |= write_at(f, (long)BLOCK_SIZE * (V0_DATA_START + 1), block, sizeof(block));
+    memset(block, 'z', sizeof(block));
+    r |= write_at(f, (long)BLOCK_SIZE * (V0_DATA_START + 2), block, sizeof(block));
+    r |= write_at(f, (long)BLOCK_SIZE * (V0_DATA_START + 3), "0123456789", 10);
+    r |= write_at(f, (long)BLOCK_SIZE * V0_BLOCKS - 1, "", 1); //immagine lunga quanto total_blocks
+    return fclose(f) | r;
+}
+
+static int check_hello(struct filesystem *fs){
+    struct inode res;
+    inode_t num;
+    static char buf[BLOCK_SIZE];
+    if (dir_lookup(fs, &fs->inodeTable[0], "hello", &res, &num) != 0 || num != 1 || res.size != BLOCK_SIZE + 904) return -1;
+    if (fs_read_block(fs, res.directBlocks[0], buf) != 0) return -1;
+    for (int i = 0; i < BLOCK_SIZE; i++) if (buf[i] != (char)('a' + i % 26)) return -1;
+    if (fs_read_block(fs, res.directBlocks[1], buf) != 0) return -1;
+    for (int i = 0; i < 904; i++) if (buf[i] != 'z') return -1;
+    return 0;
+}
+
+int main(void){
+    const char *img = "legacy_format_test.img";
+    int fails = 0;
+    struct inode res;
+    inode_t num;
+    static char buf[BLOCK_SIZE];
+    if (make_v0_image(img) != 0){
+        printf("cannot build the image\n");
+        return 1;
+    }
+    struct fs_options opts = { .cache_blocks = FS_DEFAULT_CACHE_BLOCKS };
+    struct filesystem *fs = open_fs_opts(img, &opts);
+    if (!fs){
+        printf("FAIL: original-format image does not mount\n");
+        return 1;
+    }
+    if (!fs->legacyInodes){ printf("FAIL: original format not recognised\n"); fails++; }
+    if (check_hello(fs) != 0){ printf("FAIL: file in the linear root directory\n"); fails++; }
+    if (dir_lookup(fs, &fs->inodeTable[0], "straddle", &res, &num) != 0 || num != STRADDLE || res.size != 10 ||
+        fs_read_block(fs, res.directBlocks[0], buf) != 0 || memcmp(buf, "0123456789", 10) != 0){
+        printf("FAIL: inode whose record spans two blocks\n"); fails++;
+    }
+    if (fs_check_bitmap(fs) != 0){ printf("FAIL: bitmap inconsistent after mount\n"); fails++; }
+    block_t fresh = block_alloc(fs);
+    if (fresh < V0_DATA_START + 4){ printf("FAIL: block %u of an existing file reallocated\n", fresh); fails++; }
+    free_block(fs, fresh);
+    printf("read: %s\n", fails ? "FAIL" : "PASS");
+
+    // the root stays linear, a new file is extent-mapped, a new directory is hashed
+    inode_t dir = inode_alloc(fs);
+    if (fs_create_file(fs, 0, "new", 0) != 0 || dir_lookup(fs, &fs->inodeTable[0], "new", &res, &num) != 0 ||
+        fs_pwrite(fs, num, "small", 5, 0) != 5){
+        printf("FAIL: create in the linear directory\n"); fails++;
+    }
+    if ((fs->inodeTable[num].flags & INODE_F_EXTENTS) == 0){ printf("FAIL: new file is not extent-mapped\n"); fails++; }
+    if (fs->inodeTable[0].flags & INODE_F_HASHDIR){ printf("FAIL: linear root was converted\n"); fails++; }
+    if (dir_add_entry(fs, 0, "d", dir) != 0 || fs_create_file(fs, dir, "inner", 0) != 0 || !(fs->inodeTable[dir].flags & INODE_F_HASHDIR)){
+        printf("FAIL: hashed directory\n"); fails++;
+    }
+    inode_t inner = (inode_t)-1;
+    if (dir_lookup(fs, &fs->inodeTable[dir], "inner", &res, &inner) != 0 || inode_write(fs, num) != 0 || inode_write(fs, inner) != 0){
+        printf("FAIL: new inodes written\n"); fails++; //fs_create_file lascia all'utente la scrittura dell'inode
+    }
+    if (fs_delete_file(fs, &fs->inodeTable[0], "straddle") != 0){ printf("FAIL: delete\n"); fails++; }
+    if (fs_flush(fs) != 0){ printf("FAIL: flush\n"); fails++; }
+    printf("write: %s\n", fails ? "FAIL" : "PASS");
+
+    struct fs_options mapped = opts;
+    mapped.use_mmap = true;
+    struct filesystem *other = open_fs_opts(img, &mapped);
+    if (other){ printf("FAIL: original-format image mapped in memory\n"); fails++; }
+
+    // everything is still there after a remount, and the records on disk are still 68 bytes
+    other = open_fs_opts(img, &opts);
+    if (!other){
+        printf("FAIL: remount\n");
+        return 1;
+    }
+    if (check_hello(other) != 0){ printf("FAIL: old file after remount\n"); fails++; }
+    if (dir_lookup(other, &other->inodeTable[0], "new", &res, &num) != 0 || !(res.flags & INODE_F_EXTENTS) ||
+        fs_pread(other, num, buf, sizeof(buf), 0) != 5 || memcmp(buf, "small", 5) != 0){
+        printf("FAIL: new file after remount\n"); fails++;
+    }
+    if (path_solver(other, "/d/inner", &res) != 0 || !(other->inodeTable[dir].flags & INODE_F_HASHDIR)){ printf("FAIL: hashed directory after remount\n"); fails++; }
+    if (dir_lookup(other, &other->inodeTable[0], "straddle", &res, &num) == 0){ printf("FAIL: deleted entry after remount\n"); fails++; }
+    if (fs_check_bitmap(other) != 0){ printf("FAIL: bitmap inconsistent after remount\n"); fails++; }
+    if (other->sb.inode_table_blocks != V0_TABLE_BLOCKS){ printf("FAIL: superblock rewritten\n"); fails++; }
+
+    struct inode_v0 rec;
+    FILE *f = fopen(img, "rb");
+    fseek(f, (long)BLOCK_SIZE * V0_TABLE_START + (long)dir * sizeof(rec), SEEK_SET);
+    if (fread(&rec, sizeof(rec), 1, f) != 1 || rec.isUsed != (1 | INODE_F_HASHDIR << INODE_V0_FLAGS_SHIFT)){
+        printf("FAIL: record of the new directory on disk\n"); fails++;
+    }
+    fclose(f);
+    printf("remount: %s\n", fails ? "FAIL" : "PASS");
+
+    // a table of 72-byte records (the builds before inline data) is in neither format: refused
+    ui32 tableBlocks = V0_TABLE_BLOCKS + 1;
+    f = fopen(img, "r+b");
+    fseek(f, (long)offsetof(struct superblock, inode_table_blocks), SEEK_SET);
+    fwrite(&tableBlocks, sizeof(tableBlocks), 1, f);
+    fclose(f);
+    if (open_fs_opts(img, &opts) != NULL){ printf("FAIL: table of 72-byte records mounted\n"); fails++; }
+
+    remove(img);
+    if (fails == 0) printf("All original format tests passed\n");
+    else printf("%d original format tests failed\n", fails);
+    return fails ? 1 : 0;
+}
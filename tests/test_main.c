@@ -61,6 +61,24 @@ int main() {
                 printf("Errore nell'allocazione del blocco.\n");
             }
 
+            // Test allocazione di un tratto contiguo
+            printf("Test allocazione range...\n");
+            block_t range_start;
+            ui32 range_count;
+            if (block_alloc_range(fs, 64, 16, &range_start, &range_count) == 0) {
+                printf("Range allocato: %u..%u (%u blocchi)\n", range_start, range_start + range_count - 1, range_count);
+                if (free_block_range(fs, range_start, range_count) == 0) {
+                    printf("Range liberato con successo.\n");
+                } else {
+                    printf("Errore nella liberazione del range.\n");
+                }
+                if (free_block_range(fs, fs->sb.data_start, fs->sb.total_blocks + 1) == 0 || free_block_range(fs, range_start, UINT32_MAX) == 0) {
+                    printf("Errore: range oltre la fine dell'immagine accettato.\n");
+                }
+            } else {
+                printf("Errore nell'allocazione del range.\n");
+            }
+
             // Test metodi directory
             printf("Test metodi directory...\n");
             inode_t dir_inode_num = inode_alloc(fs);
@@ -0,0 +1,94 @@
+#include "../FS.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// init_fs creates a sparse image: only the superblock, the used part of the bitmap and the journal
+// header take disk space; open_fs maps the inode table and reads its blocks on first access
+
+#define GB_BLOCKS (1024u * 1024 * 1024 / BLOCK_SIZE)
+
+static double now_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int main(void){
+    const char *img = "mkfs_test.img";
+    int fails = 0;
+    double t0 = now_ms();
+    if (init_fs(img, GB_BLOCKS) != 0){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    double ms = now_ms() - t0;
+    struct stat st;
+    if (stat(img, &st) != 0 || st.st_size != (off_t)GB_BLOCKS * BLOCK_SIZE){ printf("FAIL: image size %lld\n", (long long)st.st_size); fails++; }
+    long long used = (long long)st.st_blocks * 512;
+    printf("1 GB image in %.2f ms, %lld KB on disk\n", ms, used / 1024);
+    if (used > 1024 * 1024){ printf("FAIL: %lld bytes allocated, the image should be sparse\n", used); fails++; }
+
+    struct fs_options opts = { .cache_blocks = FS_DEFAULT_CACHE_BLOCKS, .journal = true };
+    struct filesystem *fs = open_fs_opts(img, &opts);
+    if (!fs){
+        printf("FAIL: open_fs_opts\n");
+        return 1;
+    }
+    if (fs_count_free_blocks(fs) != GB_BLOCKS - fs->sb.data_start || fs_count_free_inodes(fs) != fs->sb.inode_count){
+        printf("FAIL: fresh image reports %u free blocks, %u free inodes\n", fs_count_free_blocks(fs), fs_count_free_inodes(fs)); fails++;
+    }
+    inode_t root = inode_alloc(fs);
+    char name[32], data[BLOCK_SIZE];
+    memset(data, 'm', sizeof(data));
+    for (int i = 0; i < 50; i++){
+        snprintf(name, sizeof(name), "f%d", i);
+        if (fs_create_file(fs, root, name, 0) != 0){ fails++; continue; }
+    }
+    struct inode res;
+    inode_t last;
+    if (dir_lookup(fs, &fs->inodeTable[root], "f49", &res, &last) != 0 || fs_pwrite(fs, last, data, sizeof(data), 0) != (ssize_t)sizeof(data)){
+        printf("FAIL: write after mkfs\n"); fails++;
+    }
+    close_fs(fs);
+
+    // the reopened table holds the inodes written before the unmount, the untouched groups read as free
+    fs = open_fs_opts(img, &opts);
+    int missing = 0;
+    for (int i = 0; fs && i < 50; i++){
+        snprintf(name, sizeof(name), "f%d", i);
+        if (dir_lookup(fs, &fs->inodeTable[root], name, &res, NULL) != 0) missing++;
+    }
+    char back[BLOCK_SIZE];
+    if (!fs || missing || fs_pread(fs, last, back, sizeof(back), 0) != (ssize_t)sizeof(back) || memcmp(data, back, sizeof(back)) != 0){
+        printf("FAIL: %d files missing or data lost after reopen\n", missing); fails++;
+    }
+    if (fs && (fs_count_free_inodes(fs) != fs->sb.inode_count - 51 || fs_check_bitmap(fs) != 0)){ printf("FAIL: fsck after reopen\n"); fails++; }
+    close_fs(fs);
+
+    // without the journal fs_sync drops the private copies of the blocks it wrote: the inodes read back the same
+    struct fs_options plain = { .cache_blocks = FS_DEFAULT_CACHE_BLOCKS, .journal = false };
+    fs = open_fs_opts(img, &plain);
+    if (!fs || !fs->inodeTableMap){ printf("FAIL: inode table not mapped\n"); fails++; }
+    for (int round = 0; fs && round < 2; round++){
+        ui32 size = fs->inodeTable[last].size;
+        if (fs_create_file(fs, root, round ? "g1" : "g0", 0) != 0 || fs_sync(fs) != 0){ fails++; break; }
+        if (fs->inodeTable[last].size != size || dir_lookup(fs, &fs->inodeTable[root], round ? "g1" : "g0", &res, NULL) != 0 ||
+            dir_lookup(fs, &fs->inodeTable[root], "f0", &res, NULL) != 0){
+            printf("FAIL: inode table changed after fs_sync (round %d)\n", round); fails++;
+        }
+    }
+    if (fs && fs_check_bitmap(fs) != 0){ printf("FAIL: fsck without journal\n"); fails++; }
+    close_fs(fs);
+    fs = open_fs_opts(img, &plain);
+    if (!fs || dir_lookup(fs, &fs->inodeTable[root], "g1", &res, NULL) != 0 || fs_count_free_inodes(fs) != fs->sb.inode_count - 53){
+        printf("FAIL: files created without the journal lost\n"); fails++;
+    }
+    close_fs(fs);
+
+    remove(img);
+    if (fails == 0) printf("All mkfs tests passed\n");
+    else printf("%d mkfs tests failed\n", fails);
+    return fails ? 1 : 0;
+}
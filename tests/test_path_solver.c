@@ -114,10 +114,7 @@ int main(void){
     printf("Test passed: path_solver resolved 'hello.txt' to inode %u\n", found);
 
     // cleanup
-    fclose(fs->img);
-    free(fs->blockBitmap);
-    free(fs->inodeTable);
-    free(fs);
+    close_fs(fs);
 
     return 0;
 }
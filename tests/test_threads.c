@@ -0,0 +1,169 @@
+#include "../FS.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+// thread-safe mode: threads create, write, look up and delete files in their own directory and in a
+// shared one at the same time; the allocator hands out every block and inode to exactly one thread
+
+#define THREADS 8
+#define OWN 60
+#define SHARED 30
+#define ALLOCS 200
+#define INODES 16
+
+static struct filesystem *fs;
+static inode_t dirs[THREADS], shared;
+static int errors[THREADS];
+
+static void *worker(void *arg){
+    int t = (int)(long)arg;
+    char name[32], path[64], data[5000], back[5000];
+    struct inode res;
+    inode_t num;
+    memset(data, 'a' + t, sizeof(data));
+    for (int i = 0; i < OWN; i++){
+        snprintf(name, sizeof(name), "f%d", i);
+        if (fs_create_file(fs, dirs[t], name, 0) != 0) errors[t]++;
+        if (dir_lookup(fs, &fs->inodeTable[dirs[t]], name, &res, &num) != 0) { errors[t]++; continue; }
+        if (i % 4 == 0 && fs_pwrite(fs, num, data, sizeof(data), 0) != (ssize_t)sizeof(data)) errors[t]++;
+    }
+    for (int i = 0; i < SHARED; i++){
+        snprintf(name, sizeof(name), "t%d_%d", t, i);
+        if (fs_create_file(fs, shared, name, 0) != 0) errors[t]++;
+    }
+    for (int i = 0; i < OWN; i++){ // lookups through the path, data written by this thread
+        snprintf(path, sizeof(path), "/d%d/f%d", t, i);
+        if (path_solver(fs, path, &res) != 0) errors[t]++;
+        snprintf(name, sizeof(name), "f%d", i);
+        if (i % 4 == 0 && (dir_lookup(fs, &fs->inodeTable[dirs[t]], name, &res, &num) != 0 ||
+            fs_pread(fs, num, back, sizeof(back), 0) != (ssize_t)sizeof(back) || memcmp(data, back, sizeof(back)) != 0)) errors[t]++;
+    }
+    for (int i = 0; i < OWN; i += 2){
+        snprintf(name, sizeof(name), "f%d", i);
+        if (fs_delete_file(fs, &fs->inodeTable[dirs[t]], name) != 0) errors[t]++;
+    }
+    return NULL;
+}
+
+static block_t owned[THREADS][ALLOCS];
+static inode_t inodes[THREADS][INODES];
+
+static void *allocator(void *arg){
+    int t = (int)(long)arg;
+    for (int i = 0; i < ALLOCS; i++){
+        owned[t][i] = block_alloc(fs);
+        if (owned[t][i] == (block_t)-1) errors[t]++;
+        if (i % 3 == 2 && free_block(fs, owned[t][i - 1]) == 0) owned[t][i - 1] = 0; // churn: freed blocks get reused
+    }
+    for (int i = 0; i < INODES; i++){
+        inodes[t][i] = inode_alloc(fs);
+        if (inodes[t][i] == (inode_t)-1) errors[t]++;
+    }
+    return NULL;
+}
+
+static int run(void *(*fn)(void *)){
+    pthread_t th[THREADS];
+    int total = 0;
+    for (long t = 0; t < THREADS; t++) pthread_create(&th[t], NULL, fn, (void *)t);
+    for (int t = 0; t < THREADS; t++){
+        pthread_join(th[t], NULL);
+        total += errors[t];
+        errors[t] = 0;
+    }
+    return total;
+}
+
+int main(void){
+    const char *img = "threads_test.img";
+    int fails = 0;
+    if (init_fs(img, 8192) != 0){
+        printf("init_fs failed\n");
+        return 1;
+    }
+    struct fs_options opts = { .cache_blocks = FS_DEFAULT_CACHE_BLOCKS, .dentry_cache = FS_DEFAULT_DENTRY_CACHE, .journal = true, .thread_safe = true };
+    fs = open_fs_opts(img, &opts);
+    if (!fs || !fs->threadSafe || !fs->inodeLocks){
+        printf("open_fs_opts failed\n");
+        return 1;
+    }
+    inode_t root = inode_alloc(fs);
+    char name[32];
+    for (int t = 0; t < THREADS; t++){
+        snprintf(name, sizeof(name), "d%d", t);
+        dirs[t] = inode_alloc(fs);
+        dir_add_entry(fs, root, name, dirs[t]);
+    }
+    shared = inode_alloc(fs);
+    dir_add_entry(fs, root, "shared", shared);
+
+    int errs = run(worker);
+    if (errs){ printf("FAIL: %d errors in the worker threads\n", errs); fails++; }
+    struct inode res;
+    int missing = 0, extra = 0;
+    for (int t = 0; t < THREADS; t++){
+        for (int i = 0; i < OWN; i++){
+            snprintf(name, sizeof(name), "f%d", i);
+            int found = dir_lookup(fs, &fs->inodeTable[dirs[t]], name, &res, NULL) == 0;
+            if (i % 2 == 0 && found) extra++;
+            if (i % 2 == 1 && !found) missing++;
+        }
+        for (int i = 0; i < SHARED; i++){
+            snprintf(name, sizeof(name), "t%d_%d", t, i);
+            if (dir_lookup(fs, &fs->inodeTable[shared], name, &res, NULL) != 0) missing++;
+        }
+    }
+    if (missing || extra){ printf("FAIL: %d names missing, %d deleted names still present\n", missing, extra); fails++; }
+    if (fs_check_bitmap(fs) != 0){ printf("FAIL: fsck after concurrent operations\n"); fails++; }
+    printf("%d threads x %d creates: %s\n", THREADS, OWN + SHARED, fails ? "FAIL" : "PASS");
+
+    // concurrent allocator: no block or inode may be handed to two threads
+    ui32 freeBefore = fs_count_free_blocks(fs);
+    errs = run(allocator);
+    if (errs){ printf("FAIL: %d allocation failures\n", errs); fails++; }
+    static ui8 seen[MAX_BLOCKS];
+    static ui8 seenInode[MAX_INODES];
+    int dup = 0, held = 0;
+    for (int t = 0; t < THREADS; t++){
+        for (int i = 0; i < ALLOCS; i++){
+            block_t b = owned[t][i];
+            if (b == 0 || b == (block_t)-1) continue;
+            if (seen[b]++) dup++;
+            held++;
+        }
+        for (int i = 0; i < INODES; i++){
+            if (inodes[t][i] != (inode_t)-1 && seenInode[inodes[t][i]]++) dup++;
+        }
+    }
+    if (dup){ printf("FAIL: %d blocks or inodes allocated twice\n", dup); fails++; }
+    if (fs_count_free_blocks(fs) != freeBefore - (ui32)held){ printf("FAIL: free counter %u, expected %u\n", fs_count_free_blocks(fs), freeBefore - (ui32)held); fails++; }
+    for (int t = 0; t < THREADS; t++){
+        for (int i = 0; i < ALLOCS; i++){
+            if (owned[t][i] != 0 && owned[t][i] != (block_t)-1 && free_block(fs, owned[t][i]) != 0) fails++;
+        }
+        for (int i = 0; i < INODES; i++){
+            if (inodes[t][i] != (inode_t)-1) free_inode(fs, inodes[t][i]);
+        }
+    }
+    if (fs_count_free_blocks(fs) != freeBefore || fs_check_bitmap(fs) != 0){ printf("FAIL: free counter after releasing everything\n"); fails++; }
+    printf("%d threads x %d block allocations: %d held, %d duplicates\n", THREADS, ALLOCS, held, dup);
+
+    // everything survives an unmount
+    if (close_fs(fs) != 0){ printf("FAIL: close_fs\n"); fails++; }
+    fs = open_fs_opts(img, NULL);
+    missing = 0;
+    for (int t = 0; fs && t < THREADS; t++){
+        for (int i = 1; i < OWN; i += 2){
+            snprintf(name, sizeof(name), "f%d", i);
+            if (dir_lookup(fs, &fs->inodeTable[dirs[t]], name, &res, NULL) != 0) missing++;
+        }
+    }
+    if (!fs || missing || fs_check_bitmap(fs) != 0){ printf("FAIL: %d files lost after reopen\n", missing); fails++; }
+    close_fs(fs);
+
+    remove(img);
+    if (fails == 0) printf("All thread tests passed\n");
+    else printf("%d thread tests failed\n", fails);
+    return fails ? 1 : 0;
+}